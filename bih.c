@@ -5,6 +5,122 @@
 #include <string.h>
 #include "bih.h"
 
+#define BIH_SAHBINS 16
+
+typedef struct bih_sahbin_s
+{
+	int count;
+	float mins[3];
+	float maxs[3];
+}
+bih_sahbin_t;
+
+static float BIH_HalfArea(const float *mins, const float *maxs)
+{
+	float x = maxs[0] - mins[0], y = maxs[1] - mins[1], z = maxs[2] - mins[2];
+	return x * y + y * z + z * x;
+}
+
+static void BIH_AddBoxToBin(bih_sahbin_t *bin, const float *mins, const float *maxs)
+{
+	int i;
+	if (!bin->count++)
+	{
+		memcpy(bin->mins, mins, sizeof(bin->mins));
+		memcpy(bin->maxs, maxs, sizeof(bin->maxs));
+		return;
+	}
+	for (i = 0;i < 3;i++)
+	{
+		if (bin->mins[i] > mins[i]) bin->mins[i] = mins[i];
+		if (bin->maxs[i] < maxs[i]) bin->maxs[i] = maxs[i];
+	}
+}
+
+// sorts the children into front and back lists like the median split does,
+// but picks the axis and position where (area * count) summed over both
+// sides is lowest, tested at BIH_SAHBINS positions per axis, returns the
+// number of front children (0 if no split puts children on both sides)
+static int BIH_SAHSplit(bih_t *bih, int numchildren, int *leaflist, const float *mins, const float *size, int *outaxis)
+{
+	int i, j, axis, bin, back, front, bestaxis = -1, bestbin = 0;
+	float cost, bestcost = 0, scale;
+	bih_leaf_t *child;
+	bih_sahbin_t bins[BIH_SAHBINS], below[BIH_SAHBINS], above;
+
+	for (axis = 0;axis < 3;axis++)
+	{
+		if (size[axis] <= 0)
+			continue;
+		// bin the children by the center of their bounds
+		memset(bins, 0, sizeof(bins));
+		scale = BIH_SAHBINS / size[axis];
+		for (i = 0;i < numchildren;i++)
+		{
+			child = bih->leafs + leaflist[i];
+			bin = (int)(((child->mins[axis] + child->maxs[axis]) * 0.5f - mins[axis]) * scale);
+			bin = bin < 0 ? 0 : (bin >= BIH_SAHBINS ? BIH_SAHBINS - 1 : bin);
+			BIH_AddBoxToBin(&bins[bin], child->mins, child->maxs);
+		}
+		// accumulate the back side from the low end, then sweep the front
+		// side down from the high end
+		memset(below, 0, sizeof(below));
+		for (j = 0;j < BIH_SAHBINS;j++)
+		{
+			if (j)
+				below[j] = below[j-1];
+			if (bins[j].count)
+			{
+				i = below[j].count;
+				BIH_AddBoxToBin(&below[j], bins[j].mins, bins[j].maxs);
+				below[j].count = i + bins[j].count;
+			}
+		}
+		memset(&above, 0, sizeof(above));
+		for (j = BIH_SAHBINS - 1;j > 0;j--)
+		{
+			if (bins[j].count)
+			{
+				i = above.count;
+				BIH_AddBoxToBin(&above, bins[j].mins, bins[j].maxs);
+				above.count = i + bins[j].count;
+			}
+			// split between bin j-1 (back) and bin j (front)
+			if (!above.count || !below[j-1].count)
+				continue;
+			cost = BIH_HalfArea(below[j-1].mins, below[j-1].maxs) * below[j-1].count + BIH_HalfArea(above.mins, above.maxs) * above.count;
+			if (bestaxis < 0 || bestcost > cost)
+			{
+				bestcost = cost;
+				bestaxis = axis;
+				bestbin = j;
+			}
+		}
+	}
+	if (bestaxis < 0)
+		return 0;
+
+	// sort children into front and back lists
+	axis = bestaxis;
+	scale = BIH_SAHBINS / size[axis];
+	front = 0;
+	back = 0;
+	for (i = 0;i < numchildren;i++)
+	{
+		child = bih->leafs + leaflist[i];
+		bin = (int)(((child->mins[axis] + child->maxs[axis]) * 0.5f - mins[axis]) * scale);
+		bin = bin < 0 ? 0 : (bin >= BIH_SAHBINS ? BIH_SAHBINS - 1 : bin);
+		if (bin < bestbin)
+			bih->leafsortscratch[back++] = leaflist[i];
+		else
+			leaflist[front++] = leaflist[i];
+	}
+	if (back)
+		memcpy(leaflist + front, bih->leafsortscratch, back*sizeof(leaflist[0]));
+	*outaxis = axis;
+	return front;
+}
+
 static int BIH_BuildNode(bih_t *bih, int numchildren, int *leaflist, float *totalmins, float *totalmaxs)
 {
 	int i;
@@ -82,6 +198,9 @@ static int BIH_BuildNode(bih_t *bih, int numchildren, int *leaflist, float *tota
 			node->children[j] = leaflist[j];
 		return nodenum;
 	}
+	// try the surface area heuristic first if requested
+	if ((bih->buildflags & BIH_BUILDFLAG_SAH) && (front = BIH_SAHSplit(bih, numchildren, leaflist, mins, size, &axis)))
+		back = numchildren - front;
 	// pick longest axis
 	longestaxis = 0;
 	if (size[0] < size[1]) longestaxis = 1;
@@ -89,7 +208,7 @@ static int BIH_BuildNode(bih_t *bih, int numchildren, int *leaflist, float *tota
 	// iterate possible split axis choices, starting with the longest axis, if
 	// all fail it means all children have the same bounds and we simply split
 	// the list in half because each node can only have two children.
-	for (j = 0;j < 3;j++)
+	for (j = front ? 3 : 0;j < 3;j++)
 	{
 		// pick an axis
 		axis = (longestaxis + j) % 3;
@@ -113,7 +232,7 @@ static int BIH_BuildNode(bih_t *bih, int numchildren, int *leaflist, float *tota
 		if (front && back)
 			break;
 	}
-	if (j == 3)
+	if (j == 3 && !(front && back))
 	{
 		// somewhat common case: no good choice, divide children arbitrarily
 		axis = 0;
@@ -130,7 +249,7 @@ static int BIH_BuildNode(bih_t *bih, int numchildren, int *leaflist, float *tota
 	return nodenum;
 }
 
-int BIH_Build(bih_t *bih, int numleafs, bih_leaf_t *leafs, int maxnodes, bih_node_t *nodes, int *temp_leafsort, int *temp_leafsortscratch)
+int BIH_Build(bih_t *bih, int numleafs, bih_leaf_t *leafs, int maxnodes, bih_node_t *nodes, int *temp_leafsort, int *temp_leafsortscratch, int buildflags)
 {
 	int i;
 
@@ -142,6 +261,7 @@ int BIH_Build(bih_t *bih, int numleafs, bih_leaf_t *leafs, int maxnodes, bih_nod
 	bih->numnodes = 0;
 	bih->maxnodes = maxnodes;
 	bih->nodes = nodes;
+	bih->buildflags = buildflags;
 
 	// clear things we intend to rebuild
 	memset(bih->nodes, 0, sizeof(bih->nodes[0]) * bih->maxnodes);
@@ -152,14 +272,95 @@ int BIH_Build(bih_t *bih, int numleafs, bih_leaf_t *leafs, int maxnodes, bih_nod
 	return bih->error;
 }
 
+static int BIH_PackNode(bih_t *bih, int nodenum, int *numpackednodes, int *numpackedleafs)
+{
+	int i;
+	int packednodenum = (*numpackednodes)++;
+	float f;
+	const bih_node_t *node = bih->nodes + nodenum;
+	bih_packednode_t *packednode = bih->packednodes + packednodenum;
+	// round outward by an extra step so float error in unpacking can't
+	// shrink the box
+	for (i = 0;i < 3;i++)
+	{
+		f = (node->mins[i] - bih->packedmins[i]) / bih->packedunscale[i] - 1.0f;
+		packednode->mins[i] = (unsigned short)(f < 0 ? 0 : (f > 65535 ? 65535 : (int)f));
+		f = (node->maxs[i] - bih->packedmins[i]) / bih->packedunscale[i] + 2.0f;
+		packednode->maxs[i] = (unsigned short)(f < 0 ? 0 : (f > 65535 ? 65535 : (int)f));
+	}
+	packednode->type = (unsigned char)node->type;
+	if (node->type == BIH_UNORDERED)
+	{
+		packednode->front = *numpackedleafs;
+		for (i = 0;i < BIH_MAXUNORDEREDCHILDREN && node->children[i] >= 0;i++)
+			bih->packedleafs[(*numpackedleafs)++] = node->children[i];
+		packednode->numchildren = (unsigned char)i;
+		return packednodenum;
+	}
+	packednode->frontmin = node->frontmin;
+	packednode->backmax = node->backmax;
+	// the front child always comes right after its parent
+	packednode->front = BIH_PackNode(bih, node->front, numpackednodes, numpackedleafs);
+	packednode->back = BIH_PackNode(bih, node->back, numpackednodes, numpackedleafs);
+	return packednodenum;
+}
+
+void BIH_Pack(bih_t *bih, bih_packednode_t *packednodes, int *packedleafs)
+{
+	int i;
+	int numpackednodes = 0;
+	int numpackedleafs = 0;
+	if (bih->error || !bih->numnodes)
+		return;
+	bih->packednodes = packednodes;
+	bih->packedleafs = packedleafs;
+	memset(packednodes, 0, bih->numnodes * sizeof(*packednodes));
+	// quantize to a grid slightly larger than the tree so nothing clamps
+	for (i = 0;i < 3;i++)
+	{
+		bih->packedmins[i] = bih->mins[i] - 1;
+		bih->packedunscale[i] = (bih->maxs[i] + 1 - bih->packedmins[i]) / 65532.0f;
+	}
+	bih->rootnode = BIH_PackNode(bih, bih->rootnode, &numpackednodes, &numpackedleafs);
+}
+
+const bih_node_t *BIH_GetNode(const bih_t *bih, int nodenum, bih_node_t *nodeview)
+{
+	int i;
+	const bih_packednode_t *packednode;
+	if (!bih->packednodes)
+		return bih->nodes + nodenum;
+	packednode = bih->packednodes + nodenum;
+	nodeview->type = (bih_nodetype_t)packednode->type;
+	for (i = 0;i < 3;i++)
+	{
+		nodeview->mins[i] = bih->packedmins[i] + packednode->mins[i] * bih->packedunscale[i];
+		nodeview->maxs[i] = bih->packedmins[i] + packednode->maxs[i] * bih->packedunscale[i];
+	}
+	if (packednode->type == BIH_UNORDERED)
+	{
+		for (i = 0;i < packednode->numchildren;i++)
+			nodeview->children[i] = bih->packedleafs[packednode->front + i];
+		if (i < BIH_MAXUNORDEREDCHILDREN)
+			nodeview->children[i] = -1;
+		return nodeview;
+	}
+	nodeview->front = packednode->front;
+	nodeview->back = packednode->back;
+	nodeview->frontmin = packednode->frontmin;
+	nodeview->backmax = packednode->backmax;
+	return nodeview;
+}
+
 static void BIH_GetTriangleListForBox_Node(const bih_t *bih, int nodenum, int maxtriangles, int *trianglelist_idx, int *trianglelist_surf, int *numtrianglespointer, const float *mins, const float *maxs)
 {
 	int axis;
-	bih_node_t *node;
+	const bih_node_t *node;
+	bih_node_t nodeview;
 	bih_leaf_t *leaf;
 	for(;;)
 	{
-		node = bih->nodes + nodenum;
+		node = BIH_GetNode(bih, nodenum, &nodeview);
 		// check if this is an unordered node (which holds an array of leaf numbers)
 		if (node->type == BIH_UNORDERED)
 		{
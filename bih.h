@@ -50,6 +50,23 @@ typedef struct bih_node_s
 }
 bih_node_t;
 
+// compact copy of a node made by BIH_Pack, two fit in a 64 byte cache line
+typedef struct bih_packednode_s
+{
+	// bounds quantized to the whole tree's bounds (rounded outward)
+	unsigned short mins[3];
+	unsigned short maxs[3];
+	unsigned char type; // = BIH_SPLITX and similar values
+	unsigned char numchildren; // BIH_UNORDERED: number of leafs
+	unsigned short padding;
+	// BIH_UNORDERED uses front as the first index in packedleafs
+	int front;
+	int back;
+	float frontmin;
+	float backmax;
+}
+bih_packednode_t;
+
 typedef struct bih_leaf_s
 {
 	bih_leaftype_t type; // = BIH_BRUSH And similar values
@@ -75,16 +92,32 @@ typedef struct bih_s
 	// bounds calculated by BIH_Build
 	float mins[3];
 	float maxs[3];
+	// depth first copy of nodes made by BIH_Pack (NULL if not packed), when
+	// present traversals read these instead of nodes (see BIH_GetNode), so
+	// the owner may free nodes after packing
+	bih_packednode_t *packednodes;
+	int *packedleafs;
+	float packedmins[3];
+	float packedunscale[3];
 
 	// fields used only during BIH_Build:
 	int maxnodes;
+	int buildflags;
 	int error; // set to a value if an error occurs in building (such as numnodes == maxnodes)
 	int *leafsort;
 	int *leafsortscratch;
 }
 bih_t;
 
-int BIH_Build(bih_t *bih, int numleafs, bih_leaf_t *leafs, int maxnodes, bih_node_t *nodes, int *temp_leafsort, int *temp_leafsortscratch);
+// choose splits with the surface area heuristic instead of the middle of the longest axis
+#define BIH_BUILDFLAG_SAH 1
+
+int BIH_Build(bih_t *bih, int numleafs, bih_leaf_t *leafs, int maxnodes, bih_node_t *nodes, int *temp_leafsort, int *temp_leafsortscratch, int buildflags);
+// fills packednodes (numnodes entries) and packedleafs (numleafs entries) and
+// makes the tree use them
+void BIH_Pack(bih_t *bih, bih_packednode_t *packednodes, int *packedleafs);
+// returns the node, unpacking it into nodeview first if the tree is packed
+const bih_node_t *BIH_GetNode(const bih_t *bih, int nodenum, bih_node_t *nodeview);
 
 int BIH_GetTriangleListForBox(const bih_t *bih, int maxtriangles, int *trianglelist_idx, int *trianglelist_surf, const float *mins, const float *maxs);
 
@@ -96,6 +96,8 @@ void CL_StopPlayback (void)
 	if (cls.timedemo)
 		CL_FinishTimeDemo ();
 
+	EntityFrame8_Benchmark_Report();
+
 	if (!cls.demostarting) // only quit if not starting another demo
 		if (COM_CheckParm("-demo") || COM_CheckParm("-capturedemo"))
 			Host_Quit_f();
@@ -400,6 +402,7 @@ void CL_Record_f (void)
 	cls.demorecording = true;
 	cls.demo_lastcsprogssize = -1;
 	cls.demo_lastcsprogscrc = -1;
+	cl.demokeyframe8 = 0;
 }
 
 
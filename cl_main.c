@@ -113,6 +113,7 @@ void CL_ClearState(void)
 
 // wipe the entire cl structure
 	Mem_EmptyPool(cls.levelmempool);
+	Collision_TraceCache_Reset(&cl.world.tracecache);
 	memset (&cl, 0, sizeof(cl));
 
 	S_StopAllSounds();
@@ -2056,6 +2057,11 @@ static void CL_AreaStats_f(void)
 	World_PrintAreaStats(&cl.world, "client");
 }
 
+static void CL_AreaBenchmark_f(void)
+{
+	World_BenchmarkAreas(&cl.world, "client", Cmd_Argc() > 1 ? max(1, atoi(Cmd_Argv(1))) : 100000);
+}
+
 cl_locnode_t *CL_Locs_FindNearest(const vec3_t point)
 {
 	int i;
@@ -2463,6 +2469,7 @@ void CL_Init (void)
 	Cmd_AddCommand ("pausedemo", CL_PauseDemo_f, "pause demo playback (can also safely pause demo recording if using QUAKE, QUAKEDP or NEHAHRAMOVIE protocol, useful for making movies)");
 
 	Cmd_AddCommand ("cl_areastats", CL_AreaStats_f, "prints statistics on entity culling during collision traces");
+	Cmd_AddCommand ("cl_areabenchmark", CL_AreaBenchmark_f, "times entity box queries (default 100000) around the linked csqc entities with the areagrid and with sv_areatree");
 
 	Cvar_RegisterVariable(&r_draweffects);
 	Cvar_RegisterVariable(&cl_explosions_alpha_start);
@@ -31,6 +31,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "menu.h"
 #endif
 #include "cl_video.h"
+#include "taskqueue.h"
 
 const char *svc_strings[128] =
 {
@@ -172,6 +173,7 @@ cvar_t cl_worldnamenoextension = {CVAR_READONLY, "cl_worldnamenoextension", "",
 cvar_t cl_worldbasename = {CVAR_READONLY, "cl_worldbasename", "", "name of current worldmodel without maps/ prefix or extension"};
 
 cvar_t developer_networkentities = {0, "developer_networkentities", "0", "prints received entities, value is 0-10 (higher for more info, 10 being the most verbose)"};
+cvar_t cl_entityframe8_benchmark = {0, "cl_entityframe8_benchmark", "0", "when playing a demo recorded with protocol DP5 to DP7, transcodes every entity frame and stat update to DP8 and back and prints the bytes and time per frame when the demo ends (use with timedemo)"};
 cvar_t cl_gameplayfix_soundsmovewithentities = {0, "cl_gameplayfix_soundsmovewithentities", "1", "causes sounds made by lifts, players, projectiles, and any other entities, to move with the entity, so for example a rocket noise follows the rocket rather than staying at the starting position"};
 cvar_t cl_sound_wizardhit = {0, "cl_sound_wizardhit", "wizard/hit.wav", "sound to play during TE_WIZSPIKE (empty cvar disables sound)"};
 cvar_t cl_sound_hknighthit = {0, "cl_sound_hknighthit", "hknight/hit.wav", "sound to play during TE_KNIGHTSPIKE (empty cvar disables sound)"};
@@ -317,6 +319,10 @@ void CL_KeepaliveMessage (qboolean readmessages)
 
 	qboolean thisrecursive;
 
+	// model loading code calls this from the task queue as well
+	if (TaskQueue_IsWorkerThread())
+		return;
+
 	thisrecursive = recursive;
 	recursive = true;
 
@@ -1946,6 +1952,7 @@ static void CL_ParseServerInfo (void)
 				strlcpy(cls.demoname, demofile, sizeof(cls.demoname));
 				cls.demo_lastcsprogssize = -1;
 				cls.demo_lastcsprogscrc = -1;
+				cl.demokeyframe8 = 0;
 			}
 			else
 				Con_Print ("ERROR: couldn't open.\n");
@@ -3917,6 +3924,7 @@ void CL_ParseServerMessage(void)
 						strip_pqc = true;
 						break;
 					case PROTOCOL_DARKPLACES7:
+					case PROTOCOL_DARKPLACES8:
 					default:
 						// ProQuake does not support
 						// these protocols
@@ -4127,6 +4135,8 @@ void CL_ParseServerMessage(void)
 				if (i < 0 || i >= MAX_CL_STATS)
 					Host_Error ("svc_updatestat: %i is invalid", i);
 				cl.stats[i] = MSG_ReadLong(&cl_message);
+				if (cl_entityframe8_benchmark.integer && cls.demoplayback)
+					EntityFrame8_Benchmark_Stat(i, 6);
 				break;
 
 			case svc_updatestatubyte:
@@ -4134,6 +4144,8 @@ void CL_ParseServerMessage(void)
 				if (i < 0 || i >= MAX_CL_STATS)
 					Host_Error ("svc_updatestat: %i is invalid", i);
 				cl.stats[i] = MSG_ReadByte(&cl_message);
+				if (cl_entityframe8_benchmark.integer && cls.demoplayback)
+					EntityFrame8_Benchmark_Stat(i, 3);
 				break;
 
 			case svc_spawnstaticsound:
@@ -4226,6 +4238,8 @@ void CL_ParseServerMessage(void)
 					EntityFrame_CL_ReadFrame();
 				else if (cls.protocol == PROTOCOL_DARKPLACES4)
 					EntityFrame4_CL_ReadFrame();
+				else if (cl_entityframe8_benchmark.integer && cls.demoplayback && cls.protocol != PROTOCOL_DARKPLACES8)
+					EntityFrame8_Benchmark_ReadFrame();
 				else
 					EntityFrame5_CL_ReadFrame();
 				break;
@@ -4293,6 +4307,7 @@ void CL_Parse_Init(void)
 	Cvar_RegisterVariable(&cl_worldbasename);
 
 	Cvar_RegisterVariable(&developer_networkentities);
+	Cvar_RegisterVariable(&cl_entityframe8_benchmark);
 	Cvar_RegisterVariable(&cl_gameplayfix_soundsmovewithentities);
 
 	Cvar_RegisterVariable(&cl_sound_wizardhit);
@@ -380,6 +380,9 @@ typedef struct rtlight_s
 	/// masks of all shadowmap sides that have any potential static receivers or casters
 	int static_shadowmap_receivers;
 	int static_shadowmap_casters;
+	/// some static shadow casters deform or have animated alpha tested
+	/// textures, so shadowmaps of this light are not kept between frames
+	qboolean static_shadowmap_animated;
 	/// particle-tracing cache for global illumination
 	int particlecache_numparticles;
 	int particlecache_maxparticles;
@@ -1278,6 +1281,10 @@ typedef struct client_state_s
 	entityframe_database_t *entitydatabase;
 	entityframe4_database_t *entitydatabase4;
 	entityframeqw_database_t *entitydatabaseqw;
+	entityframe8_history_t *entityhistory8;
+	// first PROTOCOL_DARKPLACES8 frame of the demo being recorded that decodes
+	// on its own, 0 if there was none yet, -1 if one has been asked for
+	int demokeyframe8;
 
 	// keep track of quake entities because they need to be killed if they get stale
 	int lastquakeentity;
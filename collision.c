@@ -15,12 +15,81 @@ cvar_t collision_extendtraceboxlength = {0, "collision_extendtraceboxlength", "1
 cvar_t collision_extendtracelinelength = {0, "collision_extendtracelinelength", "1", "internal bias for traceline() qc builtin to account for collision_impactnudge (this does not alter the final trace length)"};
 cvar_t collision_debug_tracelineasbox = {0, "collision_debug_tracelineasbox", "0", "workaround for any bugs in Collision_TraceLineBrushFloat by using Collision_TraceBrushBrushFloat"};
 cvar_t collision_cache = {0, "collision_cache", "1", "store results of collision traces for next frame to reuse if possible (optimization)"};
+cvar_t collision_tracecache = {0, "collision_tracecache", "4096", "how many traces against the world and brush entities to remember across frames so stationary entities repeating the same trace skip it (rounded down to a power of 2), 0 disables"};
 //cvar_t collision_triangle_neighborsides = {0, "collision_triangle_neighborsides", "1", "override automatic side generation if triangle has neighbors with face planes that form a convex edge (perfect solution, but can not work for all edges)"};
 cvar_t collision_triangle_bevelsides = {0, "collision_triangle_bevelsides", "0", "generate sloped edge planes on triangles - if 0, see axialedgeplanes"};
 cvar_t collision_triangle_axialsides = {0, "collision_triangle_axialsides", "1", "generate axially-aligned edge planes on triangles - otherwise use perpendicular edge planes"};
 
 mempool_t *collision_mempool;
 
+#define TRACEBENCH_GROUPSIZE 16
+static void Collision_TraceBench_f(void)
+{
+	dp_model_t *model = sv.active ? sv.worldmodel : cl.worldmodel;
+	int i, n, numrays, numdiffer = 0;
+	float *starts, *ends;
+	vec3_t origin, center;
+	trace_t *singletraces, *batchtraces;
+	double t0, t1, t2;
+
+	if (!model || !model->TraceLine)
+	{
+		Con_Print("collision_tracebench: no map loaded\n");
+		return;
+	}
+	if (!model->TraceLines)
+	{
+		Con_Printf("collision_tracebench: %s has no batch trace function\n", model->name);
+		return;
+	}
+	numrays = Cmd_Argc() > 1 ? atoi(Cmd_Argv(1)) : 65536;
+	numrays = bound(TRACEBENCH_GROUPSIZE, numrays, 1048576);
+
+	starts = (float *)Mem_Alloc(tempmempool, numrays * sizeof(float[3]));
+	ends = (float *)Mem_Alloc(tempmempool, numrays * sizeof(float[3]));
+	singletraces = (trace_t *)Mem_Alloc(tempmempool, numrays * sizeof(trace_t));
+	batchtraces = (trace_t *)Mem_Alloc(tempmempool, numrays * sizeof(trace_t));
+
+	// rays come in groups from a shared origin towards nearby points, like
+	// the sv_cullentities_trace samples or bouncegrid photons from one light
+	VectorClear(origin);
+	VectorClear(center);
+	for (i = 0;i < numrays;i++)
+	{
+		if (!(i % TRACEBENCH_GROUPSIZE))
+		{
+			VectorSet(origin, lhrandom(model->normalmins[0], model->normalmaxs[0]), lhrandom(model->normalmins[1], model->normalmaxs[1]), lhrandom(model->normalmins[2], model->normalmaxs[2]));
+			VectorSet(center, lhrandom(model->normalmins[0], model->normalmaxs[0]), lhrandom(model->normalmins[1], model->normalmaxs[1]), lhrandom(model->normalmins[2], model->normalmaxs[2]));
+		}
+		VectorCopy(origin, starts + i * 3);
+		VectorSet(ends + i * 3, center[0] + lhrandom(-128, 128), center[1] + lhrandom(-128, 128), center[2] + lhrandom(-128, 128));
+	}
+
+	t0 = Sys_DirtyTime();
+	for (i = 0;i < numrays;i++)
+		model->TraceLine(model, NULL, NULL, singletraces + i, starts + i * 3, ends + i * 3, SUPERCONTENTS_SOLID);
+	t1 = Sys_DirtyTime();
+	for (i = 0;i < numrays;i += n)
+	{
+		n = min(numrays - i, MAX_TRACELINESBATCH);
+		model->TraceLines(model, NULL, NULL, n, batchtraces + i, starts + i * 3, ends + i * 3, SUPERCONTENTS_SOLID);
+	}
+	t2 = Sys_DirtyTime();
+
+	for (i = 0;i < numrays;i++)
+	{
+		if (singletraces[i].fraction != batchtraces[i].fraction || singletraces[i].startsolid != batchtraces[i].startsolid || singletraces[i].hitsupercontents != batchtraces[i].hitsupercontents || !VectorCompare(singletraces[i].plane.normal, batchtraces[i].plane.normal))
+			numdiffer++;
+	}
+
+	Con_Printf("%i rays on %s: single %.0f rays/s, batch %.0f rays/s (%.2fx), %i results differ\n", numrays, model->name, numrays / max(t1 - t0, 0.000001), numrays / max(t2 - t1, 0.000001), (t1 - t0) / max(t2 - t1, 0.000001), numdiffer);
+
+	Mem_Free(starts);
+	Mem_Free(ends);
+	Mem_Free(singletraces);
+	Mem_Free(batchtraces);
+}
+
 void Collision_Init (void)
 {
 	Cvar_RegisterVariable(&collision_impactnudge);
@@ -29,9 +98,11 @@ void Collision_Init (void)
 	Cvar_RegisterVariable(&collision_extendtraceboxlength);
 	Cvar_RegisterVariable(&collision_debug_tracelineasbox);
 	Cvar_RegisterVariable(&collision_cache);
+	Cvar_RegisterVariable(&collision_tracecache);
 //	Cvar_RegisterVariable(&collision_triangle_neighborsides);
 	Cvar_RegisterVariable(&collision_triangle_bevelsides);
 	Cvar_RegisterVariable(&collision_triangle_axialsides);
+	Cmd_AddCommand("collision_tracebench", Collision_TraceBench_f, "measures how many lines per second the world model traces one at a time and in batches (optional parameter is the number of lines)");
 	collision_mempool = Mem_AllocPool("collision cache", 0, NULL);
 	Collision_Cache_Init(collision_mempool);
 }
@@ -1830,6 +1901,46 @@ void Collision_ClipLineToWorld(trace_t *trace, dp_model_t *model, const vec3_t t
 	Collision_ClipExtendFinish(&extendtraceinfo);
 }
 
+void Collision_ClipLinesToWorld(int numtraces, trace_t *traces, dp_model_t *model, const float *starts, const float *ends, int hitsupercontents, float extend, qboolean hitsurfaces)
+{
+	int i, j, n;
+	extendtraceinfo_t extendtraceinfo[MAX_TRACELINESBATCH];
+	float extendstarts[MAX_TRACELINESBATCH][3];
+	float extendends[MAX_TRACELINESBATCH][3];
+
+	for (i = 0;i < numtraces;i += n)
+	{
+		n = min(numtraces - i, MAX_TRACELINESBATCH);
+		for (j = 0;j < n;j++)
+		{
+			Collision_ClipExtendPrepare(&extendtraceinfo[j], traces + i + j, starts + (i + j) * 3, ends + (i + j) * 3, extend);
+			VectorCopy(extendtraceinfo[j].extendstart, extendstarts[j]);
+			VectorCopy(extendtraceinfo[j].extendend, extendends[j]);
+		}
+
+		// same choice of trace function as Collision_ClipLineToWorld
+		if (model && model->TraceLineAgainstSurfaces && hitsurfaces)
+		{
+			if (model->TraceLinesAgainstSurfaces)
+				model->TraceLinesAgainstSurfaces(model, NULL, NULL, n, traces + i, extendstarts[0], extendends[0], hitsupercontents);
+			else
+				for (j = 0;j < n;j++)
+					model->TraceLineAgainstSurfaces(model, NULL, NULL, traces + i + j, extendstarts[j], extendends[j], hitsupercontents);
+		}
+		else if (model && model->TraceLine)
+		{
+			if (model->TraceLines)
+				model->TraceLines(model, NULL, NULL, n, traces + i, extendstarts[0], extendends[0], hitsupercontents);
+			else
+				for (j = 0;j < n;j++)
+					model->TraceLine(model, NULL, NULL, traces + i + j, extendstarts[j], extendends[j], hitsupercontents);
+		}
+
+		for (j = 0;j < n;j++)
+			Collision_ClipExtendFinish(&extendtraceinfo[j]);
+	}
+}
+
 void Collision_ClipPointToGenericEntity(trace_t *trace, dp_model_t *model, const frameblend_t *frameblend, const skeleton_t *skeleton, const vec3_t bodymins, const vec3_t bodymaxs, int bodysupercontents, matrix4x4_t *matrix, matrix4x4_t *inversematrix, const vec3_t start, int hitsupercontentsmask)
 {
 	float starttransformed[3];
@@ -1861,6 +1972,262 @@ void Collision_ClipPointToWorld(trace_t *trace, dp_model_t *model, const vec3_t
 	VectorCopy(start, trace->endpos);
 }
 
+#define COLLISION_TRACECACHE_BOX 1
+#define COLLISION_TRACECACHE_LINE 2
+#define COLLISION_TRACECACHE_LINESURFACES 3
+#define COLLISION_TRACECACHE_POINT 4
+#define COLLISION_TRACECACHE_CONTENTS 5
+#define COLLISION_TRACECACHE_MAXSIZE 65536
+// only these look the same in every frame and pose
+#define COLLISION_TRACECACHE_STATICMODEL(m) ((m)->type == mod_brushq1 || (m)->type == mod_brushq2 || (m)->type == mod_brushq3 || (m)->type == mod_obj)
+
+// everything a trace against an unmoving brush model depends on, compared
+// with memcmp so it is always cleared first
+typedef struct collision_tracecachekey_s
+{
+	dp_model_t *model;
+	int kind; // COLLISION_TRACECACHE_ value, 0 for an empty slot
+	int hitsupercontentsmask;
+	float extend;
+	float impactnudge;
+	int options; // cvars that change trace results, see Collision_TraceCache_Options
+	vec3_t start;
+	vec3_t mins;
+	vec3_t maxs;
+	vec3_t end;
+	matrix4x4_t matrix; // identity for the world
+}
+collision_tracecachekey_t;
+
+typedef struct collision_tracecacheentry_s
+{
+	unsigned int hash;
+	collision_tracecachekey_t key;
+	trace_t trace;
+}
+collision_tracecacheentry_t;
+
+void Collision_TraceCache_Reset(collision_tracecache_t *cache)
+{
+	if (cache->entries)
+		Mem_Free(cache->entries);
+	cache->entries = NULL;
+	cache->size = 0;
+}
+
+// returns the slot for the key, sets *found if it already holds the result
+static collision_tracecacheentry_t *Collision_TraceCache_Lookup(collision_tracecache_t *cache, const collision_tracecachekey_t *key, qboolean *found)
+{
+	int size;
+	unsigned int i, hash;
+	const unsigned int *k;
+	collision_tracecacheentry_t *entry;
+	*found = false;
+	// resize (which also clears) when the cvar changes
+	for (size = 1;size * 2 <= bound(0, collision_tracecache.integer, COLLISION_TRACECACHE_MAXSIZE);size *= 2)
+		;
+	if (collision_tracecache.integer < 1)
+		size = 0;
+	if (cache->size != size)
+	{
+		Collision_TraceCache_Reset(cache);
+		if (size)
+			cache->entries = (collision_tracecacheentry_t *)Mem_Alloc(collision_mempool, size * sizeof(*cache->entries));
+		cache->size = size;
+	}
+	if (!cache->size)
+		return NULL;
+	// same cheap checksum as Collision_Cache_HashIndexForArray, followed by
+	// a multiply so the low bits used as the index depend on all of it
+	k = (const unsigned int *)key;
+	for (i = 0, hash = 0;i < sizeof(*key) / sizeof(unsigned int);i++)
+		hash += k[i] * (1 + i);
+	hash *= 2654435761u;
+	entry = cache->entries + ((hash >> 16) & (cache->size - 1));
+	if (entry->hash == hash && !memcmp(&entry->key, key, sizeof(*key)))
+		*found = true;
+	else
+	{
+		// replace whatever was there
+		entry->hash = hash;
+		entry->key = *key;
+	}
+	return entry;
+}
+
+// the cvars that change what a trace against the same model returns, so a
+// remembered result is not reused after one of them is changed
+static int Collision_TraceCache_Options(void)
+{
+	int options = 0;
+	if (mod_collision_bih.integer)
+		options |= 1<<0;
+	if (mod_q1bsp_polygoncollisions.integer)
+		options |= 1<<1;
+	if (mod_q3bsp_curves_collisions.integer)
+		options |= 1<<2;
+	if (sv_gameplayfix_q1bsptracelinereportstexture.integer)
+		options |= 1<<3;
+	if (collision_triangle_bevelsides.integer)
+		options |= 1<<4;
+	if (collision_triangle_axialsides.integer)
+		options |= 1<<5;
+	if (collision_debug_tracelineasbox.integer)
+		options |= 1<<6;
+	return options;
+}
+
+static void Collision_TraceCache_SetupKey(collision_tracecachekey_t *key, dp_model_t *model, int kind, const matrix4x4_t *matrix, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int hitsupercontentsmask, float extend)
+{
+	memset(key, 0, sizeof(*key));
+	key->model = model;
+	key->kind = kind;
+	key->hitsupercontentsmask = hitsupercontentsmask;
+	key->extend = extend;
+	key->impactnudge = collision_impactnudge.value;
+	key->options = Collision_TraceCache_Options();
+	VectorCopy(start, key->start);
+	if (mins)
+		VectorCopy(mins, key->mins);
+	if (maxs)
+		VectorCopy(maxs, key->maxs);
+	if (end)
+		VectorCopy(end, key->end);
+	if (matrix)
+		key->matrix = *matrix;
+	else
+		key->matrix = identitymatrix;
+}
+
+void Collision_TraceCache_ClipToWorld(collision_tracecache_t *cache, trace_t *trace, dp_model_t *model, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int hitsupercontents, float extend)
+{
+	collision_tracecachekey_t key;
+	collision_tracecacheentry_t *entry;
+	qboolean found;
+	if (!model || !model->TraceBox)
+	{
+		Collision_ClipToWorld(trace, model, start, mins, maxs, end, hitsupercontents, extend);
+		return;
+	}
+	Collision_TraceCache_SetupKey(&key, model, COLLISION_TRACECACHE_BOX, NULL, start, mins, maxs, end, hitsupercontents, extend);
+	entry = Collision_TraceCache_Lookup(cache, &key, &found);
+	if (found)
+	{
+		*trace = entry->trace;
+		return;
+	}
+	Collision_ClipToWorld(trace, model, start, mins, maxs, end, hitsupercontents, extend);
+	if (entry)
+		entry->trace = *trace;
+}
+
+void Collision_TraceCache_ClipLineToWorld(collision_tracecache_t *cache, trace_t *trace, dp_model_t *model, const vec3_t start, const vec3_t end, int hitsupercontents, float extend, qboolean hitsurfaces)
+{
+	collision_tracecachekey_t key;
+	collision_tracecacheentry_t *entry;
+	qboolean found;
+	if (!model || !model->TraceLine)
+	{
+		Collision_ClipLineToWorld(trace, model, start, end, hitsupercontents, extend, hitsurfaces);
+		return;
+	}
+	Collision_TraceCache_SetupKey(&key, model, hitsurfaces ? COLLISION_TRACECACHE_LINESURFACES : COLLISION_TRACECACHE_LINE, NULL, start, NULL, NULL, end, hitsupercontents, extend);
+	entry = Collision_TraceCache_Lookup(cache, &key, &found);
+	if (found)
+	{
+		*trace = entry->trace;
+		return;
+	}
+	Collision_ClipLineToWorld(trace, model, start, end, hitsupercontents, extend, hitsurfaces);
+	if (entry)
+		entry->trace = *trace;
+}
+
+void Collision_TraceCache_ClipPointToWorld(collision_tracecache_t *cache, trace_t *trace, dp_model_t *model, const vec3_t start, int hitsupercontents)
+{
+	collision_tracecachekey_t key;
+	collision_tracecacheentry_t *entry;
+	qboolean found;
+	if (!model || !model->TracePoint)
+	{
+		Collision_ClipPointToWorld(trace, model, start, hitsupercontents);
+		return;
+	}
+	Collision_TraceCache_SetupKey(&key, model, COLLISION_TRACECACHE_POINT, NULL, start, NULL, NULL, NULL, hitsupercontents, 0);
+	entry = Collision_TraceCache_Lookup(cache, &key, &found);
+	if (found)
+	{
+		*trace = entry->trace;
+		return;
+	}
+	Collision_ClipPointToWorld(trace, model, start, hitsupercontents);
+	if (entry)
+		entry->trace = *trace;
+}
+
+void Collision_TraceCache_ClipToGenericEntity(collision_tracecache_t *cache, trace_t *trace, dp_model_t *model, const frameblend_t *frameblend, const skeleton_t *skeleton, const vec3_t bodymins, const vec3_t bodymaxs, int bodysupercontents, matrix4x4_t *matrix, matrix4x4_t *inversematrix, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int hitsupercontentsmask, float extend)
+{
+	collision_tracecachekey_t key;
+	collision_tracecacheentry_t *entry;
+	qboolean found;
+	// only brush models are the same in every frame and pose
+	if (!model || !COLLISION_TRACECACHE_STATICMODEL(model) || !model->TraceBox)
+	{
+		Collision_ClipToGenericEntity(trace, model, frameblend, skeleton, bodymins, bodymaxs, bodysupercontents, matrix, inversematrix, start, mins, maxs, end, hitsupercontentsmask, extend);
+		return;
+	}
+	Collision_TraceCache_SetupKey(&key, model, COLLISION_TRACECACHE_BOX, matrix, start, mins, maxs, end, hitsupercontentsmask, extend);
+	entry = Collision_TraceCache_Lookup(cache, &key, &found);
+	if (found)
+	{
+		*trace = entry->trace;
+		return;
+	}
+	Collision_ClipToGenericEntity(trace, model, frameblend, skeleton, bodymins, bodymaxs, bodysupercontents, matrix, inversematrix, start, mins, maxs, end, hitsupercontentsmask, extend);
+	if (entry)
+		entry->trace = *trace;
+}
+
+void Collision_TraceCache_ClipLineToGenericEntity(collision_tracecache_t *cache, trace_t *trace, dp_model_t *model, const frameblend_t *frameblend, const skeleton_t *skeleton, const vec3_t bodymins, const vec3_t bodymaxs, int bodysupercontents, matrix4x4_t *matrix, matrix4x4_t *inversematrix, const vec3_t start, const vec3_t end, int hitsupercontentsmask, float extend, qboolean hitsurfaces)
+{
+	collision_tracecachekey_t key;
+	collision_tracecacheentry_t *entry;
+	qboolean found;
+	if (!model || !COLLISION_TRACECACHE_STATICMODEL(model) || !model->TraceLine)
+	{
+		Collision_ClipLineToGenericEntity(trace, model, frameblend, skeleton, bodymins, bodymaxs, bodysupercontents, matrix, inversematrix, start, end, hitsupercontentsmask, extend, hitsurfaces);
+		return;
+	}
+	Collision_TraceCache_SetupKey(&key, model, hitsurfaces ? COLLISION_TRACECACHE_LINESURFACES : COLLISION_TRACECACHE_LINE, matrix, start, NULL, NULL, end, hitsupercontentsmask, extend);
+	entry = Collision_TraceCache_Lookup(cache, &key, &found);
+	if (found)
+	{
+		*trace = entry->trace;
+		return;
+	}
+	Collision_ClipLineToGenericEntity(trace, model, frameblend, skeleton, bodymins, bodymaxs, bodysupercontents, matrix, inversematrix, start, end, hitsupercontentsmask, extend, hitsurfaces);
+	if (entry)
+		entry->trace = *trace;
+}
+
+int Collision_TraceCache_PointSuperContents(collision_tracecache_t *cache, dp_model_t *model, const vec3_t point)
+{
+	collision_tracecachekey_t key;
+	collision_tracecacheentry_t *entry;
+	qboolean found;
+	int supercontents;
+	if (!model || !model->PointSuperContents)
+		return 0;
+	Collision_TraceCache_SetupKey(&key, model, COLLISION_TRACECACHE_CONTENTS, NULL, point, NULL, NULL, NULL, 0, 0);
+	entry = Collision_TraceCache_Lookup(cache, &key, &found);
+	if (found)
+		return entry->trace.startsupercontents;
+	supercontents = model->PointSuperContents(model, 0, point);
+	if (entry)
+		entry->trace.startsupercontents = supercontents;
+	return supercontents;
+}
+
 void Collision_CombineTraces(trace_t *cliptrace, const trace_t *trace, void *touch, qboolean isbmodel)
 {
 	// take the 'best' answers from the new trace and combine with existing data
@@ -169,10 +169,33 @@ void Collision_ClipPointToGenericEntity(trace_t *trace, dp_model_t *model, const
 // like above but does not do a transform and does nothing if model is NULL
 void Collision_ClipToWorld(trace_t *trace, dp_model_t *model, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int hitsupercontents, float extend);
 void Collision_ClipLineToWorld(trace_t *trace, dp_model_t *model, const vec3_t start, const vec3_t end, int hitsupercontents, float extend, qboolean hitsurfaces);
+// traces numtraces lines (starts and ends are 3 floats per trace) using the model's batch trace functions if it has them
+void Collision_ClipLinesToWorld(int numtraces, trace_t *traces, dp_model_t *model, const float *starts, const float *ends, int hitsupercontents, float extend, qboolean hitsurfaces);
 void Collision_ClipPointToWorld(trace_t *trace, dp_model_t *model, const vec3_t start, int hitsupercontents);
 // caching surface trace for renderer (NOT THREAD SAFE)
 void Collision_Cache_ClipLineToGenericEntitySurfaces(trace_t *trace, dp_model_t *model, matrix4x4_t *matrix, matrix4x4_t *inversematrix, const vec3_t start, const vec3_t end, int hitsupercontentsmask);
 void Collision_Cache_ClipLineToWorldSurfaces(trace_t *trace, dp_model_t *model, const vec3_t start, const vec3_t end, int hitsupercontents);
+// results of traces against the world model and brush entities, kept across
+// frames until replaced (brush entities are keyed by their placement, so a
+// relinked door simply stops matching), each world has its own (NOT THREAD SAFE)
+typedef struct collision_tracecache_s
+{
+	struct collision_tracecacheentry_s *entries;
+	int size;
+}
+collision_tracecache_t;
+// frees the entries, call when models may have been freed or reloaded
+void Collision_TraceCache_Reset(collision_tracecache_t *cache);
+// same as the functions without TraceCache, but return the remembered result
+// if the same trace was done before
+void Collision_TraceCache_ClipToWorld(collision_tracecache_t *cache, trace_t *trace, dp_model_t *model, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int hitsupercontents, float extend);
+void Collision_TraceCache_ClipLineToWorld(collision_tracecache_t *cache, trace_t *trace, dp_model_t *model, const vec3_t start, const vec3_t end, int hitsupercontents, float extend, qboolean hitsurfaces);
+void Collision_TraceCache_ClipPointToWorld(collision_tracecache_t *cache, trace_t *trace, dp_model_t *model, const vec3_t start, int hitsupercontents);
+// only brush models are cached, anything else is passed through
+void Collision_TraceCache_ClipToGenericEntity(collision_tracecache_t *cache, trace_t *trace, dp_model_t *model, const struct frameblend_s *frameblend, const struct skeleton_s *skeleton, const vec3_t bodymins, const vec3_t bodymaxs, int bodysupercontents, matrix4x4_t *matrix, matrix4x4_t *inversematrix, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int hitsupercontentsmask, float extend);
+void Collision_TraceCache_ClipLineToGenericEntity(collision_tracecache_t *cache, trace_t *trace, dp_model_t *model, const struct frameblend_s *frameblend, const struct skeleton_s *skeleton, const vec3_t bodymins, const vec3_t bodymaxs, int bodysupercontents, matrix4x4_t *matrix, matrix4x4_t *inversematrix, const vec3_t start, const vec3_t end, int hitsupercontentsmask, float extend, qboolean hitsurfaces);
+// frame 0 PointSuperContents of the world model
+int Collision_TraceCache_PointSuperContents(collision_tracecache_t *cache, dp_model_t *model, const vec3_t point);
 // combines data from two traces:
 // merges contents flags, startsolid, allsolid, inwater
 // updates fraction, endpos, plane and surface info if new fraction is shorter
@@ -5,6 +5,7 @@
 
 #include "hmac.h"
 #include "libcurl.h"
+#include "crypto_aesni.h"
 
 cvar_t crypto_developer = {CVAR_SAVE, "crypto_developer", "0", "print extra info about crypto handshake"};
 cvar_t crypto_servercpupercent = {CVAR_SAVE, "crypto_servercpupercent", "10", "allowed crypto CPU load in percent for server operation (0 = no limit, faster)"};
@@ -13,6 +14,8 @@ cvar_t crypto_servercpudebug = {CVAR_SAVE, "crypto_servercpudebug", "0", "print
 static double crypto_servercpu_accumulator = 0;
 static double crypto_servercpu_lastrealtime = 0;
 cvar_t crypto_aeslevel = {CVAR_SAVE, "crypto_aeslevel", "1", "whether to support AES encryption in authenticated connections (0 = no, 1 = supported, 2 = requested, 3 = required)"};
+cvar_t crypto_aesni = {CVAR_SAVE, "crypto_aesni", "1", "use the AES instructions of the cpu for packet encryption when available"};
+static qboolean crypto_aesni_supported = false;
 int crypto_keyfp_recommended_length;
 static const char *crypto_idstring = NULL;
 static char crypto_idstring_buf[512];
@@ -353,6 +356,9 @@ static void Crypto_Rijndael_CloseLibrary (void)
 
 #endif
 
+// AES works with either the library or the AES instructions of the cpu
+#define Crypto_HaveAES() (d0_rijndael_dll || crypto_aesni_supported)
+
 // various helpers
 void sha256(unsigned char *out, const unsigned char *in, int n)
 {
@@ -819,7 +825,7 @@ static void Crypto_BuildIdString(void)
 	char vabuf[1024];
 
 	crypto_idstring = NULL;
-	dpsnprintf(crypto_idstring_buf, sizeof(crypto_idstring_buf), "%d", d0_rijndael_dll ? crypto_aeslevel.integer : 0);
+	dpsnprintf(crypto_idstring_buf, sizeof(crypto_idstring_buf), "%d", Crypto_HaveAES() ? crypto_aeslevel.integer : 0);
 	for (i = 0; i < MAX_PUBKEYS; ++i)
 		if (pubkeys[i])
 			strlcat(crypto_idstring_buf, va(vabuf, sizeof(vabuf), " %s@%s%s", pubkeys_priv_fp64[i], pubkeys_havesig[i] ? "" : "~", pubkeys_fp64[i]), sizeof(crypto_idstring_buf));
@@ -1046,6 +1052,7 @@ void Crypto_Shutdown(void)
 void Crypto_Init(void)
 {
 	cryptomempool = Mem_AllocPool("crypto", 0, NULL);
+	crypto_aesni_supported = Sys_HaveAESNI();
 
 	if(!Crypto_OpenLibrary())
 		return;
@@ -1420,6 +1427,7 @@ static void Crypto_HostKey_Clear_f(void)
 	}
 }
 
+static void Crypto_Benchmark_f(void);
 void Crypto_Init_Commands(void)
 {
 	if(d0_blind_id_dll)
@@ -1430,7 +1438,7 @@ void Crypto_Init_Commands(void)
 		Cmd_AddCommand("crypto_hostkeys", Crypto_HostKeys_f, "lists the cached host keys");
 		Cmd_AddCommand("crypto_hostkey_clear", Crypto_HostKey_Clear_f, "clears a cached host key");
 		Cvar_RegisterVariable(&crypto_developer);
-		if(d0_rijndael_dll)
+		if(Crypto_HaveAES())
 			Cvar_RegisterVariable(&crypto_aeslevel);
 		else
 			crypto_aeslevel.integer = 0; // make sure
@@ -1438,11 +1446,17 @@ void Crypto_Init_Commands(void)
 		Cvar_RegisterVariable(&crypto_servercpumaxtime);
 		Cvar_RegisterVariable(&crypto_servercpudebug);
 	}
+	Cvar_RegisterVariable(&crypto_aesni);
+	Cmd_AddCommand("crypto_benchmark", Crypto_Benchmark_f, "measures the speed of packet encryption (optional argument: packet size)");
 }
 // end
 
 // AES encryption
-static void aescpy(unsigned char *key, const unsigned char *iv, unsigned char *dst, const unsigned char *src, size_t len)
+static qboolean Crypto_UseAESNI(void)
+{
+	return crypto_aesni_supported && (crypto_aesni.integer || !d0_rijndael_dll);
+}
+static void aescpy_rijndael(unsigned char *key, const unsigned char *iv, unsigned char *dst, const unsigned char *src, size_t len)
 {
 	const unsigned char *xorpos = iv;
 	unsigned char xorbuf[16];
@@ -1468,7 +1482,7 @@ static void aescpy(unsigned char *key, const unsigned char *iv, unsigned char *d
 		qd0_rijndael_encrypt(rk, D0_RIJNDAEL_NROUNDS(DHKEY_SIZE * 8), xorbuf, dst);
 	}
 }
-static void seacpy(unsigned char *key, const unsigned char *iv, unsigned char *dst, const unsigned char *src, size_t len)
+static void seacpy_rijndael(unsigned char *key, const unsigned char *iv, unsigned char *dst, const unsigned char *src, size_t len)
 {
 	const unsigned char *xorpos = iv;
 	unsigned char xorbuf[16];
@@ -1492,6 +1506,57 @@ static void seacpy(unsigned char *key, const unsigned char *iv, unsigned char *d
 			dst[i] = xorbuf[i] ^ xorpos[i];
 	}
 }
+static void aescpy(unsigned char *key, const unsigned char *iv, unsigned char *dst, const unsigned char *src, size_t len)
+{
+#ifdef AESNI_POSSIBLE
+	if(Crypto_UseAESNI())
+	{
+		const unsigned char *keys[1], *ivs[1], *srcs[1];
+		unsigned char *dsts[1];
+		keys[0] = key;
+		ivs[0] = iv;
+		srcs[0] = src;
+		dsts[0] = dst;
+		Crypto_AESNI_EncryptCBC(1, keys, ivs, dsts, srcs, &len);
+		return;
+	}
+#endif
+	aescpy_rijndael(key, iv, dst, src, len);
+}
+static void seacpy(unsigned char *key, const unsigned char *iv, unsigned char *dst, const unsigned char *src, size_t len)
+{
+#ifdef AESNI_POSSIBLE
+	if(Crypto_UseAESNI())
+	{
+		Crypto_AESNI_DecryptCBC(key, iv, dst, src, len);
+		return;
+	}
+#endif
+	seacpy_rijndael(key, iv, dst, src, len);
+}
+
+// writes the length and HMAC part of an AES packet, which is also the IV
+static qboolean Crypto_EncryptPacket_AESHeader(unsigned char *dhkey, const void *data_src, size_t len_src, void *data_dst, size_t *len_dst, size_t len)
+{
+	unsigned char h[32];
+	// AES packet = 1 byte length overhead, 15 bytes from HMAC-SHA-256, data, 0..15 bytes padding
+	// 15 bytes HMAC-SHA-256 (112bit) suffice as the attacker can't do more than forge a random-looking packet
+	// HMAC is needed to not leak information about packet content
+	if(developer_networking.integer)
+	{
+		Con_Print("To be encrypted:\n");
+		Com_HexDumpToConsole((const unsigned char *) data_src, (int)len_src);
+	}
+	if(len_src + 32 > len || !HMAC_SHA256_32BYTES(h, (const unsigned char *) data_src, (int)len_src, dhkey, DHKEY_SIZE))
+	{
+		Con_Printf("Crypto_EncryptPacket failed (not enough space: %d bytes in, %d bytes out)\n", (int) len_src, (int) len);
+		return false;
+	}
+	*len_dst = ((len_src + 15) / 16) * 16 + 16; // add 16 for HMAC, then round to 16-size for AES
+	((unsigned char *) data_dst)[0] = (unsigned char)(*len_dst - len_src);
+	memcpy(((unsigned char *) data_dst)+1, h, 15);
+	return true;
+}
 
 // NOTE: we MUST avoid the following begins of the packet:
 //   1. 0xFF, 0xFF, 0xFF, 0xFF
@@ -1505,22 +1570,8 @@ const void *Crypto_EncryptPacket(crypto_t *crypto, const void *data_src, size_t
 	{
 		if(crypto->use_aes)
 		{
-			// AES packet = 1 byte length overhead, 15 bytes from HMAC-SHA-256, data, 0..15 bytes padding
-			// 15 bytes HMAC-SHA-256 (112bit) suffice as the attacker can't do more than forge a random-looking packet
-			// HMAC is needed to not leak information about packet content
-			if(developer_networking.integer)
-			{
-				Con_Print("To be encrypted:\n");
-				Com_HexDumpToConsole((const unsigned char *) data_src, (int)len_src);
-			}
-			if(len_src + 32 > len || !HMAC_SHA256_32BYTES(h, (const unsigned char *) data_src, (int)len_src, crypto->dhkey, DHKEY_SIZE))
-			{
-				Con_Printf("Crypto_EncryptPacket failed (not enough space: %d bytes in, %d bytes out)\n", (int) len_src, (int) len);
+			if(!Crypto_EncryptPacket_AESHeader(crypto->dhkey, data_src, len_src, data_dst, len_dst, len))
 				return NULL;
-			}
-			*len_dst = ((len_src + 15) / 16) * 16 + 16; // add 16 for HMAC, then round to 16-size for AES
-			((unsigned char *) data_dst)[0] = (unsigned char)(*len_dst - len_src);
-			memcpy(((unsigned char *) data_dst)+1, h, 15);
 			aescpy(crypto->dhkey, (const unsigned char *) data_dst, ((unsigned char *) data_dst) + 16, (const unsigned char *) data_src, len_src);
 			//                    IV                                dst                                src                               len
 		}
@@ -1554,6 +1605,48 @@ const void *Crypto_EncryptPacket(crypto_t *crypto, const void *data_src, size_t
 	}
 }
 
+void Crypto_EncryptPackets(crypto_packet_t *packets, int numpackets)
+{
+	int i;
+#ifdef AESNI_POSSIBLE
+	int n = 0;
+	const unsigned char *keys[CRYPTO_AESNI_STREAMS], *ivs[CRYPTO_AESNI_STREAMS], *srcs[CRYPTO_AESNI_STREAMS];
+	unsigned char *dsts[CRYPTO_AESNI_STREAMS];
+	size_t lens[CRYPTO_AESNI_STREAMS];
+#endif
+	for(i = 0; i < numpackets; ++i)
+	{
+		crypto_packet_t *p = &packets[i];
+		if(!Crypto_EncryptPacket_AESHeader(p->dhkey, p->data_src, p->len_src, p->data_dst, &p->len_dst, p->len))
+		{
+			p->len_dst = 0;
+			continue;
+		}
+#ifdef AESNI_POSSIBLE
+		if(Crypto_UseAESNI())
+		{
+			// several packets go through the AES instructions at once
+			keys[n] = p->dhkey;
+			ivs[n] = (const unsigned char *) p->data_dst;
+			dsts[n] = ((unsigned char *) p->data_dst) + 16;
+			srcs[n] = (const unsigned char *) p->data_src;
+			lens[n] = p->len_src;
+			if(++n == CRYPTO_AESNI_STREAMS)
+			{
+				Crypto_AESNI_EncryptCBC(n, keys, ivs, dsts, srcs, lens);
+				n = 0;
+			}
+			continue;
+		}
+#endif
+		aescpy_rijndael(p->dhkey, (const unsigned char *) p->data_dst, ((unsigned char *) p->data_dst) + 16, (const unsigned char *) p->data_src, p->len_src);
+	}
+#ifdef AESNI_POSSIBLE
+	if(n)
+		Crypto_AESNI_EncryptCBC(n, keys, ivs, dsts, srcs, lens);
+#endif
+}
+
 const void *Crypto_DecryptPacket(crypto_t *crypto, const void *data_src, size_t len_src, void *data_dst, size_t *len_dst, size_t len)
 {
 	unsigned char h[32];
@@ -1657,6 +1750,182 @@ const void *Crypto_DecryptPacket(crypto_t *crypto, const void *data_src, size_t
 		return data_src;
 	}
 }
+
+#define CRYPTO_BENCHMARK_PACKETS 64
+#define CRYPTO_BENCHMARK_TIME 0.5
+
+typedef enum crypto_benchmark_e
+{
+	CRYPTO_BENCHMARK_RIJNDAEL,
+	CRYPTO_BENCHMARK_AESNI,
+	CRYPTO_BENCHMARK_AESNI_BATCH,
+	CRYPTO_BENCHMARK_RIJNDAEL_DECRYPT,
+	CRYPTO_BENCHMARK_AESNI_DECRYPT,
+	CRYPTO_BENCHMARK_PACKET,
+	CRYPTO_BENCHMARK_PACKET_BATCH,
+	CRYPTO_BENCHMARK_COUNT
+}
+crypto_benchmark_t;
+
+static const char *crypto_benchmark_names[CRYPTO_BENCHMARK_COUNT] =
+{
+	"d0_rijndael encryption",
+	"AES instructions encryption",
+	"AES instructions encryption, batched",
+	"d0_rijndael decryption",
+	"AES instructions decryption",
+	"packets with HMAC",
+	"packets with HMAC, batched",
+};
+
+// encrypts (or decrypts) each packet in src to dst once
+static void Crypto_Benchmark_Run(crypto_benchmark_t mode, unsigned char *keys, const unsigned char *src, unsigned char *dst, size_t packetsize)
+{
+	int i;
+	size_t stride = packetsize + CRYPTO_HEADERSIZE + 1;
+	crypto_t crypto;
+	crypto_packet_t packets[CRYPTO_BENCHMARK_PACKETS];
+	size_t len_dst;
+	switch(mode)
+	{
+	case CRYPTO_BENCHMARK_RIJNDAEL:
+		for(i = 0; i < CRYPTO_BENCHMARK_PACKETS; ++i)
+			aescpy_rijndael(keys + i * DHKEY_SIZE, dst + i * stride, dst + i * stride + 16, src + i * stride, packetsize);
+		break;
+	case CRYPTO_BENCHMARK_RIJNDAEL_DECRYPT:
+		for(i = 0; i < CRYPTO_BENCHMARK_PACKETS; ++i)
+			seacpy_rijndael(keys + i * DHKEY_SIZE, src + i * stride, dst + i * stride, src + i * stride + 16, packetsize);
+		break;
+#ifdef AESNI_POSSIBLE
+	case CRYPTO_BENCHMARK_AESNI:
+	case CRYPTO_BENCHMARK_AESNI_BATCH:
+		{
+			int j, n, streams = mode == CRYPTO_BENCHMARK_AESNI_BATCH ? CRYPTO_AESNI_STREAMS : 1;
+			const unsigned char *k[CRYPTO_AESNI_STREAMS], *ivs[CRYPTO_AESNI_STREAMS], *srcs[CRYPTO_AESNI_STREAMS];
+			unsigned char *dsts[CRYPTO_AESNI_STREAMS];
+			size_t lens[CRYPTO_AESNI_STREAMS];
+			for(i = 0; i < CRYPTO_BENCHMARK_PACKETS; i += n)
+			{
+				n = min(streams, CRYPTO_BENCHMARK_PACKETS - i);
+				for(j = 0; j < n; ++j)
+				{
+					k[j] = keys + (i + j) * DHKEY_SIZE;
+					ivs[j] = dst + (i + j) * stride;
+					dsts[j] = dst + (i + j) * stride + 16;
+					srcs[j] = src + (i + j) * stride;
+					lens[j] = packetsize;
+				}
+				Crypto_AESNI_EncryptCBC(n, k, ivs, dsts, srcs, lens);
+			}
+		}
+		break;
+	case CRYPTO_BENCHMARK_AESNI_DECRYPT:
+		for(i = 0; i < CRYPTO_BENCHMARK_PACKETS; ++i)
+			Crypto_AESNI_DecryptCBC(keys + i * DHKEY_SIZE, src + i * stride, dst + i * stride, src + i * stride + 16, packetsize);
+		break;
+#endif
+	case CRYPTO_BENCHMARK_PACKET:
+		memset(&crypto, 0, sizeof(crypto));
+		crypto.authenticated = true;
+		crypto.use_aes = true;
+		for(i = 0; i < CRYPTO_BENCHMARK_PACKETS; ++i)
+		{
+			memcpy(crypto.dhkey, keys + i * DHKEY_SIZE, DHKEY_SIZE);
+			Crypto_EncryptPacket(&crypto, src + i * stride, packetsize, dst + i * stride, &len_dst, stride);
+		}
+		break;
+	case CRYPTO_BENCHMARK_PACKET_BATCH:
+		for(i = 0; i < CRYPTO_BENCHMARK_PACKETS; ++i)
+		{
+			memcpy(packets[i].dhkey, keys + i * DHKEY_SIZE, DHKEY_SIZE);
+			packets[i].data_src = src + i * stride;
+			packets[i].len_src = packetsize;
+			packets[i].data_dst = dst + i * stride;
+			packets[i].len = stride;
+		}
+		Crypto_EncryptPackets(packets, CRYPTO_BENCHMARK_PACKETS);
+		break;
+	default:
+		break;
+	}
+}
+
+static void Crypto_Benchmark_f(void)
+{
+	size_t packetsize = Cmd_Argc() > 1 ? (size_t)bound(1, atoi(Cmd_Argv(1)), 1400) : 1024;
+	size_t stride = packetsize + CRYPTO_HEADERSIZE + 1, size = CRYPTO_BENCHMARK_PACKETS * stride;
+	unsigned char *keys, *plain, *cipher, *out;
+	qboolean available[CRYPTO_BENCHMARK_COUNT];
+	double starttime, elapsed;
+	int i, mode, runs;
+
+	available[CRYPTO_BENCHMARK_RIJNDAEL] = available[CRYPTO_BENCHMARK_RIJNDAEL_DECRYPT] = d0_rijndael_dll != 0;
+	available[CRYPTO_BENCHMARK_AESNI] = available[CRYPTO_BENCHMARK_AESNI_BATCH] = available[CRYPTO_BENCHMARK_AESNI_DECRYPT] = crypto_aesni_supported;
+	// the HMAC needs the sha256 of d0_blind_id
+	available[CRYPTO_BENCHMARK_PACKET] = available[CRYPTO_BENCHMARK_PACKET_BATCH] = Crypto_Available() && Crypto_HaveAES();
+	if(!Crypto_HaveAES())
+	{
+		Con_Print("crypto_benchmark: neither d0_rijndael nor the AES instructions are available\n");
+		return;
+	}
+
+	keys = (unsigned char *) Mem_Alloc(tempmempool, CRYPTO_BENCHMARK_PACKETS * DHKEY_SIZE);
+	plain = (unsigned char *) Mem_Alloc(tempmempool, size);
+	cipher = (unsigned char *) Mem_Alloc(tempmempool, size);
+	out = (unsigned char *) Mem_Alloc(tempmempool, size);
+	for(i = 0; i < CRYPTO_BENCHMARK_PACKETS * DHKEY_SIZE; ++i)
+		keys[i] = rand() & 0xFF;
+	for(i = 0; i < (int)size; ++i)
+		plain[i] = rand() & 0xFF;
+	// random IVs like the HMAC would give
+	for(i = 0; i < CRYPTO_BENCHMARK_PACKETS; ++i)
+		memcpy(cipher + i * stride, plain + i * stride + packetsize, 16);
+
+	Con_Printf("%i packets of %i bytes per run, on one core:\n", CRYPTO_BENCHMARK_PACKETS, (int)packetsize);
+	for(mode = 0; mode < CRYPTO_BENCHMARK_COUNT; ++mode)
+	{
+		if(!available[mode])
+			continue;
+		runs = 0;
+		starttime = Sys_DirtyTime();
+		do
+		{
+			if(mode == CRYPTO_BENCHMARK_RIJNDAEL_DECRYPT || mode == CRYPTO_BENCHMARK_AESNI_DECRYPT)
+				Crypto_Benchmark_Run((crypto_benchmark_t) mode, keys, cipher, out, packetsize);
+			else
+				Crypto_Benchmark_Run((crypto_benchmark_t) mode, keys, plain, mode <= CRYPTO_BENCHMARK_AESNI_BATCH ? cipher : out, packetsize);
+			runs++;
+			elapsed = Sys_DirtyTime() - starttime;
+		}
+		while(elapsed < CRYPTO_BENCHMARK_TIME);
+		Con_Printf("%-40s %8.1f MB/s\n", crypto_benchmark_names[mode], runs * (double)(CRYPTO_BENCHMARK_PACKETS * packetsize) / elapsed / 1000000.0);
+
+		// the paths have to agree on the result
+		if(mode == CRYPTO_BENCHMARK_AESNI_BATCH && available[CRYPTO_BENCHMARK_RIJNDAEL])
+		{
+			memcpy(out, cipher, size);
+			Crypto_Benchmark_Run(CRYPTO_BENCHMARK_RIJNDAEL, keys, plain, out, packetsize);
+			for(i = 0; i < CRYPTO_BENCHMARK_PACKETS; ++i)
+				if(memcmp(out + i * stride + 16, cipher + i * stride + 16, (packetsize + 15) & ~15))
+					break;
+			if(i < CRYPTO_BENCHMARK_PACKETS)
+				Con_Printf("^1AES instructions do not match d0_rijndael (packet %i)\n", i);
+		}
+		if(mode == CRYPTO_BENCHMARK_RIJNDAEL_DECRYPT || mode == CRYPTO_BENCHMARK_AESNI_DECRYPT)
+		{
+			for(i = 0; i < CRYPTO_BENCHMARK_PACKETS; ++i)
+				if(memcmp(out + i * stride, plain + i * stride, packetsize))
+					break;
+			if(i < CRYPTO_BENCHMARK_PACKETS)
+				Con_Printf("^1%s does not give back the data (packet %i)\n", crypto_benchmark_names[mode], i);
+		}
+	}
+
+	Mem_Free(out);
+	Mem_Free(cipher);
+	Mem_Free(plain);
+	Mem_Free(keys);
+}
 // end
 
 const char *Crypto_GetInfoResponseDataString(void)
@@ -1712,7 +1981,7 @@ static int Crypto_ServerParsePacket_Internal(const char *data_in, size_t len_in,
 	if(!d0_blind_id_dll)
 		return CRYPTO_NOMATCH; // no support
 
-	if (len_in > 8 && !memcmp(string, "connect\\", 8) && d0_rijndael_dll && crypto_aeslevel.integer >= 3)
+	if (len_in > 8 && !memcmp(string, "connect\\", 8) && Crypto_HaveAES() && crypto_aeslevel.integer >= 3)
 	{
 		const char *s;
 		int i;
@@ -1764,7 +2033,7 @@ static int Crypto_ServerParsePacket_Internal(const char *data_in, size_t len_in,
 				aeslevel = 0; // not supported
 			else
 				aeslevel = bound(0, atoi(s), 3);
-			switch(bound(0, d0_rijndael_dll ? crypto_aeslevel.integer : 0, 3))
+			switch(bound(0, Crypto_HaveAES() ? crypto_aeslevel.integer : 0, 3))
 			{
 				default: // dummy, never happens, but to make gcc happy...
 				case 0:
@@ -2096,7 +2365,7 @@ int Crypto_ClientParsePacket(const char *data_in, size_t len_in, char *data_out,
 	// if "challenge": verify challenge, and discard message, send next crypto protocol message instead
 	// otherwise, just handle actual protocol messages
 
-	if (len_in == 6 && !memcmp(string, "accept", 6) && cls.connect_trying && d0_rijndael_dll)
+	if (len_in == 6 && !memcmp(string, "accept", 6) && cls.connect_trying && Crypto_HaveAES())
 	{
 		int wantserverid = -1;
 		Crypto_RetrieveHostKey(&cls.connect_address, &wantserverid, NULL, 0, NULL, 0, NULL, NULL);
@@ -2109,7 +2378,7 @@ int Crypto_ClientParsePacket(const char *data_in, size_t len_in, char *data_out,
 		}
 		return CRYPTO_NOMATCH;
 	}
-	else if (len_in >= 1 && string[0] == 'j' && cls.connect_trying && d0_rijndael_dll)
+	else if (len_in >= 1 && string[0] == 'j' && cls.connect_trying && Crypto_HaveAES())
 	{
 		int wantserverid = -1;
 		Crypto_RetrieveHostKey(&cls.connect_address, &wantserverid, NULL, 0, NULL, 0, NULL, NULL);
@@ -2201,7 +2470,7 @@ int Crypto_ClientParsePacket(const char *data_in, size_t len_in, char *data_out,
 		GetUntilNul(&data_in, &len_in);
 		if(!data_in)
 			return (wantserverid >= 0) ? Crypto_ClientError(data_out, len_out, "Server tried an unauthenticated connection even though a host key is present") :
-				(d0_rijndael_dll && crypto_aeslevel.integer >= 3) ? Crypto_ServerError(data_out, len_out, "This server requires encryption to be not required (crypto_aeslevel <= 2)", NULL) :
+				(Crypto_HaveAES() && crypto_aeslevel.integer >= 3) ? Crypto_ServerError(data_out, len_out, "This server requires encryption to be not required (crypto_aeslevel <= 2)", NULL) :
 				CRYPTO_NOMATCH;
 
 		// FTEQW extension protocol
@@ -2237,7 +2506,7 @@ int Crypto_ClientParsePacket(const char *data_in, size_t len_in, char *data_out,
 
 		if(!vlen_blind_id_ptr)
 			return (wantserverid >= 0) ? Crypto_ClientError(data_out, len_out, "Server tried an unauthenticated connection even though authentication is required") :
-				(d0_rijndael_dll && crypto_aeslevel.integer >= 3) ? Crypto_ServerError(data_out, len_out, "This server requires encryption to be not required (crypto_aeslevel <= 2)", NULL) :
+				(Crypto_HaveAES() && crypto_aeslevel.integer >= 3) ? Crypto_ServerError(data_out, len_out, "This server requires encryption to be not required (crypto_aeslevel <= 2)", NULL) :
 				CRYPTO_NOMATCH;
 
 		data_in = vlen_blind_id_ptr;
@@ -2297,7 +2566,7 @@ int Crypto_ClientParsePacket(const char *data_in, size_t len_in, char *data_out,
 			CDATA->wantserver_issigned = wantserver_issigned;
 
 			if(CDATA->wantserver_idfp[0]) // if we know a host key, honor its encryption setting
-			switch(bound(0, d0_rijndael_dll ? crypto_aeslevel.integer : 0, 3))
+			switch(bound(0, Crypto_HaveAES() ? crypto_aeslevel.integer : 0, 3))
 			{
 				default: // dummy, never happens, but to make gcc happy...
 				case 0:
@@ -2320,7 +2589,7 @@ int Crypto_ClientParsePacket(const char *data_in, size_t len_in, char *data_out,
 
 			// build outgoing message
 			// append regular stuff
-			PutWithNul(&data_out_p, len_out, va(vabuf, sizeof(vabuf), "d0pk\\cnt\\0\\id\\%d\\aeslevel\\%d\\challenge\\%s", CDATA->cdata_id, d0_rijndael_dll ? crypto_aeslevel.integer : 0, challenge));
+			PutWithNul(&data_out_p, len_out, va(vabuf, sizeof(vabuf), "d0pk\\cnt\\0\\id\\%d\\aeslevel\\%d\\challenge\\%s", CDATA->cdata_id, Crypto_HaveAES() ? crypto_aeslevel.integer : 0, challenge));
 			PutWithNul(&data_out_p, len_out, serverid >= 0 ? pubkeys_fp64[serverid] : "");
 			PutWithNul(&data_out_p, len_out, clientid >= 0 ? pubkeys_fp64[clientid] : "");
 
@@ -2381,7 +2650,7 @@ int Crypto_ClientParsePacket(const char *data_in, size_t len_in, char *data_out,
 			if(wantserver_idfp[0]) // if we know a host key, honor its encryption setting
 			if(wantserver_aeslevel >= 3)
 				return Crypto_ClientError(data_out, len_out, "Server insists on encryption, but neither can authenticate to the other");
-			return (d0_rijndael_dll && crypto_aeslevel.integer >= 3) ? Crypto_ServerError(data_out, len_out, "This server requires encryption to be not required (crypto_aeslevel <= 2)", NULL) :
+			return (Crypto_HaveAES() && crypto_aeslevel.integer >= 3) ? Crypto_ServerError(data_out, len_out, "This server requires encryption to be not required (crypto_aeslevel <= 2)", NULL) :
 				CRYPTO_NOMATCH;
 		}
 	}
@@ -2420,12 +2689,12 @@ int Crypto_ClientParsePacket(const char *data_in, size_t len_in, char *data_out,
 				CLEAR_CDATA;
 				return Crypto_ClientError(data_out, len_out, "Stored host key requires encryption, but server did not enable encryption");
 			}
-			if(aes && (!d0_rijndael_dll || crypto_aeslevel.integer <= 0))
+			if(aes && (!Crypto_HaveAES() || crypto_aeslevel.integer <= 0))
 			{
 				CLEAR_CDATA;
 				return Crypto_ClientError(data_out, len_out, "Server insists on encryption too hard");
 			}
-			if(!aes && (d0_rijndael_dll && crypto_aeslevel.integer >= 3))
+			if(!aes && (Crypto_HaveAES() && crypto_aeslevel.integer >= 3))
 			{
 				CLEAR_CDATA;
 				return Crypto_ClientError(data_out, len_out, "Server insists on plaintext too hard");
@@ -2551,12 +2820,12 @@ int Crypto_ClientParsePacket(const char *data_in, size_t len_in, char *data_out,
 					CLEAR_CDATA;
 					return Crypto_ClientError(data_out, len_out, "Stored host key requires encryption, but server did not enable encryption");
 				}
-				if(aes && (!d0_rijndael_dll || crypto_aeslevel.integer <= 0))
+				if(aes && (!Crypto_HaveAES() || crypto_aeslevel.integer <= 0))
 				{
 					CLEAR_CDATA;
 					return Crypto_ClientError(data_out, len_out, "Server insists on encryption too hard");
 				}
-				if(!aes && (d0_rijndael_dll && crypto_aeslevel.integer >= 3))
+				if(!aes && (Crypto_HaveAES() && crypto_aeslevel.integer >= 3))
 				{
 					CLEAR_CDATA;
 					return Crypto_ClientError(data_out, len_out, "Server insists on plaintext too hard");
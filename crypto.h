@@ -39,6 +39,21 @@ qboolean Crypto_Available(void);
 void sha256(unsigned char *out, const unsigned char *in, int n); // may ONLY be called if Crypto_Available()
 const void *Crypto_EncryptPacket(crypto_t *crypto, const void *data_src, size_t len_src, void *data_dst, size_t *len_dst, size_t len);
 const void *Crypto_DecryptPacket(crypto_t *crypto, const void *data_src, size_t len_src, void *data_dst, size_t *len_dst, size_t len);
+
+// an AES packet for Crypto_EncryptPackets, which encrypts several of them the
+// same way Crypto_EncryptPacket would (len_dst is 0 if one failed)
+typedef struct crypto_packet_s
+{
+	unsigned char dhkey[DHKEY_SIZE];
+	const void *data_src;
+	size_t len_src;
+	void *data_dst;
+	size_t len_dst;
+	size_t len;
+}
+crypto_packet_t;
+void Crypto_EncryptPackets(crypto_packet_t *packets, int numpackets);
+
 #define CRYPTO_NOMATCH 0        // process as usual (packet was not used)
 #define CRYPTO_MATCH 1          // process as usual (packet was used)
 #define CRYPTO_DISCARD 2        // discard this packet
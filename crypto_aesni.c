@@ -0,0 +1,134 @@
+#include "crypto_aesni.h"
+
+#ifdef AESNI_POSSIBLE
+
+#include <wmmintrin.h>
+
+static __m128i Crypto_AESNI_ExpandStep(__m128i key, __m128i assist)
+{
+	assist = _mm_shuffle_epi32(assist, 0xff);
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	return _mm_xor_si128(key, assist);
+}
+
+static void Crypto_AESNI_ExpandKey(const unsigned char *key, __m128i *rk)
+{
+	// the round constant has to be an immediate
+	rk[0] = _mm_loadu_si128((const __m128i *)key);
+	rk[1] = Crypto_AESNI_ExpandStep(rk[0], _mm_aeskeygenassist_si128(rk[0], 0x01));
+	rk[2] = Crypto_AESNI_ExpandStep(rk[1], _mm_aeskeygenassist_si128(rk[1], 0x02));
+	rk[3] = Crypto_AESNI_ExpandStep(rk[2], _mm_aeskeygenassist_si128(rk[2], 0x04));
+	rk[4] = Crypto_AESNI_ExpandStep(rk[3], _mm_aeskeygenassist_si128(rk[3], 0x08));
+	rk[5] = Crypto_AESNI_ExpandStep(rk[4], _mm_aeskeygenassist_si128(rk[4], 0x10));
+	rk[6] = Crypto_AESNI_ExpandStep(rk[5], _mm_aeskeygenassist_si128(rk[5], 0x20));
+	rk[7] = Crypto_AESNI_ExpandStep(rk[6], _mm_aeskeygenassist_si128(rk[6], 0x40));
+	rk[8] = Crypto_AESNI_ExpandStep(rk[7], _mm_aeskeygenassist_si128(rk[7], 0x80));
+	rk[9] = Crypto_AESNI_ExpandStep(rk[8], _mm_aeskeygenassist_si128(rk[8], 0x1b));
+	rk[10] = Crypto_AESNI_ExpandStep(rk[9], _mm_aeskeygenassist_si128(rk[9], 0x36));
+}
+
+// reads a block that may be cut short by the end of the data
+static __m128i Crypto_AESNI_LoadBlock(const unsigned char *src, size_t len)
+{
+	unsigned char buf[16];
+	if (len >= 16)
+		return _mm_loadu_si128((const __m128i *)src);
+	memset(buf, 0, sizeof(buf));
+	memcpy(buf, src, len);
+	return _mm_loadu_si128((const __m128i *)buf);
+}
+
+void Crypto_AESNI_EncryptCBC(int numstreams, const unsigned char *const *keys, const unsigned char *const *ivs, unsigned char *const *dst, const unsigned char *const *src, const size_t *len)
+{
+	// each block of a CBC stream depends on the one before, so the latency
+	// of the aesenc instructions is hidden by working on several packets
+	__m128i rk[CRYPTO_AESNI_STREAMS][11], prev[CRYPTO_AESNI_STREAMS], s[CRYPTO_AESNI_STREAMS];
+	size_t pos[CRYPTO_AESNI_STREAMS];
+	int active[CRYPTO_AESNI_STREAMS];
+	int i, j, r, n;
+
+	for (i = 0;i < numstreams;i++)
+	{
+		Crypto_AESNI_ExpandKey(keys[i], rk[i]);
+		prev[i] = _mm_loadu_si128((const __m128i *)ivs[i]);
+		pos[i] = 0;
+	}
+	for (;;)
+	{
+		n = 0;
+		for (i = 0;i < numstreams;i++)
+			if (pos[i] < len[i])
+				active[n++] = i;
+		if (!n)
+			break;
+		for (j = 0;j < n;j++)
+		{
+			i = active[j];
+			s[j] = _mm_xor_si128(_mm_xor_si128(Crypto_AESNI_LoadBlock(src[i] + pos[i], len[i] - pos[i]), prev[i]), rk[i][0]);
+		}
+		for (r = 1;r < 10;r++)
+			for (j = 0;j < n;j++)
+				s[j] = _mm_aesenc_si128(s[j], rk[active[j]][r]);
+		for (j = 0;j < n;j++)
+		{
+			i = active[j];
+			prev[i] = _mm_aesenclast_si128(s[j], rk[i][10]);
+			_mm_storeu_si128((__m128i *)(dst[i] + pos[i]), prev[i]);
+			pos[i] += 16;
+		}
+	}
+}
+
+void Crypto_AESNI_DecryptCBC(const unsigned char *key, const unsigned char *iv, unsigned char *dst, const unsigned char *src, size_t len)
+{
+	// unlike encryption the blocks of one stream decrypt independently
+	__m128i rk[11], dk[11], prev, c[4], s[4];
+	unsigned char buf[16];
+	size_t pos = 0;
+	int i, r;
+
+	Crypto_AESNI_ExpandKey(key, rk);
+	dk[0] = rk[10];
+	for (r = 1;r < 10;r++)
+		dk[r] = _mm_aesimc_si128(rk[10 - r]);
+	dk[10] = rk[0];
+
+	prev = _mm_loadu_si128((const __m128i *)iv);
+	for (;pos + 64 <= len;pos += 64)
+	{
+		for (i = 0;i < 4;i++)
+		{
+			c[i] = _mm_loadu_si128((const __m128i *)(src + pos + i * 16));
+			s[i] = _mm_xor_si128(c[i], dk[0]);
+		}
+		for (r = 1;r < 10;r++)
+			for (i = 0;i < 4;i++)
+				s[i] = _mm_aesdec_si128(s[i], dk[r]);
+		for (i = 0;i < 4;i++)
+		{
+			s[i] = _mm_aesdeclast_si128(s[i], dk[10]);
+			_mm_storeu_si128((__m128i *)(dst + pos + i * 16), _mm_xor_si128(s[i], i ? c[i - 1] : prev));
+		}
+		prev = c[3];
+	}
+	for (;pos < len;pos += 16)
+	{
+		c[0] = _mm_loadu_si128((const __m128i *)(src + pos));
+		s[0] = _mm_xor_si128(c[0], dk[0]);
+		for (r = 1;r < 10;r++)
+			s[0] = _mm_aesdec_si128(s[0], dk[r]);
+		s[0] = _mm_xor_si128(_mm_aesdeclast_si128(s[0], dk[10]), prev);
+		if (len - pos >= 16)
+			_mm_storeu_si128((__m128i *)(dst + pos), s[0]);
+		else
+		{
+			_mm_storeu_si128((__m128i *)buf, s[0]);
+			memcpy(dst + pos, buf, len - pos);
+		}
+		prev = c[0];
+	}
+}
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef CRYPTO_AESNI_H
+#define CRYPTO_AESNI_H
+
+#include "quakedef.h"
+
+#ifdef AESNI_POSSIBLE
+// how many packets Crypto_AESNI_EncryptCBC interleaves
+#define CRYPTO_AESNI_STREAMS 8
+
+// AES-128-CBC the same way as aescpy/seacpy in crypto.c (a short last block
+// is zero padded, encryption writes whole blocks, decryption only len bytes)
+void Crypto_AESNI_EncryptCBC(int numstreams, const unsigned char *const *keys, const unsigned char *const *ivs, unsigned char *const *dst, const unsigned char *const *src, const size_t *len);
+void Crypto_AESNI_DecryptCBC(const unsigned char *key, const unsigned char *iv, unsigned char *dst, const unsigned char *src, size_t len);
+#endif
+
+#endif
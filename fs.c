@@ -34,7 +34,9 @@
 #else
 # include <pwd.h>
 # include <sys/stat.h>
+# include <sys/mman.h>
 # include <unistd.h>
+# define FS_USE_MMAP
 #endif
 
 #include "quakedef.h"
@@ -199,6 +201,14 @@ typedef struct
 /// real file will be removed on close
 #define QFILE_FLAG_REMOVE (1 << 3)
 
+/// memory mapping of a whole package, shared with the files opened from it
+typedef struct packmapping_s
+{
+	const unsigned char *data;
+	fs_offset_t size;
+	int refcount;	///< the pack and each file opened from it hold a reference
+} packmapping_t;
+
 #define FILE_BUFF_SIZE 2048
 typedef struct
 {
@@ -225,6 +235,7 @@ struct qfile_s
 	ztoolkit_t*		ztk;	///< For zipped files.
 
 	const unsigned char *data;	///< For data files.
+	packmapping_t *mapping;		///< For files read from a mapped package.
 
 	const char *filename; ///< Kept around for QFILE_FLAG_REMOVE, unused otherwise
 };
@@ -291,6 +302,9 @@ typedef struct pack_s
 	int numfiles;
 	qboolean vpack;
 	packfile_t *files;
+	packmapping_t *mapping;	///< whole archive mapped in memory, NULL if not mapped
+	fs_offset_t filesize;	///< size and mtime of the archive, used as the index cache key
+	fs_offset_t filemtime;
 } pack_t;
 //@}
 
@@ -784,13 +798,356 @@ static pack_t *FS_LoadPackPK3FromFD (const char *packfile, int packhandle, qbool
 	Con_DPrintf("Added packfile %s (%i files)\n", packfile, real_nb_files);
 	return pack;
 }
+
+
+/*
+====================
+FS_MapPack
+
+Map a whole package in memory, so stored files can be read without syscalls
+====================
+*/
+static void FS_MapPack (pack_t *pack)
+{
+#ifdef FS_USE_MMAP
+	void *data;
+
+	if (pack->mapping || pack->filesize <= 0 || COM_CheckParm("-nopk3mmap"))
+		return;
+	// don't run out of address space with big archives on 32bit builds
+	if (sizeof(void *) < 8 && pack->filesize > (64 << 20))
+		return;
+
+	data = mmap (NULL, (size_t)pack->filesize, PROT_READ, MAP_SHARED, pack->handle, 0);
+	if (data == MAP_FAILED)
+		return;
+
+	pack->mapping = (packmapping_t *)Mem_Alloc (fs_mempool, sizeof (packmapping_t));
+	pack->mapping->data = (const unsigned char *)data;
+	pack->mapping->size = pack->filesize;
+	pack->mapping->refcount = 1;
+#endif
+}
+
+
+/*
+====================
+FS_ReleaseMapping
+
+Drop a reference to a package mapping, and unmap it after the last one
+====================
+*/
+static void FS_ReleaseMapping (packmapping_t *mapping)
+{
+	int refcount;
+
+	if (fs_mutex) Thread_LockMutex(fs_mutex);
+	refcount = --mapping->refcount;
+	if (fs_mutex) Thread_UnlockMutex(fs_mutex);
+	if (refcount > 0)
+		return;
+
+#ifdef FS_USE_MMAP
+	munmap ((void *)mapping->data, (size_t)mapping->size);
+#endif
+	Mem_Free (mapping);
+}
+
+
+/*
+=============================================================================
+
+PK3 INDEX CACHE
+
+The file lists of the mounted PK3 archives are saved in the user directory,
+keyed by archive path, size and modification time, so that later startups
+and rescans can mount unchanged archives without parsing them again.
+
+=============================================================================
+*/
+
+#define PK3INDEX_FILENAME "pk3index.dat"
+#define PK3INDEX_MAGIC "DPPK3IDX"
+#define PK3INDEX_VERSION 1
+
+/// on-disk archive record, followed by the archive path and its packfile_t array
+typedef struct pk3index_record_s
+{
+	fs_offset_t filesize;
+	fs_offset_t filemtime;
+	int numfiles;
+	int namelength;	///< including the terminating 0
+} pk3index_record_t;
+
+typedef struct pk3index_entry_s
+{
+	pk3index_record_t record;
+	const char *filename;
+	const unsigned char *files;	///< packfile_t array, not necessarily aligned
+} pk3index_entry_t;
+
+typedef struct pk3index_s
+{
+	qboolean loaded;
+	qboolean modified;	///< an archive was parsed which the index file didn't know about
+	unsigned char *data;
+	int numentries;
+	pk3index_entry_t *entries;
+} pk3index_t;
+
+static pk3index_t fs_pk3index;
+
+static void FS_PK3Index_Free (void)
+{
+	if (fs_pk3index.data)
+		Mem_Free (fs_pk3index.data);
+	if (fs_pk3index.entries)
+		Mem_Free (fs_pk3index.entries);
+	fs_pk3index.data = NULL;
+	fs_pk3index.entries = NULL;
+	fs_pk3index.numentries = 0;
+	fs_pk3index.loaded = false;
+}
+
+static qboolean FS_PK3Index_Parse (fs_offset_t size)
+{
+	const unsigned char *data = fs_pk3index.data;
+	fs_offset_t pos;
+	int header[3];
+	int i;
+
+	pos = (fs_offset_t)(strlen(PK3INDEX_MAGIC) + sizeof(header));
+	if (size < pos || memcmp (data, PK3INDEX_MAGIC, strlen(PK3INDEX_MAGIC)))
+		return false;
+	memcpy (header, data + strlen(PK3INDEX_MAGIC), sizeof(header));
+	if (header[0] != PK3INDEX_VERSION || header[1] != (int)sizeof(packfile_t) || header[2] < 0 || header[2] > size / (fs_offset_t)sizeof(pk3index_record_t))
+		return false;
+
+	fs_pk3index.numentries = header[2];
+	fs_pk3index.entries = (pk3index_entry_t *)Mem_Alloc (fs_mempool, fs_pk3index.numentries * sizeof(pk3index_entry_t));
+	for (i = 0;i < fs_pk3index.numentries;i++)
+	{
+		pk3index_entry_t *entry = &fs_pk3index.entries[i];
+
+		if (pos + (fs_offset_t)sizeof(entry->record) > size)
+			return false;
+		memcpy (&entry->record, data + pos, sizeof(entry->record));
+		pos += sizeof(entry->record);
+		if (entry->record.namelength < 1 || entry->record.namelength > MAX_OSPATH || entry->record.numfiles < 0 || entry->record.numfiles > MAX_FILES_IN_PACK)
+			return false;
+		if (pos + entry->record.namelength + (fs_offset_t)entry->record.numfiles * (fs_offset_t)sizeof(packfile_t) > size)
+			return false;
+		entry->filename = (const char *)data + pos;
+		if (entry->filename[entry->record.namelength - 1])
+			return false;
+		pos += entry->record.namelength;
+		entry->files = data + pos;
+		pos += entry->record.numfiles * sizeof(packfile_t);
+	}
+	return true;
+}
+
+static void FS_PK3Index_Load (void)
+{
+	char path[MAX_OSPATH];
+	qfile_t *file;
+	fs_offset_t size;
+
+	fs_pk3index.loaded = true;
+	if (!*fs_userdir || COM_CheckParm("-nopk3index"))
+		return;
+
+	dpsnprintf (path, sizeof(path), "%s%s", fs_userdir, PK3INDEX_FILENAME);
+	file = FS_SysOpen (path, "rb", false);
+	if (!file)
+		return;
+	size = FS_FileSize (file);
+	fs_pk3index.data = (unsigned char *)Mem_Alloc (fs_mempool, size + 1);
+	if (FS_Read (file, fs_pk3index.data, size) != size || !FS_PK3Index_Parse (size))
+	{
+		Con_DPrintf ("Ignoring invalid PK3 index cache %s\n", path);
+		FS_PK3Index_Free ();
+		fs_pk3index.loaded = true;
+	}
+	FS_Close (file);
+}
+
+static pk3index_entry_t *FS_PK3Index_Find (const char *packfile, fs_offset_t filesize, fs_offset_t filemtime)
+{
+	int i;
+
+	if (!fs_pk3index.loaded)
+		FS_PK3Index_Load ();
+	for (i = 0;i < fs_pk3index.numentries;i++)
+	{
+		pk3index_entry_t *entry = &fs_pk3index.entries[i];
+		if (entry->record.filesize == filesize && entry->record.filemtime == filemtime && !strcmp (entry->filename, packfile))
+			return entry;
+	}
+	return NULL;
+}
+
+static void FS_PK3Index_WriteRecord (qfile_t *file, const char *filename, fs_offset_t filesize, fs_offset_t filemtime, int numfiles, const void *files)
+{
+	pk3index_record_t record;
+
+	memset (&record, 0, sizeof(record));
+	record.filesize = filesize;
+	record.filemtime = filemtime;
+	record.numfiles = numfiles;
+	record.namelength = (int)strlen(filename) + 1;
+	FS_Write (file, &record, sizeof(record));
+	FS_Write (file, filename, record.namelength);
+	FS_Write (file, files, numfiles * sizeof(packfile_t));
+}
+
+static qboolean FS_PK3Index_IsCacheable (const pack_t *pack)
+{
+	// only archives mounted by path have a size and mtime to check against
+	return pack && !pack->vpack && pack->filesize > 0;
+}
+
+/*
+====================
+FS_PK3Index_Save
+
+Rewrite the index cache if an archive had to be parsed. Records of archives
+that are not mounted right now (other gamedirs) are kept while they exist.
+====================
+*/
+static void FS_PK3Index_Save (void)
+{
+	char path[MAX_OSPATH], temppath[MAX_OSPATH];
+	qfile_t *file;
+	searchpath_t *search;
+	int i, numentries;
+	int header[3];
+
+	if (!fs_pk3index.modified)
+		return;
+	fs_pk3index.modified = false;
+	if (!*fs_userdir || COM_CheckParm("-nopk3index") || COM_CheckParm("-readonly"))
+		return;
+	if (!fs_pk3index.loaded)
+		FS_PK3Index_Load ();
+
+	// records of archives that are no longer mounted or no longer exist are dropped
+	numentries = 0;
+	for (search = fs_searchpaths;search;search = search->next)
+		if (FS_PK3Index_IsCacheable (search->pack))
+			numentries++;
+	for (i = 0;i < fs_pk3index.numentries;i++)
+	{
+		pk3index_entry_t *entry = &fs_pk3index.entries[i];
+		for (search = fs_searchpaths;search;search = search->next)
+			if (FS_PK3Index_IsCacheable (search->pack) && !strcmp (search->pack->filename, entry->filename))
+				break;
+		if (search || FS_SysFileType (entry->filename) != FS_FILETYPE_FILE)
+			entry->record.numfiles = -1;
+		else
+			numentries++;
+	}
+
+	dpsnprintf (path, sizeof(path), "%s%s", fs_userdir, PK3INDEX_FILENAME);
+	dpsnprintf (temppath, sizeof(temppath), "%s.tmp", path);
+	file = FS_SysOpen (temppath, "wb", false);
+	if (!file)
+	{
+		FS_PK3Index_Free ();
+		return;
+	}
+
+	header[0] = PK3INDEX_VERSION;
+	header[1] = (int)sizeof(packfile_t);
+	header[2] = numentries;
+	FS_Write (file, PK3INDEX_MAGIC, strlen(PK3INDEX_MAGIC));
+	FS_Write (file, header, sizeof(header));
+	for (search = fs_searchpaths;search;search = search->next)
+		if (FS_PK3Index_IsCacheable (search->pack))
+			FS_PK3Index_WriteRecord (file, search->pack->filename, search->pack->filesize, search->pack->filemtime, search->pack->numfiles, search->pack->files);
+	for (i = 0;i < fs_pk3index.numentries;i++)
+	{
+		pk3index_entry_t *entry = &fs_pk3index.entries[i];
+		if (entry->record.numfiles >= 0)
+			FS_PK3Index_WriteRecord (file, entry->filename, entry->record.filesize, entry->record.filemtime, entry->record.numfiles, entry->files);
+	}
+	FS_Close (file);
+
+#ifdef WIN32
+	remove (path);
+#endif
+	if (rename (temppath, path) == -1)
+		Con_DPrintf ("Could not save the PK3 index cache %s\n", path);
+
+	// the new file is loaded again when it is needed
+	FS_PK3Index_Free ();
+}
+
+
+/*
+====================
+FS_LoadPackPK3FromIndex
+
+Create a package entry from the index cache, without reading the archive
+====================
+*/
+static pack_t *FS_LoadPackPK3FromIndex (const char *packfile, int packhandle, const pk3index_entry_t *entry)
+{
+	pack_t *pack;
+	int i;
+
+	pack = (pack_t *)Mem_Alloc(fs_mempool, sizeof (pack_t));
+	pack->ignorecase = true; // PK3 ignores case
+	strlcpy (pack->filename, packfile, sizeof (pack->filename));
+	pack->handle = packhandle;
+	pack->numfiles = entry->record.numfiles;
+	pack->files = (packfile_t *)Mem_Alloc(fs_mempool, max(pack->numfiles, 1) * sizeof(packfile_t));
+	memcpy (pack->files, entry->files, pack->numfiles * sizeof(packfile_t));
+	for (i = 0;i < pack->numfiles;i++)
+		pack->files[i].name[sizeof(pack->files[i].name) - 1] = 0;
+
+	Con_DPrintf("Added packfile %s (%i files, cached index)\n", packfile, pack->numfiles);
+	return pack;
+}
+
 static pack_t *FS_LoadPackPK3 (const char *packfile)
 {
 	int packhandle;
+	pack_t *pack;
+	pk3index_entry_t *entry;
+#ifdef WIN32
+	struct _stati64 st;
+#else
+	struct stat st;
+#endif
+
 	packhandle = FS_SysOpenFD (packfile, "rb", false);
 	if (packhandle < 0)
 		return NULL;
-	return FS_LoadPackPK3FromFD(packfile, packhandle, false);
+#ifdef WIN32
+	if (_fstati64 (packhandle, &st) == -1)
+#else
+	if (fstat (packhandle, &st) == -1)
+#endif
+		return FS_LoadPackPK3FromFD(packfile, packhandle, false);
+
+	entry = FS_PK3Index_Find (packfile, st.st_size, st.st_mtime);
+	if (entry)
+		pack = FS_LoadPackPK3FromIndex (packfile, packhandle, entry);
+	else
+	{
+		pack = FS_LoadPackPK3FromFD(packfile, packhandle, false);
+		if (pack)
+			fs_pk3index.modified = true;
+	}
+
+	if (pack)
+	{
+		pack->filesize = st.st_size;
+		pack->filemtime = st.st_mtime;
+		FS_MapPack (pack);
+	}
+	return pack;
 }
 
 
@@ -811,12 +1168,20 @@ static qboolean PK3_GetTrueFileOffset (packfile_t *pfile, pack_t *pack)
 		return true;
 
 	// Load the local file description
-	if (lseek (pack->handle, pfile->offset, SEEK_SET) == -1)
+	if (pack->mapping && pfile->offset + ZIP_LOCAL_CHUNK_BASE_SIZE <= pack->mapping->size)
 	{
-		Con_Printf ("Can't seek in package %s\n", pack->filename);
-		return false;
+		memcpy (buffer, pack->mapping->data + pfile->offset, ZIP_LOCAL_CHUNK_BASE_SIZE);
+		count = ZIP_LOCAL_CHUNK_BASE_SIZE;
+	}
+	else
+	{
+		if (lseek (pack->handle, pfile->offset, SEEK_SET) == -1)
+		{
+			Con_Printf ("Can't seek in package %s\n", pack->filename);
+			return false;
+		}
+		count = read (pack->handle, buffer, ZIP_LOCAL_CHUNK_BASE_SIZE);
 	}
-	count = read (pack->handle, buffer, ZIP_LOCAL_CHUNK_BASE_SIZE);
 	if (count != ZIP_LOCAL_CHUNK_BASE_SIZE || BuffBigLong (buffer) != ZIP_DATA_HEADER)
 	{
 		Con_Printf ("Can't retrieve file %s in package %s\n", pfile->name, pack->filename);
@@ -1070,6 +1435,188 @@ static pack_t *FS_LoadPackVirtual (const char *dirname)
 	return pack;
 }
 
+/*
+=============================================================================
+
+FILE INDEX
+
+All files of the mounted packages are in one hash table, so FS_FindFile does
+not need to search every package. Packages are always added in front of the
+packages already mounted, so a new package is inserted at the head of the
+hash chains and each chain stays sorted by search priority.
+
+=============================================================================
+*/
+
+typedef struct fileindexnode_s
+{
+	struct fileindexnode_s *next;	///< same hash, lower priority
+	searchpath_t *search;
+	int index;	///< in search->pack->files
+	unsigned int hashvalue;
+} fileindexnode_t;
+
+/// nodes for one package, followed by the node array
+typedef struct fileindexblock_s
+{
+	struct fileindexblock_s *next;
+} fileindexblock_t;
+
+typedef struct fileindex_s
+{
+	int numnodes;
+	int hashsize;
+	fileindexnode_t **hash;
+	fileindexblock_t *blocks;
+	// every node sorted by name without case, built on demand by FS_Search
+	int numsorted;
+	fileindexnode_t **sorted;
+} fileindex_t;
+
+static fileindex_t fs_fileindex;
+
+#define FS_FILEINDEX_NAME(node) ((node)->search->pack->files[(node)->index].name)
+
+static unsigned int FS_FileIndex_HashName (const char *name)
+{
+	unsigned int hashvalue = 2166136261u;
+	for (;*name;name++)
+		hashvalue = (hashvalue ^ (unsigned char)tolower(*name)) * 16777619u;
+	return hashvalue;
+}
+
+static void FS_FileIndex_Clear (void)
+{
+	while (fs_fileindex.blocks)
+	{
+		fileindexblock_t *block = fs_fileindex.blocks;
+		fs_fileindex.blocks = block->next;
+		Mem_Free (block);
+	}
+	if (fs_fileindex.hash)
+		Mem_Free (fs_fileindex.hash);
+	if (fs_fileindex.sorted)
+		Mem_Free (fs_fileindex.sorted);
+	memset (&fs_fileindex, 0, sizeof(fs_fileindex));
+}
+
+static void FS_FileIndex_Resize (int hashsize)
+{
+	fileindexnode_t **hash, **tails, *node, *next;
+	int i, bucket;
+
+	hash = (fileindexnode_t **)Mem_Alloc (fs_mempool, hashsize * sizeof(*hash));
+	tails = (fileindexnode_t **)Mem_Alloc (tempmempool, hashsize * sizeof(*tails));
+	// append to the new chains in order, to keep them sorted by priority
+	for (i = 0;i < fs_fileindex.hashsize;i++)
+	{
+		for (node = fs_fileindex.hash[i];node;node = next)
+		{
+			next = node->next;
+			node->next = NULL;
+			bucket = node->hashvalue & (hashsize - 1);
+			if (tails[bucket])
+				tails[bucket]->next = node;
+			else
+				hash[bucket] = node;
+			tails[bucket] = node;
+		}
+	}
+	Mem_Free (tails);
+	if (fs_fileindex.hash)
+		Mem_Free (fs_fileindex.hash);
+	fs_fileindex.hash = hash;
+	fs_fileindex.hashsize = hashsize;
+}
+
+/*
+====================
+FS_FileIndex_AddPack
+
+Add the files of a package that was just put in front of all other packages
+====================
+*/
+static void FS_FileIndex_AddPack (searchpath_t *search)
+{
+	pack_t *pak = search->pack;
+	fileindexblock_t *block;
+	fileindexnode_t *nodes;
+	int i, hashsize;
+
+	if (!pak || pak->vpack || pak->numfiles <= 0)
+		return;
+
+	hashsize = max(fs_fileindex.hashsize, 1024);
+	while (hashsize < (fs_fileindex.numnodes + pak->numfiles) / 2)
+		hashsize *= 2;
+	if (hashsize != fs_fileindex.hashsize)
+		FS_FileIndex_Resize (hashsize);
+
+	block = (fileindexblock_t *)Mem_Alloc (fs_mempool, sizeof(fileindexblock_t) + pak->numfiles * sizeof(fileindexnode_t));
+	block->next = fs_fileindex.blocks;
+	fs_fileindex.blocks = block;
+	nodes = (fileindexnode_t *)(block + 1);
+	for (i = 0;i < pak->numfiles;i++)
+	{
+		fileindexnode_t *node = &nodes[i];
+		fileindexnode_t **bucket;
+		node->search = search;
+		node->index = i;
+		node->hashvalue = FS_FileIndex_HashName (pak->files[i].name);
+		bucket = &fs_fileindex.hash[node->hashvalue & (fs_fileindex.hashsize - 1)];
+		node->next = *bucket;
+		*bucket = node;
+	}
+	fs_fileindex.numnodes += pak->numfiles;
+
+	if (fs_fileindex.sorted)
+		Mem_Free (fs_fileindex.sorted);
+	fs_fileindex.sorted = NULL;
+	fs_fileindex.numsorted = 0;
+}
+
+/// returns the highest priority package entry for the name, or NULL
+static fileindexnode_t *FS_FileIndex_Find (const char *name)
+{
+	fileindexnode_t *node;
+	unsigned int hashvalue;
+
+	if (!fs_fileindex.hashsize)
+		return NULL;
+	hashvalue = FS_FileIndex_HashName (name);
+	for (node = fs_fileindex.hash[hashvalue & (fs_fileindex.hashsize - 1)];node;node = node->next)
+	{
+		if (node->hashvalue != hashvalue)
+			continue;
+		if (!(node->search->pack->ignorecase ? strcasecmp : strcmp) (FS_FILEINDEX_NAME(node), name))
+			return node;
+	}
+	return NULL;
+}
+
+static int FS_FileIndex_SortCompare (const void *a, const void *b)
+{
+	return strcasecmp (FS_FILEINDEX_NAME(*(const fileindexnode_t **)a), FS_FILEINDEX_NAME(*(const fileindexnode_t **)b));
+}
+
+static void FS_FileIndex_Sort (void)
+{
+	int i, j;
+
+	if (fs_fileindex.sorted || !fs_fileindex.numnodes)
+		return;
+	fs_fileindex.sorted = (fileindexnode_t **)Mem_Alloc (fs_mempool, fs_fileindex.numnodes * sizeof(fileindexnode_t *));
+	for (i = 0, j = 0;i < fs_fileindex.hashsize;i++)
+	{
+		fileindexnode_t *node;
+		for (node = fs_fileindex.hash[i];node;node = node->next)
+			fs_fileindex.sorted[j++] = node;
+	}
+	fs_fileindex.numsorted = j;
+	qsort (fs_fileindex.sorted, fs_fileindex.numsorted, sizeof(fileindexnode_t *), FS_FileIndex_SortCompare);
+}
+
+
 /*
 ================
 FS_AddPack_Fullpath
@@ -1161,6 +1708,7 @@ static qboolean FS_AddPack_Fullpath(const char *pakfile, const char *shortname,
 			fs_searchpaths = search;
 		}
 		search->pack = pak;
+		FS_FileIndex_AddPack(search);
 		if(pak->vpack)
 		{
 			dpsnprintf(search->filename, sizeof(search->filename), "%s/", pakfile);
@@ -1342,6 +1890,7 @@ static void FS_ClearSearchPath (void)
 	// unload all packs and directory information, close all pack files
 	// (if a qfile is still reading a pack it won't be harmed because it used
 	//  dup() to get its own handle already)
+	FS_FileIndex_Clear();
 	while (fs_searchpaths)
 	{
 		searchpath_t *search = fs_searchpaths;
@@ -1350,6 +1899,9 @@ static void FS_ClearSearchPath (void)
 		{
 			if(!search->pack->vpack)
 			{
+				// files opened from a mapped pack keep their own reference
+				if (search->pack->mapping)
+					FS_ReleaseMapping(search->pack->mapping);
 				// close the file
 				close(search->pack->handle);
 				// free any memory associated with it
@@ -1370,6 +1922,7 @@ static void FS_AddSelfPack(void)
 		search = (searchpath_t *)Mem_Alloc(fs_mempool, sizeof(searchpath_t));
 		search->next = fs_searchpaths;
 		search->pack = fs_selfpack;
+		FS_FileIndex_AddPack(search);
 		fs_searchpaths = search;
 	}
 }
@@ -1476,6 +2029,9 @@ void FS_Rescan (void)
 		break;
 	}
 
+	// remember the file lists of any newly parsed pk3 archives
+	FS_PK3Index_Save();
+
 	// unload all wads so that future queries will return the new data
 	W_UnloadAll();
 }
@@ -2294,6 +2850,22 @@ static qfile_t *FS_OpenPackedFile (pack_t* pack, int pack_ind)
 	}
 #endif
 
+	// stored files in a mapped pack are read straight from the mapping
+	// (the caller holds fs_mutex, which protects the reference count)
+	if (pack->mapping && !(pfile->flags & PACKFILE_FLAG_DEFLATED) && pfile->offset + pfile->realsize <= pack->mapping->size)
+	{
+		file = (qfile_t *)Mem_Alloc (fs_mempool, sizeof (*file));
+		memset (file, 0, sizeof (*file));
+		file->handle = -1;
+		file->flags = QFILE_FLAG_PACKED | QFILE_FLAG_DATA;
+		file->real_length = pfile->realsize;
+		file->ungetc = EOF;
+		file->data = pack->mapping->data + pfile->offset;
+		file->mapping = pack->mapping;
+		file->mapping->refcount++;
+		return file;
+	}
+
 	// LordHavoc: lseek affects all duplicates of a handle so we do it before
 	// the dup() call to avoid having to close the dup_handle on error here
 	if (lseek (pack->handle, pfile->offset, SEEK_SET) == -1)
@@ -2355,6 +2927,13 @@ static qfile_t *FS_OpenPackedFile (pack_t* pack, int pack_ind)
 		ztk->zstream.avail_out = sizeof (file->buff);
 
 		file->ztk = ztk;
+
+		// compressed data is copied from the mapping instead of read()
+		if (pack->mapping && pfile->offset + pfile->packsize <= pack->mapping->size)
+		{
+			file->mapping = pack->mapping;
+			file->mapping->refcount++;
+		}
 	}
 
 	return file;
@@ -2432,6 +3011,11 @@ static searchpath_t *FS_FindFile (const char *name, int* index, qboolean quiet)
 {
 	searchpath_t *search;
 	pack_t *pak;
+	fileindexnode_t *node;
+
+	// the file index knows the first package containing the file, only the
+	// directories in front of that package have to be checked
+	node = FS_FileIndex_Find (name);
 
 	// search through the path, one element at a time
 	for (search = fs_searchpaths;search;search = search->next)
@@ -2439,51 +3023,28 @@ static searchpath_t *FS_FindFile (const char *name, int* index, qboolean quiet)
 		// is the element a pak file?
 		if (search->pack && !search->pack->vpack)
 		{
-			int (*strcmp_funct) (const char* str1, const char* str2);
-			int left, right, middle;
+			if (!node || node->search != search)
+				continue;
 
 			pak = search->pack;
-			strcmp_funct = pak->ignorecase ? strcasecmp : strcmp;
-
-			// Look for the file (binary search)
-			left = 0;
-			right = pak->numfiles - 1;
-			while (left <= right)
+			if (fs_empty_files_in_pack_mark_deletions.integer && pak->files[node->index].realsize == 0)
 			{
-				int diff;
-
-				middle = (left + right) / 2;
-				diff = strcmp_funct (pak->files[middle].name, name);
-
-				// Found it
-				if (!diff)
-				{
-					if (fs_empty_files_in_pack_mark_deletions.integer && pak->files[middle].realsize == 0)
-					{
-						// yes, but the first one is empty so we treat it as not being there
-						if (!quiet && developer_extra.integer)
-							Con_DPrintf("FS_FindFile: %s is marked as deleted\n", name);
-
-						if (index != NULL)
-							*index = -1;
-						return NULL;
-					}
+				// yes, but the first one is empty so we treat it as not being there
+				if (!quiet && developer_extra.integer)
+					Con_DPrintf("FS_FindFile: %s is marked as deleted\n", name);
 
-					if (!quiet && developer_extra.integer)
-						Con_DPrintf("FS_FindFile: %s in %s\n",
-									pak->files[middle].name, pak->filename);
+				if (index != NULL)
+					*index = -1;
+				return NULL;
+			}
 
-					if (index != NULL)
-						*index = middle;
-					return search;
-				}
+			if (!quiet && developer_extra.integer)
+				Con_DPrintf("FS_FindFile: %s in %s\n",
+							pak->files[node->index].name, pak->filename);
 
-				// If we're too far in the list
-				if (diff > 0)
-					right = middle - 1;
-				else
-					left = middle + 1;
-			}
+			if (index != NULL)
+				*index = node->index;
+			return search;
 		}
 		else
 		{
@@ -2705,6 +3266,8 @@ int FS_Close (qfile_t* file)
 {
 	if(file->flags & QFILE_FLAG_DATA)
 	{
+		if (file->mapping)
+			FS_ReleaseMapping(file->mapping);
 		Mem_Free(file);
 		return 0;
 	}
@@ -2734,6 +3297,9 @@ int FS_Close (qfile_t* file)
 		Mem_Free (file->ztk);
 	}
 
+	if (file->mapping)
+		FS_ReleaseMapping(file->mapping);
+
 	Mem_Free (file);
 	return 0;
 }
@@ -2820,9 +3386,9 @@ fs_offset_t FS_Read (qfile_t* file, void* buffer, size_t buffersize)
 		size_t left = file->real_length - file->position;
 		if(buffersize > left)
 			buffersize = left;
-		memcpy(buffer, file->data + file->position, buffersize);
+		memcpy((unsigned char *)buffer + done, file->data + file->position, buffersize);
 		file->position += buffersize;
-		return buffersize;
+		return done + buffersize;
 	}
 
 	// First, we copy as many bytes as we can from "buff"
@@ -2916,11 +3482,16 @@ fs_offset_t FS_Read (qfile_t* file, void* buffer, size_t buffersize)
 			count = (fs_offset_t)(ztk->comp_length - ztk->in_position);
 			if (count > (fs_offset_t)sizeof (ztk->input))
 				count = (fs_offset_t)sizeof (ztk->input);
-			lseek (file->handle, file->offset + (fs_offset_t)ztk->in_position, SEEK_SET);
-			if (read (file->handle, ztk->input, count) != count)
+			if (file->mapping)
+				memcpy (ztk->input, file->mapping->data + file->offset + ztk->in_position, count);
+			else
 			{
-				Con_Printf ("FS_Read: unexpected end of file\n");
-				break;
+				lseek (file->handle, file->offset + (fs_offset_t)ztk->in_position, SEEK_SET);
+				if (read (file->handle, ztk->input, count) != count)
+				{
+					Con_Printf ("FS_Read: unexpected end of file\n");
+					break;
+				}
 			}
 
 			ztk->in_ind = 0;
@@ -3456,13 +4027,15 @@ fssearch_t *FS_Search(const char *pattern, int caseinsensitive, int quiet)
 {
 	fssearch_t *search;
 	searchpath_t *searchpath;
-	pack_t *pak;
 	int i, basepathlength, numfiles, numchars, resultlistindex, dirlistindex;
+	int first, last, middle;
+	size_t prefixlength;
 	stringlist_t resultlist;
 	stringlist_t dirlist;
 	const char *slash, *backslash, *colon, *separator;
 	char *basepath;
 	char temp[MAX_OSPATH];
+	char lastname[MAX_OSPATH];
 
 	for (i = 0;pattern[i] == '.' || pattern[i] == ':' || pattern[i] == '/' || pattern[i] == '\\';i++)
 		;
@@ -3487,48 +4060,67 @@ fssearch_t *FS_Search(const char *pattern, int caseinsensitive, int quiet)
 		memcpy(basepath, pattern, basepathlength);
 	basepath[basepathlength] = 0;
 
-	// search through the path, one element at a time
-	for (searchpath = fs_searchpaths;searchpath;searchpath = searchpath->next)
+	// pak file elements come from the sorted file index, only the names
+	// starting with the part of the pattern before any wildcard are checked
+	FS_FileIndex_Sort();
+	prefixlength = strcspn(pattern, "*?");
+	first = 0;
+	last = fs_fileindex.numsorted;
+	while (first < last)
 	{
-		// is the element a pak file?
-		if (searchpath->pack && !searchpath->pack->vpack)
+		middle = (first + last) / 2;
+		if (strncasecmp(FS_FILEINDEX_NAME(fs_fileindex.sorted[middle]), pattern, prefixlength) < 0)
+			first = middle + 1;
+		else
+			last = middle;
+	}
+	lastname[0] = 0;
+	for (i = first;i < fs_fileindex.numsorted;i++)
+	{
+		fileindexnode_t *node = fs_fileindex.sorted[i];
+		const char *name = FS_FILEINDEX_NAME(node);
+		size_t namelength;
+
+		if (strncasecmp(name, pattern, prefixlength))
+			break;
+		// the same file in several packs
+		if (!strcmp(name, lastname))
+			continue;
+		strlcpy(temp, name, sizeof(temp));
+		while (temp[0])
 		{
-			// look through all the pak file elements
-			pak = searchpath->pack;
-			for (i = 0;i < pak->numfiles;i++)
+			if (matchpattern(temp, (char *)pattern, true))
 			{
-				strlcpy(temp, pak->files[i].name, sizeof(temp));
-				while (temp[0])
-				{
-					if (matchpattern(temp, (char *)pattern, true))
-					{
-						for (resultlistindex = 0;resultlistindex < resultlist.numstrings;resultlistindex++)
-							if (!strcmp(resultlist.strings[resultlistindex], temp))
-								break;
-						if (resultlistindex == resultlist.numstrings)
-						{
-							stringlistappend(&resultlist, temp);
-							if (!quiet && developer_loading.integer)
-								Con_Printf("SearchPackFile: %s : %s\n", pak->filename, temp);
-						}
-					}
-					// strip off one path element at a time until empty
-					// this way directories are added to the listing if they match the pattern
-					slash = strrchr(temp, '/');
-					backslash = strrchr(temp, '\\');
-					colon = strrchr(temp, ':');
-					separator = temp;
-					if (separator < slash)
-						separator = slash;
-					if (separator < backslash)
-						separator = backslash;
-					if (separator < colon)
-						separator = colon;
-					*((char *)separator) = 0;
-				}
+				stringlistappend(&resultlist, temp);
+				if (!quiet && developer_loading.integer)
+					Con_Printf("SearchPackFile: %s : %s\n", node->search->pack->filename, temp);
 			}
+			// strip off one path element at a time until empty
+			// this way directories are added to the listing if they match the pattern
+			slash = strrchr(temp, '/');
+			backslash = strrchr(temp, '\\');
+			colon = strrchr(temp, ':');
+			separator = temp;
+			if (separator < slash)
+				separator = slash;
+			if (separator < backslash)
+				separator = backslash;
+			if (separator < colon)
+				separator = colon;
+			*((char *)separator) = 0;
+			// the directories of the previous name were checked already
+			namelength = strlen(temp);
+			if (namelength && !strncmp(lastname, temp, namelength) && (lastname[namelength] == '/' || lastname[namelength] == '\\' || lastname[namelength] == ':'))
+				break;
 		}
-		else
+		strlcpy(lastname, name, sizeof(lastname));
+	}
+
+	// search through the path, one element at a time
+	for (searchpath = fs_searchpaths;searchpath;searchpath = searchpath->next)
+	{
+		// pak files were searched above, only directories are left
+		if (!searchpath->pack || searchpath->pack->vpack)
 		{
 			stringlist_t matchedSet, foundSet;
 			const char *start = pattern;
@@ -28,6 +28,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "csprogs.h"
 #include "cl_video.h"
 #include "dpsoftrast.h"
+#include "taskqueue.h"
 
 #ifdef SUPPORTD3D
 #include <d3d9.h>
@@ -113,6 +114,7 @@ cvar_t r_cullentities_trace_samples = {0, "r_cullentities_trace_samples", "2", "
 cvar_t r_cullentities_trace_tempentitysamples = {0, "r_cullentities_trace_tempentitysamples", "-1", "number of samples to test for entity culling of temp entities (including all CSQC entities), -1 disables trace culling on these entities to prevent flicker (pvs still applies)"};
 cvar_t r_cullentities_trace_enlarge = {0, "r_cullentities_trace_enlarge", "0", "box enlargement for entity culling"};
 cvar_t r_cullentities_trace_delay = {0, "r_cullentities_trace_delay", "1", "number of seconds until the entity gets actually culled"};
+cvar_t r_threads = {CVAR_SAVE, "r_threads", "0", "number of parallel tasks to split world and entity culling and world surface gathering into (run on taskqueue_maxthreads worker threads), 0 does it all on the main thread"};
 cvar_t r_sortentities = {0, "r_sortentities", "0", "sort entities before drawing (might be faster)"};
 cvar_t r_speeds = {0, "r_speeds","0", "displays rendering statistics and per-subsystem timings"};
 cvar_t r_fullbright = {0, "r_fullbright","0", "makes map very bright and renders faster"};
@@ -4320,6 +4322,7 @@ void GL_Main_Init(void)
 	Cvar_RegisterVariable(&r_cullentities_trace_tempentitysamples);
 	Cvar_RegisterVariable(&r_cullentities_trace_enlarge);
 	Cvar_RegisterVariable(&r_cullentities_trace_delay);
+	Cvar_RegisterVariable(&r_threads);
 	Cvar_RegisterVariable(&r_sortentities);
 	Cvar_RegisterVariable(&r_drawviewmodel);
 	Cvar_RegisterVariable(&r_drawexteriormodel);
@@ -4600,95 +4603,40 @@ int R_CullBoxCustomPlanes(const vec3_t mins, const vec3_t maxs, int numplanes, c
 	return false;
 }
 
-//==================================================================================
-
-// LordHavoc: this stores temporary data used within the same frame
-
-typedef struct r_framedata_mem_s
+int R_NumTasks(int count, int minpertask)
 {
-	struct r_framedata_mem_s *purge; // older mem block to free on next frame
-	size_t size; // how much usable space
-	size_t current; // how much space in use
-	size_t mark; // last "mark" location, temporary memory can be freed by returning to this
-	size_t wantedsize; // how much space was allocated
-	unsigned char *data; // start of real data (16byte aligned)
+	int numtasks = min(r_threads.integer, R_MAXTASKS);
+	numtasks = min(numtasks, count / minpertask);
+	return max(numtasks, 1);
 }
-r_framedata_mem_t;
 
-static r_framedata_mem_t *r_framedata_mem;
+//==================================================================================
+
+// LordHavoc: this stores temporary data used within the same frame
+// (in the client frame arena, r_framedatasize is the size it starts at)
 
 void R_FrameData_Reset(void)
 {
-	while (r_framedata_mem)
-	{
-		r_framedata_mem_t *next = r_framedata_mem->purge;
-		Mem_Free(r_framedata_mem);
-		r_framedata_mem = next;
-	}
+	Mem_FrameFree(&mem_framearena_client);
 }
 
-static void R_FrameData_Resize(qboolean mustgrow)
+void R_FrameData_NewFrame(void)
 {
 	size_t wantedsize;
 	wantedsize = (size_t)(r_framedatasize.value * 1024*1024);
-	wantedsize = bound(65536, wantedsize, 1000*1024*1024);
-	if (!r_framedata_mem || r_framedata_mem->wantedsize != wantedsize || mustgrow)
-	{
-		r_framedata_mem_t *newmem = (r_framedata_mem_t *)Mem_Alloc(r_main_mempool, wantedsize);
-		newmem->wantedsize = wantedsize;
-		newmem->data = (unsigned char *)(((size_t)(newmem+1) + 15) & ~15);
-		newmem->size = (unsigned char *)newmem + wantedsize - newmem->data;
-		newmem->current = 0;
-		newmem->mark = 0;
-		newmem->purge = r_framedata_mem;
-		r_framedata_mem = newmem;
-	}
-}
-
-void R_FrameData_NewFrame(void)
-{
-	R_FrameData_Resize(false);
-	if (!r_framedata_mem)
-		return;
-	// if we ran out of space on the last frame, free the old memory now
-	while (r_framedata_mem->purge)
-	{
-		// repeatedly remove the second item in the list, leaving only head
-		r_framedata_mem_t *next = r_framedata_mem->purge->purge;
-		Mem_Free(r_framedata_mem->purge);
-		r_framedata_mem->purge = next;
-	}
-	// reset the current mem pointer
-	r_framedata_mem->current = 0;
-	r_framedata_mem->mark = 0;
+	mem_framearena_client.minsize = bound(65536, wantedsize, 1000*1024*1024);
+	Mem_FrameReset(&mem_framearena_client);
 }
 
 void *R_FrameData_Alloc(size_t size)
 {
-	void *data;
-	float newvalue;
-
-	// align to 16 byte boundary - the data pointer is already aligned, so we
-	// only need to ensure the size of every allocation is also aligned
-	size = (size + 15) & ~15;
-
-	while (!r_framedata_mem || r_framedata_mem->current + size > r_framedata_mem->size)
-	{
-		// emergency - we ran out of space, allocate more memory
-		newvalue = bound(0.25f, r_framedatasize.value * 2.0f, 256.0f);
-		// this might not be a growing it, but we'll allocate another buffer every time
-		Cvar_SetValueQuick(&r_framedatasize, newvalue);
-		R_FrameData_Resize(true);
-	}
-
-	data = r_framedata_mem->data + r_framedata_mem->current;
-	r_framedata_mem->current += size;
+	void *data = Mem_FrameAlloc(&mem_framearena_client, size);
 
 	// count the usage for stats
-	r_refdef.stats[r_stat_framedatacurrent] = max(r_refdef.stats[r_stat_framedatacurrent], (int)r_framedata_mem->current);
-	r_refdef.stats[r_stat_framedatasize] = max(r_refdef.stats[r_stat_framedatasize], (int)r_framedata_mem->size);
+	r_refdef.stats[r_stat_framedatacurrent] = max(r_refdef.stats[r_stat_framedatacurrent], (int)mem_framearena_client.used);
+	r_refdef.stats[r_stat_framedatasize] = max(r_refdef.stats[r_stat_framedatasize], (int)mem_framearena_client.highwater);
 
-	return (void *)data;
+	return data;
 }
 
 void *R_FrameData_Store(size_t size, void *data)
@@ -4701,16 +4649,12 @@ void *R_FrameData_Store(size_t size, void *data)
 
 void R_FrameData_SetMark(void)
 {
-	if (!r_framedata_mem)
-		return;
-	r_framedata_mem->mark = r_framedata_mem->current;
+	Mem_FrameSetMark(&mem_framearena_client);
 }
 
 void R_FrameData_ReturnToMark(void)
 {
-	if (!r_framedata_mem)
-		return;
-	r_framedata_mem->current = r_framedata_mem->mark;
+	Mem_FrameReturnToMark(&mem_framearena_client);
 }
 
 //==================================================================================
@@ -4910,10 +4854,20 @@ void R_AnimCache_ClearCache(void)
 	}
 }
 
-static void R_AnimCache_UpdateEntityMeshBuffers(entity_render_t *ent, int numvertices)
+// the mesh animation work for one entity, filled in serially and run later,
+// possibly on a worker thread
+typedef struct r_animcache_job_s
 {
-	int i;
+	entity_render_t *ent;
+	float *vertex3f;
+	float *normal3f;
+	float *svector3f;
+	float *tvector3f;
+}
+r_animcache_job_t;
 
+static void R_AnimCache_AllocEntityMeshBuffers(entity_render_t *ent, int numvertices)
+{
 	// check if we need the meshbuffers
 	if (!vid.useinterleavedarrays)
 		return;
@@ -4926,6 +4880,15 @@ static void R_AnimCache_UpdateEntityMeshBuffers(entity_render_t *ent, int numver
 		r_refdef.stats[r_stat_animcache_vertexmesh_count] += 1;
 		r_refdef.stats[r_stat_animcache_vertexmesh_vertices] += numvertices;
 		r_refdef.stats[r_stat_animcache_vertexmesh_maxvertices] = max(r_refdef.stats[r_stat_animcache_vertexmesh_maxvertices], numvertices);
+	}
+}
+
+static void R_AnimCache_UpdateEntityMeshBuffers(entity_render_t *ent, int numvertices)
+{
+	int i;
+
+	if (ent->animcache_vertexmesh)
+	{
 		memcpy(ent->animcache_vertexmesh, ent->model->surfmesh.data_vertexmesh, sizeof(r_vertexmesh_t)*numvertices);
 		for (i = 0;i < numvertices;i++)
 			memcpy(ent->animcache_vertexmesh[i].vertex3f, ent->animcache_vertex3f + 3*i, sizeof(float[3]));
@@ -4941,11 +4904,15 @@ static void R_AnimCache_UpdateEntityMeshBuffers(entity_render_t *ent, int numver
 	}
 }
 
-qboolean R_AnimCache_GetEntity(entity_render_t *ent, qboolean wantnormals, qboolean wanttangents)
+// allocates the cache arrays and counts stats (not thread safe), and fills in
+// the animation work left to do (job->ent is NULL if there is none)
+static qboolean R_AnimCache_PrepareEntity(entity_render_t *ent, qboolean wantnormals, qboolean wanttangents, r_animcache_job_t *job)
 {
 	dp_model_t *model = ent->model;
 	int numvertices;
 
+	job->ent = NULL;
+
 	// see if this ent is worth caching
 	if (!model || !model->Draw || !model->AnimateVertices)
 		return false;
@@ -4994,8 +4961,12 @@ qboolean R_AnimCache_GetEntity(entity_render_t *ent, qboolean wantnormals, qbool
 				ent->animcache_svector3f = (float *)R_FrameData_Alloc(sizeof(float[3])*numvertices);
 				ent->animcache_tvector3f = (float *)R_FrameData_Alloc(sizeof(float[3])*numvertices);
 			}
-			model->AnimateVertices(model, ent->frameblend, ent->skeleton, NULL, wantnormals ? ent->animcache_normal3f : NULL, wanttangents ? ent->animcache_svector3f : NULL, wanttangents ? ent->animcache_tvector3f : NULL);
-			R_AnimCache_UpdateEntityMeshBuffers(ent, model->surfmesh.num_vertices);
+			job->ent = ent;
+			job->vertex3f = NULL;
+			job->normal3f = wantnormals ? ent->animcache_normal3f : NULL;
+			job->svector3f = wanttangents ? ent->animcache_svector3f : NULL;
+			job->tvector3f = wanttangents ? ent->animcache_tvector3f : NULL;
+			R_AnimCache_AllocEntityMeshBuffers(ent, model->surfmesh.num_vertices);
 			r_refdef.stats[r_stat_animcache_shade_count] += 1;
 			r_refdef.stats[r_stat_animcache_shade_vertices] += numvertices;
 			r_refdef.stats[r_stat_animcache_shade_maxvertices] = max(r_refdef.stats[r_stat_animcache_shade_maxvertices], numvertices);
@@ -5013,8 +4984,12 @@ qboolean R_AnimCache_GetEntity(entity_render_t *ent, qboolean wantnormals, qbool
 			ent->animcache_svector3f = (float *)R_FrameData_Alloc(sizeof(float[3])*numvertices);
 			ent->animcache_tvector3f = (float *)R_FrameData_Alloc(sizeof(float[3])*numvertices);
 		}
-		model->AnimateVertices(model, ent->frameblend, ent->skeleton, ent->animcache_vertex3f, ent->animcache_normal3f, ent->animcache_svector3f, ent->animcache_tvector3f);
-		R_AnimCache_UpdateEntityMeshBuffers(ent, model->surfmesh.num_vertices);
+		job->ent = ent;
+		job->vertex3f = ent->animcache_vertex3f;
+		job->normal3f = ent->animcache_normal3f;
+		job->svector3f = ent->animcache_svector3f;
+		job->tvector3f = ent->animcache_tvector3f;
+		R_AnimCache_AllocEntityMeshBuffers(ent, model->surfmesh.num_vertices);
 		if (wantnormals || wanttangents)
 		{
 			r_refdef.stats[r_stat_animcache_shade_count] += 1;
@@ -5028,9 +5003,40 @@ qboolean R_AnimCache_GetEntity(entity_render_t *ent, qboolean wantnormals, qbool
 	return true;
 }
 
+// only touches the arrays allocated for this job, so jobs can run in parallel
+static void R_AnimCache_AnimateEntity(const r_animcache_job_t *job)
+{
+	entity_render_t *ent = job->ent;
+	dp_model_t *model = ent->model;
+	model->AnimateVertices(model, ent->frameblend, ent->skeleton, job->vertex3f, job->normal3f, job->svector3f, job->tvector3f);
+	R_AnimCache_UpdateEntityMeshBuffers(ent, model->surfmesh.num_vertices);
+}
+
+qboolean R_AnimCache_GetEntity(entity_render_t *ent, qboolean wantnormals, qboolean wanttangents)
+{
+	r_animcache_job_t job;
+	if (!R_AnimCache_PrepareEntity(ent, wantnormals, wanttangents, &job))
+		return false;
+	if (job.ent)
+		R_AnimCache_AnimateEntity(&job);
+	return true;
+}
+
+static void R_AnimCache_CacheVisibleEntities_Task(taskqueue_task_t *t)
+{
+	size_t i;
+	const r_animcache_job_t *jobs = (const r_animcache_job_t *)t->p[0];
+	for (i = t->i[0];i < t->i[1];i++)
+		R_AnimCache_AnimateEntity(jobs + i);
+}
+
 void R_AnimCache_CacheVisibleEntities(void)
 {
 	int i;
+	int numjobs;
+	int numtasks;
+	r_animcache_job_t *jobs;
+	taskqueue_task_t tasks[R_MAXTASKS];
 	qboolean wantnormals = true;
 	qboolean wanttangents = !r_showsurfaces.integer;
 
@@ -5054,12 +5060,33 @@ void R_AnimCache_CacheVisibleEntities(void)
 	if (r_shownormals.integer)
 		wanttangents = wantnormals = true;
 
-	// TODO: thread this
 	// NOTE: R_PrepareRTLights() also caches entities
 
+	if (R_NumTasks(r_refdef.scene.numentities, 1) <= 1)
+	{
+		for (i = 0;i < r_refdef.scene.numentities;i++)
+			if (r_refdef.viewcache.entityvisible[i])
+				R_AnimCache_GetEntity(r_refdef.scene.entities[i], wantnormals, wanttangents);
+		return;
+	}
+
+	// allocate everything up front, then animate the meshes in parallel
+	jobs = (r_animcache_job_t *)R_FrameData_Alloc(sizeof(r_animcache_job_t) * r_refdef.scene.numentities);
+	numjobs = 0;
 	for (i = 0;i < r_refdef.scene.numentities;i++)
 		if (r_refdef.viewcache.entityvisible[i])
-			R_AnimCache_GetEntity(r_refdef.scene.entities[i], wantnormals, wanttangents);
+			if (R_AnimCache_PrepareEntity(r_refdef.scene.entities[i], wantnormals, wanttangents, jobs + numjobs) && jobs[numjobs].ent)
+				numjobs++;
+	numtasks = R_NumTasks(numjobs, 1);
+	for (i = 0;i < numtasks;i++)
+		TaskQueue_Setup(tasks + i, R_AnimCache_CacheVisibleEntities_Task, (size_t)numjobs * i / numtasks, (size_t)numjobs * (i + 1) / numtasks, jobs, NULL);
+	if (numtasks > 1)
+	{
+		TaskQueue_Enqueue(numtasks, tasks);
+		TaskQueue_WaitForTaskDone(numtasks, tasks);
+	}
+	else
+		R_AnimCache_CacheVisibleEntities_Task(tasks);
 }
 
 //==================================================================================
@@ -5220,40 +5247,29 @@ static qboolean R_CanSeeBox(int numsamples, vec_t enlarge, vec3_t eye, vec3_t en
 }
 
 
-static void R_View_UpdateEntityVisible (void)
+// i[0] to i[1] is the range of entities to check, p[0] points to renderimask
+static void R_View_UpdateEntityVisible_Task(taskqueue_task_t *t)
 {
 	int i;
-	int renderimask;
-	int samples;
+	int renderimask = *(int *)t->p[0];
 	entity_render_t *ent;
-
-	if (r_refdef.envmap || r_fb.water.hideplayer)
-		renderimask = RENDER_EXTERIORMODEL | RENDER_VIEWMODEL;
-	else if (chase_active.integer || r_fb.water.renderingscene)
-		renderimask = RENDER_VIEWMODEL;
-	else
-		renderimask = RENDER_EXTERIORMODEL;
-	if (!r_drawviewmodel.integer)
-		renderimask |= RENDER_VIEWMODEL;
-	if (!r_drawexteriormodel.integer)
-		renderimask |= RENDER_EXTERIORMODEL;
-	memset(r_refdef.viewcache.entityvisible, 0, r_refdef.scene.numentities);
-	if (r_refdef.scene.worldmodel && r_refdef.scene.worldmodel->brush.BoxTouchingVisibleLeafs)
+	dp_model_t *worldmodel = r_refdef.scene.worldmodel;
+	if (worldmodel && worldmodel->brush.BoxTouchingVisibleLeafs)
 	{
 		// worldmodel can check visibility
-		for (i = 0;i < r_refdef.scene.numentities;i++)
+		for (i = (int)t->i[0];i < (int)t->i[1];i++)
 		{
 			ent = r_refdef.scene.entities[i];
 			if (!(ent->flags & renderimask))
 			if (!R_CullBox(ent->mins, ent->maxs) || (ent->model && ent->model->type == mod_sprite && (ent->model->sprite.sprnum_type == SPR_LABEL || ent->model->sprite.sprnum_type == SPR_LABEL_SCALE)))
-			if ((ent->flags & (RENDER_NODEPTHTEST | RENDER_WORLDOBJECT | RENDER_VIEWMODEL)) || r_refdef.scene.worldmodel->brush.BoxTouchingVisibleLeafs(r_refdef.scene.worldmodel, r_refdef.viewcache.world_leafvisible, ent->mins, ent->maxs))
+			if ((ent->flags & (RENDER_NODEPTHTEST | RENDER_WORLDOBJECT | RENDER_VIEWMODEL)) || worldmodel->brush.BoxTouchingVisibleLeafs(worldmodel, r_refdef.viewcache.world_leafvisible, ent->mins, ent->maxs))
 				r_refdef.viewcache.entityvisible[i] = true;
 		}
 	}
 	else
 	{
 		// no worldmodel or it can't check visibility
-		for (i = 0;i < r_refdef.scene.numentities;i++)
+		for (i = (int)t->i[0];i < (int)t->i[1];i++)
 		{
 			ent = r_refdef.scene.entities[i];
 			if (!(ent->flags & renderimask))
@@ -5261,6 +5277,39 @@ static void R_View_UpdateEntityVisible (void)
 				r_refdef.viewcache.entityvisible[i] = true;
 		}
 	}
+}
+
+static void R_View_UpdateEntityVisible (void)
+{
+	int i;
+	int renderimask;
+	int samples;
+	int numtasks;
+	taskqueue_task_t tasks[R_MAXTASKS];
+	entity_render_t *ent;
+
+	if (r_refdef.envmap || r_fb.water.hideplayer)
+		renderimask = RENDER_EXTERIORMODEL | RENDER_VIEWMODEL;
+	else if (chase_active.integer || r_fb.water.renderingscene)
+		renderimask = RENDER_VIEWMODEL;
+	else
+		renderimask = RENDER_EXTERIORMODEL;
+	if (!r_drawviewmodel.integer)
+		renderimask |= RENDER_VIEWMODEL;
+	if (!r_drawexteriormodel.integer)
+		renderimask |= RENDER_EXTERIORMODEL;
+	memset(r_refdef.viewcache.entityvisible, 0, r_refdef.scene.numentities);
+	numtasks = R_NumTasks(r_refdef.scene.numentities, 64);
+	for (i = 0;i < numtasks;i++)
+		TaskQueue_Setup(tasks + i, R_View_UpdateEntityVisible_Task, (size_t)r_refdef.scene.numentities * i / numtasks, (size_t)r_refdef.scene.numentities * (i + 1) / numtasks, &renderimask, NULL);
+	if (numtasks > 1)
+	{
+		TaskQueue_Enqueue(numtasks, tasks);
+		TaskQueue_WaitForTaskDone(numtasks, tasks);
+	}
+	else
+		R_View_UpdateEntityVisible_Task(tasks);
+	// the line of sight traces are not thread safe
 	if(r_cullentities_trace.integer && r_refdef.scene.worldmodel && r_refdef.scene.worldmodel->brush.TraceLineOfSight && !r_refdef.view.useclipplane && !r_trippy.integer)
 		// sorry, this check doesn't work for portal/reflection/refraction renders as the view origin is not useful for culling
 	{
@@ -12511,6 +12560,23 @@ static void R_DrawDebugModel(void)
 
 int r_maxsurfacelist = 0;
 const msurface_t **r_surfacelist = NULL;
+// lists the visible world surfaces among sortedmodelsurfaces i[0] to i[1],
+// writing them to r_surfacelist from i[0] on and the count to p[0]
+static void R_DrawWorldSurfaces_Gather_Task(taskqueue_task_t *t)
+{
+	int i, j, n = 0;
+	dp_model_t *model = r_refdef.scene.worldmodel;
+	const unsigned char *surfacevisible = r_refdef.viewcache.world_surfacevisible;
+	const msurface_t **list = r_surfacelist + t->i[0];
+	for (i = (int)t->i[0];i < (int)t->i[1];i++)
+	{
+		j = model->sortedmodelsurfaces[i];
+		if (surfacevisible[j])
+			list[n++] = model->data_surfaces + j;
+	}
+	*(int *)t->p[0] = n;
+}
+
 void R_DrawWorldSurfaces(qboolean skysurfaces, qboolean writedepth, qboolean depthonly, qboolean debug, qboolean prepass)
 {
 	int i, j, endj, flagsmask;
@@ -12518,6 +12584,9 @@ void R_DrawWorldSurfaces(qboolean skysurfaces, qboolean writedepth, qboolean dep
 	msurface_t *surfaces;
 	unsigned char *update;
 	int numsurfacelist = 0;
+	int numtasks;
+	int taskcounts[R_MAXTASKS];
+	taskqueue_task_t tasks[R_MAXTASKS];
 	if (model == NULL)
 		return;
 
@@ -12565,12 +12634,24 @@ void R_DrawWorldSurfaces(qboolean skysurfaces, qboolean writedepth, qboolean dep
 	rsurface.texture = NULL;
 	rsurface.rtlight = NULL;
 	numsurfacelist = 0;
-	// add visible surfaces to draw list
-	for (i = 0;i < model->nummodelsurfaces;i++)
+	// add visible surfaces to draw list, each task lists its part of the
+	// sorted surfaces in place and the parts are then packed together in
+	// order, so the list is the same however many tasks there are
+	numtasks = R_NumTasks(model->nummodelsurfaces, 1024);
+	for (i = 0;i < numtasks;i++)
+		TaskQueue_Setup(tasks + i, R_DrawWorldSurfaces_Gather_Task, (size_t)model->nummodelsurfaces * i / numtasks, (size_t)model->nummodelsurfaces * (i + 1) / numtasks, taskcounts + i, NULL);
+	if (numtasks > 1)
 	{
-		j = model->sortedmodelsurfaces[i];
-		if (r_refdef.viewcache.world_surfacevisible[j])
-			r_surfacelist[numsurfacelist++] = surfaces + j;
+		TaskQueue_Enqueue(numtasks, tasks);
+		TaskQueue_WaitForTaskDone(numtasks, tasks);
+	}
+	else
+		R_DrawWorldSurfaces_Gather_Task(tasks);
+	for (i = 0;i < numtasks;i++)
+	{
+		if (numsurfacelist != (int)tasks[i].i[0])
+			memmove((void *)(r_surfacelist + numsurfacelist), r_surfacelist + tasks[i].i[0], taskcounts[i] * sizeof(*r_surfacelist));
+		numsurfacelist += taskcounts[i];
 	}
 	// update lightmaps if needed
 	if (model->brushq1.firstrender)
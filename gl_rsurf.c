@@ -24,6 +24,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "portals.h"
 #include "csprogs.h"
 #include "image.h"
+#include "taskqueue.h"
 
 cvar_t r_ambient = {0, "r_ambient", "0", "brightens map, value is 0-128"};
 cvar_t r_lockpvs = {0, "r_lockpvs", "0", "disables pvs switching, allows you to walk around and inspect what is visible from a given location in the map (anything not visible from your current location will not be drawn)"};
@@ -400,13 +401,24 @@ void R_DrawPortals(void)
 	}
 }
 
-static void R_View_WorldVisibility_CullSurfaces(void)
+// i[0] to i[1] is the range of surfaces to cull
+static void R_View_WorldVisibility_CullSurfaces_Task(taskqueue_task_t *t)
 {
 	int surfaceindex;
+	unsigned char *surfacevisible = r_refdef.viewcache.world_surfacevisible;
+	msurface_t *surfaces = r_refdef.scene.worldmodel->data_surfaces;
+	for (surfaceindex = (int)t->i[0];surfaceindex < (int)t->i[1];surfaceindex++)
+		if (surfacevisible[surfaceindex] && R_CullBox(surfaces[surfaceindex].mins, surfaces[surfaceindex].maxs))
+			surfacevisible[surfaceindex] = 0;
+}
+
+static void R_View_WorldVisibility_CullSurfaces(void)
+{
+	int i;
 	int surfaceindexstart;
-	int surfaceindexend;
-	unsigned char *surfacevisible;
-	msurface_t *surfaces;
+	int numsurfaces;
+	int numtasks;
+	taskqueue_task_t tasks[R_MAXTASKS];
 	dp_model_t *model = r_refdef.scene.worldmodel;
 	if (!model)
 		return;
@@ -415,17 +427,71 @@ static void R_View_WorldVisibility_CullSurfaces(void)
 	if (r_usesurfaceculling.integer < 1)
 		return;
 	surfaceindexstart = model->firstmodelsurface;
-	surfaceindexend = surfaceindexstart + model->nummodelsurfaces;
-	surfaces = model->data_surfaces;
-	surfacevisible = r_refdef.viewcache.world_surfacevisible;
-	for (surfaceindex = surfaceindexstart;surfaceindex < surfaceindexend;surfaceindex++)
-		if (surfacevisible[surfaceindex] && R_CullBox(surfaces[surfaceindex].mins, surfaces[surfaceindex].maxs))
-			surfacevisible[surfaceindex] = 0;
+	numsurfaces = model->nummodelsurfaces;
+	numtasks = R_NumTasks(numsurfaces, 1024);
+	for (i = 0;i < numtasks;i++)
+		TaskQueue_Setup(tasks + i, R_View_WorldVisibility_CullSurfaces_Task, surfaceindexstart + (size_t)numsurfaces * i / numtasks, surfaceindexstart + (size_t)numsurfaces * (i + 1) / numtasks, NULL, NULL);
+	if (numtasks > 1)
+	{
+		TaskQueue_Enqueue(numtasks, tasks);
+		TaskQueue_WaitForTaskDone(numtasks, tasks);
+	}
+	else
+		R_View_WorldVisibility_CullSurfaces_Task(tasks);
 }
 
-void R_View_WorldVisibility(qboolean forcenovis)
+// flags the leafs in the pvs p[0] (NULL to check only that the leaf is in a
+// cluster) that are on screen, i[0] to i[1] is the range of leafs to check
+static void R_View_WorldVisibility_CullLeafs_Task(taskqueue_task_t *t)
+{
+	int j;
+	mleaf_t *leaf;
+	const unsigned char *pvs = (const unsigned char *)t->p[0];
+	dp_model_t *model = r_refdef.scene.worldmodel;
+	for (j = (int)t->i[0], leaf = model->brush.data_leafs + j;j < (int)t->i[1];j++, leaf++)
+	{
+		if (leaf->clusterindex < 0)
+			continue;
+		if (pvs && !CHECKPVSBIT(pvs, leaf->clusterindex))
+			continue;
+		if (!R_CullBox(leaf->mins, leaf->maxs))
+			r_refdef.viewcache.world_leafvisible[j] = true;
+	}
+}
+
+// marks the on screen leafs (in the pvs if one is given) and their surfaces
+// visible, the leaf bounds are culled in parallel tasks and the surfaces are
+// marked afterwards
+static void R_View_WorldVisibility_MarkLeafs(dp_model_t *model, const unsigned char *pvs)
 {
 	int i, j, *mark;
+	int numtasks;
+	taskqueue_task_t tasks[R_MAXTASKS];
+	mleaf_t *leaf;
+	numtasks = R_NumTasks(model->brush.num_leafs, 1024);
+	for (i = 0;i < numtasks;i++)
+		TaskQueue_Setup(tasks + i, R_View_WorldVisibility_CullLeafs_Task, (size_t)model->brush.num_leafs * i / numtasks, (size_t)model->brush.num_leafs * (i + 1) / numtasks, (void *)pvs, NULL);
+	if (numtasks > 1)
+	{
+		TaskQueue_Enqueue(numtasks, tasks);
+		TaskQueue_WaitForTaskDone(numtasks, tasks);
+	}
+	else
+		R_View_WorldVisibility_CullLeafs_Task(tasks);
+	for (j = 0, leaf = model->brush.data_leafs;j < model->brush.num_leafs;j++, leaf++)
+	{
+		if (!r_refdef.viewcache.world_leafvisible[j])
+			continue;
+		r_refdef.stats[r_stat_world_leafs]++;
+		if (leaf->numleafsurfaces)
+			for (i = 0, mark = leaf->firstleafsurface;i < leaf->numleafsurfaces;i++, mark++)
+				r_refdef.viewcache.world_surfacevisible[*mark] = true;
+	}
+}
+
+void R_View_WorldVisibility(qboolean forcenovis)
+{
+	int i, *mark;
 	mleaf_t *leaf;
 	mleaf_t *viewleaf;
 	dp_model_t *model = r_refdef.scene.worldmodel;
@@ -441,18 +507,7 @@ void R_View_WorldVisibility(qboolean forcenovis)
 		r_refdef.viewcache.world_novis = false;
 
 		// simply cull each marked leaf to the frustum (view pyramid)
-		for (j = 0, leaf = model->brush.data_leafs;j < model->brush.num_leafs;j++, leaf++)
-		{
-			// if leaf is in current pvs and on the screen, mark its surfaces
-			if (CHECKPVSBIT(r_refdef.viewcache.world_pvsbits, leaf->clusterindex) && !R_CullBox(leaf->mins, leaf->maxs))
-			{
-				r_refdef.stats[r_stat_world_leafs]++;
-				r_refdef.viewcache.world_leafvisible[j] = true;
-				if (leaf->numleafsurfaces)
-					for (i = 0, mark = leaf->firstleafsurface;i < leaf->numleafsurfaces;i++, mark++)
-						r_refdef.viewcache.world_surfacevisible[*mark] = true;
-			}
-		}
+		R_View_WorldVisibility_MarkLeafs(model, r_refdef.viewcache.world_pvsbits);
 		R_View_WorldVisibility_CullSurfaces();
 		return;
 	}
@@ -479,20 +534,7 @@ void R_View_WorldVisibility(qboolean forcenovis)
 			// simply cull each leaf to the frustum (view pyramid)
 			// similar to quake's RecursiveWorldNode but without cache misses
 			r_refdef.viewcache.world_novis = true;
-			for (j = 0, leaf = model->brush.data_leafs;j < model->brush.num_leafs;j++, leaf++)
-			{
-				if (leaf->clusterindex < 0)
-					continue;
-				// if leaf is in current pvs and on the screen, mark its surfaces
-				if (!R_CullBox(leaf->mins, leaf->maxs))
-				{
-					r_refdef.stats[r_stat_world_leafs]++;
-					r_refdef.viewcache.world_leafvisible[j] = true;
-					if (leaf->numleafsurfaces)
-						for (i = 0, mark = leaf->firstleafsurface;i < leaf->numleafsurfaces;i++, mark++)
-							r_refdef.viewcache.world_surfacevisible[*mark] = true;
-				}
-			}
+			R_View_WorldVisibility_MarkLeafs(model, NULL);
 		}
 		// just check if each leaf in the PVS is on screen
 		// (unless portal culling is enabled)
@@ -502,20 +544,7 @@ void R_View_WorldVisibility(qboolean forcenovis)
 			// simply check if each leaf is in the Potentially Visible Set,
 			// and cull to frustum (view pyramid)
 			// similar to quake's RecursiveWorldNode but without cache misses
-			for (j = 0, leaf = model->brush.data_leafs;j < model->brush.num_leafs;j++, leaf++)
-			{
-				if (leaf->clusterindex < 0)
-					continue;
-				// if leaf is in current pvs and on the screen, mark its surfaces
-				if (CHECKPVSBIT(r_refdef.viewcache.world_pvsbits, leaf->clusterindex) && !R_CullBox(leaf->mins, leaf->maxs))
-				{
-					r_refdef.stats[r_stat_world_leafs]++;
-					r_refdef.viewcache.world_leafvisible[j] = true;
-					if (leaf->numleafsurfaces)
-						for (i = 0, mark = leaf->firstleafsurface;i < leaf->numleafsurfaces;i++, mark++)
-							r_refdef.viewcache.world_surfacevisible[*mark] = true;
-				}
-			}
+			R_View_WorldVisibility_MarkLeafs(model, r_refdef.viewcache.world_pvsbits);
 		}
 		// if desired use a recursive portal flow, culling each portal to
 		// frustum and checking if the leaf the portal leads to is in the pvs
@@ -975,7 +1004,8 @@ static void R_Q1BSP_RecursiveGetLightInfo_BSP(r_q1bsp_getlightinfo_t *info, qboo
 static void R_Q1BSP_RecursiveGetLightInfo_BIH(r_q1bsp_getlightinfo_t *info, const bih_t *bih)
 {
 	bih_leaf_t *leaf;
-	bih_node_t *node;
+	const bih_node_t *node;
+	bih_node_t nodeview;
 	int nodenum;
 	int axis;
 	int surfaceindex;
@@ -999,7 +1029,7 @@ static void R_Q1BSP_RecursiveGetLightInfo_BIH(r_q1bsp_getlightinfo_t *info, cons
 		// pop one off the stack to process
 		nodenum = nodestack[--nodestackpos];
 		// node
-		node = bih->nodes + nodenum;
+		node = BIH_GetNode(bih, nodenum, &nodeview);
 		if (node->type == BIH_UNORDERED)
 		{
 			for (nodeleafindex = 0;nodeleafindex < BIH_MAXUNORDEREDCHILDREN && node->children[nodeleafindex] >= 0;nodeleafindex++)
@@ -32,6 +32,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "sv_demo.h"
 #include "snd_main.h"
 #include "thread.h"
+#include "taskqueue.h"
 #include "utf8lib.h"
 
 /*
@@ -595,6 +596,7 @@ void Host_ShutdownServer(void)
 
 // make sure all the clients know we're disconnecting
 	World_End(&sv.world);
+	SV_VisGrid_End();
 	if(prog->loaded)
 	{
 		if(PRVM_serverfunction(SV_Shutdown))
@@ -709,6 +711,9 @@ void Host_Main(void)
 		cl_timer += deltacleantime;
 		sv_timer += deltacleantime;
 
+		// start or stop worker threads if taskqueue_maxthreads changed
+		TaskQueue_Frame(false);
+
 		if (!svs.threaded)
 		{
 			svs.perf_acc_realtime += deltacleantime;
@@ -760,6 +765,11 @@ void Host_Main(void)
 
 		Log_DestBuffer_Flush();
 
+		// server temporaries last for one main loop iteration (the server
+		// thread resets them itself)
+		if (!svs.threaded)
+			Mem_FrameReset(&mem_framearena_server);
+
 		// receive packets on each main loop iteration, as the main loop may
 		// be undersleeping due to select() detecting a new packet
 		if (sv.active && !svs.threaded)
@@ -1275,6 +1285,7 @@ static void Host_Init (void)
 	Host_ServerOptions();
 
 	Thread_Init();
+	TaskQueue_Init();
 
 	if (cls.state == ca_dedicated)
 		Cmd_AddCommand ("disconnect", CL_Disconnect_f, "disconnect from server (or disconnect all clients if running a server)");
@@ -1450,6 +1461,7 @@ void Host_Shutdown(void)
 	}
 
 	SV_StopThread();
+	TaskQueue_Shutdown();
 	Thread_Shutdown();
 	Cmd_Shutdown();
 	Key_Shutdown();
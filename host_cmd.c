@@ -2990,6 +2990,12 @@ void Host_Pings_f (void)
 		MSG_WriteString(&host_client->netconnection->message, "\n");
 }
 
+static void Host_KeyFrame_f(void)
+{
+	if (host_client->entitydatabase5)
+		EntityFrame8_KeyFrame(host_client->entitydatabase5);
+}
+
 static void Host_PingPLReport_f(void)
 {
 	char *errbyte;
@@ -3092,6 +3098,7 @@ void Host_InitCommands (void)
 	Cmd_AddCommand ("bottomcolor", Host_BottomColor_f, "QW command to set bottom color without changing top color");
 
 	Cmd_AddCommand_WithClientCommand ("pings", NULL, Host_Pings_f, "command sent by clients to request updated ping and packetloss of players on scoreboard (originally from QW, but also used on NQ servers)");
+	Cmd_AddCommand_WithClientCommand ("keyframe", NULL, Host_KeyFrame_f, "command sent by clients that start recording a demo to request an entity frame that does not depend on earlier ones (PROTOCOL_DARKPLACES8)");
 	Cmd_AddCommand ("pingplreport", Host_PingPLReport_f, "command sent by server containing client ping and packet loss values for scoreboard, triggered by pings command from client (not used by QW servers)");
 
 	Cmd_AddCommand ("fixtrans", Image_FixTransparentPixels_f, "change alpha-zero pixels in an image file to sensible values, and write out a new TGA (warning: SLOW)");
@@ -1,6 +1,13 @@
 
 // Written by Forest Hale 2003-06-15 and placed into public domain.
 
+#ifdef __linux__
+// for recvmmsg and sendmmsg
+# ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+# endif
+#endif
+
 #ifdef WIN32
 #ifdef _MSC_VER
 #pragma comment(lib, "ws2_32.lib")
@@ -29,6 +36,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
+#include <fcntl.h>
 #include <errno.h>
 #include <netdb.h>
 #include <netinet/in.h>
@@ -81,6 +89,12 @@
 #define SOCKLEN_T socklen_t
 #endif
 
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+#define LHNET_MMSG
+#endif
+// most messages passed to one recvmmsg or sendmmsg call
+#define LHNET_MAXBATCH 64
+
 #ifdef MSG_DONTWAIT
 #define LHNET_RECVFROM_FLAGS MSG_DONTWAIT
 #define LHNET_SENDTO_FLAGS 0
@@ -728,6 +742,11 @@ static int lhnet_default_dscp = 0;
 static int lhnet_didWSAStartup = 0;
 static WSADATA lhnet_winsockdata;
 #endif
+#if !defined(WIN32) && !defined(__MORPHOS__)
+#define LHNET_WAKEUPPIPE
+// written to by LHNET_Wakeup to interrupt LHNET_SleepUntilPacketOnSockets_Microseconds
+static int lhnet_wakeuppipe[2] = {-1, -1};
+#endif
 
 void LHNET_Init(void)
 {
@@ -741,6 +760,15 @@ void LHNET_Init(void)
 	if (!lhnet_didWSAStartup)
 		Con_Print("LHNET_Init: WSAStartup failed, networking disabled\n");
 #endif
+#ifdef LHNET_WAKEUPPIPE
+	if (pipe(lhnet_wakeuppipe) == 0)
+	{
+		fcntl(lhnet_wakeuppipe[0], F_SETFL, fcntl(lhnet_wakeuppipe[0], F_GETFL) | O_NONBLOCK);
+		fcntl(lhnet_wakeuppipe[1], F_SETFL, fcntl(lhnet_wakeuppipe[1], F_GETFL) | O_NONBLOCK);
+	}
+	else
+		lhnet_wakeuppipe[0] = lhnet_wakeuppipe[1] = -1;
+#endif
 }
 
 int LHNET_DefaultDSCP(int dscp)
@@ -775,6 +803,14 @@ void LHNET_Shutdown(void)
 		lhnet_didWSAStartup = 0;
 		WSACleanup();
 	}
+#endif
+#ifdef LHNET_WAKEUPPIPE
+	if (lhnet_wakeuppipe[0] >= 0)
+	{
+		close(lhnet_wakeuppipe[0]);
+		close(lhnet_wakeuppipe[1]);
+		lhnet_wakeuppipe[0] = lhnet_wakeuppipe[1] = -1;
+	}
 #endif
 	lhnet_active = 0;
 }
@@ -867,6 +903,72 @@ void LHNET_SleepUntilPacket_Microseconds(int microseconds)
 #endif
 }
 
+void LHNET_SleepUntilPacketOnSockets_Microseconds(lhnetsocket_t **sockets, int numsockets, int microseconds)
+{
+#ifdef FD_SET
+	fd_set fdreadset;
+	struct timeval tv;
+	int i, lastfd;
+	lhnetsocket_t *s;
+	FD_ZERO(&fdreadset);
+	lastfd = 0;
+	for (i = 0;i < numsockets;i++)
+	{
+		s = sockets[i];
+		if (s->address.addresstype == LHNETADDRESSTYPE_INET4 || s->address.addresstype == LHNETADDRESSTYPE_INET6)
+		{
+			if (lastfd < s->inetsocket)
+				lastfd = s->inetsocket;
+#if defined(WIN32) && !defined(_MSC_VER)
+			FD_SET((int)s->inetsocket, &fdreadset);
+#else
+			FD_SET((unsigned int)s->inetsocket, &fdreadset);
+#endif
+		}
+	}
+#ifdef LHNET_WAKEUPPIPE
+	if (lhnet_wakeuppipe[0] >= 0)
+	{
+		if (lastfd < lhnet_wakeuppipe[0])
+			lastfd = lhnet_wakeuppipe[0];
+		FD_SET((unsigned int)lhnet_wakeuppipe[0], &fdreadset);
+	}
+#endif
+	tv.tv_sec = microseconds / 1000000;
+	tv.tv_usec = microseconds % 1000000;
+	select(lastfd + 1, &fdreadset, NULL, NULL, &tv);
+#ifdef LHNET_WAKEUPPIPE
+	if (lhnet_wakeuppipe[0] >= 0 && FD_ISSET(lhnet_wakeuppipe[0], &fdreadset))
+	{
+		char buf[64];
+		while (read(lhnet_wakeuppipe[0], buf, sizeof(buf)) > 0)
+			;
+	}
+#endif
+#else
+	Sys_Sleep(microseconds);
+#endif
+}
+
+int LHNET_HasWakeup(void)
+{
+#ifdef LHNET_WAKEUPPIPE
+	return lhnet_wakeuppipe[1] >= 0;
+#else
+	return 0;
+#endif
+}
+
+void LHNET_Wakeup(void)
+{
+#ifdef LHNET_WAKEUPPIPE
+	char c = 0;
+	if (lhnet_wakeuppipe[1] >= 0)
+		if (write(lhnet_wakeuppipe[1], &c, 1) < 0)
+			; // the pipe is full, so a wakeup is already pending
+#endif
+}
+
 lhnetsocket_t *LHNET_OpenSocket_Connectionless(lhnetaddress_t *address)
 {
 	lhnetsocket_t *lhnetsocket, *s;
@@ -1238,6 +1340,133 @@ int LHNET_Write(lhnetsocket_t *lhnetsocket, const void *content, int contentleng
 	return value;
 }
 
+int LHNET_ReadBatch(lhnetsocket_t *lhnetsocket, lhnetmessage_t *messages, int nummessages)
+{
+	int i, value;
+#ifdef LHNET_MMSG
+	struct mmsghdr msgs[LHNET_MAXBATCH];
+	struct iovec iov[LHNET_MAXBATCH];
+	lhnetaddressnative_t *address;
+	if (lhnetsocket && nummessages > 0 && (lhnetsocket->address.addresstype == LHNETADDRESSTYPE_INET4 || lhnetsocket->address.addresstype == LHNETADDRESSTYPE_INET6))
+	{
+		if (nummessages > LHNET_MAXBATCH)
+			nummessages = LHNET_MAXBATCH;
+		memset(msgs, 0, nummessages * sizeof(*msgs));
+		for (i = 0;i < nummessages;i++)
+		{
+			address = (lhnetaddressnative_t *)&messages[i].address;
+			address->addresstype = LHNETADDRESSTYPE_NONE;
+			iov[i].iov_base = messages[i].content;
+			iov[i].iov_len = messages[i].length;
+			msgs[i].msg_hdr.msg_iov = iov + i;
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_name = &address->addr.sock;
+#ifndef NOSUPPORTIPV6
+			msgs[i].msg_hdr.msg_namelen = lhnetsocket->address.addresstype == LHNETADDRESSTYPE_INET6 ? sizeof(address->addr.in6) : sizeof(address->addr.in);
+#else
+			msgs[i].msg_hdr.msg_namelen = sizeof(address->addr.in);
+#endif
+		}
+		value = recvmmsg(lhnetsocket->inetsocket, msgs, nummessages, LHNET_RECVFROM_FLAGS, NULL);
+		if (value < 0)
+		{
+			int e = SOCKETERRNO;
+			if (e == EWOULDBLOCK)
+				return 0;
+			switch (e)
+			{
+				case ECONNREFUSED:
+					Con_Print("Connection refused\n");
+					return 0;
+			}
+			Con_DPrintf("LHNET_ReadBatch: recvmmsg returned error: %s\n", LHNETPRIVATE_StrError());
+			return -1;
+		}
+		for (i = 0;i < value;i++)
+		{
+			address = (lhnetaddressnative_t *)&messages[i].address;
+			messages[i].length = msgs[i].msg_len;
+			address->addresstype = lhnetsocket->address.addresstype;
+#ifndef NOSUPPORTIPV6
+			if (address->addresstype == LHNETADDRESSTYPE_INET6)
+				address->port = ntohs(address->addr.in6.sin6_port);
+			else
+#endif
+				address->port = ntohs(address->addr.in.sin_port);
+		}
+		return value;
+	}
+#endif
+	for (i = 0;i < nummessages;i++)
+	{
+		value = LHNET_Read(lhnetsocket, messages[i].content, messages[i].length, &messages[i].address);
+		if (value <= 0)
+			return (value < 0 && i == 0) ? -1 : i;
+		messages[i].length = value;
+	}
+	return i;
+}
+
+int LHNET_WriteBatch(lhnetsocket_t *lhnetsocket, const lhnetmessage_t *messages, int nummessages)
+{
+	int i, value, sent = 0;
+#ifdef LHNET_MMSG
+	struct mmsghdr msgs[LHNET_MAXBATCH];
+	struct iovec iov[LHNET_MAXBATCH];
+	int count, first;
+	lhnetaddressnative_t *address;
+	if (lhnetsocket && (lhnetsocket->address.addresstype == LHNETADDRESSTYPE_INET4 || lhnetsocket->address.addresstype == LHNETADDRESSTYPE_INET6))
+	{
+		while (nummessages > 0)
+		{
+			count = nummessages < LHNET_MAXBATCH ? nummessages : LHNET_MAXBATCH;
+			memset(msgs, 0, count * sizeof(*msgs));
+			for (i = 0;i < count;i++)
+			{
+				address = (lhnetaddressnative_t *)&messages[i].address;
+				iov[i].iov_base = messages[i].content;
+				iov[i].iov_len = messages[i].length;
+				msgs[i].msg_hdr.msg_iov = iov + i;
+				msgs[i].msg_hdr.msg_iovlen = 1;
+				msgs[i].msg_hdr.msg_name = &address->addr.sock;
+#ifndef NOSUPPORTIPV6
+				msgs[i].msg_hdr.msg_namelen = lhnetsocket->address.addresstype == LHNETADDRESSTYPE_INET6 ? sizeof(address->addr.in6) : sizeof(address->addr.in);
+#else
+				msgs[i].msg_hdr.msg_namelen = sizeof(address->addr.in);
+#endif
+				// LHNET_Write refuses to send to an address of the wrong type
+				if (address->addresstype != lhnetsocket->address.addresstype)
+					msgs[i].msg_hdr.msg_namelen = 0;
+			}
+			for (first = 0;first < count;)
+			{
+				value = sendmmsg(lhnetsocket->inetsocket, msgs + first, count - first, LHNET_SENDTO_FLAGS);
+				if (value > 0)
+				{
+					sent += value;
+					first += value;
+					continue;
+				}
+				// the first message failed, skip it like a failed sendto and carry on with the rest
+				if (SOCKETERRNO != EWOULDBLOCK)
+					Con_DPrintf("LHNET_WriteBatch: sendmmsg returned error: %s\n", LHNETPRIVATE_StrError());
+				first++;
+			}
+			messages += count;
+			nummessages -= count;
+		}
+		return sent;
+	}
+#endif
+	for (i = 0;i < nummessages;i++)
+	{
+		value = LHNET_Write(lhnetsocket, messages[i].content, messages[i].length, &messages[i].address);
+		if (value == messages[i].length)
+			sent++;
+	}
+	return sent;
+}
+
 #ifdef STANDALONETEST
 int main(int argc, char **argv)
 {
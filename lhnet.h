@@ -42,11 +42,30 @@ void LHNET_Init(void);
 void LHNET_Shutdown(void);
 int LHNET_DefaultDSCP(int dscp); // < 0: query; >= 0: set (returns previous value)
 void LHNET_SleepUntilPacket_Microseconds(int microseconds);
+// waits for a packet on one of the given sockets, or for LHNET_Wakeup to be called from another thread
+void LHNET_SleepUntilPacketOnSockets_Microseconds(lhnetsocket_t **sockets, int numsockets, int microseconds);
+// false if LHNET_Wakeup can not interrupt a sleep on this platform (the sleep only ends on packets or timeout)
+int LHNET_HasWakeup(void);
+void LHNET_Wakeup(void);
 lhnetsocket_t *LHNET_OpenSocket_Connectionless(lhnetaddress_t *address);
 void LHNET_CloseSocket(lhnetsocket_t *lhnetsocket);
 lhnetaddress_t *LHNET_AddressFromSocket(lhnetsocket_t *sock);
 int LHNET_Read(lhnetsocket_t *lhnetsocket, void *content, int maxcontentlength, lhnetaddress_t *address);
 int LHNET_Write(lhnetsocket_t *lhnetsocket, const void *content, int contentlength, const lhnetaddress_t *address);
 
+typedef struct lhnetmessage_s
+{
+	void *content;
+	// buffer size for LHNET_ReadBatch (replaced by the packet length), packet length for LHNET_WriteBatch
+	int length;
+	lhnetaddress_t address;
+}
+lhnetmessage_t;
+
+// reads up to nummessages packets (with one recvmmsg where available), returns how many were read, or -1 on error
+int LHNET_ReadBatch(lhnetsocket_t *lhnetsocket, lhnetmessage_t *messages, int nummessages);
+// sends all the packets (with one sendmmsg per 64 where available), returns how many were sent
+int LHNET_WriteBatch(lhnetsocket_t *lhnetsocket, const lhnetmessage_t *messages, int nummessages);
+
 #endif
 
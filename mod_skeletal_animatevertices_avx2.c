@@ -0,0 +1,74 @@
+#include "mod_skeletal_animatevertices_avx2.h"
+#include "mod_skeletal_animatevertices_sse.h"
+
+#ifdef AVX2_POSSIBLE
+
+#ifdef MATRIX4x4_OPENGLORIENTATION
+#error "AVX2 skeletal requires D3D matrix layout"
+#endif
+
+#include <immintrin.h>
+
+void Mod_Skeletal_AnimateVertices_AVX2(const dp_model_t * RESTRICT model, const frameblend_t * RESTRICT frameblend, const skeleton_t *skeleton, float * RESTRICT vertex3f, float * RESTRICT normal3f, float * RESTRICT svector3f, float * RESTRICT tvector3f)
+{
+	// vertex weighted skeletal, two vertices per iteration (one in each 128bit
+	// half), the blend matrices are the same as the SSE code path
+	int i;
+	int numvertices = model->surfmesh.num_vertices;
+	const matrix4x4_t *boneposerelative = Mod_Skeletal_BuildBlendMatrices_SSE(model, frameblend, skeleton);
+	const unsigned short * RESTRICT b = model->surfmesh.blends;
+	const float * RESTRICT v = model->surfmesh.data_vertex3f;
+	const float * RESTRICT n = model->surfmesh.data_normal3f;
+	const float * RESTRICT sv = model->surfmesh.data_svector3f;
+	const float * RESTRICT tv = model->surfmesh.data_tvector3f;
+	// two packed xyz vertices are spread out to xyz? xyz? and packed back
+	// again, the masked loads and stores never touch the next vertex
+	const __m256i spread = _mm256_setr_epi32(0, 1, 2, 2, 3, 4, 5, 5);
+	const __m256i pack = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7);
+	const __m256i mask2 = _mm256_setr_epi32(-1, -1, -1, -1, -1, -1, 0, 0);
+	const __m256i mask1 = _mm256_setr_epi32(-1, -1, -1, 0, 0, 0, 0, 0);
+
+#define TRANSFORM_POSITION(in, out) { \
+		__m256 pin = _mm256_permutevar8x32_ps(_mm256_maskload_ps((in) + i * 3, mask), spread); \
+		__m256 pout = _mm256_fmadd_ps(_mm256_shuffle_ps(pin, pin, 0x00), m1, m4); \
+		pout = _mm256_fmadd_ps(_mm256_shuffle_ps(pin, pin, 0x55), m2, pout); \
+		pout = _mm256_fmadd_ps(_mm256_shuffle_ps(pin, pin, 0xaa), m3, pout); \
+		_mm256_maskstore_ps((out) + i * 3, mask, _mm256_permutevar8x32_ps(pout, pack)); \
+	}
+
+#define TRANSFORM_VECTOR(in, out) { \
+		__m256 vin = _mm256_permutevar8x32_ps(_mm256_maskload_ps((in) + i * 3, mask), spread); \
+		__m256 vout = _mm256_mul_ps(_mm256_shuffle_ps(vin, vin, 0x00), m1); \
+		vout = _mm256_fmadd_ps(_mm256_shuffle_ps(vin, vin, 0x55), m2, vout); \
+		vout = _mm256_fmadd_ps(_mm256_shuffle_ps(vin, vin, 0xaa), m3, vout); \
+		_mm256_maskstore_ps((out) + i * 3, mask, _mm256_permutevar8x32_ps(vout, pack)); \
+	}
+
+	for (i = 0;i < numvertices;i += 2)
+	{
+		// an odd last vertex just uses its own matrix twice
+		const float * RESTRICT ma = &boneposerelative[b[i]].m[0][0];
+		const float * RESTRICT mb = &boneposerelative[b[min(i + 1, numvertices - 1)]].m[0][0];
+		__m256i mask = i + 1 < numvertices ? mask2 : mask1;
+		/* bonepose array is 16 byte aligned */
+		__m256 m1 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_load_ps(ma)), _mm_load_ps(mb), 1);
+		__m256 m2 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_load_ps(ma + 4)), _mm_load_ps(mb + 4), 1);
+		__m256 m3 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_load_ps(ma + 8)), _mm_load_ps(mb + 8), 1);
+		if (vertex3f)
+		{
+			__m256 m4 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_load_ps(ma + 12)), _mm_load_ps(mb + 12), 1);
+			TRANSFORM_POSITION(v, vertex3f);
+		}
+		if (normal3f)
+			TRANSFORM_VECTOR(n, normal3f);
+		if (svector3f)
+			TRANSFORM_VECTOR(sv, svector3f);
+		if (tvector3f)
+			TRANSFORM_VECTOR(tv, tvector3f);
+	}
+
+#undef TRANSFORM_POSITION
+#undef TRANSFORM_VECTOR
+}
+
+#endif
@@ -0,0 +1,79 @@
+#include "mod_skeletal_animatevertices_avx512.h"
+#include "mod_skeletal_animatevertices_sse.h"
+
+#ifdef AVX512_POSSIBLE
+
+#ifdef MATRIX4x4_OPENGLORIENTATION
+#error "AVX-512 skeletal requires D3D matrix layout"
+#endif
+
+#include <immintrin.h>
+
+void Mod_Skeletal_AnimateVertices_AVX512(const dp_model_t * RESTRICT model, const frameblend_t * RESTRICT frameblend, const skeleton_t *skeleton, float * RESTRICT vertex3f, float * RESTRICT normal3f, float * RESTRICT svector3f, float * RESTRICT tvector3f)
+{
+	// vertex weighted skeletal, four vertices per iteration (one in each
+	// 128bit lane), the blend matrices are the same as the SSE code path
+	int i, count;
+	int numvertices = model->surfmesh.num_vertices;
+	const matrix4x4_t *boneposerelative = Mod_Skeletal_BuildBlendMatrices_SSE(model, frameblend, skeleton);
+	const unsigned short * RESTRICT b = model->surfmesh.blends;
+	const float * RESTRICT v = model->surfmesh.data_vertex3f;
+	const float * RESTRICT n = model->surfmesh.data_normal3f;
+	const float * RESTRICT sv = model->surfmesh.data_svector3f;
+	const float * RESTRICT tv = model->surfmesh.data_tvector3f;
+	// four packed xyz vertices are spread out to xyz? per lane and packed back
+	// again, the masked loads and stores never touch the next vertex
+	const __m512i spread = _mm512_setr_epi32(0, 1, 2, 2, 3, 4, 5, 5, 6, 7, 8, 8, 9, 10, 11, 11);
+	const __m512i pack = _mm512_setr_epi32(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 15, 15, 15, 15);
+
+#define TRANSFORM_POSITION(in, out) { \
+		__m512 pin = _mm512_permutexvar_ps(spread, _mm512_maskz_loadu_ps(mask, (in) + i * 3)); \
+		__m512 pout = _mm512_fmadd_ps(_mm512_shuffle_ps(pin, pin, 0x00), m1, m4); \
+		pout = _mm512_fmadd_ps(_mm512_shuffle_ps(pin, pin, 0x55), m2, pout); \
+		pout = _mm512_fmadd_ps(_mm512_shuffle_ps(pin, pin, 0xaa), m3, pout); \
+		_mm512_mask_storeu_ps((out) + i * 3, mask, _mm512_permutexvar_ps(pack, pout)); \
+	}
+
+#define TRANSFORM_VECTOR(in, out) { \
+		__m512 vin = _mm512_permutexvar_ps(spread, _mm512_maskz_loadu_ps(mask, (in) + i * 3)); \
+		__m512 vout = _mm512_mul_ps(_mm512_shuffle_ps(vin, vin, 0x00), m1); \
+		vout = _mm512_fmadd_ps(_mm512_shuffle_ps(vin, vin, 0x55), m2, vout); \
+		vout = _mm512_fmadd_ps(_mm512_shuffle_ps(vin, vin, 0xaa), m3, vout); \
+		_mm512_mask_storeu_ps((out) + i * 3, mask, _mm512_permutexvar_ps(pack, vout)); \
+	}
+
+	for (i = 0;i < numvertices;i += 4)
+	{
+		// a short last group reuses the matrix of its last vertex
+		__m512 ma, mb, mc, md, t0, t1, t2, t3, m1, m2, m3, m4;
+		__mmask16 mask;
+		count = min(numvertices - i, 4);
+		mask = (__mmask16)((1 << (count * 3)) - 1);
+		ma = _mm512_loadu_ps(&boneposerelative[b[i]].m[0][0]);
+		mb = _mm512_loadu_ps(&boneposerelative[b[i + min(1, count - 1)]].m[0][0]);
+		mc = _mm512_loadu_ps(&boneposerelative[b[i + min(2, count - 1)]].m[0][0]);
+		md = _mm512_loadu_ps(&boneposerelative[b[i + min(3, count - 1)]].m[0][0]);
+		// transpose the 128bit rows so m1 holds the first row of each matrix
+		t0 = _mm512_shuffle_f32x4(ma, mb, _MM_SHUFFLE(1, 0, 1, 0));
+		t1 = _mm512_shuffle_f32x4(mc, md, _MM_SHUFFLE(1, 0, 1, 0));
+		t2 = _mm512_shuffle_f32x4(ma, mb, _MM_SHUFFLE(3, 2, 3, 2));
+		t3 = _mm512_shuffle_f32x4(mc, md, _MM_SHUFFLE(3, 2, 3, 2));
+		m1 = _mm512_shuffle_f32x4(t0, t1, _MM_SHUFFLE(2, 0, 2, 0));
+		m2 = _mm512_shuffle_f32x4(t0, t1, _MM_SHUFFLE(3, 1, 3, 1));
+		m3 = _mm512_shuffle_f32x4(t2, t3, _MM_SHUFFLE(2, 0, 2, 0));
+		m4 = _mm512_shuffle_f32x4(t2, t3, _MM_SHUFFLE(3, 1, 3, 1));
+		if (vertex3f)
+			TRANSFORM_POSITION(v, vertex3f);
+		if (normal3f)
+			TRANSFORM_VECTOR(n, normal3f);
+		if (svector3f)
+			TRANSFORM_VECTOR(sv, svector3f);
+		if (tvector3f)
+			TRANSFORM_VECTOR(tv, tvector3f);
+	}
+
+#undef TRANSFORM_POSITION
+#undef TRANSFORM_VECTOR
+}
+
+#endif
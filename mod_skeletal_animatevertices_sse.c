@@ -8,20 +8,15 @@
 
 #include <xmmintrin.h>
 
-void Mod_Skeletal_AnimateVertices_SSE(const dp_model_t * RESTRICT model, const frameblend_t * RESTRICT frameblend, const skeleton_t *skeleton, float * RESTRICT vertex3f, float * RESTRICT normal3f, float * RESTRICT svector3f, float * RESTRICT tvector3f)
+matrix4x4_t *Mod_Skeletal_BuildBlendMatrices_SSE(const dp_model_t * RESTRICT model, const frameblend_t * RESTRICT frameblend, const skeleton_t *skeleton)
 {
-	// vertex weighted skeletal
 	int i, k;
 	int blends;
 	matrix4x4_t *bonepose;
 	matrix4x4_t *boneposerelative;
 	float m[12];
 	const blendweights_t * RESTRICT weights;
-	int num_vertices_minus_one;
-
-	num_vertices_minus_one = model->surfmesh.num_vertices - 1;
 
-	//unsigned long long ts = rdtsc();
 	bonepose = (matrix4x4_t *) Mod_Skeletal_AnimateVertices_AllocBuffers(sizeof(matrix4x4_t) * (model->num_bones*2 + model->surfmesh.num_blends));
 	boneposerelative = bonepose + model->num_bones;
 
@@ -259,6 +254,18 @@ void Mod_Skeletal_AnimateVertices_SSE(const dp_model_t * RESTRICT model, const f
 		_mm_store_ps(b+8, b2);
 		_mm_store_ps(b+12, b3);
 	}
+	return boneposerelative;
+}
+
+void Mod_Skeletal_AnimateVertices_SSE(const dp_model_t * RESTRICT model, const frameblend_t * RESTRICT frameblend, const skeleton_t *skeleton, float * RESTRICT vertex3f, float * RESTRICT normal3f, float * RESTRICT svector3f, float * RESTRICT tvector3f)
+{
+	// vertex weighted skeletal
+	int i;
+	int num_vertices_minus_one = model->surfmesh.num_vertices - 1;
+	const matrix4x4_t *boneposerelative;
+
+	//unsigned long long ts = rdtsc();
+	boneposerelative = Mod_Skeletal_BuildBlendMatrices_SSE(model, frameblend, skeleton);
 
 #define LOAD_MATRIX_SCALAR() const float * RESTRICT m = &boneposerelative[*b].m[0][0]
 
@@ -4,6 +4,9 @@
 #include "quakedef.h"
 
 #ifdef SSE_POSSIBLE
+// computes the per bone and per blend relative matrices into the animation
+// scratch buffer, also used by the AVX code paths
+matrix4x4_t *Mod_Skeletal_BuildBlendMatrices_SSE(const dp_model_t * RESTRICT model, const frameblend_t * RESTRICT frameblend, const skeleton_t *skeleton);
 void Mod_Skeletal_AnimateVertices_SSE(const dp_model_t * RESTRICT model, const frameblend_t * RESTRICT frameblend, const skeleton_t *skeleton, float * RESTRICT vertex3f, float * RESTRICT normal3f, float * RESTRICT svector3f, float * RESTRICT tvector3f);
 #endif
 
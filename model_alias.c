@@ -25,11 +25,24 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #ifdef SSE_POSSIBLE
 #include "mod_skeletal_animatevertices_sse.h"
 #endif
+#ifdef AVX2_POSSIBLE
+#include "mod_skeletal_animatevertices_avx2.h"
+#endif
+#ifdef AVX512_POSSIBLE
+#include "mod_skeletal_animatevertices_avx512.h"
+#endif
+#include "thread.h"
+#include "taskqueue.h"
 
 #ifdef SSE_POSSIBLE
 static qboolean r_skeletal_use_sse_defined = false;
 cvar_t r_skeletal_use_sse = {0, "r_skeletal_use_sse", "1", "use SSE for skeletal model animation"};
 #endif
+#ifdef AVX2_POSSIBLE
+// 0 = none, 1 = AVX2, 2 = AVX-512 (as detected at startup)
+static int r_skeletal_avx_supported = 0;
+cvar_t r_skeletal_use_avx = {0, "r_skeletal_use_avx", "2", "use AVX2 (1) or AVX-512 (2, falls back to AVX2 if not supported) for skeletal model animation, requires r_skeletal_use_sse"};
+#endif
 cvar_t r_skeletal_debugbone = {0, "r_skeletal_debugbone", "-1", "development cvar for testing skeletal model code"};
 cvar_t r_skeletal_debugbonecomponent = {0, "r_skeletal_debugbonecomponent", "3", "development cvar for testing skeletal model code"};
 cvar_t r_skeletal_debugbonevalue = {0, "r_skeletal_debugbonevalue", "100", "development cvar for testing skeletal model code"};
@@ -41,22 +54,33 @@ cvar_t mod_alias_force_animated = {0, "mod_alias_force_animated", "", "if set to
 
 float mod_md3_sin[320];
 
-static size_t Mod_Skeletal_AnimateVertices_maxbonepose = 0;
-static void *Mod_Skeletal_AnimateVertices_bonepose = NULL;
+// each thread animating models has its own scratch buffer, all of them come
+// from one pool so they can be freed together while no tasks are running
+static mempool_t *Mod_Skeletal_AnimateVertices_mempool = NULL;
+static int Mod_Skeletal_AnimateVertices_generation = 1;
+static THREAD_LOCAL int Mod_Skeletal_AnimateVertices_bonepose_generation = 0;
+static THREAD_LOCAL size_t Mod_Skeletal_AnimateVertices_maxbonepose = 0;
+static THREAD_LOCAL void *Mod_Skeletal_AnimateVertices_bonepose = NULL;
 void Mod_Skeletal_FreeBuffers(void)
 {
-	if(Mod_Skeletal_AnimateVertices_bonepose)
-		Mem_Free(Mod_Skeletal_AnimateVertices_bonepose);
-	Mod_Skeletal_AnimateVertices_maxbonepose = 0;
-	Mod_Skeletal_AnimateVertices_bonepose = NULL;
+	if(Mod_Skeletal_AnimateVertices_mempool)
+		Mem_EmptyPool(Mod_Skeletal_AnimateVertices_mempool);
+	Mod_Skeletal_AnimateVertices_generation++;
 }
 void *Mod_Skeletal_AnimateVertices_AllocBuffers(size_t nbytes)
 {
+	if(Mod_Skeletal_AnimateVertices_bonepose_generation != Mod_Skeletal_AnimateVertices_generation)
+	{
+		// the pool was emptied since this thread last allocated
+		Mod_Skeletal_AnimateVertices_bonepose_generation = Mod_Skeletal_AnimateVertices_generation;
+		Mod_Skeletal_AnimateVertices_maxbonepose = 0;
+		Mod_Skeletal_AnimateVertices_bonepose = NULL;
+	}
 	if(Mod_Skeletal_AnimateVertices_maxbonepose < nbytes)
 	{
 		if(Mod_Skeletal_AnimateVertices_bonepose)
 			Mem_Free(Mod_Skeletal_AnimateVertices_bonepose);
-		Mod_Skeletal_AnimateVertices_bonepose = Z_Malloc(nbytes);
+		Mod_Skeletal_AnimateVertices_bonepose = Mem_Alloc(Mod_Skeletal_AnimateVertices_mempool, nbytes);
 		Mod_Skeletal_AnimateVertices_maxbonepose = nbytes;
 	}
 	return Mod_Skeletal_AnimateVertices_bonepose;
@@ -179,6 +203,20 @@ static void Mod_Skeletal_AnimateVertices(const dp_model_t * RESTRICT model, cons
 	if(r_skeletal_use_sse_defined)
 		if(r_skeletal_use_sse.integer)
 		{
+#ifdef AVX512_POSSIBLE
+			if(r_skeletal_avx_supported >= 2 && r_skeletal_use_avx.integer >= 2)
+			{
+				Mod_Skeletal_AnimateVertices_AVX512(model, frameblend, skeleton, vertex3f, normal3f, svector3f, tvector3f);
+				return;
+			}
+#endif
+#ifdef AVX2_POSSIBLE
+			if(r_skeletal_avx_supported >= 1 && r_skeletal_use_avx.integer >= 1)
+			{
+				Mod_Skeletal_AnimateVertices_AVX2(model, frameblend, skeleton, vertex3f, normal3f, svector3f, tvector3f);
+				return;
+			}
+#endif
 			Mod_Skeletal_AnimateVertices_SSE(model, frameblend, skeleton, vertex3f, normal3f, svector3f, tvector3f);
 			return;
 		}
@@ -186,6 +224,153 @@ static void Mod_Skeletal_AnimateVertices(const dp_model_t * RESTRICT model, cons
 	Mod_Skeletal_AnimateVertices_Generic(model, frameblend, skeleton, vertex3f, normal3f, svector3f, tvector3f);
 }
 
+#define MOD_SKELETAL_BENCHMARK_REPEATS 8
+
+typedef void (*mod_skeletal_animatevertices_t)(const dp_model_t * RESTRICT model, const frameblend_t * RESTRICT frameblend, const skeleton_t *skeleton, float * RESTRICT vertex3f, float * RESTRICT normal3f, float * RESTRICT svector3f, float * RESTRICT tvector3f);
+
+typedef struct mod_skeletal_benchmark_s
+{
+	const dp_model_t *model;
+	mod_skeletal_animatevertices_t animate;
+	const frameblend_t *frameblends;
+	float *vertex3f;
+	float *normal3f;
+	float *svector3f;
+	float *tvector3f;
+}
+mod_skeletal_benchmark_t;
+
+static void Mod_Skeletal_Benchmark_Task(taskqueue_task_t *t)
+{
+	size_t i;
+	const mod_skeletal_benchmark_t *b = (const mod_skeletal_benchmark_t *)t->p[0];
+	size_t stride = b->model->surfmesh.num_vertices * 3;
+	for (i = t->i[0];i < t->i[1];i++)
+		b->animate(b->model, b->frameblends + i * MAX_FRAMEBLENDS, NULL, b->vertex3f + i * stride, b->normal3f + i * stride, b->svector3f + i * stride, b->tvector3f + i * stride);
+}
+
+static double Mod_Skeletal_Benchmark_Run(mod_skeletal_benchmark_t *b, int copies, int numtasks)
+{
+	int i, repeat;
+	double t0;
+	taskqueue_task_t tasks[64];
+	for (i = 0;i < numtasks;i++)
+		TaskQueue_Setup(tasks + i, Mod_Skeletal_Benchmark_Task, (size_t)copies * i / numtasks, (size_t)copies * (i + 1) / numtasks, b, NULL);
+	t0 = Sys_DirtyTime();
+	for (repeat = 0;repeat < MOD_SKELETAL_BENCHMARK_REPEATS;repeat++)
+	{
+		if (numtasks > 1)
+		{
+			TaskQueue_Enqueue(numtasks, tasks);
+			TaskQueue_WaitForTaskDone(numtasks, tasks);
+		}
+		else
+			Mod_Skeletal_Benchmark_Task(tasks);
+	}
+	return (Sys_DirtyTime() - t0) / MOD_SKELETAL_BENCHMARK_REPEATS;
+}
+
+static void Mod_Skeletal_Benchmark_f(void)
+{
+	int i, p, copies, numtasks, numpaths = 0;
+	size_t j, numfloats;
+	float *reference, *output, maxerror;
+	double generictime = 0, t, splittime;
+	dp_model_t *model;
+	frameblend_t *frameblends;
+	mod_skeletal_benchmark_t b;
+	const char *pathnames[4];
+	mod_skeletal_animatevertices_t paths[4];
+
+	if (Cmd_Argc() < 2)
+	{
+		Con_Print("usage: mod_skeletal_benchmark <model> [copies] [tasks]\n");
+		return;
+	}
+	model = Mod_ForName(Cmd_Argv(1), false, false, NULL);
+	if (!model || model->AnimateVertices != Mod_Skeletal_AnimateVertices || !model->num_bones || !model->surfmesh.num_vertices)
+	{
+		Con_Printf("mod_skeletal_benchmark: %s is not a skeletal model\n", Cmd_Argv(1));
+		return;
+	}
+	copies = Cmd_Argc() > 2 ? atoi(Cmd_Argv(2)) : 64;
+	copies = bound(1, copies, 4096);
+	numtasks = Cmd_Argc() > 3 ? atoi(Cmd_Argv(3)) : max(TaskQueue_NumThreads(), 1);
+	numtasks = bound(1, numtasks, min(copies, 64));
+
+	pathnames[numpaths] = "generic";
+	paths[numpaths++] = Mod_Skeletal_AnimateVertices_Generic;
+#ifdef SSE_POSSIBLE
+	if (r_skeletal_use_sse_defined)
+	{
+		pathnames[numpaths] = "SSE";
+		paths[numpaths++] = Mod_Skeletal_AnimateVertices_SSE;
+	}
+#endif
+#ifdef AVX2_POSSIBLE
+	if (r_skeletal_avx_supported >= 1)
+	{
+		pathnames[numpaths] = "AVX2";
+		paths[numpaths++] = Mod_Skeletal_AnimateVertices_AVX2;
+	}
+#endif
+#ifdef AVX512_POSSIBLE
+	if (r_skeletal_avx_supported >= 2)
+	{
+		pathnames[numpaths] = "AVX-512";
+		paths[numpaths++] = Mod_Skeletal_AnimateVertices_AVX512;
+	}
+#endif
+
+	// every copy blends a different pair of poses
+	frameblends = (frameblend_t *)Mem_Alloc(tempmempool, copies * sizeof(frameblend_t[MAX_FRAMEBLENDS]));
+	for (i = 0;i < copies;i++)
+	{
+		frameblends[i * MAX_FRAMEBLENDS + 0].subframe = i % max(model->num_poses, 1);
+		frameblends[i * MAX_FRAMEBLENDS + 0].lerp = 0.75f;
+		frameblends[i * MAX_FRAMEBLENDS + 1].subframe = (i + 1) % max(model->num_poses, 1);
+		frameblends[i * MAX_FRAMEBLENDS + 1].lerp = 0.25f;
+	}
+	numfloats = (size_t)copies * model->surfmesh.num_vertices * 3;
+	reference = (float *)Mem_Alloc(tempmempool, numfloats * 4 * sizeof(float));
+	output = (float *)Mem_Alloc(tempmempool, numfloats * 4 * sizeof(float));
+
+	Con_Printf("%s: %i copies of %i vertices, %i bones\n", model->name, copies, model->surfmesh.num_vertices, model->num_bones);
+	b.model = model;
+	b.frameblends = frameblends;
+	for (p = 0;p < numpaths;p++)
+	{
+		// the generic path is the reference the others are compared to
+		float *out = p ? output : reference;
+		b.animate = paths[p];
+		b.vertex3f = out;
+		b.normal3f = out + numfloats;
+		b.svector3f = out + numfloats * 2;
+		b.tvector3f = out + numfloats * 3;
+		t = Mod_Skeletal_Benchmark_Run(&b, copies, 1);
+		if (!p)
+			generictime = t;
+		maxerror = 0;
+		for (j = 0;p && j < numfloats * 4;j++)
+			maxerror = max(maxerror, fabs(output[j] - reference[j]));
+		Con_Printf("%8s: %8.3f ms, %6.1f Mvertices/s (%.2fx generic), max difference %g\n", pathnames[p], t * 1000.0, copies * model->surfmesh.num_vertices / max(t, 0.000001) / 1000000.0, generictime / max(t, 0.000001), maxerror);
+	}
+
+	// the path selected by the cvars, first on one thread and then split
+	b.animate = model->AnimateVertices;
+	b.vertex3f = output;
+	b.normal3f = output + numfloats;
+	b.svector3f = output + numfloats * 2;
+	b.tvector3f = output + numfloats * 3;
+	t = Mod_Skeletal_Benchmark_Run(&b, copies, 1);
+	splittime = Mod_Skeletal_Benchmark_Run(&b, copies, numtasks);
+	Con_Printf("%i tasks on %i worker threads: %8.3f ms, %.2fx one task\n", numtasks, TaskQueue_NumThreads(), splittime * 1000.0, t / max(splittime, 0.000001));
+
+	Mem_Free(frameblends);
+	Mem_Free(reference);
+	Mem_Free(output);
+}
+
 void Mod_AliasInit (void)
 {
 	int i;
@@ -199,9 +384,20 @@ void Mod_AliasInit (void)
 	Cvar_RegisterVariable(&mod_alias_force_animated);
 	for (i = 0;i < 320;i++)
 		mod_md3_sin[i] = sin(i * M_PI * 2.0f / 256.0);
+	Cmd_AddCommand("mod_skeletal_benchmark", Mod_Skeletal_Benchmark_f, "times skeletal animation of a model with each code path and split across tasks (usage: mod_skeletal_benchmark <model> [copies] [tasks])");
+	Mod_Skeletal_AnimateVertices_mempool = Mem_AllocPool("skeletal animation", 0, NULL);
 #ifdef SSE_POSSIBLE
 	if(Sys_HaveSSE())
 	{
+#ifdef AVX2_POSSIBLE
+		r_skeletal_avx_supported = Sys_HaveAVX512() ? 2 : (Sys_HaveAVX2() ? 1 : 0);
+		if (r_skeletal_avx_supported)
+		{
+			Con_Printf("Skeletal animation uses %s code path\n", r_skeletal_avx_supported >= 2 ? "AVX-512" : "AVX2");
+			Cvar_RegisterVariable(&r_skeletal_use_avx);
+		}
+		else
+#endif
 		Con_Printf("Skeletal animation uses SSE code path\n");
 		r_skeletal_use_sse_defined = true;
 		Cvar_RegisterVariable(&r_skeletal_use_sse);
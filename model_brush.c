@@ -24,6 +24,11 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "polygon.h"
 #include "curves.h"
 #include "wad.h"
+#include "taskqueue.h"
+#include "thread.h"
+#ifdef SSE_PRESENT
+#include <xmmintrin.h>
+#endif
 
 
 //cvar_t r_subdivide_size = {CVAR_SAVE, "r_subdivide_size", "128", "how large water polygons should be (smaller values produce more polygons which give better warping effects)"};
@@ -61,6 +66,8 @@ cvar_t mod_q3shader_force_terrain_alphaflag = {0, "mod_q3shader_force_terrain_al
 
 cvar_t mod_q1bsp_polygoncollisions = {0, "mod_q1bsp_polygoncollisions", "0", "disables use of precomputed cliphulls and instead collides with polygons (uses Bounding Interval Hierarchy optimizations)"};
 cvar_t mod_collision_bih = {0, "mod_collision_bih", "1", "enables use of generated Bounding Interval Hierarchy tree instead of compiled bsp tree in collision code"};
+cvar_t mod_collision_bih_sah = {0, "mod_collision_bih_sah", "1", "builds Bounding Interval Hierarchy trees with the surface area heuristic rather than splitting at the middle (takes effect on map load)"};
+cvar_t mod_collision_bih_packed = {0, "mod_collision_bih_packed", "1", "stores Bounding Interval Hierarchy nodes in a compact depth first layout with quantized bounds (takes effect on map load)"};
 cvar_t mod_recalculatenodeboxes = {0, "mod_recalculatenodeboxes", "1", "enables use of generated node bounding boxes based on BSP tree portal reconstruction, rather than the node boxes supplied by the map compiler"};
 
 static texture_t mod_q1bsp_texture_solid;
@@ -70,6 +77,8 @@ static texture_t mod_q1bsp_texture_slime;
 static texture_t mod_q1bsp_texture_water;
 
 static qboolean Mod_Q3BSP_TraceLineOfSight(struct model_s *model, const vec3_t start, const vec3_t end);
+static void Mod_Q3BSP_TraceLinesOfSight(struct model_s *model, int numtraces, const float *starts, const float *ends, qboolean *visible);
+static void Mod_BIHStats_f(void);
 
 void Mod_BrushInit(void)
 {
@@ -107,7 +116,10 @@ void Mod_BrushInit(void)
 	Cvar_RegisterVariable(&mod_q3shader_force_terrain_alphaflag);
 	Cvar_RegisterVariable(&mod_q1bsp_polygoncollisions);
 	Cvar_RegisterVariable(&mod_collision_bih);
+	Cvar_RegisterVariable(&mod_collision_bih_sah);
+	Cvar_RegisterVariable(&mod_collision_bih_packed);
 	Cvar_RegisterVariable(&mod_recalculatenodeboxes);
+	Cmd_AddCommand("mod_bihstats", Mod_BIHStats_f, "prints the shape and memory use of the current map's Bounding Interval Hierarchy trees, and how many nodes random lines visit");
 
 	// these games were made for older DP engines and are no longer
 	// maintained; use this hack to show their textures properly
@@ -959,6 +971,84 @@ static void Mod_Q1BSP_TraceLine(struct model_s *model, const frameblend_t *frame
 #endif
 }
 
+// traces several lines through the hull together for as long as they all
+// stay on the same side of every plane, then finishes each line on its own
+// from the node where they split up
+#define Q1BSP_PACKETSIZE 4
+static void Mod_Q1BSP_TraceLines(struct model_s *model, const frameblend_t *frameblend, const skeleton_t *skeleton, int numtraces, trace_t *traces, const float *starts, const float *ends, int hitsupercontentsmask)
+{
+	RecursiveHullCheckTraceInfo_t rhc[Q1BSP_PACKETSIZE];
+	const mclipnode_t *node;
+	const mplane_t *plane;
+	double t1, t2;
+	int i, lane, numlanes, num, side, laneside;
+
+	if (sv_gameplayfix_q1bsptracelinereportstexture.integer)
+	{
+		for (i = 0;i < numtraces;i++)
+			Mod_Q1BSP_TraceLine(model, frameblend, skeleton, traces + i, starts + i*3, ends + i*3, hitsupercontentsmask);
+		return;
+	}
+
+	for (i = 0;i < numtraces;)
+	{
+		for (numlanes = 0;i < numtraces && numlanes < Q1BSP_PACKETSIZE;i++)
+		{
+			if (VectorCompare(starts + i*3, ends + i*3))
+			{
+				Mod_Q1BSP_TracePoint(model, frameblend, skeleton, traces + i, starts + i*3, hitsupercontentsmask);
+				continue;
+			}
+			memset(&rhc[numlanes], 0, sizeof(rhc[numlanes]));
+			memset(traces + i, 0, sizeof(trace_t));
+			rhc[numlanes].trace = traces + i;
+			rhc[numlanes].trace->hitsupercontentsmask = hitsupercontentsmask;
+			rhc[numlanes].trace->fraction = 1;
+			rhc[numlanes].trace->allsolid = true;
+			rhc[numlanes].hull = &model->brushq1.hulls[0]; // 0x0x0
+			VectorCopy(starts + i*3, rhc[numlanes].start);
+			VectorCopy(ends + i*3, rhc[numlanes].end);
+			VectorSubtract(rhc[numlanes].end, rhc[numlanes].start, rhc[numlanes].dist);
+			numlanes++;
+		}
+		if (!numlanes)
+			continue;
+
+		// this is the same walk Mod_Q1BSP_RecursiveHullCheck does while a
+		// line does not cross any planes
+		num = model->brushq1.hulls[0].firstclipnode;
+		while (num >= 0)
+		{
+			node = model->brushq1.hulls[0].clipnodes + num;
+			plane = model->brushq1.hulls[0].planes + node->planenum;
+			side = -1;
+			for (lane = 0;lane < numlanes;lane++)
+			{
+				if (plane->type < 3)
+				{
+					t1 = rhc[lane].start[plane->type] - plane->dist;
+					t2 = rhc[lane].end[plane->type] - plane->dist;
+				}
+				else
+				{
+					t1 = DotProduct (plane->normal, rhc[lane].start) - plane->dist;
+					t2 = DotProduct (plane->normal, rhc[lane].end) - plane->dist;
+				}
+				laneside = t1 < 0;
+				if (laneside != (t2 < 0) || (side >= 0 && laneside != side))
+					break;
+				side = laneside;
+			}
+			if (lane < numlanes)
+				break;
+			num = node->children[side];
+		}
+
+		for (lane = 0;lane < numlanes;lane++)
+			Mod_Q1BSP_RecursiveHullCheck(&rhc[lane], num, 0, 1, rhc[lane].start, rhc[lane].end);
+	}
+}
+
 static void Mod_Q1BSP_TraceBox(struct model_s *model, const frameblend_t *frameblend, const skeleton_t *skeleton, trace_t *trace, const vec3_t start, const vec3_t boxmins, const vec3_t boxmaxs, const vec3_t end, int hitsupercontentsmask)
 {
 	// this function currently only supports same size start and end
@@ -1179,6 +1269,18 @@ static qboolean Mod_Q1BSP_TraceLineOfSight(struct model_s *model, const vec3_t s
 	return trace.fraction == 1;
 }
 
+static void Mod_Q1BSP_TraceLinesOfSight(struct model_s *model, int numtraces, const float *starts, const float *ends, qboolean *visible)
+{
+	int i;
+	trace_t traces[MAX_TRACELINESBATCH];
+	for (;numtraces > 0;numtraces -= MAX_TRACELINESBATCH, starts += MAX_TRACELINESBATCH*3, ends += MAX_TRACELINESBATCH*3, visible += MAX_TRACELINESBATCH)
+	{
+		Mod_Q1BSP_TraceLines(model, NULL, NULL, min(numtraces, MAX_TRACELINESBATCH), traces, starts, ends, SUPERCONTENTS_VISBLOCKERMASK);
+		for (i = 0;i < min(numtraces, MAX_TRACELINESBATCH);i++)
+			visible[i] = traces[i].fraction == 1;
+	}
+}
+
 static int Mod_Q1BSP_LightPoint_RecursiveBSPNode(dp_model_t *model, vec3_t ambientcolor, vec3_t diffusecolor, vec3_t diffusenormal, const mnode_t *node, float x, float y, float startz, float endz)
 {
 	int side;
@@ -3758,29 +3860,130 @@ static void Mod_Q1BSP_RoundUpToHullSize(dp_model_t *cmodel, const vec3_t inmins,
 	VectorAdd(inmins, hull->clip_size, outmaxs);
 }
 
-static int Mod_Q1BSP_CreateShadowMesh(dp_model_t *mod)
+// only reads the model, so this can run on a worker thread
+// assigns each surface its range of triangles in the combined shadow mesh
+static int Mod_Q1BSP_NumberShadowMeshTriangles(dp_model_t *mod)
 {
 	int j;
 	int numshadowmeshtriangles = 0;
 	msurface_t *surface;
-	if (cls.state == ca_dedicated)
-		return 0;
-	// make a single combined shadow mesh to allow optimized shadow volume creation
-
 	for (j = 0, surface = mod->data_surfaces;j < mod->num_surfaces;j++, surface++)
 	{
 		surface->num_firstshadowmeshtriangle = numshadowmeshtriangles;
 		numshadowmeshtriangles += surface->num_triangles;
 	}
-	mod->brush.shadowmesh = Mod_ShadowMesh_Begin(mod->mempool, numshadowmeshtriangles * 3, numshadowmeshtriangles, NULL, NULL, NULL, false, false, true);
+	return numshadowmeshtriangles;
+}
+
+static shadowmesh_t *Mod_Q1BSP_CreateShadowMesh(dp_model_t *mod)
+{
+	int j;
+	int numshadowmeshtriangles;
+	msurface_t *surface;
+	shadowmesh_t *shadowmesh;
+	if (cls.state == ca_dedicated)
+		return NULL;
+	// make a single combined shadow mesh to allow optimized shadow volume creation
+	numshadowmeshtriangles = Mod_Q1BSP_NumberShadowMeshTriangles(mod);
+	shadowmesh = Mod_ShadowMesh_Begin(mod->mempool, numshadowmeshtriangles * 3, numshadowmeshtriangles, NULL, NULL, NULL, false, false, true);
 	for (j = 0, surface = mod->data_surfaces;j < mod->num_surfaces;j++, surface++)
 		if (surface->num_triangles > 0)
-			Mod_ShadowMesh_AddMesh(mod->mempool, mod->brush.shadowmesh, NULL, NULL, NULL, mod->surfmesh.data_vertex3f, NULL, NULL, NULL, NULL, surface->num_triangles, (mod->surfmesh.data_element3i + 3 * surface->num_firsttriangle));
-	mod->brush.shadowmesh = Mod_ShadowMesh_Finish(mod->mempool, mod->brush.shadowmesh, false, r_enableshadowvolumes.integer != 0, false);
-	if (mod->brush.shadowmesh && mod->brush.shadowmesh->neighbor3i)
-		Mod_BuildTriangleNeighbors(mod->brush.shadowmesh->neighbor3i, mod->brush.shadowmesh->element3i, mod->brush.shadowmesh->numtriangles);
+			Mod_ShadowMesh_AddMesh(mod->mempool, shadowmesh, NULL, NULL, NULL, mod->surfmesh.data_vertex3f, NULL, NULL, NULL, NULL, surface->num_triangles, (mod->surfmesh.data_element3i + 3 * surface->num_firsttriangle));
+	shadowmesh = Mod_ShadowMesh_Finish(mod->mempool, shadowmesh, false, r_enableshadowvolumes.integer != 0, false);
+	if (shadowmesh && shadowmesh->neighbor3i)
+		Mod_BuildTriangleNeighbors(shadowmesh->neighbor3i, shadowmesh->element3i, shadowmesh->numtriangles);
 
-	return numshadowmeshtriangles;
+	return shadowmesh;
+}
+
+static void Mod_Q1BSP_CreateShadowMesh_Task(taskqueue_task_t *t)
+{
+	t->p[1] = Mod_Q1BSP_CreateShadowMesh((dp_model_t *)t->p[0]);
+}
+
+static void Mod_MakeCollisionBIH_Task(taskqueue_task_t *t)
+{
+	Mod_MakeCollisionBIH((dp_model_t *)t->p[0], t->i[0] != 0, (bih_t *)t->p[1]);
+}
+
+/*
+=================
+Mod_Brush_BuildShadowMeshAndBIHs
+
+builds the combined shadow mesh and the BIH trees of every submodel, these
+only read the loaded geometry so they all go on the task queue at once,
+call this after the submodels are set up since they copy the world model,
+with mod_cache they are read from the model cache instead when it matches
+=================
+*/
+static void Mod_Brush_BuildShadowMeshAndBIHs(dp_model_t *mod, int bihflags)
+{
+	int i, numtasks = 0;
+	taskqueue_task_t *tasks;
+	dp_model_t *submodel;
+	shadowmesh_t *shadowmesh;
+	qboolean wantshadowmesh = cls.state != ca_dedicated;
+
+	if (Mod_Cache_LoadBrush(mod, bihflags, wantshadowmesh))
+	{
+		if (wantshadowmesh)
+			Mod_Q1BSP_NumberShadowMeshTriangles(mod);
+		return;
+	}
+
+	tasks = (taskqueue_task_t *)Mem_Alloc(tempmempool, (mod->brush.numsubmodels * 2 + 1) * sizeof(*tasks));
+	// the shadow mesh is the biggest job, so queue it first
+	TaskQueue_Setup(tasks + numtasks++, Mod_Q1BSP_CreateShadowMesh_Task, 0, 0, mod, NULL);
+	for (i = 0;i < mod->brush.numsubmodels;i++)
+	{
+		submodel = mod->brush.submodels[i];
+		if (bihflags & MOD_BRUSH_COLLISIONBIH)
+			TaskQueue_Setup(tasks + numtasks++, Mod_MakeCollisionBIH_Task, false, 0, submodel, &submodel->collision_bih);
+		if (bihflags & MOD_BRUSH_RENDERBIH)
+			TaskQueue_Setup(tasks + numtasks++, Mod_MakeCollisionBIH_Task, true, 0, submodel, &submodel->render_bih);
+	}
+	TaskQueue_Enqueue(numtasks, tasks);
+	TaskQueue_WaitForTaskDone(numtasks, tasks);
+
+	shadowmesh = (shadowmesh_t *)tasks[0].p[1];
+	mod->brush.shadowmesh = shadowmesh;
+	for (i = 0;i < mod->brush.numsubmodels;i++)
+		mod->brush.submodels[i]->brush.shadowmesh = shadowmesh;
+	Mem_Free(tasks);
+
+	Mod_Cache_SaveBrush(mod, bihflags, wantshadowmesh);
+}
+
+// the qw checksums only read the file, so they run while the lumps load,
+// this is static because a Host_Error in a lump loader abandons the wait
+typedef struct mod_q1bsp_checksumjob_s
+{
+	taskqueue_task_t task;
+	qboolean pending;
+	unsigned char *data[HEADER_LUMPS];
+	int size[HEADER_LUMPS];
+	int md4sum, md4sum2;
+}
+mod_q1bsp_checksumjob_t;
+
+static mod_q1bsp_checksumjob_t mod_q1bsp_checksumjob;
+
+static void Mod_Q1BSP_Checksum_Task(taskqueue_task_t *t)
+{
+	mod_q1bsp_checksumjob_t *job = (mod_q1bsp_checksumjob_t *)t->p[0];
+	int i, temp;
+	job->md4sum = 0;
+	job->md4sum2 = 0;
+	for (i = 0;i < HEADER_LUMPS;i++)
+	{
+		if (i == LUMP_ENTITIES)
+			continue;
+		temp = Com_BlockChecksum(job->data[i], job->size[i]);
+		job->md4sum ^= LittleLong(temp);
+		if (i == LUMP_VISIBILITY || i == LUMP_LEAFS || i == LUMP_NODES)
+			continue;
+		job->md4sum2 ^= LittleLong(temp);
+	}
 }
 
 void Mod_CollisionBIH_TraceLineAgainstSurfaces(dp_model_t *model, const frameblend_t *frameblend, const skeleton_t *skeleton, trace_t *trace, const vec3_t start, const vec3_t end, int hitsupercontentsmask);
@@ -3797,6 +4000,7 @@ void Mod_Q1BSP_Load(dp_model_t *mod, void *buffer, void *bufferend)
 	model_brush_lightstyleinfo_t styleinfo[256];
 	unsigned char *datapointer;
 	sizebuf_t sb;
+	double loadmark = Sys_DirtyTime();
 
 	MSG_InitReadBuffer(&sb, (unsigned char *)buffer, (unsigned char *)bufferend - (unsigned char *)buffer);
 
@@ -3868,10 +4072,12 @@ void Mod_Q1BSP_Load(dp_model_t *mod, void *buffer, void *bufferend)
 	mod->soundfromcenter = true;
 	mod->TraceBox = Mod_Q1BSP_TraceBox;
 	mod->TraceLine = Mod_Q1BSP_TraceLine;
+	mod->TraceLines = Mod_Q1BSP_TraceLines;
 	mod->TracePoint = Mod_Q1BSP_TracePoint;
 	mod->PointSuperContents = Mod_Q1BSP_PointSuperContents;
 	mod->TraceLineAgainstSurfaces = Mod_Q1BSP_TraceLineAgainstSurfaces;
 	mod->brush.TraceLineOfSight = Mod_Q1BSP_TraceLineOfSight;
+	mod->brush.TraceLinesOfSight = Mod_Q1BSP_TraceLinesOfSight;
 	mod->brush.SuperContentsFromNativeContents = Mod_Q1BSP_SuperContentsFromNativeContents;
 	mod->brush.NativeContentsFromSuperContents = Mod_Q1BSP_NativeContentsFromSuperContents;
 	mod->brush.GetPVS = Mod_Q1BSP_GetPVS;
@@ -3898,29 +4104,31 @@ void Mod_Q1BSP_Load(dp_model_t *mod, void *buffer, void *bufferend)
 
 // load into heap
 
-	mod->brush.qw_md4sum = 0;
-	mod->brush.qw_md4sum2 = 0;
+	// checksum the lumps on the task queue while they load
+	if (mod_q1bsp_checksumjob.pending)
+		TaskQueue_WaitForTaskDone(1, &mod_q1bsp_checksumjob.task);
 	for (i = 0;i < HEADER_LUMPS;i++)
 	{
-		int temp;
-		if (i == LUMP_ENTITIES)
-			continue;
-		temp = Com_BlockChecksum(lumpsb[i].data, lumpsb[i].cursize);
-		mod->brush.qw_md4sum ^= LittleLong(temp);
-		if (i == LUMP_VISIBILITY || i == LUMP_LEAFS || i == LUMP_NODES)
-			continue;
-		mod->brush.qw_md4sum2 ^= LittleLong(temp);
+		mod_q1bsp_checksumjob.data[i] = lumpsb[i].data;
+		mod_q1bsp_checksumjob.size[i] = lumpsb[i].cursize;
 	}
+	TaskQueue_Setup(&mod_q1bsp_checksumjob.task, Mod_Q1BSP_Checksum_Task, 0, 0, &mod_q1bsp_checksumjob, NULL);
+	mod_q1bsp_checksumjob.pending = true;
+	TaskQueue_Enqueue(1, &mod_q1bsp_checksumjob.task);
 
 	Mod_Q1BSP_LoadEntities(&lumpsb[LUMP_ENTITIES]);
 	Mod_Q1BSP_LoadVertexes(&lumpsb[LUMP_VERTEXES]);
 	Mod_Q1BSP_LoadEdges(&lumpsb[LUMP_EDGES]);
 	Mod_Q1BSP_LoadSurfedges(&lumpsb[LUMP_SURFEDGES]);
+	Mod_LoadTimings_Stage(mod->name, "vertexes", &loadmark);
 	Mod_Q1BSP_LoadTextures(&lumpsb[LUMP_TEXTURES]);
+	Mod_LoadTimings_Stage(mod->name, "textures", &loadmark);
 	Mod_Q1BSP_LoadLighting(&lumpsb[LUMP_LIGHTING]);
+	Mod_LoadTimings_Stage(mod->name, "lighting", &loadmark);
 	Mod_Q1BSP_LoadPlanes(&lumpsb[LUMP_PLANES]);
 	Mod_Q1BSP_LoadTexinfo(&lumpsb[LUMP_TEXINFO]);
 	Mod_Q1BSP_LoadFaces(&lumpsb[LUMP_FACES]);
+	Mod_LoadTimings_Stage(mod->name, "faces", &loadmark);
 	Mod_Q1BSP_LoadLeaffaces(&lumpsb[LUMP_MARKSURFACES]);
 	Mod_Q1BSP_LoadVisibility(&lumpsb[LUMP_VISIBILITY]);
 	// load submodels before leafs because they contain the number of vis leafs
@@ -3928,6 +4136,13 @@ void Mod_Q1BSP_Load(dp_model_t *mod, void *buffer, void *bufferend)
 	Mod_Q1BSP_LoadLeafs(&lumpsb[LUMP_LEAFS]);
 	Mod_Q1BSP_LoadNodes(&lumpsb[LUMP_NODES]);
 	Mod_Q1BSP_LoadClipnodes(&lumpsb[LUMP_CLIPNODES], &hullinfo);
+	Mod_LoadTimings_Stage(mod->name, "bsp tree", &loadmark);
+
+	TaskQueue_WaitForTaskDone(1, &mod_q1bsp_checksumjob.task);
+	mod_q1bsp_checksumjob.pending = false;
+	mod->brush.qw_md4sum = mod_q1bsp_checksumjob.md4sum;
+	mod->brush.qw_md4sum2 = mod_q1bsp_checksumjob.md4sum2;
+	Mod_LoadTimings_Stage(mod->name, "checksum wait", &loadmark);
 
 	for (i = 0; i < HEADER_LUMPS; i++)
 		if (lumpsb[i].readcount != lumpsb[i].cursize && i != LUMP_TEXTURES && i != LUMP_LIGHTING)
@@ -3943,15 +4158,16 @@ void Mod_Q1BSP_Load(dp_model_t *mod, void *buffer, void *bufferend)
 	mod->brushq1.num_compressedpvs = 0;
 
 	Mod_Q1BSP_MakeHull0();
+	Mod_LoadTimings_Stage(mod->name, "hull0", &loadmark);
 	if (mod_bsp_portalize.integer)
+	{
 		Mod_Q1BSP_MakePortals();
+		Mod_LoadTimings_Stage(mod->name, "portals", &loadmark);
+	}
 
 	mod->numframes = 2;		// regular and alternate animation
 	mod->numskins = 1;
 
-	// make a single combined shadow mesh to allow optimized shadow volume creation
-	Mod_Q1BSP_CreateShadowMesh(loadmodel);
-
 	if (loadmodel->brush.numsubmodels)
 		loadmodel->brush.submodels = (dp_model_t **)Mem_Alloc(loadmodel->mempool, loadmodel->brush.numsubmodels * sizeof(dp_model_t *));
 
@@ -4126,17 +4342,15 @@ void Mod_Q1BSP_Load(dp_model_t *mod, void *buffer, void *bufferend)
 		}
 		//mod->brushq1.num_visleafs = bm->visleafs;
 
-		// build a Bounding Interval Hierarchy for culling triangles in light rendering
-		Mod_MakeCollisionBIH(mod, true, &mod->render_bih);
-
 		if (mod_q1bsp_polygoncollisions.integer)
 		{
-			mod->collision_bih = mod->render_bih;
 			// point traces and contents checks still use the bsp tree
 			mod->TraceLine = Mod_CollisionBIH_TraceLine;
+			mod->TraceLines = Mod_CollisionBIH_TraceLines;
 			mod->TraceBox = Mod_CollisionBIH_TraceBox;
 			mod->TraceBrush = Mod_CollisionBIH_TraceBrush;
 			mod->TraceLineAgainstSurfaces = Mod_CollisionBIH_TraceLineAgainstSurfaces;
+			mod->TraceLinesAgainstSurfaces = Mod_CollisionBIH_TraceLinesAgainstSurfaces;
 		}
 
 		// generate VBOs and other shared data before cloning submodels
@@ -4147,6 +4361,15 @@ void Mod_Q1BSP_Load(dp_model_t *mod, void *buffer, void *bufferend)
 			//Mod_Q1BSP_ProcessLightList();
 		}
 	}
+	Mod_LoadTimings_Stage(loadmodel->name, "submodels", &loadmark);
+
+	// make a single combined shadow mesh to allow optimized shadow volume creation
+	// and build a Bounding Interval Hierarchy for culling triangles in light rendering
+	Mod_Brush_BuildShadowMeshAndBIHs(loadmodel, MOD_BRUSH_RENDERBIH);
+	if (mod_q1bsp_polygoncollisions.integer)
+		for (i = 0;i < loadmodel->brush.numsubmodels;i++)
+			loadmodel->brush.submodels[i]->collision_bih = loadmodel->brush.submodels[i]->render_bih;
+	Mod_LoadTimings_Stage(loadmodel->name, "shadow mesh and bih", &loadmark);
 
 	Con_DPrintf("Stats for q1bsp model \"%s\": %i faces, %i nodes, %i leafs, %i visleafs, %i visleafportals, mesh: %i vertices, %i triangles, %i surfaces\n", loadmodel->name, loadmodel->num_surfaces, loadmodel->brush.num_nodes, loadmodel->brush.num_leafs, mod->brush.num_pvsclusters, loadmodel->brush.num_portals, loadmodel->surfmesh.num_vertices, loadmodel->surfmesh.num_triangles, loadmodel->num_surfaces);
 }
@@ -4753,6 +4976,7 @@ static void Mod_Q2BSP_Load(dp_model_t *mod, void *buffer, void *bufferend)
 	model_brush_lightstyleinfo_t styleinfo[256];
 	unsigned char *datapointer;
 	sizebuf_t sb;
+	double loadmark = Sys_DirtyTime();
 
 	MSG_InitReadBuffer(&sb, (unsigned char *)buffer, (unsigned char *)bufferend - (unsigned char *)buffer);
 
@@ -4787,11 +5011,14 @@ static void Mod_Q2BSP_Load(dp_model_t *mod, void *buffer, void *bufferend)
 	mod->soundfromcenter = true;
 	mod->TracePoint = Mod_CollisionBIH_TracePoint;
 	mod->TraceLine = Mod_CollisionBIH_TraceLine;
+	mod->TraceLines = Mod_CollisionBIH_TraceLines;
 	mod->TraceBox = Mod_CollisionBIH_TraceBox;
 	mod->TraceBrush = Mod_CollisionBIH_TraceBrush;
 	mod->PointSuperContents = Mod_CollisionBIH_PointSuperContents;
 	mod->TraceLineAgainstSurfaces = Mod_CollisionBIH_TraceLine;
+	mod->TraceLinesAgainstSurfaces = Mod_CollisionBIH_TraceLines;
 	mod->brush.TraceLineOfSight = Mod_Q3BSP_TraceLineOfSight;
+	mod->brush.TraceLinesOfSight = Mod_Q3BSP_TraceLinesOfSight;
 	mod->brush.SuperContentsFromNativeContents = Mod_Q2BSP_SuperContentsFromNativeContents;
 	mod->brush.NativeContentsFromSuperContents = Mod_Q2BSP_NativeContentsFromSuperContents;
 	mod->brush.GetPVS = Mod_Q1BSP_GetPVS;
@@ -4852,6 +5079,7 @@ static void Mod_Q2BSP_Load(dp_model_t *mod, void *buffer, void *bufferend)
 	Mod_Q2BSP_LoadLeafs(&lumpsb[Q2LUMP_LEAFS]);
 	Mod_Q2BSP_LoadNodes(&lumpsb[Q2LUMP_NODES]);
 	Mod_Q2BSP_LoadSubmodels(&lumpsb[Q2LUMP_MODELS]);
+	Mod_LoadTimings_Stage(mod->name, "lumps", &loadmark);
 
 	for (i = 0; i < Q2HEADER_LUMPS; i++)
 		if (lumpsb[i].readcount != lumpsb[i].cursize)
@@ -4869,14 +5097,14 @@ static void Mod_Q2BSP_Load(dp_model_t *mod, void *buffer, void *bufferend)
 
 	// the MakePortals code works fine on the q2bsp data as well
 	if (mod_bsp_portalize.integer)
+	{
 		Mod_Q1BSP_MakePortals();
+		Mod_LoadTimings_Stage(mod->name, "portals", &loadmark);
+	}
 
 	mod->numframes = 0;		// q2bsp animations are kind of special, frame is unbounded...
 	mod->numskins = 1;
 
-	// make a single combined shadow mesh to allow optimized shadow volume creation
-	Mod_Q1BSP_CreateShadowMesh(loadmodel);
-
 	if (loadmodel->brush.numsubmodels)
 		loadmodel->brush.submodels = (dp_model_t **)Mem_Alloc(loadmodel->mempool, loadmodel->brush.numsubmodels * sizeof(dp_model_t *));
 
@@ -5047,17 +5275,18 @@ static void Mod_Q2BSP_Load(dp_model_t *mod, void *buffer, void *bufferend)
 		}
 		//mod->brushq1.num_visleafs = bm->visleafs;
 
-		// build a Bounding Interval Hierarchy for culling triangles in light rendering
-		Mod_MakeCollisionBIH(mod, false, &mod->collision_bih);
-
-		// build a Bounding Interval Hierarchy for culling brushes in collision detection
-		Mod_MakeCollisionBIH(mod, true, &mod->render_bih);
-
 		// generate VBOs and other shared data before cloning submodels
 		if (i == 0)
 			Mod_BuildVBOs();
 	}
 	mod = loadmodel;
+	Mod_LoadTimings_Stage(mod->name, "submodels", &loadmark);
+
+	// make a single combined shadow mesh to allow optimized shadow volume creation,
+	// and build Bounding Interval Hierarchies for culling brushes in collision
+	// detection and triangles in light rendering
+	Mod_Brush_BuildShadowMeshAndBIHs(mod, MOD_BRUSH_COLLISIONBIH | MOD_BRUSH_RENDERBIH);
+	Mod_LoadTimings_Stage(mod->name, "shadow mesh and bih", &loadmark);
 
 	Con_DPrintf("Stats for q2bsp model \"%s\": %i faces, %i nodes, %i leafs, %i clusters, %i clusterportals, mesh: %i vertices, %i triangles, %i surfaces\n", loadmodel->name, loadmodel->num_surfaces, loadmodel->brush.num_nodes, loadmodel->brush.num_leafs, mod->brush.num_pvsclusters, loadmodel->brush.num_portals, loadmodel->surfmesh.num_vertices, loadmodel->surfmesh.num_triangles, loadmodel->num_surfaces);
 }
@@ -6701,6 +6930,8 @@ static int Mod_Q3BSP_TraceLineOfSight_RecursiveNodeCheck(mnode_t *node, double p
 	return ((mleaf_t *)node)->clusterindex < 0;
 }
 
+static void Mod_Q3BSP_TraceLines(dp_model_t *model, const frameblend_t *frameblend, const skeleton_t *skeleton, int numtraces, trace_t *traces, const float *starts, const float *ends, int hitsupercontentsmask);
+
 static qboolean Mod_Q3BSP_TraceLineOfSight(struct model_s *model, const vec3_t start, const vec3_t end)
 {
 	if (model->brush.submodel || mod_q3bsp_tracelineofsight_brushes.integer)
@@ -6718,11 +6949,31 @@ static qboolean Mod_Q3BSP_TraceLineOfSight(struct model_s *model, const vec3_t s
 	}
 }
 
+static void Mod_Q3BSP_TraceLinesOfSight(struct model_s *model, int numtraces, const float *starts, const float *ends, qboolean *visible)
+{
+	int i;
+	trace_t traces[MAX_TRACELINESBATCH];
+	if (!model->brush.submodel && !mod_q3bsp_tracelineofsight_brushes.integer)
+	{
+		// the vis check is already cheap
+		for (i = 0;i < numtraces;i++)
+			visible[i] = Mod_Q3BSP_TraceLineOfSight(model, starts + i*3, ends + i*3);
+		return;
+	}
+	for (;numtraces > 0;numtraces -= MAX_TRACELINESBATCH, starts += MAX_TRACELINESBATCH*3, ends += MAX_TRACELINESBATCH*3, visible += MAX_TRACELINESBATCH)
+	{
+		Mod_Q3BSP_TraceLines(model, NULL, NULL, min(numtraces, MAX_TRACELINESBATCH), traces, starts, ends, SUPERCONTENTS_VISBLOCKERMASK);
+		for (i = 0;i < min(numtraces, MAX_TRACELINESBATCH);i++)
+			visible[i] = traces[i].fraction == 1;
+	}
+}
+
 void Mod_CollisionBIH_TracePoint(dp_model_t *model, const frameblend_t *frameblend, const skeleton_t *skeleton, trace_t *trace, const vec3_t start, int hitsupercontentsmask)
 {
 	const bih_t *bih;
 	const bih_leaf_t *leaf;
 	const bih_node_t *node;
+	bih_node_t nodeview;
 	const colbrushf_t *brush;
 	int axis;
 	int nodenum;
@@ -6734,7 +6985,7 @@ void Mod_CollisionBIH_TracePoint(dp_model_t *model, const frameblend_t *frameble
 	trace->hitsupercontentsmask = hitsupercontentsmask;
 
 	bih = &model->collision_bih;
-	if(!bih->nodes)
+	if(!bih->numnodes)
 		return;
 
 	nodenum = bih->rootnode;
@@ -6742,7 +6993,7 @@ void Mod_CollisionBIH_TracePoint(dp_model_t *model, const frameblend_t *frameble
 	while (nodestackpos)
 	{
 		nodenum = nodestack[--nodestackpos];
-		node = bih->nodes + nodenum;
+		node = BIH_GetNode(bih, nodenum, &nodeview);
 #if 1
 		if (!BoxesOverlap(start, start, node->mins, node->maxs))
 			continue;
@@ -6782,10 +7033,11 @@ void Mod_CollisionBIH_TracePoint(dp_model_t *model, const frameblend_t *frameble
 	}
 }
 
-static void Mod_CollisionBIH_TraceLineShared(dp_model_t *model, const frameblend_t *frameblend, const skeleton_t *skeleton, trace_t *trace, const vec3_t start, const vec3_t end, int hitsupercontentsmask, const bih_t *bih)
+static void Mod_CollisionBIH_TraceLineShared(dp_model_t *model, const frameblend_t *frameblend, const skeleton_t *skeleton, trace_t *trace, const vec3_t start, const vec3_t end, int hitsupercontentsmask, const bih_t *bih, int *numnodesvisited)
 {
 	const bih_leaf_t *leaf;
 	const bih_node_t *node;
+	bih_node_t nodeview;
 	const colbrushf_t *brush;
 	const int *e;
 	const texture_t *texture;
@@ -6793,7 +7045,7 @@ static void Mod_CollisionBIH_TraceLineShared(dp_model_t *model, const frameblend
 	vec_t d1, d2, d3, d4, f, nodestackline[1024][6];
 	int axis, nodenum, nodestackpos = 0, nodestack[1024];
 
-	if(!bih->nodes)
+	if(!bih->numnodes)
 		return;
 
 	if (VectorCompare(start, end))
@@ -6819,7 +7071,9 @@ static void Mod_CollisionBIH_TraceLineShared(dp_model_t *model, const frameblend
 	while (nodestackpos)
 	{
 		nodenum = nodestack[--nodestackpos];
-		node = bih->nodes + nodenum;
+		node = BIH_GetNode(bih, nodenum, &nodeview);
+		if (numnodesvisited)
+			(*numnodesvisited)++;
 		VectorCopy(nodestackline[nodestackpos], nodestart);
 		VectorCopy(nodestackline[nodestackpos] + 3, nodeend);
 		sweepnodemins[0] = min(nodestart[0], nodeend[0]) - 1;
@@ -6912,7 +7166,192 @@ void Mod_CollisionBIH_TraceLine(dp_model_t *model, const frameblend_t *frameblen
 		Mod_CollisionBIH_TracePoint(model, frameblend, skeleton, trace, start, hitsupercontentsmask);
 		return;
 	}
-	Mod_CollisionBIH_TraceLineShared(model, frameblend, skeleton, trace, start, end, hitsupercontentsmask, &model->collision_bih);
+	Mod_CollisionBIH_TraceLineShared(model, frameblend, skeleton, trace, start, end, hitsupercontentsmask, &model->collision_bih, NULL);
+}
+
+// packet tracing: BIH_PACKETSIZE rays walk the tree together, each lane keeps
+// the part of its line (as a 0-1 fraction range) that is still inside the
+// node boxes, and leafs are clipped against only the lanes that reach them
+#define BIH_PACKETSIZE 4
+
+typedef struct bih_tracepacket_s
+{
+	// one lane per ray in each array
+	float origin[3][BIH_PACKETSIZE];
+	float invdelta[3][BIH_PACKETSIZE];
+	trace_t *traces[BIH_PACKETSIZE];
+	const float *starts[BIH_PACKETSIZE];
+	const float *ends[BIH_PACKETSIZE];
+}
+bih_tracepacket_t;
+
+typedef struct bih_tracepacketnode_s
+{
+	int nodenum;
+	float tmin[BIH_PACKETSIZE];
+	float tmax[BIH_PACKETSIZE];
+}
+bih_tracepacketnode_t;
+
+// clips the lane ranges to the box (enlarged by 1 unit like the single line
+// trace does), returns a bit for each lane that still has some line left
+static int Mod_CollisionBIH_TracePacketBox(const bih_tracepacket_t *p, const float *mins, const float *maxs, float *tmin, float *tmax)
+{
+#ifdef SSE_PRESENT
+	__m128 lo = _mm_loadu_ps(tmin), hi = _mm_loadu_ps(tmax), org, inv, t1, t2;
+	int axis;
+	for (axis = 0;axis < 3;axis++)
+	{
+		org = _mm_loadu_ps(p->origin[axis]);
+		inv = _mm_loadu_ps(p->invdelta[axis]);
+		t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(mins[axis] - 1), org), inv);
+		t2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(maxs[axis] + 1), org), inv);
+		lo = _mm_max_ps(lo, _mm_min_ps(t1, t2));
+		hi = _mm_min_ps(hi, _mm_max_ps(t1, t2));
+	}
+	_mm_storeu_ps(tmin, lo);
+	_mm_storeu_ps(tmax, hi);
+	return _mm_movemask_ps(_mm_cmple_ps(lo, hi));
+#else
+	int axis, lane, mask = 0;
+	float t1, t2;
+	for (lane = 0;lane < BIH_PACKETSIZE;lane++)
+	{
+		for (axis = 0;axis < 3;axis++)
+		{
+			t1 = (mins[axis] - 1 - p->origin[axis][lane]) * p->invdelta[axis][lane];
+			t2 = (maxs[axis] + 1 - p->origin[axis][lane]) * p->invdelta[axis][lane];
+			tmin[lane] = max(tmin[lane], min(t1, t2));
+			tmax[lane] = min(tmax[lane], max(t1, t2));
+		}
+		if (tmin[lane] <= tmax[lane])
+			mask |= 1 << lane;
+	}
+	return mask;
+#endif
+}
+
+static void Mod_CollisionBIH_TracePacket(dp_model_t *model, const bih_tracepacket_t *p, const bih_t *bih)
+{
+	const bih_leaf_t *leaf;
+	const bih_node_t *node;
+	bih_node_t nodeview;
+	const colbrushf_t *brush;
+	const int *e;
+	const texture_t *texture;
+	bih_tracepacketnode_t *s;
+	float leaftmin[BIH_PACKETSIZE], leaftmax[BIH_PACKETSIZE];
+	int i, lane, lanes, leaflanes, nodestackpos = 1;
+	bih_tracepacketnode_t nodestack[1024];
+
+	nodestack[0].nodenum = bih->rootnode;
+	for (lane = 0;lane < BIH_PACKETSIZE;lane++)
+	{
+		// unused lanes get an empty range so they never reach anything
+		nodestack[0].tmin[lane] = p->traces[lane] ? 0 : 1;
+		nodestack[0].tmax[lane] = p->traces[lane] ? 1 : 0;
+	}
+	while (nodestackpos)
+	{
+		s = nodestack + --nodestackpos;
+		node = BIH_GetNode(bih, s->nodenum, &nodeview);
+		// nothing past the closest impact so far can change the result
+		for (lane = 0;lane < BIH_PACKETSIZE;lane++)
+			if (p->traces[lane])
+				s->tmax[lane] = min(s->tmax[lane], (float)p->traces[lane]->fraction);
+		lanes = Mod_CollisionBIH_TracePacketBox(p, node->mins, node->maxs, s->tmin, s->tmax);
+		if (!lanes)
+			continue;
+		if (node->type <= BIH_SPLITZ && nodestackpos+2 <= 1024)
+		{
+			// push back first so front is done first, like the single line
+			// trace, the children check their own boxes when popped
+			nodestack[nodestackpos + 1] = *s;
+			nodestack[nodestackpos + 1].nodenum = node->front;
+			nodestack[nodestackpos].nodenum = node->back;
+			nodestackpos += 2;
+		}
+		else if (node->type == BIH_UNORDERED)
+		{
+			for (i = 0;i < BIH_MAXUNORDEREDCHILDREN && node->children[i] >= 0;i++)
+			{
+				leaf = bih->leafs + node->children[i];
+				memcpy(leaftmin, s->tmin, sizeof(leaftmin));
+				memcpy(leaftmax, s->tmax, sizeof(leaftmax));
+				leaflanes = Mod_CollisionBIH_TracePacketBox(p, leaf->mins, leaf->maxs, leaftmin, leaftmax) & lanes;
+				for (lane = 0;leaflanes;lane++, leaflanes >>= 1)
+				{
+					if (!(leaflanes & 1))
+						continue;
+					switch(leaf->type)
+					{
+					case BIH_BRUSH:
+						brush = model->brush.data_brushes[leaf->itemindex].colbrushf;
+						Collision_TraceLineBrushFloat(p->traces[lane], p->starts[lane], p->ends[lane], brush, brush);
+						break;
+					case BIH_COLLISIONTRIANGLE:
+						if (!mod_q3bsp_curves_collisions.integer)
+							break;
+						e = model->brush.data_collisionelement3i + 3*leaf->itemindex;
+						texture = model->data_textures + leaf->textureindex;
+						Collision_TraceLineTriangleFloat(p->traces[lane], p->starts[lane], p->ends[lane], model->brush.data_collisionvertex3f + e[0] * 3, model->brush.data_collisionvertex3f + e[1] * 3, model->brush.data_collisionvertex3f + e[2] * 3, texture->supercontents, texture->surfaceflags, texture);
+						break;
+					case BIH_RENDERTRIANGLE:
+						e = model->surfmesh.data_element3i + 3*leaf->itemindex;
+						texture = model->data_textures + leaf->textureindex;
+						Collision_TraceLineTriangleFloat(p->traces[lane], p->starts[lane], p->ends[lane], model->surfmesh.data_vertex3f + e[0] * 3, model->surfmesh.data_vertex3f + e[1] * 3, model->surfmesh.data_vertex3f + e[2] * 3, texture->supercontents, texture->surfaceflags, texture);
+						break;
+					}
+				}
+			}
+		}
+	}
+}
+
+static void Mod_CollisionBIH_TraceLinesShared(dp_model_t *model, const frameblend_t *frameblend, const skeleton_t *skeleton, int numtraces, trace_t *traces, const float *starts, const float *ends, int hitsupercontentsmask, const bih_t *bih)
+{
+	bih_tracepacket_t p;
+	int i, axis, lane = 0;
+	float delta;
+
+	memset(&p, 0, sizeof(p));
+	for (i = 0;i < numtraces;i++)
+	{
+		if (VectorCompare(starts + i*3, ends + i*3))
+		{
+			Mod_CollisionBIH_TracePoint(model, frameblend, skeleton, traces + i, starts + i*3, hitsupercontentsmask);
+			continue;
+		}
+		memset(traces + i, 0, sizeof(traces[i]));
+		traces[i].fraction = 1;
+		traces[i].hitsupercontentsmask = hitsupercontentsmask;
+		if (!bih->numnodes)
+			continue;
+		p.traces[lane] = traces + i;
+		p.starts[lane] = starts + i*3;
+		p.ends[lane] = ends + i*3;
+		for (axis = 0;axis < 3;axis++)
+		{
+			// a huge reciprocal rather than infinity for lines parallel to
+			// the axis, so a line lying exactly on a box plane still counts
+			delta = ends[i*3+axis] - starts[i*3+axis];
+			p.origin[axis][lane] = starts[i*3+axis];
+			p.invdelta[axis][lane] = fabs(delta) > 1e-20f ? 1.0f / delta : 1e20f;
+		}
+		if (++lane == BIH_PACKETSIZE)
+		{
+			Mod_CollisionBIH_TracePacket(model, &p, bih);
+			memset(&p, 0, sizeof(p));
+			lane = 0;
+		}
+	}
+	if (lane)
+		Mod_CollisionBIH_TracePacket(model, &p, bih);
+}
+
+void Mod_CollisionBIH_TraceLines(dp_model_t *model, const frameblend_t *frameblend, const skeleton_t *skeleton, int numtraces, trace_t *traces, const float *starts, const float *ends, int hitsupercontentsmask)
+{
+	Mod_CollisionBIH_TraceLinesShared(model, frameblend, skeleton, numtraces, traces, starts, ends, hitsupercontentsmask, &model->collision_bih);
 }
 
 void Mod_CollisionBIH_TraceBrush(dp_model_t *model, const frameblend_t *frameblend, const skeleton_t *skeleton, trace_t *trace, colbrushf_t *thisbrush_start, colbrushf_t *thisbrush_end, int hitsupercontentsmask)
@@ -6920,6 +7359,7 @@ void Mod_CollisionBIH_TraceBrush(dp_model_t *model, const frameblend_t *frameble
 	const bih_t *bih;
 	const bih_leaf_t *leaf;
 	const bih_node_t *node;
+	bih_node_t nodeview;
 	const colbrushf_t *brush;
 	const int *e;
 	const texture_t *texture;
@@ -6938,7 +7378,7 @@ void Mod_CollisionBIH_TraceBrush(dp_model_t *model, const frameblend_t *frameble
 	}
 
 	bih = &model->collision_bih;
-	if(!bih->nodes)
+	if(!bih->numnodes)
 		return;
 	nodenum = bih->rootnode;
 
@@ -6972,7 +7412,7 @@ void Mod_CollisionBIH_TraceBrush(dp_model_t *model, const frameblend_t *frameble
 	while (nodestackpos)
 	{
 		nodenum = nodestack[--nodestackpos];
-		node = bih->nodes + nodenum;
+		node = BIH_GetNode(bih, nodenum, &nodeview);
 		VectorCopy(nodestackline[nodestackpos], nodestart);
 		VectorCopy(nodestackline[nodestackpos] + 3, nodeend);
 		sweepnodemins[0] = min(nodestart[0], nodeend[0]) + mins[0] - 1;
@@ -7339,7 +7779,19 @@ static void Mod_Q3BSP_TraceBrush_RecursiveBSPNode(trace_t *trace, dp_model_t *mo
 }
 
 
-static int markframe = 0;
+// the marks are stored in the shared brushes and surfaces, so traces running
+// at the same time on task queue workers must never use the same value: each
+// thread counts on its own and puts its thread number in the low bits (a
+// brush marked by another thread is just tested again)
+static THREAD_LOCAL int markframe = 0;
+
+static int Mod_Q3BSP_NextMarkFrame(void)
+{
+	markframe = (markframe + 1) & 0x1FFFFFF;
+	if (!markframe)
+		markframe = 1;
+	return (markframe << 6) | TaskQueue_ThreadNumber();
+}
 
 static void Mod_Q3BSP_TracePoint(dp_model_t *model, const frameblend_t *frameblend, const skeleton_t *skeleton, trace_t *trace, const vec3_t start, int hitsupercontentsmask)
 {
@@ -7357,7 +7809,7 @@ static void Mod_Q3BSP_TracePoint(dp_model_t *model, const frameblend_t *frameble
 				Collision_TracePointBrushFloat(trace, start, brush->colbrushf);
 	}
 	else
-		Mod_Q3BSP_TracePoint_RecursiveBSPNode(trace, model, model->brush.data_nodes, start, ++markframe);
+		Mod_Q3BSP_TracePoint_RecursiveBSPNode(trace, model, model->brush.data_nodes, start, Mod_Q3BSP_NextMarkFrame());
 }
 
 static void Mod_Q3BSP_TraceLine(dp_model_t *model, const frameblend_t *frameblend, const skeleton_t *skeleton, trace_t *trace, const vec3_t start, const vec3_t end, int hitsupercontentsmask)
@@ -7395,7 +7847,17 @@ static void Mod_Q3BSP_TraceLine(dp_model_t *model, const frameblend_t *frameblen
 					Collision_TraceLineTriangleMeshFloat(trace, start, end, surface->num_collisiontriangles, surface->deprecatedq3data_collisionelement3i, surface->deprecatedq3data_collisionvertex3f, surface->deprecatedq3num_collisionbboxstride, surface->deprecatedq3data_collisionbbox6f, surface->texture->supercontents, surface->texture->surfaceflags, surface->texture, segmentmins, segmentmaxs);
 	}
 	else
-		Mod_Q3BSP_TraceLine_RecursiveBSPNode(trace, model, model->brush.data_nodes, start, end, 0, 1, start, end, ++markframe, segmentmins, segmentmaxs);
+		Mod_Q3BSP_TraceLine_RecursiveBSPNode(trace, model, model->brush.data_nodes, start, end, 0, 1, start, end, Mod_Q3BSP_NextMarkFrame(), segmentmins, segmentmaxs);
+}
+
+static void Mod_Q3BSP_TraceLines(dp_model_t *model, const frameblend_t *frameblend, const skeleton_t *skeleton, int numtraces, trace_t *traces, const float *starts, const float *ends, int hitsupercontentsmask)
+{
+	int i;
+	if (mod_collision_bih.integer)
+		Mod_CollisionBIH_TraceLines(model, frameblend, skeleton, numtraces, traces, starts, ends, hitsupercontentsmask);
+	else
+		for (i = 0;i < numtraces;i++)
+			Mod_Q3BSP_TraceLine(model, frameblend, skeleton, traces + i, starts + i*3, ends + i*3, hitsupercontentsmask);
 }
 
 static void Mod_Q3BSP_TraceBrush(dp_model_t *model, const frameblend_t *frameblend, const skeleton_t *skeleton, trace_t *trace, colbrushf_t *start, colbrushf_t *end, int hitsupercontentsmask)
@@ -7437,7 +7899,7 @@ static void Mod_Q3BSP_TraceBrush(dp_model_t *model, const frameblend_t *frameble
 					Collision_TraceBrushTriangleMeshFloat(trace, start, end, surface->num_collisiontriangles, surface->deprecatedq3data_collisionelement3i, surface->deprecatedq3data_collisionvertex3f, surface->deprecatedq3num_collisionbboxstride, surface->deprecatedq3data_collisionbbox6f, surface->texture->supercontents, surface->texture->surfaceflags, surface->texture, segmentmins, segmentmaxs);
 	}
 	else
-		Mod_Q3BSP_TraceBrush_RecursiveBSPNode(trace, model, model->brush.data_nodes, start, end, ++markframe, segmentmins, segmentmaxs);
+		Mod_Q3BSP_TraceBrush_RecursiveBSPNode(trace, model, model->brush.data_nodes, start, end, Mod_Q3BSP_NextMarkFrame(), segmentmins, segmentmaxs);
 }
 
 static void Mod_Q3BSP_TraceBox(dp_model_t *model, const frameblend_t *frameblend, const skeleton_t *skeleton, trace_t *trace, const vec3_t start, const vec3_t boxmins, const vec3_t boxmaxs, const vec3_t end, int hitsupercontentsmask)
@@ -7493,7 +7955,12 @@ static int Mod_Q3BSP_PointSuperContents(struct model_s *model, int frame, const
 
 void Mod_CollisionBIH_TraceLineAgainstSurfaces(dp_model_t *model, const frameblend_t *frameblend, const skeleton_t *skeleton, trace_t *trace, const vec3_t start, const vec3_t end, int hitsupercontentsmask)
 {
-	Mod_CollisionBIH_TraceLineShared(model, frameblend, skeleton, trace, start, end, hitsupercontentsmask, &model->render_bih);
+	Mod_CollisionBIH_TraceLineShared(model, frameblend, skeleton, trace, start, end, hitsupercontentsmask, &model->render_bih, NULL);
+}
+
+void Mod_CollisionBIH_TraceLinesAgainstSurfaces(dp_model_t *model, const frameblend_t *frameblend, const skeleton_t *skeleton, int numtraces, trace_t *traces, const float *starts, const float *ends, int hitsupercontentsmask)
+{
+	Mod_CollisionBIH_TraceLinesShared(model, frameblend, skeleton, numtraces, traces, starts, ends, hitsupercontentsmask, &model->render_bih);
 }
 
 
@@ -7617,13 +8084,21 @@ bih_t *Mod_MakeCollisionBIH(dp_model_t *model, qboolean userendersurfaces, bih_t
 	temp_leafsortscratch = temp_leafsort + bihnumleafs;
 
 	// now build it
-	BIH_Build(out, bihnumleafs, bihleafs, bihmaxnodes, bihnodes, temp_leafsort, temp_leafsortscratch);
+	BIH_Build(out, bihnumleafs, bihleafs, bihmaxnodes, bihnodes, temp_leafsort, temp_leafsortscratch, mod_collision_bih_sah.integer ? BIH_BUILDFLAG_SAH : 0);
 
 	// we're done with the temporary data
 	Mem_Free(temp_leafsort);
 
+	// make the compact copy the traversals will read, it replaces the nodes
+	if (mod_collision_bih_packed.integer && !out->error && out->numnodes)
+	{
+		BIH_Pack(out, (bih_packednode_t *)Mem_Alloc(loadmodel->mempool, sizeof(bih_packednode_t) * out->numnodes), (int *)Mem_Alloc(loadmodel->mempool, sizeof(int) * bihnumleafs));
+		Mem_Free(out->nodes);
+		out->nodes = NULL;
+		out->maxnodes = 0;
+	}
 	// resize the BIH nodes array if it over-allocated
-	if (out->maxnodes > out->numnodes)
+	else if (out->maxnodes > out->numnodes)
 	{
 		out->maxnodes = out->numnodes;
 		out->nodes = (bih_node_t *)Mem_Realloc(loadmodel->mempool, out->nodes, out->numnodes * sizeof(bih_node_t));
@@ -7632,6 +8107,74 @@ bih_t *Mod_MakeCollisionBIH(dp_model_t *model, qboolean userendersurfaces, bih_t
 	return out;
 }
 
+typedef struct mod_bihstats_s
+{
+	int numnodes;
+	int numunordered;
+	int numleafs;
+	int maxdepth;
+	double leafdepthsum;
+}
+mod_bihstats_t;
+
+static void Mod_BIHStats_RecursiveNode(const bih_t *bih, int nodenum, int depth, mod_bihstats_t *stats)
+{
+	int i;
+	bih_node_t nodeview;
+	const bih_node_t *node = BIH_GetNode(bih, nodenum, &nodeview);
+	stats->numnodes++;
+	stats->maxdepth = max(stats->maxdepth, depth);
+	if (node->type == BIH_UNORDERED)
+	{
+		stats->numunordered++;
+		for (i = 0;i < BIH_MAXUNORDEREDCHILDREN && node->children[i] >= 0;i++)
+		{
+			stats->numleafs++;
+			stats->leafdepthsum += depth;
+		}
+		return;
+	}
+	// copy the children first, nodeview is reused by the recursion
+	i = node->back;
+	Mod_BIHStats_RecursiveNode(bih, node->front, depth + 1, stats);
+	Mod_BIHStats_RecursiveNode(bih, i, depth + 1, stats);
+}
+
+static void Mod_BIHStats_Print(dp_model_t *model, const char *name, const bih_t *bih)
+{
+	int i, numnodesvisited = 0;
+	mod_bihstats_t stats;
+	vec3_t start, end;
+	trace_t trace;
+	if (!bih->numnodes)
+	{
+		Con_Printf("%s: not built\n", name);
+		return;
+	}
+	memset(&stats, 0, sizeof(stats));
+	Mod_BIHStats_RecursiveNode(bih, bih->rootnode, 0, &stats);
+	for (i = 0;i < 4096;i++)
+	{
+		VectorSet(start, lhrandom(model->normalmins[0], model->normalmaxs[0]), lhrandom(model->normalmins[1], model->normalmaxs[1]), lhrandom(model->normalmins[2], model->normalmaxs[2]));
+		VectorSet(end, lhrandom(model->normalmins[0], model->normalmaxs[0]), lhrandom(model->normalmins[1], model->normalmaxs[1]), lhrandom(model->normalmins[2], model->normalmaxs[2]));
+		Mod_CollisionBIH_TraceLineShared(model, NULL, NULL, &trace, start, end, SUPERCONTENTS_SOLID, bih, &numnodesvisited);
+	}
+	Con_Printf("%s: %i nodes (%i unordered), %i leafs, depth %i max %.1f average leaf, %s layout %i bytes, %.1f nodes visited per random line\n", name, stats.numnodes, stats.numunordered, stats.numleafs, stats.maxdepth, stats.numleafs ? stats.leafdepthsum / stats.numleafs : 0.0, bih->packednodes ? "packed" : "unpacked", bih->packednodes ? (int)(bih->numnodes * sizeof(bih_packednode_t) + stats.numleafs * sizeof(int)) : (int)(bih->numnodes * sizeof(bih_node_t)), numnodesvisited / 4096.0);
+}
+
+static void Mod_BIHStats_f(void)
+{
+	dp_model_t *model = sv.active ? sv.worldmodel : cl.worldmodel;
+	if (!model)
+	{
+		Con_Print("mod_bihstats: no map loaded\n");
+		return;
+	}
+	Con_Printf("%s:\n", model->name);
+	Mod_BIHStats_Print(model, "collision_bih", &model->collision_bih);
+	Mod_BIHStats_Print(model, "render_bih", &model->render_bih);
+}
+
 static int Mod_Q3BSP_SuperContentsFromNativeContents(dp_model_t *model, int nativecontents)
 {
 	int supercontents = 0;
@@ -7710,6 +8253,7 @@ static void Mod_Q3BSP_Load(dp_model_t *mod, void *buffer, void *bufferend)
 	int i, j, lumps;
 	q3dheader_t *header;
 	float corner[3], yawradius, modelradius;
+	double loadmark = Sys_DirtyTime();
 
 	mod->modeldatatypestring = "Q3BSP";
 
@@ -7734,10 +8278,13 @@ static void Mod_Q3BSP_Load(dp_model_t *mod, void *buffer, void *bufferend)
 	mod->TraceBox = Mod_Q3BSP_TraceBox;
 	mod->TraceBrush = Mod_Q3BSP_TraceBrush;
 	mod->TraceLine = Mod_Q3BSP_TraceLine;
+	mod->TraceLines = Mod_Q3BSP_TraceLines;
 	mod->TracePoint = Mod_Q3BSP_TracePoint;
 	mod->PointSuperContents = Mod_Q3BSP_PointSuperContents;
 	mod->TraceLineAgainstSurfaces = Mod_CollisionBIH_TraceLine;
+	mod->TraceLinesAgainstSurfaces = Mod_CollisionBIH_TraceLines;
 	mod->brush.TraceLineOfSight = Mod_Q3BSP_TraceLineOfSight;
+	mod->brush.TraceLinesOfSight = Mod_Q3BSP_TraceLinesOfSight;
 	mod->brush.SuperContentsFromNativeContents = Mod_Q3BSP_SuperContentsFromNativeContents;
 	mod->brush.NativeContentsFromSuperContents = Mod_Q3BSP_NativeContentsFromSuperContents;
 	mod->brush.GetPVS = Mod_Q1BSP_GetPVS;
@@ -7804,9 +8351,11 @@ static void Mod_Q3BSP_Load(dp_model_t *mod, void *buffer, void *bufferend)
 		// all this checksumming can take a while, so let's send keepalives here too
 		CL_KeepaliveMessage(false);
 	}
+	Mod_LoadTimings_Stage(mod->name, "checksum", &loadmark);
 
 	Mod_Q3BSP_LoadEntities(&header->lumps[Q3LUMP_ENTITIES]);
 	Mod_Q3BSP_LoadTextures(&header->lumps[Q3LUMP_TEXTURES]);
+	Mod_LoadTimings_Stage(mod->name, "textures", &loadmark);
 	Mod_Q3BSP_LoadPlanes(&header->lumps[Q3LUMP_PLANES]);
 	if (header->version == Q3BSPVERSION_IG)
 		Mod_Q3BSP_LoadBrushSides_IG(&header->lumps[Q3LUMP_BRUSHSIDES]);
@@ -7816,8 +8365,11 @@ static void Mod_Q3BSP_Load(dp_model_t *mod, void *buffer, void *bufferend)
 	Mod_Q3BSP_LoadEffects(&header->lumps[Q3LUMP_EFFECTS]);
 	Mod_Q3BSP_LoadVertices(&header->lumps[Q3LUMP_VERTICES]);
 	Mod_Q3BSP_LoadTriangles(&header->lumps[Q3LUMP_TRIANGLES]);
+	Mod_LoadTimings_Stage(mod->name, "brushes and vertices", &loadmark);
 	Mod_Q3BSP_LoadLightmaps(&header->lumps[Q3LUMP_LIGHTMAPS], &header->lumps[Q3LUMP_FACES]);
+	Mod_LoadTimings_Stage(mod->name, "lightmaps", &loadmark);
 	Mod_Q3BSP_LoadFaces(&header->lumps[Q3LUMP_FACES]);
+	Mod_LoadTimings_Stage(mod->name, "faces", &loadmark);
 	Mod_Q3BSP_LoadModels(&header->lumps[Q3LUMP_MODELS]);
 	Mod_Q3BSP_LoadLeafBrushes(&header->lumps[Q3LUMP_LEAFBRUSHES]);
 	Mod_Q3BSP_LoadLeafFaces(&header->lumps[Q3LUMP_LEAFFACES]);
@@ -7826,17 +8378,18 @@ static void Mod_Q3BSP_Load(dp_model_t *mod, void *buffer, void *bufferend)
 	Mod_Q3BSP_LoadLightGrid(&header->lumps[Q3LUMP_LIGHTGRID]);
 	Mod_Q3BSP_LoadPVS(&header->lumps[Q3LUMP_PVS]);
 	loadmodel->brush.numsubmodels = loadmodel->brushq3.num_models;
+	Mod_LoadTimings_Stage(mod->name, "bsp tree", &loadmark);
 
 	// the MakePortals code works fine on the q3bsp data as well
 	if (mod_bsp_portalize.integer)
+	{
 		Mod_Q1BSP_MakePortals();
+		Mod_LoadTimings_Stage(mod->name, "portals", &loadmark);
+	}
 
 	// FIXME: shader alpha should replace r_wateralpha support in q3bsp
 	loadmodel->brush.supportwateralpha = true;
 
-	// make a single combined shadow mesh to allow optimized shadow volume creation
-	Mod_Q1BSP_CreateShadowMesh(loadmodel);
-
 	loadmodel->brush.num_leafs = 0;
 	Mod_Q3BSP_RecursiveFindNumLeafs(loadmodel->brush.data_nodes);
 
@@ -7937,13 +8490,15 @@ static void Mod_Q3BSP_Load(dp_model_t *mod, void *buffer, void *bufferend)
 		if (j < mod->nummodelsurfaces)
 			mod->DrawAddWaterPlanes = R_Q1BSP_DrawAddWaterPlanes;
 
-		Mod_MakeCollisionBIH(mod, false, &mod->collision_bih);
-		Mod_MakeCollisionBIH(mod, true, &mod->render_bih);
-
 		// generate VBOs and other shared data before cloning submodels
 		if (i == 0)
 			Mod_BuildVBOs();
 	}
+	Mod_LoadTimings_Stage(loadmodel->name, "submodels", &loadmark);
+
+	// make a single combined shadow mesh to allow optimized shadow volume creation
+	Mod_Brush_BuildShadowMeshAndBIHs(loadmodel, MOD_BRUSH_COLLISIONBIH | MOD_BRUSH_RENDERBIH);
+	Mod_LoadTimings_Stage(loadmodel->name, "shadow mesh and bih", &loadmark);
 
 	if (mod_q3bsp_sRGBlightmaps.integer)
 	{
@@ -8041,6 +8596,7 @@ void Mod_OBJ_Load(dp_model_t *mod, void *buffer, void *bufferend)
 	int *submodelfirstsurface;
 	msurface_t *surface;
 	msurface_t *tempsurfaces;
+	double loadmark = Sys_DirtyTime();
 
 	memset(&vfirst, 0, sizeof(vfirst));
 	memset(&vprev, 0, sizeof(vprev));
@@ -8055,8 +8611,10 @@ void Mod_OBJ_Load(dp_model_t *mod, void *buffer, void *bufferend)
 	loadmodel->TraceBox = Mod_CollisionBIH_TraceBox;
 	loadmodel->TraceBrush = Mod_CollisionBIH_TraceBrush;
 	loadmodel->TraceLine = Mod_CollisionBIH_TraceLine;
+	loadmodel->TraceLines = Mod_CollisionBIH_TraceLines;
 	loadmodel->TracePoint = Mod_CollisionBIH_TracePoint_Mesh;
 	loadmodel->TraceLineAgainstSurfaces = Mod_CollisionBIH_TraceLine;
+	loadmodel->TraceLinesAgainstSurfaces = Mod_CollisionBIH_TraceLines;
 	loadmodel->PointSuperContents = Mod_CollisionBIH_PointSuperContents_Mesh;
 	loadmodel->brush.TraceLineOfSight = NULL;
 	loadmodel->brush.SuperContentsFromNativeContents = NULL;
@@ -8456,9 +9014,7 @@ void Mod_OBJ_Load(dp_model_t *mod, void *buffer, void *bufferend)
 	Mem_Free(vn);
 	Mem_Free(vertexhashtable);
 	Mem_Free(vertexhashdata);
-
-	// make a single combined shadow mesh to allow optimized shadow volume creation
-	Mod_Q1BSP_CreateShadowMesh(loadmodel);
+	Mod_LoadTimings_Stage(loadmodel->name, "parse", &loadmark);
 
 	// compute all the mesh information that was not loaded from the file
 	if (loadmodel->surfmesh.data_element3s)
@@ -8593,14 +9149,18 @@ void Mod_OBJ_Load(dp_model_t *mod, void *buffer, void *bufferend)
 		if (j < mod->nummodelsurfaces)
 			mod->DrawAddWaterPlanes = R_Q1BSP_DrawAddWaterPlanes;
 
-		Mod_MakeCollisionBIH(mod, true, &mod->collision_bih);
-		mod->render_bih = mod->collision_bih;
-
 		// generate VBOs and other shared data before cloning submodels
 		if (i == 0)
 			Mod_BuildVBOs();
 	}
 	mod = loadmodel;
+	Mod_LoadTimings_Stage(mod->name, "submodels", &loadmark);
+
+	// make a single combined shadow mesh to allow optimized shadow volume creation
+	Mod_Brush_BuildShadowMeshAndBIHs(mod, MOD_BRUSH_RENDERBIH);
+	for (i = 0;i < loadmodel->brush.numsubmodels;i++)
+		loadmodel->brush.submodels[i]->collision_bih = loadmodel->brush.submodels[i]->render_bih;
+	Mod_LoadTimings_Stage(mod->name, "shadow mesh and bih", &loadmark);
 	Mem_Free(submodelfirstsurface);
 
 	Con_DPrintf("Stats for obj model \"%s\": %i faces, %i nodes, %i leafs, %i clusters, %i clusterportals, mesh: %i vertices, %i triangles, %i surfaces\n", loadmodel->name, loadmodel->num_surfaces, loadmodel->brush.num_nodes, loadmodel->brush.num_leafs, mod->brush.num_pvsclusters, loadmodel->brush.num_portals, loadmodel->surfmesh.num_vertices, loadmodel->surfmesh.num_triangles, loadmodel->num_surfaces);
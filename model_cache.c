@@ -0,0 +1,535 @@
+// model_cache.c -- on-disk cache of derived brush model data
+
+// BIH trees and the combined shadow mesh of a map are saved to
+// cache/<modelname>.cache in the game directory after they are built, and
+// read back on the next load of the same file instead of being rebuilt.
+// the BIH arrays are used in place from the loaded file, so every index in
+// it is checked first, and only the writable game directory is read (never
+// a pk3, which a server could send).
+
+#include "quakedef.h"
+
+cvar_t mod_cache = {CVAR_SAVE, "mod_cache", "0", "saves the BIH trees and shadow mesh of each map to cache/ in the game directory and loads them back when the same map file is loaded again (1 = load and save, 2 = load only)"};
+
+// bump this whenever the layout below or the way the cached data is built changes
+#define MODCACHE_VERSION 3
+#define MODCACHE_ALIGN(n) (((n) + 15) & ~15)
+
+typedef struct modcache_header_s
+{
+	char magic[8];
+	int version;
+	// sizes of the stored structures, these differ between builds
+	int sizeof_node;
+	int sizeof_leaf;
+	int sizeof_packednode;
+	// what was built, see Mod_Cache_Options
+	int options;
+	// identity of the source model
+	int crc;
+	int geometrychecksum;
+	// brushes, planes and patch collision meshes the collision trees are built from
+	int collisionchecksum;
+	// texture flags decide which surfaces collide and cast shadows
+	int materialchecksum;
+	int curves_collisions_stride;
+	int numsubmodels;
+	int num_surfaces;
+	int num_vertices;
+	int num_triangles;
+	int num_brushes;
+	int num_planes;
+	int num_collisionvertices;
+	int num_collisiontriangles;
+}
+modcache_header_t;
+
+typedef struct modcache_bih_s
+{
+	int numleafs;
+	int numnodes;
+	int rootnode;
+	int packed;
+	float mins[3];
+	float maxs[3];
+	float packedmins[3];
+	float packedunscale[3];
+}
+modcache_bih_t;
+
+typedef struct modcache_shadowmesh_s
+{
+	int numverts;
+	int numtriangles;
+	int neighbors;
+	int padding;
+	int sideoffsets[6];
+	int sidetotals[6];
+}
+modcache_shadowmesh_t;
+
+static void Mod_Cache_Path(dp_model_t *mod, char *path, size_t pathsize)
+{
+	dpsnprintf(path, pathsize, "cache/%s.cache", mod->name);
+}
+
+static int Mod_Cache_Options(int bihflags, qboolean shadowmesh)
+{
+	int options = bihflags;
+	if (mod_collision_bih_sah.integer)
+		options |= 1<<8;
+	if (mod_collision_bih_packed.integer)
+		options |= 1<<9;
+	if (shadowmesh)
+		options |= 1<<10;
+	if (shadowmesh && r_enableshadowvolumes.integer)
+		options |= 1<<11;
+	if (mod_q3bsp_curves_collisions.integer)
+		options |= 1<<12;
+	return options;
+}
+
+static int Mod_Cache_CollisionChecksum(dp_model_t *mod)
+{
+	int i, j, n, *buf;
+	unsigned int checksum;
+	const q3mbrush_t *brush;
+	const colbrushf_t *colbrushf;
+
+	// pack the fields that matter (not the pointers) into one block
+	n = mod->brush.num_planes * 4;
+	for (i = 0, brush = mod->brush.data_brushes;i < mod->brush.num_brushes;i++, brush++)
+		if (brush->colbrushf)
+			n += 3 + brush->colbrushf->numplanes * 5;
+	buf = (int *)Mem_Alloc(tempmempool, max(n, 1) * sizeof(int));
+	n = 0;
+	for (i = 0;i < mod->brush.num_planes;i++, n += 4)
+		memcpy(buf + n, mod->brush.data_planes[i].normal_and_dist, sizeof(float[4]));
+	for (i = 0, brush = mod->brush.data_brushes;i < mod->brush.num_brushes;i++, brush++)
+	{
+		if (!(colbrushf = brush->colbrushf))
+			continue;
+		buf[n++] = brush->texture ? (int)(brush->texture - mod->data_textures) : -1;
+		buf[n++] = colbrushf->supercontents;
+		buf[n++] = colbrushf->q3surfaceflags;
+		for (j = 0;j < colbrushf->numplanes;j++, n += 5)
+		{
+			memcpy(buf + n, colbrushf->planes[j].normal_and_dist, sizeof(float[4]));
+			buf[n + 4] = colbrushf->planes[j].q3surfaceflags;
+		}
+	}
+	checksum = Com_BlockChecksum(buf, n * sizeof(int));
+	Mem_Free(buf);
+	checksum ^= Com_BlockChecksum(mod->brush.data_collisionvertex3f, mod->brush.num_collisionvertices * sizeof(float[3]));
+	checksum ^= Com_BlockChecksum(mod->brush.data_collisionelement3i, mod->brush.num_collisiontriangles * sizeof(int[3]));
+	return (int)checksum;
+}
+
+static int Mod_Cache_MaterialChecksum(dp_model_t *mod)
+{
+	int i, n = 0, *buf;
+	unsigned int checksum;
+	const texture_t *texture;
+	buf = (int *)Mem_Alloc(tempmempool, max(mod->num_textures, 1) * sizeof(int[3]));
+	for (i = 0, texture = mod->data_textures;i < mod->num_textures;i++, texture++)
+	{
+		buf[n++] = texture->basematerialflags;
+		buf[n++] = texture->supercontents;
+		buf[n++] = texture->surfaceflags;
+	}
+	checksum = Com_BlockChecksum(buf, n * sizeof(int));
+	Mem_Free(buf);
+	return (int)checksum;
+}
+
+static void Mod_Cache_MakeHeader(dp_model_t *mod, int options, modcache_header_t *header)
+{
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, "DPMCACHE", 8);
+	header->version = MODCACHE_VERSION;
+	header->sizeof_node = sizeof(bih_node_t);
+	header->sizeof_leaf = sizeof(bih_leaf_t);
+	header->sizeof_packednode = sizeof(bih_packednode_t);
+	header->options = options;
+	header->crc = mod->crc;
+	// the file crc is only 16 bits, so also check the geometry the trees are built from
+	header->geometrychecksum = (int)(Com_BlockChecksum(mod->surfmesh.data_vertex3f, mod->surfmesh.num_vertices * sizeof(float[3])) ^ Com_BlockChecksum(mod->surfmesh.data_element3i, mod->surfmesh.num_triangles * sizeof(int[3])));
+	header->collisionchecksum = Mod_Cache_CollisionChecksum(mod);
+	header->materialchecksum = Mod_Cache_MaterialChecksum(mod);
+	header->curves_collisions_stride = mod_q3bsp_curves_collisions_stride.integer;
+	header->numsubmodels = mod->brush.numsubmodels;
+	header->num_surfaces = mod->num_surfaces;
+	header->num_vertices = mod->surfmesh.num_vertices;
+	header->num_triangles = mod->surfmesh.num_triangles;
+	header->num_brushes = mod->brush.num_brushes;
+	header->num_planes = mod->brush.num_planes;
+	header->num_collisionvertices = mod->brush.num_collisionvertices;
+	header->num_collisiontriangles = mod->brush.num_collisiontriangles;
+}
+
+// the trees a submodel stores, in file order
+static int Mod_Cache_SubmodelBIHs(dp_model_t *submodel, int bihflags, bih_t **bihs)
+{
+	int n = 0;
+	if (bihflags & MOD_BRUSH_COLLISIONBIH)
+		bihs[n++] = &submodel->collision_bih;
+	if (bihflags & MOD_BRUSH_RENDERBIH)
+		bihs[n++] = &submodel->render_bih;
+	return n;
+}
+
+static size_t Mod_Cache_BIHSize(const modcache_bih_t *b)
+{
+	size_t size = MODCACHE_ALIGN(sizeof(modcache_bih_t));
+	size += MODCACHE_ALIGN(b->numleafs * sizeof(bih_leaf_t));
+	// a packed tree only keeps the packed nodes
+	if (b->packed)
+	{
+		size += MODCACHE_ALIGN(b->numnodes * sizeof(bih_packednode_t));
+		size += MODCACHE_ALIGN(b->numleafs * sizeof(int));
+	}
+	else
+		size += MODCACHE_ALIGN(b->numnodes * sizeof(bih_node_t));
+	return size;
+}
+
+static size_t Mod_Cache_ShadowMeshSize(const modcache_shadowmesh_t *s)
+{
+	size_t size = MODCACHE_ALIGN(sizeof(modcache_shadowmesh_t));
+	size += MODCACHE_ALIGN(s->numverts * sizeof(float[3]));
+	size += MODCACHE_ALIGN(s->numtriangles * sizeof(int[3]));
+	if (s->neighbors)
+		size += MODCACHE_ALIGN(s->numtriangles * sizeof(int[3]));
+	return size;
+}
+
+// every index a traversal follows must stay in the tree and the model, and
+// children must come after their parent so a bad file can't make a loop
+static qboolean Mod_Cache_CheckBIH(dp_model_t *mod, const bih_t *bih)
+{
+	int i, j;
+	const bih_leaf_t *leaf;
+	const bih_node_t *node;
+	const bih_packednode_t *packednode;
+	const msurface_t *surface;
+
+	for (i = 0, leaf = bih->leafs;i < bih->numleafs;i++, leaf++)
+	{
+		switch (leaf->type)
+		{
+		case BIH_BRUSH:
+			if (leaf->itemindex < 0 || leaf->itemindex >= mod->brush.num_brushes || !mod->brush.data_brushes[leaf->itemindex].colbrushf)
+				return false;
+			break;
+		case BIH_COLLISIONTRIANGLE:
+		case BIH_RENDERTRIANGLE:
+			if (leaf->surfaceindex < 0 || leaf->surfaceindex >= mod->num_surfaces || leaf->textureindex < 0 || leaf->textureindex >= mod->num_textures)
+				return false;
+			surface = mod->data_surfaces + leaf->surfaceindex;
+			if (leaf->type == BIH_RENDERTRIANGLE)
+			{
+				if (leaf->itemindex < surface->num_firsttriangle || leaf->itemindex >= surface->num_firsttriangle + surface->num_triangles)
+					return false;
+			}
+			else if (leaf->itemindex < surface->num_firstcollisiontriangle || leaf->itemindex >= surface->num_firstcollisiontriangle + surface->num_collisiontriangles)
+				return false;
+			break;
+		default:
+			return false;
+		}
+	}
+	if (bih->packednodes)
+	{
+		for (i = 0, packednode = bih->packednodes;i < bih->numnodes;i++, packednode++)
+		{
+			if (packednode->type == BIH_UNORDERED)
+			{
+				if (packednode->numchildren > BIH_MAXUNORDEREDCHILDREN || packednode->front < 0 || packednode->front > bih->numleafs - packednode->numchildren)
+					return false;
+			}
+			else if (packednode->type > BIH_SPLITZ || packednode->front <= i || packednode->front >= bih->numnodes || packednode->back <= i || packednode->back >= bih->numnodes)
+				return false;
+		}
+		for (i = 0;i < bih->numleafs;i++)
+			if (bih->packedleafs[i] < 0 || bih->packedleafs[i] >= bih->numleafs)
+				return false;
+	}
+	else
+	{
+		for (i = 0, node = bih->nodes;i < bih->numnodes;i++, node++)
+		{
+			if (node->type == BIH_UNORDERED)
+			{
+				for (j = 0;j < BIH_MAXUNORDEREDCHILDREN;j++)
+					if (node->children[j] >= bih->numleafs)
+						return false;
+			}
+			else if ((unsigned int)node->type > BIH_SPLITZ || node->front <= i || node->front >= bih->numnodes || node->back <= i || node->back >= bih->numnodes)
+				return false;
+		}
+	}
+	return true;
+}
+
+static qboolean Mod_Cache_CheckShadowMesh(const shadowmesh_t *mesh)
+{
+	int i;
+	for (i = 0;i < mesh->numtriangles * 3;i++)
+		if (mesh->element3i[i] < 0 || mesh->element3i[i] >= mesh->numverts)
+			return false;
+	if (mesh->neighbor3i)
+		for (i = 0;i < mesh->numtriangles * 3;i++)
+			if (mesh->neighbor3i[i] < -1 || mesh->neighbor3i[i] >= mesh->numtriangles)
+				return false;
+	for (i = 0;i < 6;i++)
+		if (mesh->sideoffsets[i] < 0 || mesh->sidetotals[i] < 0 || mesh->sideoffsets[i] > mesh->numtriangles - mesh->sidetotals[i])
+			return false;
+	return true;
+}
+
+/*
+=================
+Mod_Cache_LoadBrush
+
+fills in the BIH trees selected by bihflags (MOD_BRUSH_*BIH) for the model and all of its submodels, and the shadow mesh if wanted, returns
+false (changing nothing) if there is no matching cache file
+=================
+*/
+qboolean Mod_Cache_LoadBrush(dp_model_t *mod, int bihflags, qboolean shadowmesh)
+{
+	char path[MAX_QPATH + 16];
+	unsigned char *buf, *p, *end;
+	qfile_t *file;
+	fs_offset_t filesize;
+	modcache_header_t header;
+	modcache_bih_t b;
+	modcache_shadowmesh_t s;
+	bih_t *bihs[2], *loaded;
+	int i, j, n, numloaded = 0;
+	shadowmesh_t *mesh;
+
+	if (!mod_cache.integer || !mod->brush.numsubmodels)
+		return false;
+	Mod_Cache_Path(mod, path, sizeof(path));
+	// FS_LoadFile would also search the packs
+	file = FS_OpenRealFile(path, "rb", true);
+	if (!file)
+		return false;
+	filesize = FS_FileSize(file);
+	buf = (unsigned char *)Mem_Alloc(mod->mempool, max(filesize, 1));
+	if (FS_Read(file, buf, filesize) != filesize)
+	{
+		FS_Close(file);
+		goto fail;
+	}
+	FS_Close(file);
+	p = buf;
+	end = buf + filesize;
+
+	// the arrays are used in place, so everything is checked before any of it is used
+	Mod_Cache_MakeHeader(mod, Mod_Cache_Options(bihflags, shadowmesh), &header);
+	if (filesize < (fs_offset_t)MODCACHE_ALIGN(sizeof(header)) || memcmp(p, &header, sizeof(header)))
+		goto fail;
+	p += MODCACHE_ALIGN(sizeof(header));
+	loaded = (bih_t *)Mem_Alloc(tempmempool, mod->brush.numsubmodels * 2 * sizeof(bih_t));
+	for (i = 0;i < mod->brush.numsubmodels;i++)
+	{
+		n = Mod_Cache_SubmodelBIHs(mod->brush.submodels[i], bihflags, bihs);
+		for (j = 0;j < n;j++)
+		{
+			bih_t *bih = loaded + numloaded++;
+			if (end - p < (ptrdiff_t)sizeof(b))
+				goto failloaded;
+			memcpy(&b, p, sizeof(b));
+			if (b.numleafs < 0 || b.numnodes < 0 || b.numleafs > filesize / (fs_offset_t)sizeof(int) || b.numnodes > b.numleafs + 1 || b.rootnode < -1 || b.rootnode >= b.numnodes || (size_t)(end - p) < Mod_Cache_BIHSize(&b))
+				goto failloaded;
+			p += MODCACHE_ALIGN(sizeof(b));
+			bih->numleafs = b.numleafs;
+			bih->numnodes = bih->maxnodes = b.numnodes;
+			bih->rootnode = b.rootnode;
+			VectorCopy(b.mins, bih->mins);
+			VectorCopy(b.maxs, bih->maxs);
+			VectorCopy(b.packedmins, bih->packedmins);
+			VectorCopy(b.packedunscale, bih->packedunscale);
+			bih->leafs = b.numleafs ? (bih_leaf_t *)p : NULL;p += MODCACHE_ALIGN(b.numleafs * sizeof(bih_leaf_t));
+			if (b.packed)
+			{
+				bih->packednodes = (bih_packednode_t *)p;p += MODCACHE_ALIGN(b.numnodes * sizeof(bih_packednode_t));
+				bih->packedleafs = (int *)p;p += MODCACHE_ALIGN(b.numleafs * sizeof(int));
+			}
+			else
+			{
+				bih->nodes = b.numnodes ? (bih_node_t *)p : NULL;p += MODCACHE_ALIGN(b.numnodes * sizeof(bih_node_t));
+			}
+			if (!Mod_Cache_CheckBIH(mod, bih))
+				goto failloaded;
+		}
+	}
+	mesh = NULL;
+	if (shadowmesh)
+	{
+		if (end - p < (ptrdiff_t)sizeof(s))
+			goto failloaded;
+		memcpy(&s, p, sizeof(s));
+		if (s.numverts < 0 || s.numtriangles < 0 || s.numverts > header.num_triangles * 3 || s.numtriangles > header.num_triangles || (size_t)(end - p) < Mod_Cache_ShadowMeshSize(&s))
+			goto failloaded;
+		p += MODCACHE_ALIGN(sizeof(s));
+		if (s.numtriangles)
+		{
+			// the shadow mesh is a separate allocation like one from Mod_ShadowMesh_Finish
+			mesh = Mod_ShadowMesh_Alloc(mod->mempool, s.numverts, s.numtriangles, NULL, NULL, NULL, false, s.neighbors, false);
+			mesh->numverts = s.numverts;
+			mesh->numtriangles = s.numtriangles;
+			memcpy(mesh->sideoffsets, s.sideoffsets, sizeof(mesh->sideoffsets));
+			memcpy(mesh->sidetotals, s.sidetotals, sizeof(mesh->sidetotals));
+			memcpy(mesh->vertex3f, p, s.numverts * sizeof(float[3]));p += MODCACHE_ALIGN(s.numverts * sizeof(float[3]));
+			memcpy(mesh->element3i, p, s.numtriangles * sizeof(int[3]));p += MODCACHE_ALIGN(s.numtriangles * sizeof(int[3]));
+			if (s.neighbors)
+			{
+				memcpy(mesh->neighbor3i, p, s.numtriangles * sizeof(int[3]));p += MODCACHE_ALIGN(s.numtriangles * sizeof(int[3]));
+			}
+			if (!Mod_Cache_CheckShadowMesh(mesh))
+			{
+				Mod_ShadowMesh_Free(mesh);
+				goto failloaded;
+			}
+			if (mesh->element3s)
+				for (i = 0;i < s.numtriangles * 3;i++)
+					mesh->element3s[i] = mesh->element3i[i];
+		}
+	}
+
+	// all good, hand it out
+	numloaded = 0;
+	for (i = 0;i < mod->brush.numsubmodels;i++)
+	{
+		n = Mod_Cache_SubmodelBIHs(mod->brush.submodels[i], bihflags, bihs);
+		for (j = 0;j < n;j++)
+			*bihs[j] = loaded[numloaded++];
+		if (shadowmesh)
+			mod->brush.submodels[i]->brush.shadowmesh = mesh;
+	}
+	if (shadowmesh)
+		mod->brush.shadowmesh = mesh;
+	Mem_Free(loaded);
+	if (developer_loading.integer)
+		Con_Printf("loaded model cache %s\n", path);
+	return true;
+
+failloaded:
+	Mem_Free(loaded);
+fail:
+	Con_DPrintf("Mod_Cache_LoadBrush: %s is stale or corrupt, rebuilding\n", path);
+	Mem_Free(buf);
+	return false;
+}
+
+/*
+=================
+Mod_Cache_SaveBrush
+
+writes what Mod_Cache_LoadBrush reads, call after building the trees
+=================
+*/
+void Mod_Cache_SaveBrush(dp_model_t *mod, int bihflags, qboolean shadowmesh)
+{
+	char path[MAX_QPATH + 16];
+	unsigned char *buf, *p;
+	size_t size;
+	modcache_header_t header;
+	modcache_bih_t b;
+	modcache_shadowmesh_t s;
+	bih_t *bihs[2];
+	int i, j, n;
+	shadowmesh_t *mesh = mod->brush.shadowmesh;
+
+	if (mod_cache.integer != 1 || !mod->brush.numsubmodels)
+		return;
+	// gl_rsurf.c indexes the shadow mesh as a single mesh, anything else is not worth caching
+	if (shadowmesh && mesh && mesh->next)
+		return;
+
+	Mod_Cache_MakeHeader(mod, Mod_Cache_Options(bihflags, shadowmesh), &header);
+	memset(&s, 0, sizeof(s));
+	if (shadowmesh && mesh)
+	{
+		s.numverts = mesh->numverts;
+		s.numtriangles = mesh->numtriangles;
+		s.neighbors = mesh->neighbor3i != NULL;
+		memcpy(s.sideoffsets, mesh->sideoffsets, sizeof(s.sideoffsets));
+		memcpy(s.sidetotals, mesh->sidetotals, sizeof(s.sidetotals));
+	}
+
+	// measure
+	size = MODCACHE_ALIGN(sizeof(header));
+	for (i = 0;i < mod->brush.numsubmodels;i++)
+	{
+		n = Mod_Cache_SubmodelBIHs(mod->brush.submodels[i], bihflags, bihs);
+		for (j = 0;j < n;j++)
+		{
+			// a tree that failed to build is not saved, next load tries again
+			if (bihs[j]->error)
+				return;
+			memset(&b, 0, sizeof(b));
+			b.numleafs = bihs[j]->numleafs;
+			b.numnodes = bihs[j]->numnodes;
+			b.packed = bihs[j]->packednodes != NULL;
+			size += Mod_Cache_BIHSize(&b);
+		}
+	}
+	if (shadowmesh)
+		size += Mod_Cache_ShadowMeshSize(&s);
+
+	// fill
+	buf = p = (unsigned char *)Mem_Alloc(tempmempool, size);
+	memcpy(p, &header, sizeof(header));p += MODCACHE_ALIGN(sizeof(header));
+	for (i = 0;i < mod->brush.numsubmodels;i++)
+	{
+		n = Mod_Cache_SubmodelBIHs(mod->brush.submodels[i], bihflags, bihs);
+		for (j = 0;j < n;j++)
+		{
+			bih_t *bih = bihs[j];
+			memset(&b, 0, sizeof(b));
+			b.numleafs = bih->numleafs;
+			b.numnodes = bih->numnodes;
+			b.rootnode = bih->rootnode;
+			b.packed = bih->packednodes != NULL;
+			VectorCopy(bih->mins, b.mins);
+			VectorCopy(bih->maxs, b.maxs);
+			VectorCopy(bih->packedmins, b.packedmins);
+			VectorCopy(bih->packedunscale, b.packedunscale);
+			memcpy(p, &b, sizeof(b));p += MODCACHE_ALIGN(sizeof(b));
+			if (b.numleafs)
+				memcpy(p, bih->leafs, b.numleafs * sizeof(bih_leaf_t));
+			p += MODCACHE_ALIGN(b.numleafs * sizeof(bih_leaf_t));
+			if (b.packed)
+			{
+				memcpy(p, bih->packednodes, b.numnodes * sizeof(bih_packednode_t));p += MODCACHE_ALIGN(b.numnodes * sizeof(bih_packednode_t));
+				memcpy(p, bih->packedleafs, b.numleafs * sizeof(int));p += MODCACHE_ALIGN(b.numleafs * sizeof(int));
+			}
+			else
+			{
+				if (b.numnodes)
+					memcpy(p, bih->nodes, b.numnodes * sizeof(bih_node_t));
+				p += MODCACHE_ALIGN(b.numnodes * sizeof(bih_node_t));
+			}
+		}
+	}
+	if (shadowmesh)
+	{
+		memcpy(p, &s, sizeof(s));p += MODCACHE_ALIGN(sizeof(s));
+		if (s.numtriangles)
+		{
+			memcpy(p, mesh->vertex3f, s.numverts * sizeof(float[3]));p += MODCACHE_ALIGN(s.numverts * sizeof(float[3]));
+			memcpy(p, mesh->element3i, s.numtriangles * sizeof(int[3]));p += MODCACHE_ALIGN(s.numtriangles * sizeof(int[3]));
+			if (s.neighbors)
+			{
+				memcpy(p, mesh->neighbor3i, s.numtriangles * sizeof(int[3]));p += MODCACHE_ALIGN(s.numtriangles * sizeof(int[3]));
+			}
+		}
+	}
+
+	Mod_Cache_Path(mod, path, sizeof(path));
+	FS_WriteFile(path, buf, (fs_offset_t)size);
+	Mem_Free(buf);
+}
@@ -39,6 +39,7 @@ cvar_t mod_generatelightmaps_gridsamples = {CVAR_SAVE, "mod_generatelightmaps_gr
 cvar_t mod_generatelightmaps_lightmapradius = {CVAR_SAVE, "mod_generatelightmaps_lightmapradius", "16", "sampling area around each lightmap pixel"};
 cvar_t mod_generatelightmaps_vertexradius = {CVAR_SAVE, "mod_generatelightmaps_vertexradius", "16", "sampling area around each vertex"};
 cvar_t mod_generatelightmaps_gridradius = {CVAR_SAVE, "mod_generatelightmaps_gridradius", "64", "sampling area around each lightgrid cell center"};
+cvar_t mod_loadtimings = {0, "mod_loadtimings", "0", "prints how long each stage of loading a model or spawning a server takes"};
 
 dp_model_t *loadmodel;
 
@@ -174,6 +175,8 @@ void Mod_Init (void)
 	Cvar_RegisterVariable(&mod_generatelightmaps_lightmapradius);
 	Cvar_RegisterVariable(&mod_generatelightmaps_vertexradius);
 	Cvar_RegisterVariable(&mod_generatelightmaps_gridradius);
+	Cvar_RegisterVariable(&mod_loadtimings);
+	Cvar_RegisterVariable(&mod_cache);
 
 	Cmd_AddCommand ("modellist", Mod_Print, "prints a list of loaded models");
 	Cmd_AddCommand ("modelprecache", Mod_Precache, "load a model");
@@ -186,6 +189,21 @@ void Mod_RenderInit(void)
 	R_RegisterModule("Models", mod_start, mod_shutdown, mod_newmap, NULL, NULL);
 }
 
+/*
+==================
+Mod_LoadTimings_Stage
+
+prints the time since *mark for a stage of loading what, then resets *mark
+==================
+*/
+void Mod_LoadTimings_Stage(const char *what, const char *stage, double *mark)
+{
+	double now = Sys_DirtyTime();
+	if (mod_loadtimings.integer)
+		Con_Printf("%s: %s %.2fms\n", what, stage, (now - *mark) * 1000.0);
+	*mark = now;
+}
+
 void Mod_UnloadModel (dp_model_t *mod)
 {
 	char name[MAX_QPATH];
@@ -378,6 +396,7 @@ dp_model_t *Mod_LoadModel(dp_model_t *mod, qboolean crash, qboolean checkdisk)
 	void *buf;
 	fs_offset_t filesize = 0;
 	char vabuf[1024];
+	double loadstart, loadmark;
 
 	mod->used = true;
 
@@ -420,6 +439,7 @@ dp_model_t *Mod_LoadModel(dp_model_t *mod, qboolean crash, qboolean checkdisk)
 
 	crc = 0;
 	buf = NULL;
+	loadstart = loadmark = Sys_DirtyTime();
 
 	// even if the model is loaded it still may need reloading...
 
@@ -483,6 +503,8 @@ dp_model_t *Mod_LoadModel(dp_model_t *mod, qboolean crash, qboolean checkdisk)
 	{
 		char *bufend = (char *)buf + filesize;
 
+		Mod_LoadTimings_Stage(mod->name, "read file", &loadmark);
+
 		// all models use memory, so allocate a memory pool
 		mod->mempool = Mem_AllocPool(mod->name, 0, NULL);
 
@@ -504,6 +526,7 @@ dp_model_t *Mod_LoadModel(dp_model_t *mod, qboolean crash, qboolean checkdisk)
 		else if (num == BSPVERSION || num == 30 || !memcmp(buf, "BSP2", 4) || !memcmp(buf, "2PSB", 4)) Mod_Q1BSP_Load(mod, buf, bufend);
 		else Con_Printf("Mod_LoadModel: model \"%s\" is of unknown/unsupported type\n", mod->name);
 		Mem_Free(buf);
+		Mod_LoadTimings_Stage(mod->name, "loader", &loadmark);
 
 		Mod_FindPotentialDeforms(mod);
 
@@ -515,6 +538,9 @@ dp_model_t *Mod_LoadModel(dp_model_t *mod, qboolean crash, qboolean checkdisk)
 		}
 
 		Mod_BuildVBOs();
+		Mod_LoadTimings_Stage(mod->name, "vbos", &loadmark);
+		loadmark = loadstart;
+		Mod_LoadTimings_Stage(mod->name, "total", &loadmark);
 	}
 	else if (crash)
 	{
@@ -714,7 +740,7 @@ void Mod_BuildTriangleNeighbors(int *neighbors, const int *elements, int numtria
 		int element[2];
 	}
 	edgehashentry_t;
-	static edgehashentry_t **edgehash;
+	edgehashentry_t **edgehash;
 	edgehashentry_t *edgehashentries, *hash;
 	if (!numtriangles)
 		return;
@@ -752,6 +752,9 @@ typedef struct model_brush_lightstyleinfo_s
 }
 model_brush_lightstyleinfo_t;
 
+// how many traces the batch trace functions handle on the stack at once
+#define MAX_TRACELINESBATCH 64
+
 typedef struct model_brush_s
 {
 	// true if this model is a HalfLife .bsp file
@@ -847,6 +850,8 @@ typedef struct model_brush_s
 	void (*RoundUpToHullSize)(struct model_s *cmodel, const vec3_t inmins, const vec3_t inmaxs, vec3_t outmins, vec3_t outmaxs);
 	// trace a line of sight through this model (returns false if the line if sight is definitely blocked)
 	qboolean (*TraceLineOfSight)(struct model_s *model, const vec3_t start, const vec3_t end);
+	// batch version of TraceLineOfSight, may be NULL
+	void (*TraceLinesOfSight)(struct model_s *model, int numtraces, const float *starts, const float *ends, qboolean *visible);
 
 	char skybox[MAX_QPATH];
 
@@ -1077,6 +1082,10 @@ typedef struct model_s
 	int (*PointSuperContents)(struct model_s *model, int frame, const vec3_t point);
 	// trace a line against geometry in this model and report correct texture (used by r_shadow_bouncegrid)
 	void (*TraceLineAgainstSurfaces)(struct model_s *model, const struct frameblend_s *frameblend, const struct skeleton_s *skeleton, struct trace_s *trace, const vec3_t start, const vec3_t end, int hitsupercontentsmask);
+	// trace a batch of lines (starts and ends are 3 floats per trace), faster than separate TraceLine calls when the lines are close together, may be NULL (use Collision_ClipLinesToWorld)
+	void (*TraceLines)(struct model_s *model, const struct frameblend_s *frameblend, const struct skeleton_s *skeleton, int numtraces, struct trace_s *traces, const float *starts, const float *ends, int hitsupercontentsmask);
+	// batch version of TraceLineAgainstSurfaces, may be NULL
+	void (*TraceLinesAgainstSurfaces)(struct model_s *model, const struct frameblend_s *frameblend, const struct skeleton_s *skeleton, int numtraces, struct trace_s *traces, const float *starts, const float *ends, int hitsupercontentsmask);
 	// fields belonging to some types of model
 	model_sprite_t	sprite;
 	model_brush_t	brush;
@@ -1102,6 +1111,14 @@ extern unsigned char *mod_base;
 // texture fullbrights
 extern cvar_t r_fullbrights;
 extern cvar_t r_enableshadowvolumes;
+extern cvar_t mod_loadtimings;
+extern cvar_t mod_cache;
+extern cvar_t mod_collision_bih_sah;
+extern cvar_t mod_collision_bih_packed;
+extern cvar_t mod_q3bsp_curves_collisions;
+extern cvar_t mod_collision_bih;
+extern cvar_t mod_q1bsp_polygoncollisions;
+extern cvar_t mod_q3bsp_curves_collisions_stride;
 
 void Mod_Init (void);
 void Mod_Reload (void);
@@ -1109,6 +1126,14 @@ dp_model_t *Mod_LoadModel(dp_model_t *mod, qboolean crash, qboolean checkdisk);
 dp_model_t *Mod_FindName (const char *name, const char *parentname);
 dp_model_t *Mod_ForName (const char *name, qboolean crash, qboolean checkdisk, const char *parentname);
 void Mod_UnloadModel (dp_model_t *mod);
+void Mod_LoadTimings_Stage(const char *what, const char *stage, double *mark);
+
+// which BIH trees of a brush model are built (and cached)
+#define MOD_BRUSH_COLLISIONBIH 1
+#define MOD_BRUSH_RENDERBIH 2
+// model_cache.c
+qboolean Mod_Cache_LoadBrush(dp_model_t *mod, int bihflags, qboolean shadowmesh);
+void Mod_Cache_SaveBrush(dp_model_t *mod, int bihflags, qboolean shadowmesh);
 
 void Mod_ClearUsed(void);
 void Mod_PurgeUnused(void);
@@ -1225,6 +1250,8 @@ void Mod_CollisionBIH_TraceLine(dp_model_t *model, const struct frameblend_s *fr
 void Mod_CollisionBIH_TraceBox(dp_model_t *model, const struct frameblend_s *frameblend, const skeleton_t *skeleton, struct trace_s *trace, const vec3_t start, const vec3_t boxmins, const vec3_t boxmaxs, const vec3_t end, int hitsupercontentsmask);
 void Mod_CollisionBIH_TraceBrush(dp_model_t *model, const struct frameblend_s *frameblend, const skeleton_t *skeleton, struct trace_s *trace, struct colbrushf_s *start, struct colbrushf_s *end, int hitsupercontentsmask);
 void Mod_CollisionBIH_TracePoint_Mesh(dp_model_t *model, const struct frameblend_s *frameblend, const skeleton_t *skeleton, struct trace_s *trace, const vec3_t start, int hitsupercontentsmask);
+void Mod_CollisionBIH_TraceLines(dp_model_t *model, const struct frameblend_s *frameblend, const skeleton_t *skeleton, int numtraces, struct trace_s *traces, const float *starts, const float *ends, int hitsupercontentsmask);
+void Mod_CollisionBIH_TraceLinesAgainstSurfaces(dp_model_t *model, const struct frameblend_s *frameblend, const skeleton_t *skeleton, int numtraces, struct trace_s *traces, const float *starts, const float *ends, int hitsupercontentsmask);
 qboolean Mod_CollisionBIH_TraceLineOfSight(struct model_s *model, const vec3_t start, const vec3_t end);
 int Mod_CollisionBIH_PointSuperContents(struct model_s *model, int frame, const vec3_t point);
 int Mod_CollisionBIH_PointSuperContents_Mesh(struct model_s *model, int frame, const vec3_t point);
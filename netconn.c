@@ -89,6 +89,7 @@ cvar_t net_challengefloodblockingtimeout = {0, "net_challengefloodblockingtimeou
 cvar_t net_getstatusfloodblockingtimeout = {0, "net_getstatusfloodblockingtimeout", "1", "when a getstatus packet is received, it will block all future getstatus packets from that IP address for this many seconds (cuts down on getstatus floods). DarkPlaces retries every 4 seconds, and qstat retries once per second, so this should be <= 1. Failure here may lead to server not showing up in the server list."};
 cvar_t hostname = {CVAR_SAVE, "hostname", "UNNAMED", "server message to show in server browser"};
 cvar_t developer_networking = {0, "developer_networking", "0", "prints all received and sent packets (recommended only for debugging)"};
+static cvar_t net_thread = {CVAR_SAVE, "net_thread", "0", "receive and send server packets on a separate thread so the server frame does not wait on socket calls (takes effect when the server ports are opened)"};
 
 cvar_t cl_netlocalping = {0, "cl_netlocalping","0", "lags local loopback connection by this much ping time (useful to play more fairly on your own server with people with higher pings)"};
 static cvar_t cl_netpacketloss_send = {0, "cl_netpacketloss_send","0", "drops this percentage of outgoing packets, useful for testing network protocol robustness (jerky movement, prediction errors, etc)"};
@@ -612,6 +613,538 @@ void ServerList_QueryList(qboolean resetcache, qboolean querydp, qboolean queryq
 
 // rest
 
+static void NetConn_PrintRead(lhnetsocket_t *mysocket, void *data, int maxlength, lhnetaddress_t *peeraddress, int length)
+{
+	char addressstring[128], addressstring2[128];
+	LHNETADDRESS_ToString(LHNET_AddressFromSocket(mysocket), addressstring, sizeof(addressstring), true);
+	if (length > 0)
+	{
+		LHNETADDRESS_ToString(peeraddress, addressstring2, sizeof(addressstring2), true);
+		Con_Printf("LHNET_Read(%p (%s), %p, %i, %p) = %i from %s:\n", (void *)mysocket, addressstring, (void *)data, maxlength, (void *)peeraddress, length, addressstring2);
+		Com_HexDumpToConsole((unsigned char *)data, length);
+	}
+	else
+		Con_Printf("LHNET_Read(%p (%s), %p, %i, %p) = %i\n", (void *)mysocket, addressstring, (void *)data, maxlength, (void *)peeraddress, length);
+}
+
+static void NetConn_PrintWrite(lhnetsocket_t *mysocket, const void *data, int length, const lhnetaddress_t *peeraddress, int ret)
+{
+	char addressstring[128], addressstring2[128];
+	LHNETADDRESS_ToString(LHNET_AddressFromSocket(mysocket), addressstring, sizeof(addressstring), true);
+	LHNETADDRESS_ToString(peeraddress, addressstring2, sizeof(addressstring2), true);
+	Con_Printf("LHNET_Write(%p (%s), %p, %i, %p (%s)) = %i%s\n", (void *)mysocket, addressstring, (void *)data, length, (void *)peeraddress, addressstring2, length, ret == length ? "" : " (ERROR)");
+	Com_HexDumpToConsole((unsigned char *)data, length);
+}
+
+/*
+net_thread: a network thread owns the non-loopback server sockets, it reads
+packets into netthread.receive and sends whatever the server put in
+netthread.send.  Each queue has exactly one producer and one consumer, which
+only communicate through the head and tail offsets, so neither side takes a
+lock or waits on the other.
+*/
+
+#define NETTHREAD_QUEUESIZE (4<<20)
+// packets moved per LHNET_ReadBatch or LHNET_WriteBatch call
+#define NETTHREAD_BATCH 16
+
+// a packet in a queue, followed by its data
+typedef struct netthread_packet_s
+{
+	lhnetsocket_t *socket;
+	lhnetaddress_t address;
+	// -1 marks the end of the used part of the buffer, the next packet is at the start
+	int length;
+}
+netthread_packet_t;
+
+#define NETTHREAD_PACKETHEADERSIZE ((int)((sizeof(netthread_packet_t) + 15) & ~15))
+#define NETTHREAD_PACKETSIZE(length) (NETTHREAD_PACKETHEADERSIZE + (((length) + 15) & ~15))
+
+typedef struct netthread_queue_s
+{
+	unsigned char *buffer;
+	// only written by the producer
+	volatile int head;
+	// only written by the consumer
+	volatile int tail;
+	// times the producer ran out of room (the send queue drops the packet, the
+	// receive queue leaves packets in the socket buffer until there is room)
+	int dropped;
+}
+netthread_queue_t;
+
+typedef struct netthread_state_s
+{
+	void *thread;
+	volatile int quit;
+	// set while the thread is (about to be) sleeping in select
+	volatile int sleeping;
+	// makes the threads sending server packets take turns as the producer of the send queue
+	void *sendmutex;
+	netthread_queue_t receive;
+	netthread_queue_t send;
+	// the sockets owned by the thread, fixed while it runs
+	int numsockets;
+	lhnetsocket_t *sockets[16];
+	// LHNET_ReadBatch fills these before the packets are copied into the receive queue
+	unsigned char *readbuffers;
+	lhnetmessage_t messages[NETTHREAD_BATCH];
+}
+netthread_state_t;
+
+static netthread_state_t netthread;
+
+// returns space for a packet of up to maxlength bytes, or NULL if the queue is full
+static netthread_packet_t *NetThread_Queue_Alloc(netthread_queue_t *q, int maxlength)
+{
+	int head = q->head;
+	int tail = Thread_AtomicGet(&q->tail);
+	int size = NETTHREAD_PACKETSIZE(maxlength);
+	if (head >= tail)
+	{
+		// always leave room at the end for a wrap marker
+		if (head + size + NETTHREAD_PACKETHEADERSIZE <= NETTHREAD_QUEUESIZE)
+			return (netthread_packet_t *)(q->buffer + head);
+		if (size >= tail)
+			return NULL;
+		((netthread_packet_t *)(q->buffer + head))->length = -1;
+		return (netthread_packet_t *)q->buffer;
+	}
+	// the head must never catch up with the tail, that would look empty
+	if (head + size >= tail)
+		return NULL;
+	return (netthread_packet_t *)(q->buffer + head);
+}
+
+// returns how many packets of up to maxlength bytes NetThread_Queue_Alloc
+// can return one after another, at most limit
+static int NetThread_Queue_Space(netthread_queue_t *q, int maxlength, int limit)
+{
+	int head = q->head;
+	int tail = Thread_AtomicGet(&q->tail);
+	int size = NETTHREAD_PACKETSIZE(maxlength);
+	int n;
+	if (head >= tail)
+		n = max(NETTHREAD_QUEUESIZE - NETTHREAD_PACKETHEADERSIZE - head, 0) / size + max(tail - 1, 0) / size;
+	else
+		n = (tail - 1 - head) / size;
+	return min(n, limit);
+}
+
+// publishes a packet returned by NetThread_Queue_Alloc, length may be less than what was allocated
+static void NetThread_Queue_Commit(netthread_queue_t *q, netthread_packet_t *p, int length)
+{
+	p->length = length;
+	Thread_AtomicSet(&q->head, (int)((unsigned char *)p - q->buffer) + NETTHREAD_PACKETSIZE(length));
+}
+
+// returns the oldest packet in the queue without removing it, or NULL if empty
+static netthread_packet_t *NetThread_Queue_Peek(netthread_queue_t *q)
+{
+	int tail = q->tail;
+	int head = Thread_AtomicGet(&q->head);
+	netthread_packet_t *p;
+	if (tail == head)
+		return NULL;
+	p = (netthread_packet_t *)(q->buffer + tail);
+	if (p->length < 0)
+	{
+		// the producer wrapped around, the marker was published along with the next packet
+		p = (netthread_packet_t *)q->buffer;
+		Thread_AtomicSet(&q->tail, 0);
+	}
+	return p;
+}
+
+// returns the packet after p without removing anything, or NULL if p is the newest
+static netthread_packet_t *NetThread_Queue_Next(netthread_queue_t *q, netthread_packet_t *p)
+{
+	int offset = (int)((unsigned char *)p - q->buffer) + NETTHREAD_PACKETSIZE(p->length);
+	if (offset == Thread_AtomicGet(&q->head))
+		return NULL;
+	p = (netthread_packet_t *)(q->buffer + offset);
+	if (p->length < 0)
+		p = (netthread_packet_t *)q->buffer;
+	return p;
+}
+
+// removes p and every packet before it
+static void NetThread_Queue_Pop(netthread_queue_t *q, netthread_packet_t *p)
+{
+	Thread_AtomicSet(&q->tail, (int)((unsigned char *)p - q->buffer) + NETTHREAD_PACKETSIZE(p->length));
+}
+
+// sends everything in the send queue, a batch at a time, returns false if it was empty
+static qboolean NetThread_SendQueued(void)
+{
+	int count;
+	netthread_packet_t *p, *last;
+	lhnetsocket_t *mysocket;
+	if (!(p = NetThread_Queue_Peek(&netthread.send)))
+		return false;
+	while (p)
+	{
+		// gather consecutive packets for the same socket
+		mysocket = p->socket;
+		count = 0;
+		do
+		{
+			netthread.messages[count].content = p + 1;
+			netthread.messages[count].length = p->length;
+			netthread.messages[count].address = p->address;
+			count++;
+			last = p;
+			p = NetThread_Queue_Next(&netthread.send, p);
+		}
+		while (p && p->socket == mysocket && count < NETTHREAD_BATCH);
+		LHNET_WriteBatch(mysocket, netthread.messages, count);
+		NetThread_Queue_Pop(&netthread.send, last);
+	}
+	return true;
+}
+
+// moves packets from the socket into the receive queue, returns the number
+// received, or -1 if the queue is too full to take another batch
+static int NetThread_Receive(lhnetsocket_t *mysocket)
+{
+	int i, count, space, total = 0;
+	netthread_packet_t *p;
+	for (;;)
+	{
+		// only read as many packets as the queue can take, the rest stay in
+		// the socket buffer while the server is not keeping up
+		space = NetThread_Queue_Space(&netthread.receive, NET_HEADERSIZE+NET_MAXMESSAGE, NETTHREAD_BATCH);
+		if (!space)
+			return -1;
+		for (i = 0;i < space;i++)
+		{
+			netthread.messages[i].content = netthread.readbuffers + i * (NET_HEADERSIZE+NET_MAXMESSAGE);
+			netthread.messages[i].length = NET_HEADERSIZE+NET_MAXMESSAGE;
+		}
+		count = LHNET_ReadBatch(mysocket, netthread.messages, space);
+		if (count <= 0)
+			return total;
+		for (i = 0;i < count;i++)
+		{
+			// NetThread_Queue_Space made sure this fits
+			p = NetThread_Queue_Alloc(&netthread.receive, netthread.messages[i].length);
+			if (!p)
+			{
+				netthread.receive.dropped++;
+				continue;
+			}
+			p->socket = mysocket;
+			p->address = netthread.messages[i].address;
+			memcpy(p + 1, netthread.messages[i].content, netthread.messages[i].length);
+			NetThread_Queue_Commit(&netthread.receive, p, netthread.messages[i].length);
+		}
+		total += count;
+		if (count < space)
+			return total;
+	}
+}
+
+static int NetThread_ThreadFunc(void *unused)
+{
+	int i, received, idle, full, wasfull = false;
+	// without a way to wake the thread, sends wait for the select timeout
+	int sleeptime = LHNET_HasWakeup() ? 100000 : 1000;
+	for (;;)
+	{
+		idle = !NetThread_SendQueued();
+		full = false;
+		for (i = 0;i < netthread.numsockets;i++)
+		{
+			received = NetThread_Receive(netthread.sockets[i]);
+			if (received < 0)
+			{
+				full = true;
+				break;
+			}
+			if (received > 0)
+				idle = false;
+		}
+		if (full && !wasfull)
+			netthread.receive.dropped++;
+		wasfull = full;
+		if (Thread_AtomicGet(&netthread.quit))
+		{
+			// queued packets still go out before the thread exits
+			if (!NetThread_Queue_Peek(&netthread.send))
+				break;
+			continue;
+		}
+		if (full)
+		{
+			// the sockets stay readable, so select would return at once
+			Sys_Sleep(1000);
+			continue;
+		}
+		if (!idle)
+			continue;
+		// announce the sleep before the last check of the send queue, so that
+		// NetThread_Send either sees the flag or its packet is seen here
+		Thread_AtomicSet(&netthread.sleeping, 1);
+		if (!NetThread_Queue_Peek(&netthread.send))
+			LHNET_SleepUntilPacketOnSockets_Microseconds(netthread.sockets, netthread.numsockets, sleeptime);
+		Thread_AtomicSet(&netthread.sleeping, 0);
+	}
+	return 0;
+}
+
+static void NetThread_Start(void)
+{
+	int i;
+	if (netthread.thread || !net_thread.integer || !Thread_HasThreads())
+		return;
+	netthread.numsockets = 0;
+	for (i = 0;i < sv_numsockets;i++)
+		if (sv_sockets[i] && sv_sockets[i]->address.addresstype != LHNETADDRESSTYPE_LOOP)
+			netthread.sockets[netthread.numsockets++] = sv_sockets[i];
+	if (!netthread.numsockets)
+		return;
+	netthread.receive.buffer = (unsigned char *)Mem_Alloc(netconn_mempool, NETTHREAD_QUEUESIZE);
+	netthread.send.buffer = (unsigned char *)Mem_Alloc(netconn_mempool, NETTHREAD_QUEUESIZE);
+	netthread.readbuffers = (unsigned char *)Mem_Alloc(netconn_mempool, NETTHREAD_BATCH * (NET_HEADERSIZE+NET_MAXMESSAGE));
+	netthread.receive.head = netthread.receive.tail = netthread.receive.dropped = 0;
+	netthread.send.head = netthread.send.tail = netthread.send.dropped = 0;
+	netthread.quit = 0;
+	netthread.sleeping = 0;
+	netthread.sendmutex = Thread_CreateMutex();
+	netthread.thread = Thread_CreateThread(NetThread_ThreadFunc, NULL);
+	if (!netthread.thread)
+	{
+		Con_Printf("NetThread_Start: failed to create network thread, reading packets in the server frame\n");
+		Thread_DestroyMutex(netthread.sendmutex);
+		Mem_Free(netthread.receive.buffer);
+		Mem_Free(netthread.send.buffer);
+		Mem_Free(netthread.readbuffers);
+		memset(&netthread, 0, sizeof(netthread));
+	}
+}
+
+// sends anything still queued and stops the thread, must be called before closing the server sockets
+static void NetThread_Stop(void)
+{
+	if (!netthread.thread)
+		return;
+	Thread_AtomicSet(&netthread.quit, 1);
+	LHNET_Wakeup();
+	Thread_WaitThread(netthread.thread, 0);
+	Thread_DestroyMutex(netthread.sendmutex);
+	Mem_Free(netthread.receive.buffer);
+	Mem_Free(netthread.send.buffer);
+	Mem_Free(netthread.readbuffers);
+	memset(&netthread, 0, sizeof(netthread));
+}
+
+static qboolean NetThread_OwnsSocket(lhnetsocket_t *mysocket)
+{
+	int i;
+	for (i = 0;i < netthread.numsockets;i++)
+		if (netthread.sockets[i] == mysocket)
+			return true;
+	return false;
+}
+
+// hands a packet to the network thread, returns false if there was no room for it
+static qboolean NetThread_Send(lhnetsocket_t *mysocket, const void *data, int length, const lhnetaddress_t *peeraddress)
+{
+	netthread_packet_t *p;
+	Thread_LockMutex(netthread.sendmutex);
+	p = NetThread_Queue_Alloc(&netthread.send, length);
+	if (p)
+	{
+		p->socket = mysocket;
+		p->address = *peeraddress;
+		memcpy(p + 1, data, length);
+		NetThread_Queue_Commit(&netthread.send, p, length);
+	}
+	else
+		netthread.send.dropped++;
+	Thread_UnlockMutex(netthread.sendmutex);
+	if (p && Thread_AtomicGet(&netthread.sleeping))
+	{
+		Thread_AtomicSet(&netthread.sleeping, 0);
+		LHNET_Wakeup();
+	}
+	return p != NULL;
+}
+
+#define NETCONN_WRITEBATCH 64
+#define NETCONN_WRITEBATCHSIZE (256<<10)
+
+// server packets held back by NetConn_BeginWriteBatch
+typedef struct netconn_writebatch_s
+{
+	// protects everything below, NULL if the platform has no threads
+	void *mutex;
+	int active;
+	int nummessages;
+	int datasize;
+	lhnetsocket_t *sockets[NETCONN_WRITEBATCH];
+	lhnetmessage_t messages[NETCONN_WRITEBATCH];
+	unsigned char data[NETCONN_WRITEBATCHSIZE];
+	// AES packets are encrypted together when the batch is flushed, their
+	// messages have room for the encrypted data until then
+	int numencrypted;
+	int plaindatasize;
+	int encryptedmessages[NETCONN_WRITEBATCH];
+	crypto_packet_t encrypted[NETCONN_WRITEBATCH];
+	unsigned char plaindata[NETCONN_WRITEBATCHSIZE];
+}
+netconn_writebatch_t;
+
+static netconn_writebatch_t netconn_writebatch;
+
+// caller must hold the mutex
+static void NetConn_FlushWriteBatch(void)
+{
+	int i, first;
+	netconn_writebatch_t *b = &netconn_writebatch;
+	if (b->numencrypted)
+	{
+		Crypto_EncryptPackets(b->encrypted, b->numencrypted);
+		for (i = 0;i < b->numencrypted;i++)
+			b->messages[b->encryptedmessages[i]].length = (int)b->encrypted[i].len_dst;
+		// drop the ones that failed
+		for (i = first = 0;i < b->nummessages;i++)
+		{
+			if (!b->messages[i].length)
+				continue;
+			b->sockets[first] = b->sockets[i];
+			b->messages[first++] = b->messages[i];
+		}
+		b->nummessages = first;
+		b->numencrypted = 0;
+		b->plaindatasize = 0;
+	}
+	// one call for each run of packets on the same socket
+	for (first = 0;first < b->nummessages;first = i)
+	{
+		for (i = first + 1;i < b->nummessages && b->sockets[i] == b->sockets[first];i++)
+			;
+		LHNET_WriteBatch(b->sockets[first], b->messages + first, i - first);
+	}
+	b->nummessages = 0;
+	b->datasize = 0;
+}
+
+// returns false if no batch is being collected
+static qboolean NetConn_AddToWriteBatch(lhnetsocket_t *mysocket, const void *data, int length, const lhnetaddress_t *peeraddress)
+{
+	netconn_writebatch_t *b = &netconn_writebatch;
+	if (b->mutex)
+		Thread_LockMutex(b->mutex);
+	if (!b->active)
+	{
+		if (b->mutex)
+			Thread_UnlockMutex(b->mutex);
+		return false;
+	}
+	if (b->nummessages == NETCONN_WRITEBATCH || b->datasize + length > NETCONN_WRITEBATCHSIZE)
+		NetConn_FlushWriteBatch();
+	b->sockets[b->nummessages] = mysocket;
+	b->messages[b->nummessages].content = b->data + b->datasize;
+	b->messages[b->nummessages].length = length;
+	b->messages[b->nummessages].address = *peeraddress;
+	memcpy(b->data + b->datasize, data, length);
+	b->datasize += length;
+	b->nummessages++;
+	if (b->mutex)
+		Thread_UnlockMutex(b->mutex);
+	return true;
+}
+
+static qboolean NetConn_IsServerSocket(lhnetsocket_t *mysocket)
+{
+	int i;
+	for (i = 0;i < sv_numsockets;i++)
+		if (sv_sockets[i] == mysocket)
+			return true;
+	return false;
+}
+
+// like NetConn_AddToWriteBatch for a packet of an AES connection that still
+// has to be encrypted, returns false if it can't be held back
+static qboolean NetConn_AddEncryptedToWriteBatch(netconn_t *conn, const void *data, size_t length, size_t *sentlength)
+{
+	netconn_writebatch_t *b = &netconn_writebatch;
+	crypto_packet_t *p;
+	size_t cryptolength = ((length + 15) / 16) * 16 + 16; // see Crypto_EncryptPacket
+	if (!b->active || (netthread.thread && NetThread_OwnsSocket(conn->mysocket)) || conn->mysocket->address.addresstype == LHNETADDRESSTYPE_LOOP || !NetConn_IsServerSocket(conn->mysocket))
+		return false;
+	if (b->mutex)
+		Thread_LockMutex(b->mutex);
+	if (!b->active)
+	{
+		if (b->mutex)
+			Thread_UnlockMutex(b->mutex);
+		return false;
+	}
+	if (b->nummessages == NETCONN_WRITEBATCH || b->datasize + length + CRYPTO_HEADERSIZE + 1 > NETCONN_WRITEBATCHSIZE || b->plaindatasize + length > NETCONN_WRITEBATCHSIZE)
+		NetConn_FlushWriteBatch();
+	p = &b->encrypted[b->numencrypted];
+	memcpy(p->dhkey, conn->crypto.dhkey, DHKEY_SIZE);
+	p->data_src = b->plaindata + b->plaindatasize;
+	p->len_src = length;
+	p->data_dst = b->data + b->datasize;
+	p->len = length + CRYPTO_HEADERSIZE + 1;
+	memcpy(b->plaindata + b->plaindatasize, data, length);
+	b->plaindatasize += (int)length;
+	b->encryptedmessages[b->numencrypted++] = b->nummessages;
+	b->sockets[b->nummessages] = conn->mysocket;
+	b->messages[b->nummessages].content = b->data + b->datasize;
+	b->messages[b->nummessages].length = (int)cryptolength;
+	b->messages[b->nummessages].address = conn->peeraddress;
+	b->datasize += (int)cryptolength;
+	b->nummessages++;
+	if (b->mutex)
+		Thread_UnlockMutex(b->mutex);
+	*sentlength = cryptolength;
+	return true;
+}
+
+void NetConn_BeginWriteBatch(void)
+{
+	if (netconn_writebatch.mutex)
+		Thread_LockMutex(netconn_writebatch.mutex);
+	netconn_writebatch.active++;
+	if (netconn_writebatch.mutex)
+		Thread_UnlockMutex(netconn_writebatch.mutex);
+}
+
+void NetConn_EndWriteBatch(void)
+{
+	if (netconn_writebatch.mutex)
+		Thread_LockMutex(netconn_writebatch.mutex);
+	if (netconn_writebatch.active > 0 && --netconn_writebatch.active == 0)
+		NetConn_FlushWriteBatch();
+	if (netconn_writebatch.mutex)
+		Thread_UnlockMutex(netconn_writebatch.mutex);
+}
+
+// like NetConn_Read for several packets at once, returns how many were read
+static int NetConn_ReadBatch(lhnetsocket_t *mysocket, lhnetmessage_t *messages, int nummessages)
+{
+	int i, maxlength = messages[0].length, count;
+	if (mysocket->address.addresstype == LHNETADDRESSTYPE_LOOP && netconn_mutex)
+		Thread_LockMutex(netconn_mutex);
+	count = LHNET_ReadBatch(mysocket, messages, nummessages);
+	if (mysocket->address.addresstype == LHNETADDRESSTYPE_LOOP && netconn_mutex)
+		Thread_UnlockMutex(netconn_mutex);
+	if (developer_networking.integer)
+	{
+		if (count > 0)
+			for (i = 0;i < count;i++)
+				NetConn_PrintRead(mysocket, messages[i].content, maxlength, &messages[i].address, messages[i].length);
+		else if (count < 0)
+			NetConn_PrintRead(mysocket, messages[0].content, maxlength, &messages[0].address, count);
+	}
+	return count;
+}
+
 int NetConn_Read(lhnetsocket_t *mysocket, void *data, int maxlength, lhnetaddress_t *peeraddress)
 {
 	int length;
@@ -628,18 +1161,7 @@ int NetConn_Read(lhnetsocket_t *mysocket, void *data, int maxlength, lhnetaddres
 			if (cl_sockets[i] == mysocket && (rand() % 100) < cl_netpacketloss_receive.integer)
 				return 0;
 	if (developer_networking.integer)
-	{
-		char addressstring[128], addressstring2[128];
-		LHNETADDRESS_ToString(LHNET_AddressFromSocket(mysocket), addressstring, sizeof(addressstring), true);
-		if (length > 0)
-		{
-			LHNETADDRESS_ToString(peeraddress, addressstring2, sizeof(addressstring2), true);
-			Con_Printf("LHNET_Read(%p (%s), %p, %i, %p) = %i from %s:\n", (void *)mysocket, addressstring, (void *)data, maxlength, (void *)peeraddress, length, addressstring2);
-			Com_HexDumpToConsole((unsigned char *)data, length);
-		}
-		else
-			Con_Printf("LHNET_Read(%p (%s), %p, %i, %p) = %i\n", (void *)mysocket, addressstring, (void *)data, maxlength, (void *)peeraddress, length);
-	}
+		NetConn_PrintRead(mysocket, data, maxlength, peeraddress, length);
 	return length;
 }
 
@@ -651,19 +1173,20 @@ int NetConn_Write(lhnetsocket_t *mysocket, const void *data, int length, const l
 		for (i = 0;i < cl_numsockets;i++)
 			if (cl_sockets[i] == mysocket && (rand() % 100) < cl_netpacketloss_send.integer)
 				return length;
-	if (mysocket->address.addresstype == LHNETADDRESSTYPE_LOOP && netconn_mutex)
-		Thread_LockMutex(netconn_mutex);
-	ret = LHNET_Write(mysocket, data, length, peeraddress);
-	if (mysocket->address.addresstype == LHNETADDRESSTYPE_LOOP && netconn_mutex)
-		Thread_UnlockMutex(netconn_mutex);
-	if (developer_networking.integer)
+	if (netthread.thread && NetThread_OwnsSocket(mysocket))
+		ret = NetThread_Send(mysocket, data, length, peeraddress) ? length : -1;
+	else if (netconn_writebatch.active && mysocket->address.addresstype != LHNETADDRESSTYPE_LOOP && NetConn_IsServerSocket(mysocket) && NetConn_AddToWriteBatch(mysocket, data, length, peeraddress))
+		ret = length;
+	else
 	{
-		char addressstring[128], addressstring2[128];
-		LHNETADDRESS_ToString(LHNET_AddressFromSocket(mysocket), addressstring, sizeof(addressstring), true);
-		LHNETADDRESS_ToString(peeraddress, addressstring2, sizeof(addressstring2), true);
-		Con_Printf("LHNET_Write(%p (%s), %p, %i, %p (%s)) = %i%s\n", (void *)mysocket, addressstring, (void *)data, length, (void *)peeraddress, addressstring2, length, ret == length ? "" : " (ERROR)");
-		Com_HexDumpToConsole((unsigned char *)data, length);
+		if (mysocket->address.addresstype == LHNETADDRESSTYPE_LOOP && netconn_mutex)
+			Thread_LockMutex(netconn_mutex);
+		ret = LHNET_Write(mysocket, data, length, peeraddress);
+		if (mysocket->address.addresstype == LHNETADDRESSTYPE_LOOP && netconn_mutex)
+			Thread_UnlockMutex(netconn_mutex);
 	}
+	if (developer_networking.integer)
+		NetConn_PrintWrite(mysocket, data, length, peeraddress, ret);
 	return ret;
 }
 
@@ -707,6 +1230,22 @@ static void NetConn_UpdateCleartime(double *cleartime, int rate, int burstsize,
 	}
 }
 
+// Crypto_EncryptPacket and then NetConn_Write, except that AES packets sent
+// during a write batch are encrypted together when it is flushed
+static qboolean NetConn_WriteEncrypted(netconn_t *conn, const void *data, size_t length, void *cryptobuffer, size_t cryptobuffersize, size_t *sentlength)
+{
+	const void *sendme;
+	if (conn->crypto.authenticated && conn->crypto.use_aes && netconn_writebatch.active && NetConn_AddEncryptedToWriteBatch(conn, data, length, sentlength))
+		return true;
+	sendme = Crypto_EncryptPacket(&conn->crypto, data, length, cryptobuffer, sentlength, cryptobuffersize);
+	if (!sendme)
+	{
+		*sentlength = 0;
+		return false;
+	}
+	return NetConn_Write(conn->mysocket, sendme, (int)*sentlength, &conn->peeraddress) == (int)*sentlength;
+}
+
 static int NetConn_AddCryptoFlag(crypto_t *crypto)
 {
 	// HACK: if an encrypted connection is used, randomly set some unused
@@ -814,7 +1353,6 @@ int NetConn_SendUnreliableMessage(netconn_t *conn, sizebuf_t *data, protocolvers
 		unsigned int packetLen;
 		unsigned int dataLen;
 		unsigned int eom;
-		const void *sendme;
 		size_t sendmelen;
 
 		// if a reliable message fragment has been lost, send it again
@@ -839,8 +1377,7 @@ int NetConn_SendUnreliableMessage(netconn_t *conn, sizebuf_t *data, protocolvers
 
 			conn->outgoing_netgraph[conn->outgoing_packetcounter].reliablebytes += packetLen + 28;
 
-			sendme = Crypto_EncryptPacket(&conn->crypto, &sendbuffer, packetLen, &cryptosendbuffer, &sendmelen, sizeof(cryptosendbuffer));
-			if (sendme && NetConn_Write(conn->mysocket, sendme, (int)sendmelen, &conn->peeraddress) == (int)sendmelen)
+			if (NetConn_WriteEncrypted(conn, sendbuffer, packetLen, cryptosendbuffer, sizeof(cryptosendbuffer), &sendmelen))
 			{
 				conn->lastSendTime = realtime;
 				conn->packetsReSent++;
@@ -890,9 +1427,7 @@ int NetConn_SendUnreliableMessage(netconn_t *conn, sizebuf_t *data, protocolvers
 
 			conn->outgoing_netgraph[conn->outgoing_packetcounter].reliablebytes += packetLen + 28;
 
-			sendme = Crypto_EncryptPacket(&conn->crypto, &sendbuffer, packetLen, &cryptosendbuffer, &sendmelen, sizeof(cryptosendbuffer));
-			if(sendme)
-				NetConn_Write(conn->mysocket, sendme, (int)sendmelen, &conn->peeraddress);
+			NetConn_WriteEncrypted(conn, sendbuffer, packetLen, cryptosendbuffer, sizeof(cryptosendbuffer), &sendmelen);
 
 			conn->lastSendTime = realtime;
 			conn->packetsSent++;
@@ -920,9 +1455,7 @@ int NetConn_SendUnreliableMessage(netconn_t *conn, sizebuf_t *data, protocolvers
 
 			conn->outgoing_netgraph[conn->outgoing_packetcounter].unreliablebytes += packetLen + 28;
 
-			sendme = Crypto_EncryptPacket(&conn->crypto, &sendbuffer, packetLen, &cryptosendbuffer, &sendmelen, sizeof(cryptosendbuffer));
-			if(sendme)
-				NetConn_Write(conn->mysocket, sendme, (int)sendmelen, &conn->peeraddress);
+			NetConn_WriteEncrypted(conn, sendbuffer, packetLen, cryptosendbuffer, sizeof(cryptosendbuffer), &sendmelen);
 
 			conn->packetsSent++;
 			conn->unreliableMessagesSent++;
@@ -1007,6 +1540,7 @@ void NetConn_OpenClientPorts(void)
 
 void NetConn_CloseServerPorts(void)
 {
+	NetThread_Stop();
 	for (;sv_numsockets > 0;sv_numsockets--)
 		if (sv_sockets[sv_numsockets - 1])
 			LHNET_CloseSocket(sv_sockets[sv_numsockets - 1]);
@@ -1081,6 +1615,7 @@ void NetConn_OpenServerPorts(int opennetports)
 	}
 	if (sv_numsockets == 0)
 		Host_Error("NetConn_OpenServerPorts: unable to open any ports!");
+	NetThread_Start();
 }
 
 lhnetsocket_t *NetConn_ChooseClientSocketForAddress(lhnetaddress_t *address)
@@ -3545,14 +4080,42 @@ static int NetConn_ServerParsePacket(lhnetsocket_t *mysocket, unsigned char *dat
 	return 0;
 }
 
+#define NETCONN_READBATCH 16
+static unsigned char sv_readbuffers[NETCONN_READBATCH][NET_HEADERSIZE+NET_MAXMESSAGE];
+
 void NetConn_ServerFrame(void)
 {
-	int i, length;
-	lhnetaddress_t peeraddress;
-	unsigned char readbuffer[NET_HEADERSIZE+NET_MAXMESSAGE];
+	int i, j, count;
+	lhnetmessage_t messages[NETCONN_READBATCH];
+	netthread_packet_t *p;
+	if (netthread.thread)
+	{
+		// take everything the network thread has received so far
+		while ((p = NetThread_Queue_Peek(&netthread.receive)))
+		{
+			if (developer_networking.integer)
+				NetConn_PrintRead(p->socket, p + 1, NET_HEADERSIZE+NET_MAXMESSAGE, &p->address, p->length);
+			NetConn_ServerParsePacket(p->socket, (unsigned char *)(p + 1), p->length, &p->address);
+			NetThread_Queue_Pop(&netthread.receive, p);
+		}
+	}
 	for (i = 0;i < sv_numsockets;i++)
-		while (sv_sockets[i] && (length = NetConn_Read(sv_sockets[i], readbuffer, sizeof(readbuffer), &peeraddress)) > 0)
-			NetConn_ServerParsePacket(sv_sockets[i], readbuffer, length, &peeraddress);
+	{
+		if (!sv_sockets[i] || (netthread.thread && NetThread_OwnsSocket(sv_sockets[i])))
+			continue;
+		do
+		{
+			for (j = 0;j < NETCONN_READBATCH;j++)
+			{
+				messages[j].content = sv_readbuffers[j];
+				messages[j].length = sizeof(sv_readbuffers[j]);
+			}
+			count = NetConn_ReadBatch(sv_sockets[i], messages, NETCONN_READBATCH);
+			for (j = 0;j < count;j++)
+				NetConn_ServerParsePacket(sv_sockets[i], (unsigned char *)messages[j].content, messages[j].length, &messages[j].address);
+		}
+		while (count == NETCONN_READBATCH);
+	}
 	for (i = 0, host_client = svs.clients;i < svs.maxclients;i++, host_client++)
 	{
 		// never timeout loopback connections
@@ -3768,6 +4331,11 @@ void Net_Stats_f(void)
 	Con_Print("connections                =\n");
 	for (conn = netconn_list;conn;conn = conn->next)
 		PrintStats(conn);
+	if (netthread.thread)
+	{
+		Con_Printf("net_thread receive overflows = %i\n", netthread.receive.dropped);
+		Con_Printf("net_thread send overflows    = %i\n", netthread.send.dropped);
+	}
 }
 
 #ifdef CONFIG_MENU
@@ -3845,6 +4413,7 @@ void NetConn_Init(void)
 	Cvar_RegisterVariable(&cl_netpacketloss_receive);
 	Cvar_RegisterVariable(&hostname);
 	Cvar_RegisterVariable(&developer_networking);
+	Cvar_RegisterVariable(&net_thread);
 	Cvar_RegisterVariable(&cl_netport);
 	Cvar_RegisterVariable(&sv_netport);
 	Cvar_RegisterVariable(&net_address);
@@ -3890,7 +4459,10 @@ void NetConn_Init(void)
 	sv_message.cursize = 0;
 	LHNET_Init();
 	if (Thread_HasThreads())
+	{
 		netconn_mutex = Thread_CreateMutex();
+		netconn_writebatch.mutex = Thread_CreateMutex();
+	}
 }
 
 void NetConn_Shutdown(void)
@@ -3901,5 +4473,8 @@ void NetConn_Shutdown(void)
 	if (netconn_mutex)
 		Thread_DestroyMutex(netconn_mutex);
 	netconn_mutex = NULL;
+	if (netconn_writebatch.mutex)
+		Thread_DestroyMutex(netconn_writebatch.mutex);
+	netconn_writebatch.mutex = NULL;
 }
 
@@ -449,6 +449,9 @@ void NetConn_Listen(qboolean state);
 int NetConn_Read(lhnetsocket_t *mysocket, void *data, int maxlength, lhnetaddress_t *peeraddress);
 int NetConn_Write(lhnetsocket_t *mysocket, const void *data, int length, const lhnetaddress_t *peeraddress);
 int NetConn_WriteString(lhnetsocket_t *mysocket, const char *string, const lhnetaddress_t *peeraddress);
+// server packets written between these go out together when the last batch ends (fewer syscalls)
+void NetConn_BeginWriteBatch(void);
+void NetConn_EndWriteBatch(void);
 int NetConn_IsLocalGame(void);
 void NetConn_ClientFrame(void);
 void NetConn_ServerFrame(void);
@@ -158,6 +158,7 @@ typedef struct dfunction_s
 }
 dfunction_t;
 
+struct prvm_aot_s;
 typedef struct mfunction_s
 {
 	int		first_statement;	// negative numbers are builtins
@@ -181,6 +182,10 @@ typedef struct mfunction_s
 
 	int		numparms;
 	unsigned char	parm_size[MAX_PARMS];
+
+	// native version of this function loaded by prvm_aot.c, returns how many
+	// statements it ran (for the profile)
+	long long (*aotfunction)(struct prvm_aot_s *aot);
 }
 mfunction_t;
 
@@ -189,6 +194,7 @@ typedef struct mstatement_s
 	opcode_t	op;
 	int			operand[3]; // always a global or -1 for unused
 	int			jumpabsolute; // only used by IF, IFNOT, GOTO
+	int			fastop; // op for the fast interpreter, may be a superinstruction that also runs the following statements
 }
 mstatement_t;
 
@@ -79,17 +79,24 @@ typedef struct edict_engineprivate_s
 	// initially false to prevent projectiles from moving on their first frame
 	// (even if they were spawned by an synchronous client think)
 	qboolean move;
+	// this frame's think already ran on a worker thread (sv_parallelthinks)
+	qboolean thinkdone;
 
-	// cached cluster links for quick stationary object visibility checking
+	// cached cluster links for quick stationary object visibility checking,
+	// stored as masks of the 32bit words of a pvs bitset the clusters are in
+	// (the mask bytes are in memory order like the pvs), -1 words if not cached
 	vec3_t cullmins, cullmaxs;
-	int pvs_numclusters;
-	int pvs_clusterlist[MAX_ENTITYCLUSTERS];
+	int pvs_numclusterwords;
+	int pvs_clusterwordindex[MAX_ENTITYCLUSTERS];
+	unsigned int pvs_clusterwordmask[MAX_ENTITYCLUSTERS];
 
 	// physics grid areas this edict is linked into
 	link_t areagrid[ENTITYGRIDAREAS];
 	// since the areagrid can have multiple references to one entity,
 	// we should avoid extensive checking on entities already encountered
 	int areagridmarknumber;
+	// leaf node in world->areatree_nodes, 0 if not linked into the tree
+	int areatreeleaf;
 	// mins/maxs passed to World_LinkEdict
 	vec3_t areamins, areamaxs;
 
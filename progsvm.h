@@ -258,6 +258,69 @@ extern prvm_eval_t prvm_badvalue;
 //============================================================================
 #define PRVM_OP_STATE		1
 
+// superinstructions, PRVM_Init_Exec puts these in mstatement_t fastop when a
+// statement and the one(s) following it can be run in one interpreter step
+// (must exactly match the end of dispatchtable in prvm_execprogram.h)
+typedef enum prvm_superop_e
+{
+	PRVM_SOP_ADDRESS_STOREP = OP_BITOR + 1, // ADDRESS + STOREP_F/ENT/FLD/S/FNC
+	PRVM_SOP_ADDRESS_STOREP_V,
+	PRVM_SOP_LOAD_IF, // LOAD_F/FLD/ENT/S/FNC + IF
+	PRVM_SOP_LOAD_IFNOT,
+	PRVM_SOP_NOT_F_IFNOT,
+	PRVM_SOP_LT_IFNOT,
+	PRVM_SOP_LE_IFNOT,
+	PRVM_SOP_GT_IFNOT,
+	PRVM_SOP_GE_IFNOT,
+	PRVM_SOP_EQ_F_IFNOT,
+	PRVM_SOP_NE_F_IFNOT,
+	PRVM_SOP_EQ_E_IFNOT,
+	PRVM_SOP_NE_E_IFNOT,
+	PRVM_SOP_ADD_F_STORE_F,
+	PRVM_SOP_SUB_F_STORE_F,
+	PRVM_SOP_MUL_F_STORE_F,
+	PRVM_SOP_COUNT
+}
+prvm_superop_t;
+
+// interface between the engine and QuakeC functions compiled to native code by
+// prvm_aot_compile, the generated C file has its own copy of this so
+// PRVM_AOT_VERSION must be increased whenever it changes
+#define PRVM_AOT_VERSION 2
+typedef struct prvm_aot_s
+{
+	// refreshed by the engine before native code runs and after every callback
+	void *globals;
+	void *edictsfields;
+	prvm_uint_t entityfields;
+	prvm_uint_t entityfieldsarea;
+	prvm_uint_t max_edicts;
+	// callbacks, statement is used for error messages and stack traces
+	void (*call)(struct prvm_aot_s *aot, int statement, prvm_int_t fnum, int argc);
+	void (*fault)(struct prvm_aot_s *aot, int statement, int fault, prvm_int_t value);
+	const char *(*getstring)(struct prvm_aot_s *aot, prvm_int_t num);
+	void (*state)(struct prvm_aot_s *aot, int statement, prvm_vec_t frame, prvm_int_t think);
+	// copies of prog->writenotify_fields and its callback
+	prvm_int_t writenotify_fields[2];
+	void (*writenotify)(struct prvm_aot_s *aot, prvm_int_t edictnum);
+	struct prvm_prog_s *prog;
+}
+prvm_aot_t;
+
+// what went wrong in native code, the interpreter reports the same things
+typedef enum prvm_aotfault_e
+{
+	PRVM_AOTFAULT_ADDRESS_EDICT,
+	PRVM_AOTFAULT_ADDRESS_FIELD,
+	PRVM_AOTFAULT_LOAD_EDICT,
+	PRVM_AOTFAULT_LOAD_FIELD,
+	PRVM_AOTFAULT_STOREP,
+	PRVM_AOTFAULT_WORLDWRITE, // only a warning
+	PRVM_AOTFAULT_DIVZERO, // only a warning
+	PRVM_AOTFAULT_RUNAWAY
+}
+prvm_aotfault_t;
+
 #ifdef DP_SMALLMEMORY
 #define	PRVM_MAX_STACK_DEPTH		128
 #define	PRVM_LOCALSTACK_SIZE		2048
@@ -684,6 +747,13 @@ typedef struct prvm_prog_s
 	// printed together with backtraces
 	const char *statestring;
 
+	// native code for the hot functions, see prvm_aot.c
+	prvm_aot_t			aot;
+	dllhandle_t			aot_library;
+	// set by PRVM_AOT_Call so a nested ExecuteProgram keeps its tempstrings
+	// (the native caller may still need the return value)
+	qboolean			aot_keeptempstrings;
+
 //	prvm_builtin_mem_t  *mem_list;
 
 // now passed as parameter of PRVM_LoadProgs
@@ -712,6 +782,11 @@ typedef struct prvm_prog_s
 
 	void				(*error_cmd)(const char *format, ...) DP_FUNC_PRINTF(1); // [INIT]
 
+	// QuakeC addressing one of these entity fields for a write (OP_ADDRESS,
+	// OP_STATE, PRVM_ED_ParseEpair) calls writenotify_edict, -1 if unused
+	prvm_int_t			writenotify_fields[2];
+	void				(*writenotify_edict)(struct prvm_prog_s *prog, prvm_int_t edictnum);
+
 	void				(*ExecuteProgram)(struct prvm_prog_s *prog, func_t fnum, const char *errormessage); // pointer to one of the *VM_ExecuteProgram functions
 } prvm_prog_t;
 
@@ -746,6 +821,10 @@ extern const int vm_sv_numbuiltins;
 extern const int vm_cl_numbuiltins;
 extern const int vm_m_numbuiltins;
 
+// vm_sv_builtins for thinks running on worker threads (sv_parallelthinks)
+extern prvm_builtin_t vm_sv_parallelbuiltins[];
+qboolean SVVM_parallelsafe_builtin(int builtinnumber);
+
 extern const char * vm_sv_extensions; // client also uses this
 extern const char * vm_m_extensions;
 
@@ -837,6 +916,9 @@ unsigned int PRVM_EDICT_NUM_ERROR(prvm_prog_t *prog, unsigned int n, const char
 #define PRVM_PROG_TO_EDICT(n) (PRVM_EDICT_NUM(n))
 //prvm_edict_t *PRVM_PROG_TO_EDICT(int n);
 
+// lets the VM owner know an entity field in prog->writenotify_fields is written
+#define PRVM_ED_WRITENOTIFY(prog, edictnum, fieldofs) do { if ((prog)->writenotify_edict && ((fieldofs) == (prog)->writenotify_fields[0] || (fieldofs) == (prog)->writenotify_fields[1])) (prog)->writenotify_edict((prog), (edictnum)); } while (0)
+
 //============================================================================
 
 #define	PRVM_G_FLOAT(o) (prog->globals.fp[o])
@@ -858,6 +940,12 @@ extern	int		prvm_type_size[8]; // for consistency : I think a goal of this sub-p
 
 void PRVM_Init_Exec(prvm_prog_t *prog);
 
+void PRVM_AOT_Init(void);
+void PRVM_AOT_Load(prvm_prog_t *prog);
+void PRVM_AOT_Unload(prvm_prog_t *prog);
+void PRVM_AOT_Refresh(prvm_prog_t *prog);
+void PRVM_AOT_Call(prvm_aot_t *aot, int statement, prvm_int_t fnum, int argc);
+
 void PRVM_ED_PrintEdicts_f (void);
 void PRVM_ED_PrintNum (prvm_prog_t *prog, int ent, const char *wildcard_fieldname);
 
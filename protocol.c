@@ -64,6 +64,7 @@ struct protocolversioninfo_s
 }
 protocolversioninfo[] =
 {
+	{ 3505, PROTOCOL_DARKPLACES8 , "DP8"},
 	{ 3504, PROTOCOL_DARKPLACES7 , "DP7"},
 	{ 3503, PROTOCOL_DARKPLACES6 , "DP6"},
 	{ 3502, PROTOCOL_DARKPLACES5 , "DP5"},
@@ -2005,12 +2006,18 @@ entityframe5_database_t *EntityFrame5_AllocDatabase(mempool_t *pool)
 	return d;
 }
 
+static void EntityFrame8_Benchmark_Free(entityframe8_benchmark_t *b);
+
 void EntityFrame5_FreeDatabase(entityframe5_database_t *d)
 {
 	// all the [maxedicts] memory is allocated at once, so there's only one
 	// thing to free
 	if (d->maxedicts)
 		Mem_Free(d->deltabits);
+	if (d->history8)
+		Mem_Free(d->history8);
+	if (d->benchmark8)
+		EntityFrame8_Benchmark_Free(d->benchmark8);
 	Mem_Free(d);
 }
 
@@ -2696,16 +2703,474 @@ static int EntityState5_DeltaBits(const entity_state_t *o, const entity_state_t
 	return bits;
 }
 
-void EntityFrame5_CL_ReadFrame(void)
+// EntityFrame8 (PROTOCOL_DARKPLACES8) sends the same stats and entity updates
+// as EntityFrame5 but range codes them, every byte is coded with an adaptive
+// binary model chosen by the field it belongs to, and each frame continues
+// from the models left by a frame the client has acknowledged (or from the
+// initial models), so the models learn what is common on this connection
+// and a lost packet never puts the two ends out of sync
+
+// byte contexts, multibyte values use one context per byte (little endian)
+#define E8C_STATCOUNT 0
+#define E8C_STATINDEX (E8C_STATCOUNT + 2)
+#define E8C_STATVALUE (E8C_STATINDEX + 1)
+#define E8C_NUMBER (E8C_STATVALUE + 4)
+#define E8C_BITS (E8C_NUMBER + 2)
+#define E8C_FLAGS (E8C_BITS + 4)
+#define E8C_ORIGIN (E8C_FLAGS + 1)
+#define E8C_ORIGIN32 (E8C_ORIGIN + 6)
+#define E8C_ANGLES16 (E8C_ORIGIN32 + 4)
+#define E8C_ANGLES8 (E8C_ANGLES16 + 6)
+#define E8C_MODEL8 (E8C_ANGLES8 + 3)
+#define E8C_MODEL16 (E8C_MODEL8 + 1)
+#define E8C_FRAME8 (E8C_MODEL16 + 2)
+#define E8C_FRAME16 (E8C_FRAME8 + 1)
+#define E8C_SKIN (E8C_FRAME16 + 2)
+#define E8C_EFFECTS (E8C_SKIN + 1)
+#define E8C_ALPHA (E8C_EFFECTS + 4)
+#define E8C_SCALE (E8C_ALPHA + 1)
+#define E8C_COLORMAP (E8C_SCALE + 1)
+#define E8C_TAGENTITY (E8C_COLORMAP + 1)
+#define E8C_TAGINDEX (E8C_TAGENTITY + 2)
+#define E8C_LIGHT (E8C_TAGINDEX + 1)
+#define E8C_LIGHTSTYLE (E8C_LIGHT + 2)
+#define E8C_LIGHTPFLAGS (E8C_LIGHTSTYLE + 1)
+#define E8C_GLOWSIZE (E8C_LIGHTPFLAGS + 1)
+#define E8C_GLOWCOLOR (E8C_GLOWSIZE + 1)
+#define E8C_COLORMOD (E8C_GLOWCOLOR + 1)
+#define E8C_GLOWMOD (E8C_COLORMOD + 1)
+#define E8C_ANIMTYPE (E8C_GLOWMOD + 1)
+#define E8C_ANIMFRAME (E8C_ANIMTYPE + 1)
+#define E8C_ANIMTIME (E8C_ANIMFRAME + 2)
+#define E8C_ANIMLERP (E8C_ANIMTIME + 2)
+#define E8C_NUMBONES (E8C_ANIMLERP + 1)
+#define E8C_BONEPOSE (E8C_NUMBONES + 1)
+#define E8C_TRAILEFFECTNUM (E8C_BONEPOSE + 2)
+#define E8C_COUNT (E8C_TRAILEFFECTNUM + 2)
+
+// 11 bit probabilities of a 0 bit, indexed by the bits of the byte seen so
+// far with a leading 1 (the same bit tree layout as LZMA)
+typedef struct entityframe8_model_s
+{
+	unsigned short probs[E8C_COUNT][256];
+}
+entityframe8_model_t;
+
+#define ENTITYFRAME8_HISTORY 16
+
+struct entityframe8_history_s
+{
+	// newest frame the client acknowledged (server only)
+	int ackframenum;
+	// frames before this one are not continued from any more, set when the
+	// client asks for a keyframe (server only)
+	int keyframenum;
+	// frame the models in each slot were left by, 0 if unused
+	int framenum[ENTITYFRAME8_HISTORY];
+	entityframe8_model_t models[ENTITYFRAME8_HISTORY];
+};
+
+typedef struct entityframe8_coder_s
+{
+	qboolean decode;
+	qboolean error;
+	// range coder state
+	unsigned int low;
+	unsigned int range;
+	unsigned int code;
+	// range coded data, written when encoding and read when decoding
+	unsigned char *coded;
+	int codedsize;
+	int codedmaxsize;
+	int codedpos;
+	// EntityFrame5 layout data, read when encoding and written when decoding
+	unsigned char *raw;
+	int rawsize;
+	int rawmaxsize;
+	int rawpos;
+	// entity numbers are coded as the distance from the previous one
+	int lastnumber;
+	entityframe8_model_t *model;
+}
+entityframe8_coder_t;
+
+static entityframe8_history_t *EntityFrame8_AllocHistory(mempool_t *pool)
+{
+	return (entityframe8_history_t *)Mem_Alloc(pool, sizeof(entityframe8_history_t));
+}
+
+static qboolean EntityFrame8_HaveModel(const entityframe8_history_t *h, int framenum)
+{
+	return framenum > 0 && h->framenum[framenum % ENTITYFRAME8_HISTORY] == framenum;
+}
+
+// sets up the models for coding a frame, starting from the ones the base
+// frame left (0 for the initial models)
+static entityframe8_model_t *EntityFrame8_StartModel(entityframe8_history_t *h, int framenum, int baseframenum)
+{
+	int i, j;
+	entityframe8_model_t *model = h->models + framenum % ENTITYFRAME8_HISTORY;
+	if (baseframenum)
+		memcpy(model, h->models + baseframenum % ENTITYFRAME8_HISTORY, sizeof(*model));
+	else
+		for (i = 0;i < E8C_COUNT;i++)
+			for (j = 0;j < 256;j++)
+				model->probs[i][j] = 1024;
+	h->framenum[framenum % ENTITYFRAME8_HISTORY] = framenum;
+	return model;
+}
+
+static void EntityFrame8_EncodeBit(entityframe8_coder_t *c, unsigned short *prob, int bit)
+{
+	unsigned int bound = (c->range >> 11) * *prob;
+	int i;
+	if (bit)
+	{
+		c->low += bound;
+		c->range -= bound;
+		*prob -= *prob >> 5;
+		// carry into the bytes already written
+		if (c->low < bound)
+			for (i = c->codedsize - 1;i >= 0 && !++c->coded[i];i--)
+				;
+	}
+	else
+	{
+		c->range = bound;
+		*prob += (2048 - *prob) >> 5;
+	}
+	while (c->range < (1u << 24))
+	{
+		if (c->codedsize < c->codedmaxsize)
+			c->coded[c->codedsize++] = c->low >> 24;
+		else
+			c->error = true;
+		c->low <<= 8;
+		c->range <<= 8;
+	}
+}
+
+static int EntityFrame8_DecodeBit(entityframe8_coder_t *c, unsigned short *prob)
+{
+	unsigned int bound = (c->range >> 11) * *prob;
+	int bit;
+	if (c->code < bound)
+	{
+		c->range = bound;
+		*prob += (2048 - *prob) >> 5;
+		bit = 0;
+	}
+	else
+	{
+		c->code -= bound;
+		c->range -= bound;
+		*prob -= *prob >> 5;
+		bit = 1;
+	}
+	while (c->range < (1u << 24))
+	{
+		// the encoder leaves out trailing zero bytes
+		c->code = (c->code << 8) | (c->codedpos < c->codedsize ? c->coded[c->codedpos] : 0);
+		c->codedpos++;
+		c->range <<= 8;
+	}
+	return bit;
+}
+
+// codes one byte value in a context, without touching the raw data
+static int EntityFrame8_Symbol(entityframe8_coder_t *c, int context, int value)
+{
+	unsigned short *probs = c->model->probs[context];
+	int i, m;
+	if (c->decode)
+	{
+		for (m = 1;m < 256;)
+			m = (m << 1) | EntityFrame8_DecodeBit(c, probs + m);
+		return m - 256;
+	}
+	for (i = 7, m = 1;i >= 0;i--)
+	{
+		EntityFrame8_EncodeBit(c, probs + m, (value >> i) & 1);
+		m = (m << 1) | ((value >> i) & 1);
+	}
+	return value;
+}
+
+static int EntityFrame8_ReadRaw(entityframe8_coder_t *c)
+{
+	if (c->rawpos >= c->rawsize)
+	{
+		c->error = true;
+		return 0;
+	}
+	return c->raw[c->rawpos++];
+}
+
+static void EntityFrame8_WriteRaw(entityframe8_coder_t *c, int value)
+{
+	if (c->rawpos >= c->rawmaxsize)
+	{
+		c->error = true;
+		return;
+	}
+	c->raw[c->rawpos++] = value;
+}
+
+// codes one byte of the raw data, returns its value either way
+static int EntityFrame8_Byte(entityframe8_coder_t *c, int context)
+{
+	int value;
+	if (c->error)
+		return 0;
+	if (c->decode)
+	{
+		value = EntityFrame8_Symbol(c, context, 0);
+		EntityFrame8_WriteRaw(c, value);
+		return value;
+	}
+	value = EntityFrame8_ReadRaw(c);
+	return EntityFrame8_Symbol(c, context, value);
+}
+
+static int EntityFrame8_Short(entityframe8_coder_t *c, int context)
+{
+	int value = EntityFrame8_Byte(c, context);
+	return value | (EntityFrame8_Byte(c, context + 1) << 8);
+}
+
+static void EntityFrame8_Long(entityframe8_coder_t *c, int context)
+{
+	EntityFrame8_Byte(c, context);
+	EntityFrame8_Byte(c, context + 1);
+	EntityFrame8_Byte(c, context + 2);
+	EntityFrame8_Byte(c, context + 3);
+}
+
+// entity numbers are mostly ascending, so code the distance from the previous
+// one with the remove bit on top, 0 is the 0x8000 terminator (an entity is
+// never in a frame twice)
+static int EntityFrame8_Number(entityframe8_coder_t *c)
+{
+	int n, value;
+	if (c->error)
+		return 0x8000;
+	if (c->decode)
+	{
+		value = EntityFrame8_Symbol(c, E8C_NUMBER, 0);
+		value |= EntityFrame8_Symbol(c, E8C_NUMBER + 1, 0) << 8;
+		n = value ? ((c->lastnumber + value) & 0x7FFF) | (value & 0x8000) : 0x8000;
+		EntityFrame8_WriteRaw(c, n & 0xFF);
+		EntityFrame8_WriteRaw(c, n >> 8);
+	}
+	else
+	{
+		n = EntityFrame8_ReadRaw(c);
+		n |= EntityFrame8_ReadRaw(c) << 8;
+		value = n == 0x8000 ? 0 : ((n - c->lastnumber) & 0x7FFF) | (n & 0x8000);
+		if (n != 0x8000 && !value)
+			c->error = true;
+		EntityFrame8_Symbol(c, E8C_NUMBER, value & 0xFF);
+		EntityFrame8_Symbol(c, E8C_NUMBER + 1, value >> 8);
+	}
+	if (n != 0x8000)
+		c->lastnumber = n & 0x7FFF;
+	return n;
+}
+
+// walks one entity update in the EntityState5_WriteUpdate layout
+static void EntityFrame8_Update(entityframe8_coder_t *c)
+{
+	int i, bits, type, numbones;
+	bits = EntityFrame8_Byte(c, E8C_BITS);
+	if (bits & E5_EXTEND1)
+	{
+		bits |= EntityFrame8_Byte(c, E8C_BITS + 1) << 8;
+		if (bits & E5_EXTEND2)
+		{
+			bits |= EntityFrame8_Byte(c, E8C_BITS + 2) << 16;
+			if (bits & E5_EXTEND3)
+				bits |= EntityFrame8_Byte(c, E8C_BITS + 3) << 24;
+		}
+	}
+	if (bits & E5_FLAGS)
+		EntityFrame8_Byte(c, E8C_FLAGS);
+	if (bits & E5_ORIGIN)
+	{
+		if (bits & E5_ORIGIN32)
+			for (i = 0;i < 3;i++)
+				EntityFrame8_Long(c, E8C_ORIGIN32);
+		else
+			for (i = 0;i < 3;i++)
+				EntityFrame8_Short(c, E8C_ORIGIN + i * 2);
+	}
+	if (bits & E5_ANGLES)
+	{
+		if (bits & E5_ANGLES16)
+			for (i = 0;i < 3;i++)
+				EntityFrame8_Short(c, E8C_ANGLES16 + i * 2);
+		else
+			for (i = 0;i < 3;i++)
+				EntityFrame8_Byte(c, E8C_ANGLES8 + i);
+	}
+	if (bits & E5_MODEL)
+	{
+		if (bits & E5_MODEL16)
+			EntityFrame8_Short(c, E8C_MODEL16);
+		else
+			EntityFrame8_Byte(c, E8C_MODEL8);
+	}
+	if (bits & E5_FRAME)
+	{
+		if (bits & E5_FRAME16)
+			EntityFrame8_Short(c, E8C_FRAME16);
+		else
+			EntityFrame8_Byte(c, E8C_FRAME8);
+	}
+	if (bits & E5_SKIN)
+		EntityFrame8_Byte(c, E8C_SKIN);
+	if (bits & E5_EFFECTS)
+	{
+		if (bits & E5_EFFECTS32)
+			EntityFrame8_Long(c, E8C_EFFECTS);
+		else if (bits & E5_EFFECTS16)
+			EntityFrame8_Short(c, E8C_EFFECTS);
+		else
+			EntityFrame8_Byte(c, E8C_EFFECTS);
+	}
+	if (bits & E5_ALPHA)
+		EntityFrame8_Byte(c, E8C_ALPHA);
+	if (bits & E5_SCALE)
+		EntityFrame8_Byte(c, E8C_SCALE);
+	if (bits & E5_COLORMAP)
+		EntityFrame8_Byte(c, E8C_COLORMAP);
+	if (bits & E5_ATTACHMENT)
+	{
+		EntityFrame8_Short(c, E8C_TAGENTITY);
+		EntityFrame8_Byte(c, E8C_TAGINDEX);
+	}
+	if (bits & E5_LIGHT)
+	{
+		for (i = 0;i < 4;i++)
+			EntityFrame8_Short(c, E8C_LIGHT);
+		EntityFrame8_Byte(c, E8C_LIGHTSTYLE);
+		EntityFrame8_Byte(c, E8C_LIGHTPFLAGS);
+	}
+	if (bits & E5_GLOW)
+	{
+		EntityFrame8_Byte(c, E8C_GLOWSIZE);
+		EntityFrame8_Byte(c, E8C_GLOWCOLOR);
+	}
+	if (bits & E5_COLORMOD)
+		for (i = 0;i < 3;i++)
+			EntityFrame8_Byte(c, E8C_COLORMOD);
+	if (bits & E5_GLOWMOD)
+		for (i = 0;i < 3;i++)
+			EntityFrame8_Byte(c, E8C_GLOWMOD);
+	if (bits & E5_COMPLEXANIMATION)
+	{
+		type = EntityFrame8_Byte(c, E8C_ANIMTYPE);
+		if (type == 4)
+		{
+			EntityFrame8_Short(c, E8C_MODEL16);
+			numbones = EntityFrame8_Byte(c, E8C_NUMBONES);
+			for (i = 0;i < numbones * 7;i++)
+				EntityFrame8_Short(c, E8C_BONEPOSE);
+		}
+		else if (type < 4)
+		{
+			// frames, start times and lerps of 1-4 framegroups
+			for (i = 0;i <= type;i++)
+				EntityFrame8_Short(c, E8C_ANIMFRAME);
+			for (i = 0;i <= type;i++)
+				EntityFrame8_Short(c, E8C_ANIMTIME);
+			if (type)
+				for (i = 0;i <= type;i++)
+					EntityFrame8_Byte(c, E8C_ANIMLERP);
+		}
+		else
+			c->error = true;
+	}
+	if (bits & E5_TRAILEFFECTNUM)
+		EntityFrame8_Short(c, E8C_TRAILEFFECTNUM);
+}
+
+// walks a whole raw frame, a stats block (short count, then byte index and
+// long value for each) followed by entity updates ending with 0x8000
+static void EntityFrame8_Frame(entityframe8_coder_t *c)
+{
+	int i, n, numstats;
+	numstats = EntityFrame8_Short(c, E8C_STATCOUNT);
+	for (i = 0;i < numstats && !c->error;i++)
+	{
+		EntityFrame8_Byte(c, E8C_STATINDEX);
+		EntityFrame8_Long(c, E8C_STATVALUE);
+	}
+	c->lastnumber = 0;
+	while (!c->error && (n = EntityFrame8_Number(c)) != 0x8000)
+		if (!(n & 0x8000))
+			EntityFrame8_Update(c);
+}
+
+// range codes a raw frame with the models (which are left adapted to it),
+// returns the coded size or -1 if it failed or would not fit in codedmaxsize
+static int EntityFrame8_Encode(entityframe8_model_t *model, const unsigned char *raw, int rawsize, unsigned char *coded, int codedmaxsize)
+{
+	entityframe8_coder_t c;
+	unsigned int low;
+	int i;
+	memset(&c, 0, sizeof(c));
+	c.model = model;
+	c.raw = (unsigned char *)raw;
+	c.rawsize = rawsize;
+	c.coded = coded;
+	c.codedmaxsize = codedmaxsize;
+	c.range = 0xFFFFFFFF;
+	EntityFrame8_Frame(&c);
+	if (c.rawpos != c.rawsize)
+		c.error = true;
+	// flush with the value in the final range that has the most trailing
+	// zero bytes (the range is at least 1<<24), then leave those out
+	low = c.low + 0xFFFFFF;
+	if (low < c.low)
+		for (i = c.codedsize - 1;i >= 0 && !++c.coded[i];i--)
+			;
+	if (c.codedsize < c.codedmaxsize)
+		c.coded[c.codedsize++] = low >> 24;
+	else
+		c.error = true;
+	while (c.codedsize > 0 && !c.coded[c.codedsize - 1])
+		c.codedsize--;
+	return c.error ? -1 : c.codedsize;
+}
+
+// decodes a frame coded by EntityFrame8_Encode with the same models
+static qboolean EntityFrame8_Decode(entityframe8_model_t *model, const unsigned char *coded, int codedsize, unsigned char *raw, int rawmaxsize, int *rawsize)
+{
+	entityframe8_coder_t c;
+	int i;
+	memset(&c, 0, sizeof(c));
+	c.decode = true;
+	c.model = model;
+	c.raw = raw;
+	c.rawmaxsize = rawmaxsize;
+	c.coded = (unsigned char *)coded;
+	c.codedsize = codedsize;
+	c.range = 0xFFFFFFFF;
+	for (i = 0;i < 4;i++)
+	{
+		c.code = (c.code << 8) | (c.codedpos < c.codedsize ? c.coded[c.codedpos] : 0);
+		c.codedpos++;
+	}
+	EntityFrame8_Frame(&c);
+	*rawsize = c.rawpos;
+	return !c.error;
+}
+
+static void EntityFrame5_CL_ReadEntities(void)
 {
-	int n, enumber, framenum;
+	int n, enumber;
 	entity_t *ent;
 	entity_state_t *s;
-	// read the number of this frame to echo back in next input packet
-	framenum = MSG_ReadLong(&cl_message);
-	CL_NewFrameReceived(framenum);
-	if (cls.protocol != PROTOCOL_QUAKE && cls.protocol != PROTOCOL_QUAKEDP && cls.protocol != PROTOCOL_NEHAHRAMOVIE && cls.protocol != PROTOCOL_DARKPLACES1 && cls.protocol != PROTOCOL_DARKPLACES2 && cls.protocol != PROTOCOL_DARKPLACES3 && cls.protocol != PROTOCOL_DARKPLACES4 && cls.protocol != PROTOCOL_DARKPLACES5 && cls.protocol != PROTOCOL_DARKPLACES6)
-		cls.servermovesequence = MSG_ReadLong(&cl_message);
 	// read entity numbers until we find a 0x8000
 	// (which would be remove world entity, but is actually a terminator)
 	while ((n = (unsigned short)MSG_ReadShort(&cl_message)) != 0x8000 && !cl_message.badread)
@@ -2755,6 +3220,315 @@ void EntityFrame5_CL_ReadFrame(void)
 	}
 }
 
+// a demo started in the middle of a game would begin with frames that
+// continue from models of frames it does not have, so those are written to
+// the demo uncoded (and a keyframe is asked for) until the frames continue
+// from one the demo has
+static void EntityFrame8_CL_DemoFrame(int framenum, int base, int headerpos, const unsigned char *raw, int rawsize)
+{
+	int end = cl_message.readcount, tail = cl_message.cursize - end;
+	if (!(base & 0x7F))
+	{
+		if (cl.demokeyframe8 <= 0)
+			cl.demokeyframe8 = framenum;
+		return;
+	}
+	if (cl.demokeyframe8 > 0 && framenum - (base & 0x7F) >= cl.demokeyframe8)
+		return;
+	if (!cl.demokeyframe8 && cls.netcon)
+	{
+		MSG_WriteByte(&cls.netcon->message, clc_stringcmd);
+		MSG_WriteString(&cls.netcon->message, "keyframe");
+		cl.demokeyframe8 = -1;
+	}
+	if (headerpos + 3 + rawsize + tail > cl_message.maxsize)
+		return;
+	// replace the frame in the message (which is written to the demo after
+	// it has been parsed)
+	memmove(cl_message.data + headerpos + 3 + rawsize, cl_message.data + end, tail);
+	memcpy(cl_message.data + headerpos + 3, raw, rawsize);
+	cl_message.data[headerpos] = 0x80;
+	StoreLittleShort(cl_message.data + headerpos + 1, rawsize);
+	cl_message.cursize = headerpos + 3 + rawsize + tail;
+	cl_message.readcount = headerpos + 3 + rawsize;
+}
+
+static void EntityFrame8_CL_ReadFrame(int framenum)
+{
+	static unsigned char raw[NET_MAXMESSAGE];
+	int i, movesequence, base, size, rawsize, numstats, headerpos;
+	const unsigned char *coded;
+	entityframe8_model_t *model;
+	sizebuf_t message;
+	movesequence = MSG_ReadLong(&cl_message);
+	headerpos = cl_message.readcount;
+	base = MSG_ReadByte(&cl_message);
+	size = (unsigned short)MSG_ReadShort(&cl_message);
+	coded = cl_message.data + cl_message.readcount;
+	if (cl_message.badread || cl_message.readcount + size > cl_message.cursize)
+	{
+		cl_message.badread = true;
+		return;
+	}
+	cl_message.readcount += size;
+	if (!cl.entityhistory8)
+		cl.entityhistory8 = EntityFrame8_AllocHistory(cls.levelmempool);
+	// the high bit means the frame is not range coded, the rest says how
+	// many frames back the models continue from
+	if (base & 0x7F)
+	{
+		if (!EntityFrame8_HaveModel(cl.entityhistory8, framenum - (base & 0x7F)))
+		{
+			// not acknowledged, so the server will send it again
+			Con_DPrintf("EntityFrame8_CL_ReadFrame: frame %i continues from frame %i which is not known\n", framenum, framenum - (base & 0x7F));
+			return;
+		}
+		model = EntityFrame8_StartModel(cl.entityhistory8, framenum, framenum - (base & 0x7F));
+	}
+	else
+		model = EntityFrame8_StartModel(cl.entityhistory8, framenum, 0);
+	if (base & 0x80)
+	{
+		rawsize = min(size, (int)sizeof(raw));
+		memcpy(raw, coded, rawsize);
+	}
+	else if (!EntityFrame8_Decode(model, coded, size, raw, sizeof(raw), &rawsize))
+	{
+		cl.entityhistory8->framenum[framenum % ENTITYFRAME8_HISTORY] = 0;
+		Con_DPrintf("EntityFrame8_CL_ReadFrame: frame %i could not be decoded\n", framenum);
+		return;
+	}
+	if (cls.demorecording)
+		EntityFrame8_CL_DemoFrame(framenum, base, headerpos, raw, rawsize);
+	CL_NewFrameReceived(framenum);
+	cls.servermovesequence = movesequence;
+	// read the decoded frame like an EntityFrame5 one
+	message = cl_message;
+	cl_message.data = raw;
+	cl_message.maxsize = sizeof(raw);
+	cl_message.cursize = rawsize;
+	cl_message.readcount = 0;
+	cl_message.badread = false;
+	numstats = (unsigned short)MSG_ReadShort(&cl_message);
+	for (i = 0;i < numstats && !cl_message.badread;i++)
+	{
+		int stat = MSG_ReadByte(&cl_message);
+		cl.stats[stat] = MSG_ReadLong(&cl_message);
+	}
+	EntityFrame5_CL_ReadEntities();
+	message.badread |= cl_message.badread;
+	cl_message = message;
+}
+
+void EntityFrame5_CL_ReadFrame(void)
+{
+	int framenum;
+	// read the number of this frame to echo back in next input packet
+	framenum = MSG_ReadLong(&cl_message);
+	if (cls.protocol == PROTOCOL_DARKPLACES8)
+	{
+		EntityFrame8_CL_ReadFrame(framenum);
+		return;
+	}
+	CL_NewFrameReceived(framenum);
+	if (cls.protocol != PROTOCOL_QUAKE && cls.protocol != PROTOCOL_QUAKEDP && cls.protocol != PROTOCOL_NEHAHRAMOVIE && cls.protocol != PROTOCOL_DARKPLACES1 && cls.protocol != PROTOCOL_DARKPLACES2 && cls.protocol != PROTOCOL_DARKPLACES3 && cls.protocol != PROTOCOL_DARKPLACES4 && cls.protocol != PROTOCOL_DARKPLACES5 && cls.protocol != PROTOCOL_DARKPLACES6)
+		cls.servermovesequence = MSG_ReadLong(&cl_message);
+	EntityFrame5_CL_ReadEntities();
+}
+
+// cl_entityframe8_benchmark and sv_entityframe8_benchmark state, each
+// EntityFrame5 frame is range coded with the encoder models and decoded
+// again with the decoder models
+#define ENTITYFRAME8_BENCHMARK_MAXSIZE (NET_MAXMESSAGE + 2 + MAX_CL_STATS * 5)
+struct entityframe8_benchmark_s
+{
+	protocolversion_t protocol;
+	entityframe8_history_t *encoder;
+	entityframe8_history_t *decoder;
+	int frames;
+	int mismatches;
+	double bytes5;
+	double bytes8;
+	double readtime;
+	double encodetime;
+	double decodetime;
+};
+
+// the newest acknowledged frame the models can continue from, or 0
+static int EntityFrame8_BaseFrame(const entityframe8_history_t *h, int framenum)
+{
+	int base = h->ackframenum;
+	if (base < h->keyframenum || framenum - base >= ENTITYFRAME8_HISTORY || !EntityFrame8_HaveModel(h, base))
+		return 0;
+	return base;
+}
+
+static void EntityFrame8_Benchmark_Frame(entityframe8_benchmark_t *b, int framenum, const unsigned char *raw, int rawsize, int bytes5)
+{
+	static unsigned char coded[ENTITYFRAME8_BENCHMARK_MAXSIZE];
+	static unsigned char decoded[ENTITYFRAME8_BENCHMARK_MAXSIZE];
+	int base, size, decodedsize;
+	double t;
+	qboolean ok;
+
+	base = EntityFrame8_BaseFrame(b->encoder, framenum);
+	t = Sys_DirtyTime();
+	size = EntityFrame8_Encode(EntityFrame8_StartModel(b->encoder, framenum, base), raw, rawsize, coded, rawsize);
+	if (size < 0)
+		EntityFrame8_StartModel(b->encoder, framenum, base);
+	b->encodetime += Sys_DirtyTime() - t;
+
+	// the svc_entities byte is included on both sides
+	b->frames++;
+	b->bytes5 += bytes5;
+	b->bytes8 += 12 + (size < 0 ? rawsize : size);
+
+	if (size >= 0)
+	{
+		t = Sys_DirtyTime();
+		ok = EntityFrame8_Decode(EntityFrame8_StartModel(b->decoder, framenum, base), coded, size, decoded, sizeof(decoded), &decodedsize);
+		b->decodetime += Sys_DirtyTime() - t;
+		if (!ok || decodedsize != rawsize || memcmp(decoded, raw, rawsize))
+			b->mismatches++;
+	}
+	else
+		EntityFrame8_StartModel(b->decoder, framenum, base);
+}
+
+static void EntityFrame8_Benchmark_Print(const entityframe8_benchmark_t *b)
+{
+	const char *name = Protocol_NameForEnum(b->protocol);
+	if (!b->frames)
+		return;
+	Con_Printf("entityframe8 benchmark: %i frames, %s %.1f bytes/frame, DP8 %.1f bytes/frame (%.1f%%), ", b->frames, name, b->bytes5 / b->frames, b->bytes8 / b->frames, b->bytes8 * 100.0 / max(b->bytes5, 1));
+	if (b->readtime)
+		Con_Printf("%s read %.2f us/frame, ", name, b->readtime * 1000000.0 / b->frames);
+	Con_Printf("DP8 encode %.2f us/frame, DP8 decode %.2f us/frame, %i mismatches\n", b->encodetime * 1000000.0 / b->frames, b->decodetime * 1000000.0 / b->frames, b->mismatches);
+}
+
+// prints the results of a sv_entityframe8_benchmark client and frees it (the
+// encoder models are the history8 of its database)
+static void EntityFrame8_Benchmark_Free(entityframe8_benchmark_t *b)
+{
+	EntityFrame8_Benchmark_Print(b);
+	Mem_Free(b->decoder);
+	Mem_Free(b);
+}
+
+// cl_entityframe8_benchmark, the DP8 frames continue from the models of a
+// frame a few frames back like they would with some network latency
+#define ENTITYFRAME8_BENCHMARK_LATENCY 4
+static entityframe8_benchmark_t entityframe8_benchmark;
+// stat updates since the last frame, in the EntityFrame8 raw layout
+static sizebuf_t entityframe8_benchmark_stats;
+static unsigned char entityframe8_benchmark_statsdata[2 + MAX_CL_STATS * 5];
+static int entityframe8_benchmark_statsbytes;
+
+static void EntityFrame8_Benchmark_ClearStats(void)
+{
+	sizebuf_t *stats = &entityframe8_benchmark_stats;
+	stats->data = entityframe8_benchmark_statsdata;
+	stats->maxsize = sizeof(entityframe8_benchmark_statsdata);
+	stats->cursize = 0;
+	MSG_WriteShort(stats, 0);
+	entityframe8_benchmark_statsbytes = 0;
+}
+
+void EntityFrame8_Benchmark_Stat(int stat, int size)
+{
+	sizebuf_t *stats = &entityframe8_benchmark_stats;
+	if (!stats->maxsize)
+		EntityFrame8_Benchmark_ClearStats();
+	if (stats->cursize + 5 > stats->maxsize)
+		return;
+	MSG_WriteByte(stats, stat);
+	MSG_WriteLong(stats, cl.stats[stat]);
+	StoreLittleShort(stats->data, BuffLittleShort(stats->data) + 1);
+	entityframe8_benchmark_statsbytes += size;
+}
+
+void EntityFrame8_Benchmark_ReadFrame(void)
+{
+	static unsigned char raw[ENTITYFRAME8_BENCHMARK_MAXSIZE];
+	entityframe8_benchmark_t *b = &entityframe8_benchmark;
+	sizebuf_t *stats = &entityframe8_benchmark_stats;
+	int start = cl_message.readcount, updates, rawsize, framenum;
+	double t;
+
+	t = Sys_DirtyTime();
+	EntityFrame5_CL_ReadFrame();
+	b->readtime += Sys_DirtyTime() - t;
+	if (cl_message.badread)
+		return;
+
+	if (!b->encoder)
+	{
+		b->protocol = cls.protocol;
+		b->encoder = EntityFrame8_AllocHistory(cls.permanentmempool);
+		b->decoder = EntityFrame8_AllocHistory(cls.permanentmempool);
+	}
+	if (!stats->maxsize)
+		EntityFrame8_Benchmark_ClearStats();
+
+	// the raw frame is the stats block followed by the updates after the
+	// framenum (and movesequence)
+	updates = start + (cls.protocol == PROTOCOL_DARKPLACES5 || cls.protocol == PROTOCOL_DARKPLACES6 ? 4 : 8);
+	rawsize = stats->cursize + cl_message.readcount - updates;
+	memcpy(raw, stats->data, stats->cursize);
+	memcpy(raw + stats->cursize, cl_message.data + updates, cl_message.readcount - updates);
+
+	framenum = b->frames + 1;
+	b->encoder->ackframenum = framenum - ENTITYFRAME8_BENCHMARK_LATENCY;
+	EntityFrame8_Benchmark_Frame(b, framenum, raw, rawsize, 1 + cl_message.readcount - start + entityframe8_benchmark_statsbytes);
+
+	EntityFrame8_Benchmark_ClearStats();
+}
+
+void EntityFrame8_Benchmark_Report(void)
+{
+	entityframe8_benchmark_t *b = &entityframe8_benchmark;
+	EntityFrame8_Benchmark_Print(b);
+	if (b->encoder)
+	{
+		Mem_Free(b->encoder);
+		Mem_Free(b->decoder);
+	}
+	memset(b, 0, sizeof(*b));
+}
+
+// sv_entityframe8_benchmark, transcodes the stat updates and svc_entities
+// EntityFrame5_WriteFrame wrote to msg after start, the DP8 frames continue
+// from the frames the client acknowledged like they would with PROTOCOL_DARKPLACES8
+static void EntityFrame8_Benchmark_WriteFrame(entityframe5_database_t *d, int framenum, const sizebuf_t *msg, int start)
+{
+	static unsigned char rawdata[ENTITYFRAME8_BENCHMARK_MAXSIZE];
+	sizebuf_t raw;
+	int pos, numstats = 0;
+
+	memset(&raw, 0, sizeof(raw));
+	raw.data = rawdata;
+	raw.maxsize = sizeof(rawdata);
+	MSG_WriteShort(&raw, 0);
+	for (pos = start;pos < msg->cursize && msg->data[pos] != svc_entities;numstats++)
+	{
+		MSG_WriteByte(&raw, msg->data[pos + 1]);
+		if (msg->data[pos] == svc_updatestatubyte)
+		{
+			MSG_WriteLong(&raw, msg->data[pos + 2]);
+			pos += 3;
+		}
+		else
+		{
+			MSG_WriteLong(&raw, BuffLittleLong(msg->data + pos + 2));
+			pos += 6;
+		}
+	}
+	StoreLittleShort(raw.data, numstats);
+	pos += sv.protocol == PROTOCOL_DARKPLACES5 || sv.protocol == PROTOCOL_DARKPLACES6 ? 5 : 9;
+	SZ_Write(&raw, msg->data + pos, msg->cursize - pos);
+	EntityFrame8_Benchmark_Frame(d->benchmark8, framenum, raw.data, raw.cursize, msg->cursize - start);
+}
+
 static int packetlog5cmp(const void *a_, const void *b_)
 {
 	const entityframe5_packetlog_t *a = (const entityframe5_packetlog_t *) a_;
@@ -2830,6 +3604,112 @@ void EntityFrame5_AckFrame(entityframe5_database_t *d, int framenum)
 	for (i = 0;i < ENTITYFRAME5_MAXPACKETLOGS;i++)
 		if (d->packetlog[i].packetnumber <= framenum)
 			d->packetlog[i].packetnumber = 0;
+	// the models this frame left can be continued from now
+	if (d->history8 && framenum > d->history8->ackframenum && framenum >= d->history8->keyframenum && framenum <= d->latestframenum)
+		d->history8->ackframenum = framenum;
+}
+
+void EntityFrame8_KeyFrame(entityframe5_database_t *d)
+{
+	// the next frame starts from the initial models, and only it or newer
+	// frames are continued from after it
+	if (d->history8)
+		d->history8->keyframenum = d->latestframenum + 1;
+}
+
+// one encoded update per entity, valid for the frame it was written in, the
+// update bytes only depend on the state and the delta bits (and sv.time)
+typedef struct entityframe5_sendcache_s
+{
+	int frame;
+	int bits;
+	int size;
+	entity_state_t state;
+	unsigned char data[128];
+}
+entityframe5_sendcache_t;
+
+static entityframe5_sendcache_t *entityframe5_sendcache = NULL;
+static int entityframe5_sendcache_maxedicts = 0;
+// never reset so entries from an earlier server can't match
+static int entityframe5_sendcache_frame = 1;
+
+void EntityFrame5_ClearSendCache(void)
+{
+	entityframe5_sendcache_frame++;
+	sv.entitysendcache_hits = 0;
+	sv.entitysendcache_misses = 0;
+}
+
+static void EntityFrame5_ExpandSendCache(int newmax)
+{
+	if (entityframe5_sendcache)
+		Mem_Free(entityframe5_sendcache);
+	entityframe5_sendcache_maxedicts = newmax;
+	entityframe5_sendcache = (entityframe5_sendcache_t *)Mem_Alloc(sv_mempool, newmax * sizeof(entityframe5_sendcache_t));
+}
+
+// same as EntityState5_WriteUpdate, but if another client already needed the
+// same update of this entity this frame the bytes are copied from that one
+static void EntityState5_WriteUpdateShared(int number, const entity_state_t *s, int changedbits, sizebuf_t *msg)
+{
+	int start = msg->cursize;
+	entityframe5_sendcache_t *c;
+
+	// removals are tiny, and the size profiling prints from every write
+	if (!sv_entitysendcache.integer || s->active != ACTIVE_NETWORK || number >= entityframe5_sendcache_maxedicts || developer_networkentities.integer >= 2)
+	{
+		EntityState5_WriteUpdate(number, s, changedbits, msg);
+		return;
+	}
+	c = entityframe5_sendcache + number;
+	if (c->frame == entityframe5_sendcache_frame && c->bits == changedbits && !memcmp(&c->state, s, sizeof(*s)))
+	{
+		SZ_Write(msg, c->data, c->size);
+		sv.entitysendcache_hits++;
+		return;
+	}
+	EntityState5_WriteUpdate(number, s, changedbits, msg);
+	sv.entitysendcache_misses++;
+	if (msg->cursize - start <= (int)sizeof(c->data))
+	{
+		c->frame = entityframe5_sendcache_frame;
+		c->bits = changedbits;
+		c->size = msg->cursize - start;
+		c->state = *s;
+		memcpy(c->data, msg->data + start, c->size);
+	}
+}
+
+// raw frame built by EntityFrame5_WriteFrame for PROTOCOL_DARKPLACES8
+static unsigned char entityframe8_rawdata[65535];
+
+// writes svc_entities with the range coded raw frame, continuing from the
+// models of the newest acknowledged frame that is recent enough
+static void EntityFrame8_WriteFrame(sizebuf_t *msg, entityframe5_database_t *d, int framenum, unsigned int movesequence, const sizebuf_t *raw)
+{
+	static unsigned char coded[sizeof(entityframe8_rawdata)];
+	entityframe8_history_t *h = d->history8;
+	int base = EntityFrame8_BaseFrame(h, framenum);
+	int size;
+	size = EntityFrame8_Encode(EntityFrame8_StartModel(h, framenum, base), raw->data, raw->cursize, coded, raw->cursize);
+	MSG_WriteByte(msg, svc_entities);
+	MSG_WriteLong(msg, framenum);
+	MSG_WriteLong(msg, movesequence);
+	if (size < 0)
+	{
+		// didn't get any smaller, send it as it is and keep the base models
+		EntityFrame8_StartModel(h, framenum, base);
+		MSG_WriteByte(msg, (base ? framenum - base : 0) | 0x80);
+		MSG_WriteShort(msg, raw->cursize);
+		SZ_Write(msg, raw->data, raw->cursize);
+	}
+	else
+	{
+		MSG_WriteByte(msg, base ? framenum - base : 0);
+		MSG_WriteShort(msg, size);
+		SZ_Write(msg, coded, size);
+	}
 }
 
 qboolean EntityFrame5_WriteFrame(sizebuf_t *msg, int maxsize, entityframe5_database_t *d, int numstates, const entity_state_t **states, int viewentnum, unsigned int movesequence, qboolean need_empty)
@@ -2840,9 +3720,14 @@ qboolean EntityFrame5_WriteFrame(sizebuf_t *msg, int maxsize, entityframe5_datab
 	sizebuf_t buf;
 	unsigned char data[128];
 	entityframe5_packetlog_t *packetlog;
+	sizebuf_t raw8;
+	sizebuf_t *out;
+	int used, numstats, start;
 
 	if (prog->max_edicts > d->maxedicts)
 		EntityFrame5_ExpandEdicts(d, prog->max_edicts);
+	if (prog->max_edicts > entityframe5_sendcache_maxedicts)
+		EntityFrame5_ExpandSendCache(prog->max_edicts);
 
 	framenum = d->latestframenum + 1;
 	d->viewentnum = viewentnum;
@@ -2918,6 +3803,36 @@ qboolean EntityFrame5_WriteFrame(sizebuf_t *msg, int maxsize, entityframe5_datab
 	if (buf.cursize + 11 > buf.maxsize)
 		return false;
 
+	// PROTOCOL_DARKPLACES8 puts the stats and entity updates in a raw frame
+	// (which is range coded into msg at the end) instead of msg, counting
+	// the svc_entities header as used
+	out = msg;
+	used = 0;
+	numstats = 0;
+	if (sv.protocol == PROTOCOL_DARKPLACES8)
+	{
+		if (!d->history8)
+			d->history8 = EntityFrame8_AllocHistory(sv_mempool);
+		memset(&raw8, 0, sizeof(raw8));
+		raw8.data = entityframe8_rawdata;
+		raw8.maxsize = sizeof(entityframe8_rawdata);
+		// stat count, filled in below
+		MSG_WriteShort(&raw8, 0);
+		out = &raw8;
+		used = msg->cursize + 12;
+		maxsize = min(maxsize, used + raw8.maxsize);
+	}
+	else if (sv_entityframe8_benchmark.integer && !d->benchmark8)
+	{
+		d->benchmark8 = (entityframe8_benchmark_t *)Mem_Alloc(sv_mempool, sizeof(entityframe8_benchmark_t));
+		d->benchmark8->protocol = sv.protocol;
+		if (!d->history8)
+			d->history8 = EntityFrame8_AllocHistory(sv_mempool);
+		d->benchmark8->encoder = d->history8;
+		d->benchmark8->decoder = EntityFrame8_AllocHistory(sv_mempool);
+	}
+	start = msg->cursize;
+
 	// build lists of entities by priority level
 	memset(d->prioritychaincounts, 0, sizeof(d->prioritychaincounts));
 	l = 0;
@@ -2943,7 +3858,7 @@ qboolean EntityFrame5_WriteFrame(sizebuf_t *msg, int maxsize, entityframe5_datab
 	// write stat updates
 	if (sv.protocol != PROTOCOL_QUAKE && sv.protocol != PROTOCOL_QUAKEDP && sv.protocol != PROTOCOL_NEHAHRAMOVIE && sv.protocol != PROTOCOL_NEHAHRABJP && sv.protocol != PROTOCOL_NEHAHRABJP2 && sv.protocol != PROTOCOL_NEHAHRABJP3 && sv.protocol != PROTOCOL_DARKPLACES1 && sv.protocol != PROTOCOL_DARKPLACES2 && sv.protocol != PROTOCOL_DARKPLACES3 && sv.protocol != PROTOCOL_DARKPLACES4 && sv.protocol != PROTOCOL_DARKPLACES5)
 	{
-		for (i = 0;i < MAX_CL_STATS && msg->cursize + 6 + 11 <= maxsize;i++)
+		for (i = 0;i < MAX_CL_STATS && used + out->cursize + 6 + 11 <= maxsize;i++)
 		{
 			if (host_client->statsdeltabits[i>>3] & (1<<(i&7)))
 			{
@@ -2957,7 +3872,14 @@ qboolean EntityFrame5_WriteFrame(sizebuf_t *msg, int maxsize, entityframe5_datab
 					memset(packetlog->statsdeltabits, 0, sizeof(packetlog->statsdeltabits));
 				}
 				packetlog->statsdeltabits[i>>3] |= (1<<(i&7));
-				if (host_client->stats[i] >= 0 && host_client->stats[i] < 256)
+				if (out != msg)
+				{
+					MSG_WriteByte(out, i);
+					MSG_WriteLong(out, host_client->stats[i]);
+					numstats++;
+					l = 1;
+				}
+				else if (host_client->stats[i] >= 0 && host_client->stats[i] < 256)
 				{
 					MSG_WriteByte(msg, svc_updatestatubyte);
 					MSG_WriteByte(msg, i);
@@ -2992,10 +3914,13 @@ qboolean EntityFrame5_WriteFrame(sizebuf_t *msg, int maxsize, entityframe5_datab
 	if (developer_networkentities.integer >= 10)
 		Con_Printf("send: svc_entities %i\n", framenum);
 	d->latestframenum = framenum;
-	MSG_WriteByte(msg, svc_entities);
-	MSG_WriteLong(msg, framenum);
-	if (sv.protocol != PROTOCOL_QUAKE && sv.protocol != PROTOCOL_QUAKEDP && sv.protocol != PROTOCOL_NEHAHRAMOVIE && sv.protocol != PROTOCOL_DARKPLACES1 && sv.protocol != PROTOCOL_DARKPLACES2 && sv.protocol != PROTOCOL_DARKPLACES3 && sv.protocol != PROTOCOL_DARKPLACES4 && sv.protocol != PROTOCOL_DARKPLACES5 && sv.protocol != PROTOCOL_DARKPLACES6)
-		MSG_WriteLong(msg, movesequence);
+	if (out == msg)
+	{
+		MSG_WriteByte(msg, svc_entities);
+		MSG_WriteLong(msg, framenum);
+		if (sv.protocol != PROTOCOL_QUAKE && sv.protocol != PROTOCOL_QUAKEDP && sv.protocol != PROTOCOL_NEHAHRAMOVIE && sv.protocol != PROTOCOL_DARKPLACES1 && sv.protocol != PROTOCOL_DARKPLACES2 && sv.protocol != PROTOCOL_DARKPLACES3 && sv.protocol != PROTOCOL_DARKPLACES4 && sv.protocol != PROTOCOL_DARKPLACES5 && sv.protocol != PROTOCOL_DARKPLACES6)
+			MSG_WriteLong(msg, movesequence);
+	}
 	for (priority = ENTITYFRAME5_PRIORITYLEVELS - 1;priority >= 0 && packetlog->numstates < ENTITYFRAME5_MAXSTATES;priority--)
 	{
 		for (i = 0;i < d->prioritychaincounts[priority] && packetlog->numstates < ENTITYFRAME5_MAXSTATES;i++)
@@ -3005,12 +3930,12 @@ qboolean EntityFrame5_WriteFrame(sizebuf_t *msg, int maxsize, entityframe5_datab
 			if (d->deltabits[num] & E5_FULLUPDATE)
 				d->deltabits[num] = E5_FULLUPDATE | EntityState5_DeltaBits(&defaultstate, n);
 			buf.cursize = 0;
-			EntityState5_WriteUpdate(num, n, d->deltabits[num], &buf);
+			EntityState5_WriteUpdateShared(num, n, d->deltabits[num], &buf);
 			// if the entity won't fit, try the next one
-			if (msg->cursize + buf.cursize + 2 > maxsize)
+			if (used + out->cursize + buf.cursize + 2 > maxsize)
 				continue;
 			// write entity to the packet
-			SZ_Write(msg, buf.data, buf.cursize);
+			SZ_Write(out, buf.data, buf.cursize);
 			// mark age on entity for prioritization
 			d->updateframenum[num] = framenum;
 			// log entity so deltabits can be restored later if lost
@@ -3022,7 +3947,15 @@ qboolean EntityFrame5_WriteFrame(sizebuf_t *msg, int maxsize, entityframe5_datab
 			d->priorities[num] = 0;
 		}
 	}
-	MSG_WriteShort(msg, 0x8000);
+	MSG_WriteShort(out, 0x8000);
+
+	if (out != msg)
+	{
+		StoreLittleShort(raw8.data, numstats);
+		EntityFrame8_WriteFrame(msg, d, framenum, movesequence, &raw8);
+	}
+	else if (sv_entityframe8_benchmark.integer && d->benchmark8)
+		EntityFrame8_Benchmark_WriteFrame(d, framenum, msg, start);
 
 	return true;
 }
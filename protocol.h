@@ -783,6 +783,11 @@ typedef struct entityframe5_packetlog_s
 }
 entityframe5_packetlog_t;
 
+// models of the EntityFrame8 range coder for recent frames
+typedef struct entityframe8_history_s entityframe8_history_t;
+// sv_entityframe8_benchmark counters and models of a client
+typedef struct entityframe8_benchmark_s entityframe8_benchmark_t;
+
 typedef struct entityframe5_database_s
 {
 	// number of the latest message sent to client
@@ -827,6 +832,11 @@ typedef struct entityframe5_database_s
 	// buffers for building priority info
 	int prioritychaincounts[ENTITYFRAME5_PRIORITYLEVELS];
 	unsigned short prioritychains[ENTITYFRAME5_PRIORITYLEVELS][ENTITYFRAME5_MAXSTATES];
+
+	// range coder models of recent frames (PROTOCOL_DARKPLACES8 only)
+	struct entityframe8_history_s *history8;
+	// sv_entityframe8_benchmark (protocols before PROTOCOL_DARKPLACES8)
+	entityframe8_benchmark_t *benchmark8;
 }
 entityframe5_database_t;
 
@@ -838,8 +848,20 @@ void EntityFrame5_CL_ReadFrame(void);
 void EntityFrame5_LostFrame(entityframe5_database_t *d, int framenum);
 void EntityFrame5_AckFrame(entityframe5_database_t *d, int framenum);
 qboolean EntityFrame5_WriteFrame(sizebuf_t *msg, int maxsize, entityframe5_database_t *d, int numstates, const entity_state_t **states, int viewentnum, unsigned int movesequence, qboolean need_empty);
+// EntityFrame5_WriteFrame shares encoded entity updates between clients that
+// need the same update, call this whenever the send states are rebuilt
+void EntityFrame5_ClearSendCache(void);
+// makes the next PROTOCOL_DARKPLACES8 frame decodable on its own (for a
+// client that started recording a demo)
+void EntityFrame8_KeyFrame(entityframe5_database_t *d);
+// cl_entityframe8_benchmark, transcodes EntityFrame5 frames of a demo being
+// played to EntityFrame8 and back
+void EntityFrame8_Benchmark_ReadFrame(void);
+void EntityFrame8_Benchmark_Stat(int stat, int size);
+void EntityFrame8_Benchmark_Report(void);
 
 extern cvar_t developer_networkentities;
+extern cvar_t cl_entityframe8_benchmark;
 
 // QUAKEWORLD
 // server to client
@@ -0,0 +1,588 @@
+// prvm_aot.c -- ahead-of-time compilation of hot QuakeC functions to native code
+
+/*
+prvm_aot_compile translates the most executed functions of a loaded progs
+(by the same counters prvm_profile prints) into a C file, builds it into a
+shared library with the local compiler and loads it.  The library is cached
+next to the game directories, named after the progs name and CRC, and is
+loaded again whenever the same progs are loaded with prvm_aot enabled.
+
+Both the compiler command and prvm_aot only come from the command line
+(-aotcompiler, -aot), console commands may be stuffed by a server or queued
+by QuakeC and those must never pick what gets passed to system() or loaded.
+The client VM runs progs sent by the server and is never compiled or loaded.
+
+Native functions work on the same globals and entity fields as the
+interpreter and do the same checks, anything that needs the engine (calls,
+errors, strings, OP_STATE) goes through the callbacks in prvm_aot_t.
+*/
+
+#include "quakedef.h"
+#include "progsvm.h"
+
+cvar_t prvm_aot = {CVAR_READONLY, "prvm_aot", "0", "run QuakeC functions compiled to native code by prvm_aot_compile, the cached code is loaded with the progs (enabled by the -aot command line option)"};
+cvar_t prvm_aot_functions = {CVAR_SAVE, "prvm_aot_functions", "64", "how many of the most executed QuakeC functions prvm_aot_compile translates to native code"};
+
+extern qboolean prvm_runawaycheck;
+
+// copies of the command line options, QuakeC cvar_set ignores CVAR_READONLY
+static qboolean prvm_aot_enabled;
+static char prvm_aot_compiler[MAX_INPUTLINE];
+
+#ifdef WIN32
+#define PRVM_AOT_LIBRARYEXTENSION ".dll"
+#else
+#define PRVM_AOT_LIBRARYEXTENSION ".so"
+#endif
+
+// functions bigger than this are left to the interpreter
+#define PRVM_AOT_MAXSTATEMENTS 65536
+
+#define PRVM_AOT_REACHED 1
+#define PRVM_AOT_LABEL 2
+
+static void PRVM_AOT_CachePath(prvm_prog_t *prog, const char *extension, char *path, size_t pathsize)
+{
+	// not in a game directory, so downloads can never put a library there
+	dpsnprintf(path, pathsize, "%saot/%s_%04x_%i%s", *fs_userdir ? fs_userdir : fs_basedir, prog->name, (int)prog->filecrc, prog->numstatements, extension);
+}
+
+//============================================================================
+// callbacks for native code
+
+static void PRVM_AOT_Fault(prvm_aot_t *aot, int statement, int fault, prvm_int_t value)
+{
+	prvm_prog_t *prog = aot->prog;
+
+	prog->xstatement = statement;
+	switch (fault)
+	{
+	case PRVM_AOTFAULT_ADDRESS_EDICT:
+		prog->error_cmd("%s Progs attempted to address an out of bounds edict number", prog->name);
+		break;
+	case PRVM_AOTFAULT_ADDRESS_FIELD:
+		prog->error_cmd("%s attempted to address an invalid field (%i) in an edict", prog->name, (int)value);
+		break;
+	case PRVM_AOTFAULT_LOAD_EDICT:
+		prog->error_cmd("%s Progs attempted to read an out of bounds edict number", prog->name);
+		break;
+	case PRVM_AOTFAULT_LOAD_FIELD:
+		prog->error_cmd("%s attempted to read an invalid field in an edict (%i)", prog->name, (int)value);
+		break;
+	case PRVM_AOTFAULT_STOREP:
+		prog->error_cmd("%s attempted to write to an out of bounds edict (%i)", prog->name, (int)value);
+		break;
+	case PRVM_AOTFAULT_WORLDWRITE:
+		if (!prog->allowworldwrites)
+			VM_Warning(prog, "assignment to world.%s (field %i) in %s\n", PRVM_GetString(prog, PRVM_ED_FieldAtOfs(prog, (int)value)->s_name), (int)value, prog->name);
+		break;
+	case PRVM_AOTFAULT_DIVZERO:
+		if (developer.integer)
+			VM_Warning(prog, "Attempted division by zero in %s\n", prog->name);
+		break;
+	case PRVM_AOTFAULT_RUNAWAY:
+		if (prvm_runawaycheck)
+		{
+			PRVM_Profile(prog, 1<<30, 1000000, 0);
+			prog->error_cmd("%s runaway loop counter hit limit of %d jumps\ntip: read above for list of most-executed functions", prog->name, (int)value);
+		}
+		break;
+	default:
+		prog->error_cmd("%s native code reported unknown fault %i", prog->name, fault);
+		break;
+	}
+}
+
+static const char *PRVM_AOT_GetString(prvm_aot_t *aot, prvm_int_t num)
+{
+	return PRVM_GetString(aot->prog, (int)num);
+}
+
+static void PRVM_AOT_State(prvm_aot_t *aot, int statement, prvm_vec_t frame, prvm_int_t think)
+{
+	prvm_prog_t *prog = aot->prog;
+	prvm_edict_t *ed;
+
+	if (!(prog->flag & PRVM_OP_STATE))
+	{
+		prog->xstatement = statement;
+		prog->error_cmd("OP_STATE not supported by %s", prog->name);
+	}
+	ed = PRVM_PROG_TO_EDICT(PRVM_gameglobaledict(self));
+	PRVM_ED_WRITENOTIFY(prog, PRVM_gameglobaledict(self), prog->fieldoffsets.nextthink);
+	PRVM_gameedictfloat(ed,nextthink) = PRVM_gameglobalfloat(time) + 0.1;
+	PRVM_gameedictfloat(ed,frame) = frame;
+	PRVM_gameedictfunction(ed,think) = think;
+}
+
+static void PRVM_AOT_WriteNotify(prvm_aot_t *aot, prvm_int_t edictnum)
+{
+	prvm_prog_t *prog = aot->prog;
+	prog->writenotify_edict(prog, edictnum);
+}
+
+//============================================================================
+// loading
+
+void PRVM_AOT_Unload(prvm_prog_t *prog)
+{
+	int i;
+
+	if (!prog->aot_library)
+		return;
+	if (prog->functions)
+		for (i = 0;i < prog->numfunctions;i++)
+			prog->functions[i].aotfunction = NULL;
+	Sys_UnloadLibrary(&prog->aot_library);
+}
+
+static qboolean PRVM_AOT_LoadLibrary(prvm_prog_t *prog, const char *path)
+{
+	int i, fnum, numloaded = 0;
+	const char *dllnames[2];
+	int *abi = NULL;
+	int *numfunctions = NULL;
+	int *functionnumbers = NULL;
+	long long (**functions)(prvm_aot_t *aot) = NULL;
+	dllfunction_t aotfuncs[] =
+	{
+		{"prvm_aot_abi", (void **) &abi},
+		{"prvm_aot_numfunctions", (void **) &numfunctions},
+		{"prvm_aot_functionnumbers", (void **) &functionnumbers},
+		{"prvm_aot_functions", (void **) &functions},
+		{NULL, NULL}
+	};
+
+	PRVM_AOT_Unload(prog);
+	dllnames[0] = path;
+	dllnames[1] = NULL;
+	if (!Sys_LoadLibrary(dllnames, &prog->aot_library, aotfuncs))
+	{
+		Con_Printf("%s: could not load native code from %s\n", prog->name, path);
+		return false;
+	}
+	if (abi[0] != PRVM_AOT_VERSION || abi[1] != (int)sizeof(prvm_aot_t) || abi[2] != (int)sizeof(prvm_vec_t) || abi[3] != (int)prog->filecrc || abi[4] != prog->numstatements)
+	{
+		Con_Printf("%s: %s was made for another engine or progs version, use prvm_aot_compile to rebuild it\n", prog->name, path);
+		Sys_UnloadLibrary(&prog->aot_library);
+		return false;
+	}
+
+	prog->aot.prog = prog;
+	prog->aot.call = PRVM_AOT_Call;
+	prog->aot.fault = PRVM_AOT_Fault;
+	prog->aot.getstring = PRVM_AOT_GetString;
+	prog->aot.state = PRVM_AOT_State;
+	prog->aot.writenotify = PRVM_AOT_WriteNotify;
+	PRVM_AOT_Refresh(prog);
+
+	for (i = 0;i < *numfunctions;i++)
+	{
+		fnum = functionnumbers[i];
+		if (fnum <= 0 || fnum >= prog->numfunctions || prog->functions[fnum].first_statement < 0)
+			continue;
+		prog->functions[fnum].aotfunction = functions[i];
+		numloaded++;
+	}
+	Con_Printf("%s: loaded native code for %i functions from %s\n", prog->name, numloaded, path);
+	return true;
+}
+
+/*
+===============
+PRVM_AOT_Load
+
+Called when progs are loaded, picks up the code prvm_aot_compile built for them
+===============
+*/
+void PRVM_AOT_Load(prvm_prog_t *prog)
+{
+	char path[MAX_OSPATH];
+
+	if (!prvm_aot_enabled || prog == CLVM_prog)
+		return;
+	PRVM_AOT_CachePath(prog, PRVM_AOT_LIBRARYEXTENSION, path, sizeof(path));
+	if (!FS_SysFileExists(path))
+	{
+		Con_DPrintf("%s: no native code cached in %s\n", prog->name, path);
+		return;
+	}
+	PRVM_AOT_LoadLibrary(prog, path);
+}
+
+//============================================================================
+// code generation
+
+/*
+===============
+PRVM_AOT_Walk
+
+Marks every statement the function can reach, returns how many there are or 0
+if the function can not be compiled
+===============
+*/
+static int PRVM_AOT_Walk(prvm_prog_t *prog, mfunction_t *f, unsigned char *flags, int *stack, int *firstreached, int *lastreached)
+{
+	int i, numstack = 0, numreached = 0, next[2], numnext, k;
+	mstatement_t *st;
+
+	memset(flags, 0, prog->numstatements);
+	flags[f->first_statement] = PRVM_AOT_REACHED;
+	stack[numstack++] = f->first_statement;
+	*firstreached = *lastreached = f->first_statement;
+	while (numstack)
+	{
+		i = stack[--numstack];
+		st = prog->statements + i;
+		if (++numreached > PRVM_AOT_MAXSTATEMENTS || st->op > OP_BITOR)
+			return 0;
+		*firstreached = min(*firstreached, i);
+		*lastreached = max(*lastreached, i);
+		numnext = 0;
+		switch (st->op)
+		{
+		case OP_DONE:
+		case OP_RETURN:
+			break;
+		case OP_GOTO:
+			next[numnext++] = st->jumpabsolute;
+			break;
+		case OP_IF:
+		case OP_IFNOT:
+			next[numnext++] = st->jumpabsolute;
+			next[numnext++] = i + 1;
+			break;
+		default:
+			next[numnext++] = i + 1;
+			break;
+		}
+		for (k = 0;k < numnext;k++)
+		{
+			if (next[k] < 0 || next[k] >= prog->numstatements)
+				return 0;
+			if (k == 0 && (st->op == OP_GOTO || st->op == OP_IF || st->op == OP_IFNOT))
+				flags[next[k]] |= PRVM_AOT_LABEL;
+			if (!(flags[next[k]] & PRVM_AOT_REACHED))
+			{
+				flags[next[k]] |= PRVM_AOT_REACHED;
+				stack[numstack++] = next[k];
+			}
+		}
+	}
+	return numreached;
+}
+
+static void PRVM_AOT_EmitJump(qfile_t *file, int i, int target, const char *condition)
+{
+	// only backwards jumps can loop, count those for the runaway check
+	if (target <= i)
+		FS_Printf(file, "\tif (%s) { if (++j == 10000000) a->fault(a, %i, %i, j); goto s%i; }\n", condition, i, PRVM_AOTFAULT_RUNAWAY, target);
+	else
+		FS_Printf(file, "\tif (%s) goto s%i;\n", condition, target);
+}
+
+static void PRVM_AOT_EmitStatement(qfile_t *file, prvm_prog_t *prog, int i)
+{
+	mstatement_t *st = prog->statements + i;
+	int A = st->operand[0], B = st->operand[1], C = st->operand[2];
+	char cond[64];
+
+	switch (st->op)
+	{
+	case OP_ADD_F: FS_Printf(file, "\tF(%i) = F(%i) + F(%i);\n", C, A, B); break;
+	case OP_SUB_F: FS_Printf(file, "\tF(%i) = F(%i) - F(%i);\n", C, A, B); break;
+	case OP_MUL_F: FS_Printf(file, "\tF(%i) = F(%i) * F(%i);\n", C, A, B); break;
+	case OP_ADD_V: FS_Printf(file, "\tF(%i) = F(%i) + F(%i); F(%i) = F(%i) + F(%i); F(%i) = F(%i) + F(%i);\n", C, A, B, C+1, A+1, B+1, C+2, A+2, B+2); break;
+	case OP_SUB_V: FS_Printf(file, "\tF(%i) = F(%i) - F(%i); F(%i) = F(%i) - F(%i); F(%i) = F(%i) - F(%i);\n", C, A, B, C+1, A+1, B+1, C+2, A+2, B+2); break;
+	case OP_MUL_V: FS_Printf(file, "\tF(%i) = F(%i)*F(%i) + F(%i)*F(%i) + F(%i)*F(%i);\n", C, A, B, A+1, B+1, A+2, B+2); break;
+	case OP_MUL_FV: FS_Printf(file, "\t{ vec t = F(%i); F(%i) = t * F(%i); F(%i) = t * F(%i); F(%i) = t * F(%i); }\n", A, C, B, C+1, B+1, C+2, B+2); break;
+	case OP_MUL_VF: FS_Printf(file, "\t{ vec t = F(%i); F(%i) = t * F(%i); F(%i) = t * F(%i); F(%i) = t * F(%i); }\n", B, C, A, C+1, A+1, C+2, A+2); break;
+	case OP_DIV_F: FS_Printf(file, "\tif (F(%i) != 0) F(%i) = F(%i) / F(%i); else { a->fault(a, %i, %i, 0); F(%i) = 0; }\n", B, C, A, B, i, PRVM_AOTFAULT_DIVZERO, C); break;
+	case OP_BITAND: FS_Printf(file, "\tF(%i) = (iint)F(%i) & (iint)F(%i);\n", C, A, B); break;
+	case OP_BITOR: FS_Printf(file, "\tF(%i) = (iint)F(%i) | (iint)F(%i);\n", C, A, B); break;
+	case OP_GE: FS_Printf(file, "\tF(%i) = F(%i) >= F(%i);\n", C, A, B); break;
+	case OP_LE: FS_Printf(file, "\tF(%i) = F(%i) <= F(%i);\n", C, A, B); break;
+	case OP_GT: FS_Printf(file, "\tF(%i) = F(%i) > F(%i);\n", C, A, B); break;
+	case OP_LT: FS_Printf(file, "\tF(%i) = F(%i) < F(%i);\n", C, A, B); break;
+	case OP_AND: FS_Printf(file, "\tF(%i) = T(I(%i)) && T(I(%i));\n", C, A, B); break;
+	case OP_OR: FS_Printf(file, "\tF(%i) = T(I(%i)) || T(I(%i));\n", C, A, B); break;
+	case OP_NOT_F: FS_Printf(file, "\tF(%i) = !T(I(%i));\n", C, A); break;
+	case OP_NOT_V: FS_Printf(file, "\tF(%i) = !F(%i) && !F(%i) && !F(%i);\n", C, A, A+1, A+2); break;
+	case OP_NOT_S: FS_Printf(file, "\tF(%i) = !I(%i) || !*S(I(%i));\n", C, A, A); break;
+	case OP_NOT_FNC:
+	case OP_NOT_ENT: FS_Printf(file, "\tF(%i) = I(%i) == 0;\n", C, A); break;
+	case OP_EQ_F: FS_Printf(file, "\tF(%i) = F(%i) == F(%i);\n", C, A, B); break;
+	case OP_EQ_V: FS_Printf(file, "\tF(%i) = F(%i) == F(%i) && F(%i) == F(%i) && F(%i) == F(%i);\n", C, A, B, A+1, B+1, A+2, B+2); break;
+	case OP_EQ_S: FS_Printf(file, "\tF(%i) = !strcmp(S(I(%i)), S(I(%i)));\n", C, A, B); break;
+	case OP_EQ_E:
+	case OP_EQ_FNC: FS_Printf(file, "\tF(%i) = I(%i) == I(%i);\n", C, A, B); break;
+	case OP_NE_F: FS_Printf(file, "\tF(%i) = F(%i) != F(%i);\n", C, A, B); break;
+	case OP_NE_V: FS_Printf(file, "\tF(%i) = F(%i) != F(%i) || F(%i) != F(%i) || F(%i) != F(%i);\n", C, A, B, A+1, B+1, A+2, B+2); break;
+	case OP_NE_S: FS_Printf(file, "\tF(%i) = strcmp(S(I(%i)), S(I(%i)));\n", C, A, B); break;
+	case OP_NE_E:
+	case OP_NE_FNC: FS_Printf(file, "\tF(%i) = I(%i) != I(%i);\n", C, A, B); break;
+	case OP_STORE_F:
+	case OP_STORE_ENT:
+	case OP_STORE_FLD:
+	case OP_STORE_S:
+	case OP_STORE_FNC: FS_Printf(file, "\tI(%i) = I(%i);\n", B, A); break;
+	case OP_STORE_V: FS_Printf(file, "\tI(%i) = I(%i); I(%i) = I(%i); I(%i) = I(%i);\n", B, A, B+1, A+1, B+2, A+2); break;
+	case OP_STOREP_F:
+	case OP_STOREP_ENT:
+	case OP_STOREP_FLD:
+	case OP_STOREP_S:
+	case OP_STOREP_FNC:
+		FS_Printf(file, "\tp = (uint)I(%i); if (p - a->entityfields >= a->entityfieldsarea - a->entityfields) { if (p >= a->entityfieldsarea) { a->fault(a, %i, %i, I(%i)); return n; } if (p < a->entityfields) a->fault(a, %i, %i, I(%i)); }\n", B, i, PRVM_AOTFAULT_STOREP, B, i, PRVM_AOTFAULT_WORLDWRITE, B);
+		FS_Printf(file, "\tE(p).i = I(%i);\n", A);
+		break;
+	case OP_STOREP_V:
+		FS_Printf(file, "\tp = (uint)I(%i); if (p - a->entityfields > a->entityfieldsarea - a->entityfields - 3) { if (p > a->entityfieldsarea - 3) { a->fault(a, %i, %i, I(%i)); return n; } if (p < a->entityfields) a->fault(a, %i, %i, I(%i)); }\n", B, i, PRVM_AOTFAULT_STOREP, B, i, PRVM_AOTFAULT_WORLDWRITE, B);
+		FS_Printf(file, "\tE(p).i = I(%i); E(p + 1).i = I(%i); E(p + 2).i = I(%i);\n", A, A+1, A+2);
+		break;
+	case OP_ADDRESS:
+		FS_Printf(file, "\tif ((uint)I(%i) >= a->max_edicts) { a->fault(a, %i, %i, I(%i)); return n; }\n", A, i, PRVM_AOTFAULT_ADDRESS_EDICT, A);
+		FS_Printf(file, "\tif ((uint)I(%i) >= a->entityfields) { a->fault(a, %i, %i, I(%i)); return n; }\n", B, i, PRVM_AOTFAULT_ADDRESS_FIELD, B);
+		FS_Printf(file, "\tif (I(%i) == a->writenotify_fields[0] || I(%i) == a->writenotify_fields[1]) a->writenotify(a, I(%i));\n", B, B, A);
+		FS_Printf(file, "\tI(%i) = I(%i) * (iint)a->entityfields + I(%i);\n", C, A, B);
+		break;
+	case OP_LOAD_F:
+	case OP_LOAD_FLD:
+	case OP_LOAD_ENT:
+	case OP_LOAD_S:
+	case OP_LOAD_FNC:
+		FS_Printf(file, "\tif ((uint)I(%i) >= a->max_edicts) { a->fault(a, %i, %i, I(%i)); return n; }\n", A, i, PRVM_AOTFAULT_LOAD_EDICT, A);
+		FS_Printf(file, "\tif ((uint)I(%i) >= a->entityfields) { a->fault(a, %i, %i, I(%i)); return n; }\n", B, i, PRVM_AOTFAULT_LOAD_FIELD, B);
+		FS_Printf(file, "\tI(%i) = E((uint)I(%i) * a->entityfields + (uint)I(%i)).i;\n", C, A, B);
+		break;
+	case OP_LOAD_V:
+		FS_Printf(file, "\tif ((uint)I(%i) >= a->max_edicts) { a->fault(a, %i, %i, I(%i)); return n; }\n", A, i, PRVM_AOTFAULT_LOAD_EDICT, A);
+		FS_Printf(file, "\tif ((uint)I(%i) > a->entityfields - 3) { a->fault(a, %i, %i, I(%i)); return n; }\n", B, i, PRVM_AOTFAULT_LOAD_FIELD, B);
+		FS_Printf(file, "\tp = (uint)I(%i) * a->entityfields + (uint)I(%i); I(%i) = E(p).i; I(%i) = E(p + 1).i; I(%i) = E(p + 2).i;\n", A, B, C, C+1, C+2);
+		break;
+	case OP_IFNOT:
+		dpsnprintf(cond, sizeof(cond), "!T(I(%i))", A);
+		PRVM_AOT_EmitJump(file, i, st->jumpabsolute, cond);
+		break;
+	case OP_IF:
+		dpsnprintf(cond, sizeof(cond), "T(I(%i))", A);
+		PRVM_AOT_EmitJump(file, i, st->jumpabsolute, cond);
+		break;
+	case OP_GOTO:
+		PRVM_AOT_EmitJump(file, i, st->jumpabsolute, "1");
+		break;
+	case OP_CALL0:
+	case OP_CALL1:
+	case OP_CALL2:
+	case OP_CALL3:
+	case OP_CALL4:
+	case OP_CALL5:
+	case OP_CALL6:
+	case OP_CALL7:
+	case OP_CALL8:
+		FS_Printf(file, "\ta->call(a, %i, I(%i), %i);\n", i, A, (int)(st->op - OP_CALL0));
+		break;
+	case OP_DONE:
+	case OP_RETURN:
+		FS_Printf(file, "\tI(%i) = I(%i); I(%i) = I(%i); I(%i) = I(%i); return n;\n", OFS_RETURN, A, OFS_RETURN+1, A+1, OFS_RETURN+2, A+2);
+		break;
+	case OP_STATE:
+		FS_Printf(file, "\ta->state(a, %i, F(%i), I(%i));\n", i, A, B);
+		break;
+	default:
+		// PRVM_AOT_Walk does not let these through
+		break;
+	}
+}
+
+static void PRVM_AOT_EmitFunction(qfile_t *file, prvm_prog_t *prog, int fnum, const unsigned char *flags, int firstreached, int lastreached)
+{
+	mfunction_t *f = prog->functions + fnum;
+	int i;
+
+	FS_Printf(file, "\n// %s\nstatic long long qc%i(prvm_aot_t *a)\n{\n\tev *g = (ev *)a->globals;\n\tlong long n = 0;\n\tint j = 0;\n\tuint p;\n\t(void)j;\n\t(void)p;\n", PRVM_GetString(prog, f->s_name), fnum);
+	if (firstreached < f->first_statement)
+		FS_Printf(file, "\tgoto s%i;\n", f->first_statement);
+	for (i = firstreached;i <= lastreached;i++)
+	{
+		if (!(flags[i] & PRVM_AOT_REACHED))
+			continue;
+		if ((flags[i] & PRVM_AOT_LABEL) || (i == f->first_statement && firstreached < f->first_statement))
+			FS_Printf(file, "s%i:\n", i);
+		FS_Printf(file, "\tn++;\n");
+		PRVM_AOT_EmitStatement(file, prog, i);
+	}
+	FS_Printf(file, "}\n");
+}
+
+static void PRVM_AOT_EmitHeader(qfile_t *file, prvm_prog_t *prog)
+{
+	qboolean vec64 = sizeof(prvm_vec_t) == 8;
+	qboolean int64 = sizeof(prvm_int_t) == 8;
+
+	FS_Printf(file, "// generated by prvm_aot_compile from %s progs (crc %04x), do not edit\n", prog->name, (int)prog->filecrc);
+	FS_Printf(file, "#include <string.h>\n");
+	FS_Printf(file, "typedef %s vec;\n", vec64 ? "double" : "float");
+	FS_Printf(file, "typedef %s iint;\n", int64 ? "long long" : "int");
+	FS_Printf(file, "typedef %s uint;\n", int64 ? "unsigned long long" : "unsigned int");
+	FS_Printf(file, "typedef union ev_u { vec f; iint i; } ev;\n");
+	// must match prvm_aot_t in progsvm.h
+	FS_Printf(file,
+		"typedef struct prvm_aot_s\n"
+		"{\n"
+		"\tvoid *globals;\n"
+		"\tvoid *edictsfields;\n"
+		"\tuint entityfields;\n"
+		"\tuint entityfieldsarea;\n"
+		"\tuint max_edicts;\n"
+		"\tvoid (*call)(struct prvm_aot_s *aot, int statement, iint fnum, int argc);\n"
+		"\tvoid (*fault)(struct prvm_aot_s *aot, int statement, int fault, iint value);\n"
+		"\tconst char *(*getstring)(struct prvm_aot_s *aot, iint num);\n"
+		"\tvoid (*state)(struct prvm_aot_s *aot, int statement, vec frame, iint think);\n"
+		"\tiint writenotify_fields[2];\n"
+		"\tvoid (*writenotify)(struct prvm_aot_s *aot, iint edictnum);\n"
+		"\tvoid *prog;\n"
+		"}\n"
+		"prvm_aot_t;\n");
+	FS_Printf(file, "#define F(o) (g[o].f)\n");
+	FS_Printf(file, "#define I(o) (g[o].i)\n");
+	FS_Printf(file, "#define E(o) (((ev *)a->edictsfields)[o])\n");
+	FS_Printf(file, "#define S(x) (a->getstring(a, x))\n");
+	FS_Printf(file, "#define T(x) ((x) & %s)\n", int64 ? "0x7FFFFFFFFFFFFFFFLL" : "0x7FFFFFFF");
+	FS_Printf(file, "int prvm_aot_abi[5] = {%i, (int)sizeof(prvm_aot_t), (int)sizeof(vec), %i, %i};\n", PRVM_AOT_VERSION, (int)prog->filecrc, prog->numstatements);
+}
+
+/*
+===============
+PRVM_AOT_Compile
+
+Translates the most executed functions, builds and loads them
+===============
+*/
+static void PRVM_AOT_Compile(prvm_prog_t *prog, int maxfunctions)
+{
+	int i, fnum, best, numcompiled = 0, firstreached, lastreached;
+	double bestprofile;
+	unsigned char *picked, *flags;
+	int *stack, *compiled;
+	qfile_t *file;
+	char sourcepath[MAX_OSPATH], librarypath[MAX_OSPATH], command[MAX_INPUTLINE];
+
+	// the compiler may rewrite the library in place, never do that to a loaded one
+	PRVM_AOT_Unload(prog);
+
+	PRVM_AOT_CachePath(prog, ".c", sourcepath, sizeof(sourcepath));
+	PRVM_AOT_CachePath(prog, PRVM_AOT_LIBRARYEXTENSION, librarypath, sizeof(librarypath));
+	FS_CreatePath(sourcepath);
+	file = FS_SysOpen(sourcepath, "wb", false);
+	if (!file)
+	{
+		Con_Printf("prvm_aot_compile: could not write %s\n", sourcepath);
+		return;
+	}
+
+	picked = (unsigned char *)Mem_Alloc(tempmempool, prog->numfunctions);
+	flags = (unsigned char *)Mem_Alloc(tempmempool, prog->numstatements);
+	stack = (int *)Mem_Alloc(tempmempool, prog->numstatements * sizeof(*stack));
+	compiled = (int *)Mem_Alloc(tempmempool, max(maxfunctions, 1) * sizeof(*compiled));
+
+	PRVM_AOT_EmitHeader(file, prog);
+	Con_Printf("%s: translating the most executed functions:\n", prog->name);
+	while (numcompiled < maxfunctions)
+	{
+		best = 0;
+		bestprofile = 0;
+		for (fnum = 1;fnum < prog->numfunctions;fnum++)
+		{
+			if (!picked[fnum] && prog->functions[fnum].first_statement > 0 && prog->functions[fnum].profile > bestprofile)
+			{
+				best = fnum;
+				bestprofile = prog->functions[fnum].profile;
+			}
+		}
+		if (!best)
+			break;
+		picked[best] = true;
+		if (!PRVM_AOT_Walk(prog, prog->functions + best, flags, stack, &firstreached, &lastreached))
+		{
+			Con_Printf("%s: %s can not be translated\n", prog->name, PRVM_GetString(prog, prog->functions[best].s_name));
+			continue;
+		}
+		Con_Printf("%10.0f %s\n", bestprofile, PRVM_GetString(prog, prog->functions[best].s_name));
+		PRVM_AOT_EmitFunction(file, prog, best, flags, firstreached, lastreached);
+		compiled[numcompiled++] = best;
+	}
+
+	FS_Printf(file, "\nint prvm_aot_numfunctions = %i;\n", numcompiled);
+	// the arrays end with an unused entry so they are never empty
+	FS_Printf(file, "int prvm_aot_functionnumbers[] = {");
+	for (i = 0;i < numcompiled;i++)
+		FS_Printf(file, "%i, ", compiled[i]);
+	FS_Printf(file, "0};\nlong long (*prvm_aot_functions[])(prvm_aot_t *a) = {");
+	for (i = 0;i < numcompiled;i++)
+		FS_Printf(file, "qc%i, ", compiled[i]);
+	FS_Printf(file, "0};\n");
+	FS_Close(file);
+
+	Mem_Free(compiled);
+	Mem_Free(stack);
+	Mem_Free(flags);
+	Mem_Free(picked);
+
+	if (!numcompiled)
+	{
+		Con_Printf("%s: no profile data (prvm_profile clears it), run the game for a while before prvm_aot_compile\n", prog->name);
+		return;
+	}
+
+	dpsnprintf(command, sizeof(command), "%s -o \"%s\" \"%s\"", prvm_aot_compiler, librarypath, sourcepath);
+	Con_Printf("%s\n", command);
+	if (system(command) != 0)
+	{
+		Con_Printf("prvm_aot_compile: compiling %s failed\n", sourcepath);
+		return;
+	}
+	if (prvm_aot_enabled)
+		PRVM_AOT_LoadLibrary(prog, librarypath);
+	else
+		Con_Printf("start with -aot to use it\n");
+}
+
+static void PRVM_AOT_Compile_f(void)
+{
+	prvm_prog_t *prog;
+
+	if (Cmd_Argc() < 2)
+	{
+		Con_Print("prvm_aot_compile <program name> [number of functions]\n");
+		return;
+	}
+	if (!*prvm_aot_compiler)
+	{
+		Con_Print("prvm_aot_compile: no compiler, start with -aotcompiler \"<command>\"\n");
+		return;
+	}
+	if (!(prog = PRVM_FriendlyProgFromString(Cmd_Argv(1))))
+		return;
+	if (prog == CLVM_prog)
+	{
+		Con_Printf("prvm_aot_compile: %s progs come from the server and are never compiled\n", prog->name);
+		return;
+	}
+	PRVM_AOT_Compile(prog, Cmd_Argc() > 2 ? atoi(Cmd_Argv(2)) : prvm_aot_functions.integer);
+}
+
+void PRVM_AOT_Init(void)
+{
+	int i;
+
+	Cmd_AddCommand("prvm_aot_compile", PRVM_AOT_Compile_f, "translates the most executed QuakeC functions of the selected VM (server, menu) to C, builds them with the -aotcompiler command and loads the result, optional second parameter is how many functions (default prvm_aot_functions)");
+	Cvar_RegisterVariable(&prvm_aot);
+	Cvar_RegisterVariable(&prvm_aot_functions);
+
+	// COMMANDLINEOPTION: PRVM: -aot loads the native code prvm_aot_compile built for the server and menu progs
+	prvm_aot_enabled = COM_CheckParm("-aot") != 0;
+	Cvar_SetValueQuick(&prvm_aot, prvm_aot_enabled);
+	// COMMANDLINEOPTION: PRVM: -aotcompiler "<command>" allows prvm_aot_compile and builds with this command (for example "cc -O2 -shared -fPIC"), -o outputfile sourcefile is added to it
+	if ((i = COM_CheckParm("-aotcompiler")) && i + 1 < com_argc)
+		strlcpy(prvm_aot_compiler, com_argv[i + 1], sizeof(prvm_aot_compiler));
+}
@@ -35,6 +35,7 @@ cvar_t prvm_traceqc = {0, "prvm_traceqc", "0", "prints every QuakeC statement as
 // LordHavoc: counts usage of each QuakeC statement
 cvar_t prvm_statementprofiling = {0, "prvm_statementprofiling", "0", "counts how many times each QuakeC statement has been executed, these counts are displayed in prvm_printfunction output (if enabled)"};
 cvar_t prvm_timeprofiling = {0, "prvm_timeprofiling", "0", "counts how long each function has been executed, these counts are displayed in prvm_profile output (if enabled)"};
+cvar_t prvm_superinstructions = {0, "prvm_superinstructions", "1", "when loading progs, combine common pairs of QuakeC statements into single interpreter steps (takes effect on next progs load)"};
 cvar_t prvm_coverage = {0, "prvm_coverage", "0", "report and count coverage events (1: per-function, 2: coverage() builtin, 4: per-statement)"};
 cvar_t prvm_backtraceforwarnings = {0, "prvm_backtraceforwarnings", "0", "print a backtrace for warnings too"};
 cvar_t prvm_leaktest = {0, "prvm_leaktest", "0", "try to detect memory leaks in strings or entities"};
@@ -1044,6 +1045,8 @@ qboolean PRVM_ED_ParseEpair(prvm_prog_t *prog, prvm_edict_t *ent, ddef_t *key, c
 		Con_Printf("PRVM_ED_ParseEpair: Unknown key->type %i for key \"%s\" on %s\n", key->type, PRVM_GetString(prog, key->s_name), prog->name);
 		return false;
 	}
+	if (ent)
+		PRVM_ED_WRITENOTIFY(prog, PRVM_NUM_FOR_EDICT(ent), key->ofs);
 	return true;
 }
 
@@ -1842,12 +1845,14 @@ void PRVM_Prog_Reset(prvm_prog_t *prog)
 	{
 		PRVM_LeakTest(prog);
 		prog->reset_cmd(prog);
+		PRVM_AOT_Unload(prog);
 		Mem_FreePool(&prog->progs_mempool);
 		if(prog->po)
 			PRVM_PO_Destroy((po_t *) prog->po);
 	}
 	memset(prog,0,sizeof(prvm_prog_t));
 	prog->break_statement = -1;
+	prog->writenotify_fields[0] = prog->writenotify_fields[1] = -1;
 	prog->watch_global_type = ev_void;
 	prog->watch_field_type = ev_void;
 }
@@ -2277,6 +2282,7 @@ void PRVM_Prog_Load(prvm_prog_t *prog, const char * filename, unsigned char * da
 	PRVM_LoadLNO(prog, filename);
 
 	PRVM_Init_Exec(prog);
+	PRVM_AOT_Load(prog);
 
 	if(*prvm_language.string)
 	// in CSQC we really shouldn't be able to change how stuff works... sorry for now
@@ -2920,6 +2926,7 @@ void PRVM_Init (void)
 	Cvar_RegisterVariable (&prvm_statementprofiling);
 	Cvar_RegisterVariable (&prvm_timeprofiling);
 	Cvar_RegisterVariable (&prvm_coverage);
+	Cvar_RegisterVariable (&prvm_superinstructions);
 	Cvar_RegisterVariable (&prvm_backtraceforwarnings);
 	Cvar_RegisterVariable (&prvm_leaktest);
 	Cvar_RegisterVariable (&prvm_leaktest_follow_targetname);
@@ -2929,6 +2936,8 @@ void PRVM_Init (void)
 	Cvar_RegisterVariable (&prvm_reuseedicts_startuptime);
 	Cvar_RegisterVariable (&prvm_reuseedicts_neverinsameframe);
 
+	PRVM_AOT_Init();
+
 	// COMMANDLINEOPTION: PRVM: -norunaway disables the runaway loop check (it might be impossible to exit DarkPlaces if used!)
 	prvm_runawaycheck = !COM_CheckParm("-norunaway");
 
@@ -671,6 +671,114 @@ static int PRVM_LeaveFunction (prvm_prog_t *prog)
 	return prog->stack[prog->depth].s;
 }
 
+/*
+====================
+PRVM_FuseStatements
+
+Picks the fastop for each statement, a superinstruction runs a statement and
+the next one in one step of the interpreter, saving a dispatch.  The
+statements are left as they are so jumps into the middle of a superinstruction
+and the slow interpreter (prvm_traceqc, breakpoints, watchpoints) still work.
+====================
+*/
+extern cvar_t prvm_superinstructions;
+static void PRVM_FuseStatements(prvm_prog_t *prog)
+{
+	int i, numfused = 0;
+	mstatement_t *st;
+
+	for (i = 0, st = prog->statements;i < prog->numstatements;i++, st++)
+	{
+		st->fastop = st->op;
+		if (!prvm_superinstructions.integer || i + 1 >= prog->numstatements)
+			continue;
+		switch (st->op)
+		{
+		case OP_ADDRESS:
+			switch (st[1].op)
+			{
+			case OP_STOREP_F:
+			case OP_STOREP_ENT:
+			case OP_STOREP_FLD:
+			case OP_STOREP_S:
+			case OP_STOREP_FNC:
+				st->fastop = PRVM_SOP_ADDRESS_STOREP;
+				break;
+			case OP_STOREP_V:
+				st->fastop = PRVM_SOP_ADDRESS_STOREP_V;
+				break;
+			default:
+				break;
+			}
+			break;
+		case OP_LOAD_F:
+		case OP_LOAD_FLD:
+		case OP_LOAD_ENT:
+		case OP_LOAD_S:
+		case OP_LOAD_FNC:
+			if (st[1].op == OP_IF)
+				st->fastop = PRVM_SOP_LOAD_IF;
+			else if (st[1].op == OP_IFNOT)
+				st->fastop = PRVM_SOP_LOAD_IFNOT;
+			break;
+		case OP_NOT_F:
+			if (st[1].op == OP_IFNOT)
+				st->fastop = PRVM_SOP_NOT_F_IFNOT;
+			break;
+		case OP_LT:
+			if (st[1].op == OP_IFNOT)
+				st->fastop = PRVM_SOP_LT_IFNOT;
+			break;
+		case OP_LE:
+			if (st[1].op == OP_IFNOT)
+				st->fastop = PRVM_SOP_LE_IFNOT;
+			break;
+		case OP_GT:
+			if (st[1].op == OP_IFNOT)
+				st->fastop = PRVM_SOP_GT_IFNOT;
+			break;
+		case OP_GE:
+			if (st[1].op == OP_IFNOT)
+				st->fastop = PRVM_SOP_GE_IFNOT;
+			break;
+		case OP_EQ_F:
+			if (st[1].op == OP_IFNOT)
+				st->fastop = PRVM_SOP_EQ_F_IFNOT;
+			break;
+		case OP_NE_F:
+			if (st[1].op == OP_IFNOT)
+				st->fastop = PRVM_SOP_NE_F_IFNOT;
+			break;
+		case OP_EQ_E:
+			if (st[1].op == OP_IFNOT)
+				st->fastop = PRVM_SOP_EQ_E_IFNOT;
+			break;
+		case OP_NE_E:
+			if (st[1].op == OP_IFNOT)
+				st->fastop = PRVM_SOP_NE_E_IFNOT;
+			break;
+		case OP_ADD_F:
+			if (st[1].op == OP_STORE_F)
+				st->fastop = PRVM_SOP_ADD_F_STORE_F;
+			break;
+		case OP_SUB_F:
+			if (st[1].op == OP_STORE_F)
+				st->fastop = PRVM_SOP_SUB_F_STORE_F;
+			break;
+		case OP_MUL_F:
+			if (st[1].op == OP_STORE_F)
+				st->fastop = PRVM_SOP_MUL_F_STORE_F;
+			break;
+		default:
+			break;
+		}
+		if (st->fastop != (int)st->op)
+			numfused++;
+	}
+	if (numfused)
+		Con_DPrintf("%s: %i of %i statements start a superinstruction\n", prog->name, numfused, prog->numstatements);
+}
+
 void PRVM_Init_Exec(prvm_prog_t *prog)
 {
 	// dump the stack
@@ -678,6 +786,7 @@ void PRVM_Init_Exec(prvm_prog_t *prog)
 	prog->localstack_used = 0;
 	// reset the string table
 	// nothing here yet
+	PRVM_FuseStatements(prog);
 }
 
 /*
@@ -716,6 +825,88 @@ static void PRVM_StatementCoverageEvent(prvm_prog_t *prog, mfunction_t *func, in
 	Con_Printf("prvm_coverage: %s just executed a statement at %s for the first time. Coverage: %.2f%%.\n", prog->name, PRVM_WhereAmI(vabuf, sizeof(vabuf), prog, func, statement), prog->statements_covered * 100.0 / prog->numstatements);
 }
 
+/*
+====================
+PRVM_AOT_Refresh
+
+Copies the values native code needs into prog->aot, they may change whenever a
+builtin is called (ED_Alloc can grow the edicts)
+====================
+*/
+void PRVM_AOT_Refresh(prvm_prog_t *prog)
+{
+	prog->aot.globals = prog->globals.fp;
+	prog->aot.edictsfields = prog->edictsfields;
+	prog->aot.entityfields = prog->entityfields;
+	prog->aot.entityfieldsarea = prog->entityfieldsarea;
+	prog->aot.max_edicts = prog->max_edicts;
+	prog->aot.writenotify_fields[0] = prog->writenotify_fields[0];
+	prog->aot.writenotify_fields[1] = prog->writenotify_fields[1];
+}
+
+// native code skips the statement counters, so it is not used while they are wanted
+extern cvar_t prvm_aot;
+#define PRVM_AOT_USABLE(f) ((f)->aotfunction && prvm_aot.integer && !prvm_statementprofiling.integer && !(prvm_coverage.integer & 4))
+
+// runs the native version of a function PRVM_EnterFunction has just entered
+static void PRVM_AOT_Run(prvm_prog_t *prog, mfunction_t *f)
+{
+	PRVM_AOT_Refresh(prog);
+	f->profile += f->aotfunction(&prog->aot);
+}
+
+/*
+====================
+PRVM_AOT_Call
+
+OP_CALL for native code, the same as in prvm_execprogram.h except that QuakeC
+functions without a native version get their own ExecuteProgram
+====================
+*/
+void PRVM_AOT_Call(prvm_aot_t *aot, int statement, prvm_int_t fnum, int argc)
+{
+	prvm_prog_t *prog = aot->prog;
+	mfunction_t *newf;
+
+	prog->xstatement = statement;
+	prog->argc = argc;
+	if (!fnum)
+		prog->error_cmd("NULL function in %s", prog->name);
+	if (fnum < 0 || fnum >= prog->numfunctions)
+		prog->error_cmd("%s CALL outside the program", prog->name);
+
+	newf = &prog->functions[fnum];
+	if (newf->first_statement >= 0 && !PRVM_AOT_USABLE(newf))
+	{
+		// this counts the call itself
+		prog->aot_keeptempstrings = true;
+		prog->ExecuteProgram(prog, fnum, "PRVM_AOT_Call");
+		PRVM_AOT_Refresh(prog);
+		return;
+	}
+
+	if (newf->callcount++ == 0 && (prvm_coverage.integer & 1))
+		PRVM_FunctionCoverageEvent(prog, newf);
+
+	if (newf->first_statement < 0)
+	{
+		// negative first_statement values are built in functions
+		int builtinnumber = -newf->first_statement;
+		prog->xfunction->builtinsprofile++;
+		if (builtinnumber < prog->numbuiltins && prog->builtins[builtinnumber])
+			prog->builtins[builtinnumber](prog);
+		else
+			prog->error_cmd("No such builtin #%i in %s; most likely cause: outdated engine build. Try updating!", builtinnumber, prog->name);
+	}
+	else
+	{
+		PRVM_EnterFunction(prog, newf);
+		PRVM_AOT_Run(prog, newf);
+		PRVM_LeaveFunction(prog);
+	}
+	PRVM_AOT_Refresh(prog);
+}
+
 #ifdef __GNUC__
 #define HAVE_COMPUTED_GOTOS 1
 #endif
@@ -742,6 +933,7 @@ void MVM_ExecuteProgram (prvm_prog_t *prog, func_t fnum, const char *errormessag
 	prvm_eval_t	*ptr;
 	int		jumpcount, cachedpr_trace, exitdepth;
 	int		restorevm_tempstringsbuf_cursize;
+	qboolean	keeptempstrings = prog->aot_keeptempstrings;
 	double  calltime;
 	double tm, starttm;
 	prvm_vec_t tempfloat;
@@ -756,10 +948,13 @@ void MVM_ExecuteProgram (prvm_prog_t *prog, func_t fnum, const char *errormessag
 	unsigned int cached_max_edicts = prog->max_edicts;
 	// these do not change
 	mstatement_t *cached_statements = prog->statements;
+	prvm_int_t cached_writenotify_field0 = prog->writenotify_fields[0];
+	prvm_int_t cached_writenotify_field1 = prog->writenotify_fields[1];
 	qboolean cached_allowworldwrites = prog->allowworldwrites;
 	unsigned int cached_flag = prog->flag;
 
 	calltime = Sys_DirtyTime();
+	prog->aot_keeptempstrings = false;
 
 	if (!fnum || fnum >= (unsigned int)prog->numfunctions)
 	{
@@ -791,6 +986,14 @@ void MVM_ExecuteProgram (prvm_prog_t *prog, func_t fnum, const char *errormessag
 	if (prog->xfunction->callcount++ == 0 && (prvm_coverage.integer & 1))
 		PRVM_FunctionCoverageEvent(prog, prog->xfunction);
 
+	// native code only stands in for the fast interpreter
+	if (PRVM_AOT_USABLE(f) && !prog->trace && prog->watch_global_type == ev_void && prog->watch_field_type == ev_void && prog->break_statement < 0 && !prvm_timeprofiling.integer)
+	{
+		PRVM_AOT_Run(prog, f);
+		PRVM_LeaveFunction(prog);
+		goto cleanup;
+	}
+
 chooseexecprogram:
 	cachedpr_trace = prog->trace;
 	if (prog->trace || prog->watch_global_type != ev_void || prog->watch_field_type != ev_void || prog->break_statement >= 0)
@@ -826,7 +1029,8 @@ cleanup:
 	if (developer_insane.integer && prog->tempstringsbuf.cursize > restorevm_tempstringsbuf_cursize)
 		Con_DPrintf("MVM_ExecuteProgram: %s used %i bytes of tempstrings\n", PRVM_GetString(prog, prog->functions[fnum].s_name), prog->tempstringsbuf.cursize - restorevm_tempstringsbuf_cursize);
 	// delete tempstrings created by this function
-	prog->tempstringsbuf.cursize = restorevm_tempstringsbuf_cursize;
+	if (!keeptempstrings)
+		prog->tempstringsbuf.cursize = restorevm_tempstringsbuf_cursize;
 
 	tm = Sys_DirtyTime() - calltime;if (tm < 0 || tm >= 1800) tm = 0;
 	f->totaltime += tm;
@@ -849,6 +1053,7 @@ void CLVM_ExecuteProgram (prvm_prog_t *prog, func_t fnum, const char *errormessa
 	prvm_eval_t	*ptr;
 	int		jumpcount, cachedpr_trace, exitdepth;
 	int		restorevm_tempstringsbuf_cursize;
+	qboolean	keeptempstrings = prog->aot_keeptempstrings;
 	double  calltime;
 	double tm, starttm;
 	prvm_vec_t tempfloat;
@@ -863,10 +1068,13 @@ void CLVM_ExecuteProgram (prvm_prog_t *prog, func_t fnum, const char *errormessa
 	unsigned int cached_max_edicts = prog->max_edicts;
 	// these do not change
 	mstatement_t *cached_statements = prog->statements;
+	prvm_int_t cached_writenotify_field0 = prog->writenotify_fields[0];
+	prvm_int_t cached_writenotify_field1 = prog->writenotify_fields[1];
 	qboolean cached_allowworldwrites = prog->allowworldwrites;
 	unsigned int cached_flag = prog->flag;
 
 	calltime = Sys_DirtyTime();
+	prog->aot_keeptempstrings = false;
 
 	if (!fnum || fnum >= (unsigned int)prog->numfunctions)
 	{
@@ -898,6 +1106,14 @@ void CLVM_ExecuteProgram (prvm_prog_t *prog, func_t fnum, const char *errormessa
 	if (prog->xfunction->callcount++ == 0 && (prvm_coverage.integer & 1))
 		PRVM_FunctionCoverageEvent(prog, prog->xfunction);
 
+	// native code only stands in for the fast interpreter
+	if (PRVM_AOT_USABLE(f) && !prog->trace && prog->watch_global_type == ev_void && prog->watch_field_type == ev_void && prog->break_statement < 0 && !prvm_timeprofiling.integer)
+	{
+		PRVM_AOT_Run(prog, f);
+		PRVM_LeaveFunction(prog);
+		goto cleanup;
+	}
+
 chooseexecprogram:
 	cachedpr_trace = prog->trace;
 	if (prog->trace || prog->watch_global_type != ev_void || prog->watch_field_type != ev_void || prog->break_statement >= 0)
@@ -933,7 +1149,8 @@ cleanup:
 	if (developer_insane.integer && prog->tempstringsbuf.cursize > restorevm_tempstringsbuf_cursize)
 		Con_DPrintf("CLVM_ExecuteProgram: %s used %i bytes of tempstrings\n", PRVM_GetString(prog, prog->functions[fnum].s_name), prog->tempstringsbuf.cursize - restorevm_tempstringsbuf_cursize);
 	// delete tempstrings created by this function
-	prog->tempstringsbuf.cursize = restorevm_tempstringsbuf_cursize;
+	if (!keeptempstrings)
+		prog->tempstringsbuf.cursize = restorevm_tempstringsbuf_cursize;
 
 	tm = Sys_DirtyTime() - calltime;if (tm < 0 || tm >= 1800) tm = 0;
 	f->totaltime += tm;
@@ -960,6 +1177,7 @@ void PRVM_ExecuteProgram (prvm_prog_t *prog, func_t fnum, const char *errormessa
 	prvm_eval_t	*ptr;
 	int		jumpcount, cachedpr_trace, exitdepth;
 	int		restorevm_tempstringsbuf_cursize;
+	qboolean	keeptempstrings = prog->aot_keeptempstrings;
 	double  calltime;
 	double tm, starttm;
 	prvm_vec_t tempfloat;
@@ -974,10 +1192,13 @@ void PRVM_ExecuteProgram (prvm_prog_t *prog, func_t fnum, const char *errormessa
 	unsigned int cached_max_edicts = prog->max_edicts;
 	// these do not change
 	mstatement_t *cached_statements = prog->statements;
+	prvm_int_t cached_writenotify_field0 = prog->writenotify_fields[0];
+	prvm_int_t cached_writenotify_field1 = prog->writenotify_fields[1];
 	qboolean cached_allowworldwrites = prog->allowworldwrites;
 	unsigned int cached_flag = prog->flag;
 
 	calltime = Sys_DirtyTime();
+	prog->aot_keeptempstrings = false;
 
 	if (!fnum || fnum >= (unsigned int)prog->numfunctions)
 	{
@@ -1009,6 +1230,14 @@ void PRVM_ExecuteProgram (prvm_prog_t *prog, func_t fnum, const char *errormessa
 	if (prog->xfunction->callcount++ == 0 && (prvm_coverage.integer & 1))
 		PRVM_FunctionCoverageEvent(prog, prog->xfunction);
 
+	// native code only stands in for the fast interpreter
+	if (PRVM_AOT_USABLE(f) && !prog->trace && prog->watch_global_type == ev_void && prog->watch_field_type == ev_void && prog->break_statement < 0 && !prvm_timeprofiling.integer)
+	{
+		PRVM_AOT_Run(prog, f);
+		PRVM_LeaveFunction(prog);
+		goto cleanup;
+	}
+
 chooseexecprogram:
 	cachedpr_trace = prog->trace;
 	if (prog->trace || prog->watch_global_type != ev_void || prog->watch_field_type != ev_void || prog->break_statement >= 0)
@@ -1044,7 +1273,8 @@ cleanup:
 	if (developer_insane.integer && prog->tempstringsbuf.cursize > restorevm_tempstringsbuf_cursize)
 		Con_DPrintf("SVVM_ExecuteProgram: %s used %i bytes of tempstrings\n", PRVM_GetString(prog, prog->functions[fnum].s_name), prog->tempstringsbuf.cursize - restorevm_tempstringsbuf_cursize);
 	// delete tempstrings created by this function
-	prog->tempstringsbuf.cursize = restorevm_tempstringsbuf_cursize;
+	if (!keeptempstrings)
+		prog->tempstringsbuf.cursize = restorevm_tempstringsbuf_cursize;
 
 	tm = Sys_DirtyTime() - calltime;if (tm < 0 || tm >= 1800) tm = 0;
 	f->totaltime += tm;
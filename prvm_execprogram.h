@@ -25,6 +25,108 @@
 	startst = st
 #endif
 
+// statement bodies shared by the plain opcodes and the superinstructions
+#define PRVM_EXEC_ADDRESS() \
+	if ((prvm_uint_t)OPA->edict >= cached_max_edicts) \
+	{ \
+		PRE_ERROR(); \
+		prog->error_cmd("%s Progs attempted to address an out of bounds edict number", prog->name); \
+		goto cleanup; \
+	} \
+	if ((prvm_uint_t)OPB->_int >= cached_entityfields) \
+	{ \
+		PRE_ERROR(); \
+		prog->error_cmd("%s attempted to address an invalid field (%i) in an edict", prog->name, (int)OPB->_int); \
+		goto cleanup; \
+	} \
+	if (OPB->_int == cached_writenotify_field0 || OPB->_int == cached_writenotify_field1) \
+		prog->writenotify_edict(prog, OPA->edict); \
+	OPC->_int = OPA->edict * cached_entityfields + OPB->_int;
+
+#define PRVM_EXEC_LOAD() \
+	if ((prvm_uint_t)OPA->edict >= cached_max_edicts) \
+	{ \
+		PRE_ERROR(); \
+		prog->error_cmd("%s Progs attempted to read an out of bounds edict number", prog->name); \
+		goto cleanup; \
+	} \
+	if ((prvm_uint_t)OPB->_int >= cached_entityfields) \
+	{ \
+		PRE_ERROR(); \
+		prog->error_cmd("%s attempted to read an invalid field in an edict (%i)", prog->name, (int)OPB->_int); \
+		goto cleanup; \
+	} \
+	ed = PRVM_PROG_TO_EDICT(OPA->edict); \
+	OPC->_int = ((prvm_eval_t *)(ed->fields.ip + OPB->_int))->_int;
+
+#define PRVM_EXEC_STOREP() \
+	if ((prvm_uint_t)OPB->_int - cached_entityfields >= cached_entityfieldsarea_entityfields) \
+	{ \
+		if ((prvm_uint_t)OPB->_int >= cached_entityfieldsarea) \
+		{ \
+			PRE_ERROR(); \
+			prog->error_cmd("%s attempted to write to an out of bounds edict (%i)", prog->name, (int)OPB->_int); \
+			goto cleanup; \
+		} \
+		if ((prvm_uint_t)OPB->_int < cached_entityfields && !cached_allowworldwrites) \
+		{ \
+			PRE_ERROR(); \
+			VM_Warning(prog, "assignment to world.%s (field %i) in %s\n", PRVM_GetString(prog, PRVM_ED_FieldAtOfs(prog, OPB->_int)->s_name), (int)OPB->_int, prog->name); \
+		} \
+	} \
+	ptr = (prvm_eval_t *)(cached_edictsfields + OPB->_int); \
+	ptr->_int = OPA->_int;
+
+#define PRVM_EXEC_STOREP_V() \
+	if ((prvm_uint_t)OPB->_int - cached_entityfields > (prvm_uint_t)cached_entityfieldsarea_entityfields_3) \
+	{ \
+		if ((prvm_uint_t)OPB->_int > cached_entityfieldsarea_3) \
+		{ \
+			PRE_ERROR(); \
+			prog->error_cmd("%s attempted to write to an out of bounds edict (%i)", prog->name, (int)OPB->_int); \
+			goto cleanup; \
+		} \
+		if ((prvm_uint_t)OPB->_int < cached_entityfields && !cached_allowworldwrites) \
+		{ \
+			PRE_ERROR(); \
+			VM_Warning(prog, "assignment to world.%s (field %i) in %s\n", PRVM_GetString(prog, PRVM_ED_FieldAtOfs(prog, OPB->_int)->s_name), (int)OPB->_int, prog->name); \
+		} \
+	} \
+	ptr = (prvm_eval_t *)(cached_edictsfields + OPB->_int); \
+	ptr->ivector[0] = OPA->ivector[0]; \
+	ptr->ivector[1] = OPA->ivector[1]; \
+	ptr->ivector[2] = OPA->ivector[2];
+
+#define PRVM_EXEC_JUMP(profilemintime) \
+	ADVANCE_PROFILE_BEFORE_JUMP(); \
+	st = cached_statements + st->jumpabsolute - 1;	/* offset the st++ */ \
+	startst = st; \
+	/* no bounds check needed, it is done when loading progs */ \
+	if (++jumpcount == 10000000 && prvm_runawaycheck) \
+	{ \
+		prog->xstatement = st - cached_statements; \
+		PRVM_Profile(prog, 1<<30, profilemintime, 0); \
+		prog->error_cmd("%s runaway loop counter hit limit of %d jumps\ntip: read above for list of most-executed functions", prog->name, jumpcount); \
+	}
+
+// builtins (and native code calling them) may cause ED_Alloc() to be called
+#define PRVM_EXEC_REFRESH_CACHED() \
+	cached_edictsfields = prog->edictsfields; \
+	cached_entityfields = prog->entityfields; \
+	cached_entityfields_3 = prog->entityfields - 3; \
+	cached_entityfieldsarea = prog->entityfieldsarea; \
+	cached_entityfieldsarea_entityfields = prog->entityfieldsarea - prog->entityfields; \
+	cached_entityfieldsarea_3 = prog->entityfieldsarea - 3; \
+	cached_entityfieldsarea_entityfields_3 = prog->entityfieldsarea - prog->entityfields - 3; \
+	cached_max_edicts = prog->max_edicts; \
+	/* these do not change */ \
+	/*cached_statements = prog->statements;*/ \
+	/*cached_allowworldwrites = prog->allowworldwrites;*/ \
+	/*cached_flag = prog->flag;*/ \
+	/* if prog->trace changed we need to change interpreter path */ \
+	if (prog->trace != cachedpr_trace) \
+		goto chooseexecprogram;
+
 // This code isn't #ifdef/#define protectable, don't try.
 
 #if HAVE_COMPUTED_GOTOS && !(PRVMSLOWINTERPRETER || PRVMTIMEPROFILING)
@@ -110,10 +212,28 @@
 	&&handle_OP_OR,
 
 	&&handle_OP_BITAND,
-	&&handle_OP_BITOR
+	&&handle_OP_BITOR,
+
+	// superinstructions, must exactly match prvm_superop_e in progsvm.h
+	&&handle_PRVM_SOP_ADDRESS_STOREP,
+	&&handle_PRVM_SOP_ADDRESS_STOREP_V,
+	&&handle_PRVM_SOP_LOAD_IF,
+	&&handle_PRVM_SOP_LOAD_IFNOT,
+	&&handle_PRVM_SOP_NOT_F_IFNOT,
+	&&handle_PRVM_SOP_LT_IFNOT,
+	&&handle_PRVM_SOP_LE_IFNOT,
+	&&handle_PRVM_SOP_GT_IFNOT,
+	&&handle_PRVM_SOP_GE_IFNOT,
+	&&handle_PRVM_SOP_EQ_F_IFNOT,
+	&&handle_PRVM_SOP_NE_F_IFNOT,
+	&&handle_PRVM_SOP_EQ_E_IFNOT,
+	&&handle_PRVM_SOP_NE_E_IFNOT,
+	&&handle_PRVM_SOP_ADD_F_STORE_F,
+	&&handle_PRVM_SOP_SUB_F_STORE_F,
+	&&handle_PRVM_SOP_MUL_F_STORE_F
 	    };
 #define DISPATCH_OPCODE() \
-    goto *dispatchtable[(++st)->op]
+    goto *dispatchtable[(++st)->fastop]
 #define HANDLE_OPCODE(opcode) handle_##opcode
 
     DISPATCH_OPCODE(); // jump to first opcode
@@ -155,7 +275,12 @@
 					PRVM_Breakpoint(prog, prog->break_stack_index, "Breakpoint hit");
 				}
 #endif
-			switch (st->op)
+#if PRVMSLOWINTERPRETER
+			// trace, breakpoints and watchpoints need every statement on its own
+			switch ((int)st->op)
+#else
+			switch (st->fastop)
+#endif
 			{
 #endif
 			HANDLE_OPCODE(OP_ADD_F):
@@ -296,66 +421,14 @@
 			HANDLE_OPCODE(OP_STOREP_FLD):		// integers
 			HANDLE_OPCODE(OP_STOREP_S):
 			HANDLE_OPCODE(OP_STOREP_FNC):		// pointers
-				if ((prvm_uint_t)OPB->_int - cached_entityfields >= cached_entityfieldsarea_entityfields)
-				{
-					if ((prvm_uint_t)OPB->_int >= cached_entityfieldsarea)
-					{
-						PRE_ERROR();
-						prog->error_cmd("%s attempted to write to an out of bounds edict (%i)", prog->name, (int)OPB->_int);
-						goto cleanup;
-					}
-					if ((prvm_uint_t)OPB->_int < cached_entityfields && !cached_allowworldwrites)
-					{
-						PRE_ERROR();
-						VM_Warning(prog, "assignment to world.%s (field %i) in %s\n", PRVM_GetString(prog, PRVM_ED_FieldAtOfs(prog, OPB->_int)->s_name), (int)OPB->_int, prog->name);
-					}
-				}
-				ptr = (prvm_eval_t *)(cached_edictsfields + OPB->_int);
-				ptr->_int = OPA->_int;
+				PRVM_EXEC_STOREP();
 				DISPATCH_OPCODE();
 			HANDLE_OPCODE(OP_STOREP_V):
-				if ((prvm_uint_t)OPB->_int - cached_entityfields > (prvm_uint_t)cached_entityfieldsarea_entityfields_3)
-				{
-					if ((prvm_uint_t)OPB->_int > cached_entityfieldsarea_3)
-					{
-						PRE_ERROR();
-						prog->error_cmd("%s attempted to write to an out of bounds edict (%i)", prog->name, (int)OPB->_int);
-						goto cleanup;
-					}
-					if ((prvm_uint_t)OPB->_int < cached_entityfields && !cached_allowworldwrites)
-					{
-						PRE_ERROR();
-						VM_Warning(prog, "assignment to world.%s (field %i) in %s\n", PRVM_GetString(prog, PRVM_ED_FieldAtOfs(prog, OPB->_int)->s_name), (int)OPB->_int, prog->name);
-					}
-				}
-				ptr = (prvm_eval_t *)(cached_edictsfields + OPB->_int);
-				ptr->ivector[0] = OPA->ivector[0];
-				ptr->ivector[1] = OPA->ivector[1];
-				ptr->ivector[2] = OPA->ivector[2];
+				PRVM_EXEC_STOREP_V();
 				DISPATCH_OPCODE();
 
 			HANDLE_OPCODE(OP_ADDRESS):
-				if ((prvm_uint_t)OPA->edict >= cached_max_edicts)
-				{
-					PRE_ERROR();
-					prog->error_cmd("%s Progs attempted to address an out of bounds edict number", prog->name);
-					goto cleanup;
-				}
-				if ((prvm_uint_t)OPB->_int >= cached_entityfields)
-				{
-					PRE_ERROR();
-					prog->error_cmd("%s attempted to address an invalid field (%i) in an edict", prog->name, (int)OPB->_int);
-					goto cleanup;
-				}
-#if 0
-				if (OPA->edict == 0 && !cached_allowworldwrites)
-				{
-					PRE_ERROR();
-					prog->error_cmd("forbidden assignment to null/world entity in %s", prog->name);
-					goto cleanup;
-				}
-#endif
-				OPC->_int = OPA->edict * cached_entityfields + OPB->_int;
+				PRVM_EXEC_ADDRESS();
 				DISPATCH_OPCODE();
 
 			HANDLE_OPCODE(OP_LOAD_F):
@@ -363,20 +436,7 @@
 			HANDLE_OPCODE(OP_LOAD_ENT):
 			HANDLE_OPCODE(OP_LOAD_S):
 			HANDLE_OPCODE(OP_LOAD_FNC):
-				if ((prvm_uint_t)OPA->edict >= cached_max_edicts)
-				{
-					PRE_ERROR();
-					prog->error_cmd("%s Progs attempted to read an out of bounds edict number", prog->name);
-					goto cleanup;
-				}
-				if ((prvm_uint_t)OPB->_int >= cached_entityfields)
-				{
-					PRE_ERROR();
-					prog->error_cmd("%s attempted to read an invalid field in an edict (%i)", prog->name, (int)OPB->_int);
-					goto cleanup;
-				}
-				ed = PRVM_PROG_TO_EDICT(OPA->edict);
-				OPC->_int = ((prvm_eval_t *)(ed->fields.ip + OPB->_int))->_int;
+				PRVM_EXEC_LOAD();
 				DISPATCH_OPCODE();
 
 			HANDLE_OPCODE(OP_LOAD_V):
@@ -407,16 +467,7 @@
 				// although mostly unneeded, thanks to the only float being false being 0x0 and 0x80000000 (negative zero)
 				// and entity, string, field values can never have that value
 				{
-					ADVANCE_PROFILE_BEFORE_JUMP();
-					st = cached_statements + st->jumpabsolute - 1;	// offset the st++
-					startst = st;
-					// no bounds check needed, it is done when loading progs
-					if (++jumpcount == 10000000 && prvm_runawaycheck)
-					{
-						prog->xstatement = st - cached_statements;
-						PRVM_Profile(prog, 1<<30, 1000000, 0);
-						prog->error_cmd("%s runaway loop counter hit limit of %d jumps\ntip: read above for list of most-executed functions", prog->name, jumpcount);
-					}
+					PRVM_EXEC_JUMP(1000000);
 				}
 				DISPATCH_OPCODE();
 
@@ -426,30 +477,12 @@
 				// although mostly unneeded, thanks to the only float being false being 0x0 and 0x80000000 (negative zero)
 				// and entity, string, field values can never have that value
 				{
-					ADVANCE_PROFILE_BEFORE_JUMP();
-					st = cached_statements + st->jumpabsolute - 1;	// offset the st++
-					startst = st;
-					// no bounds check needed, it is done when loading progs
-					if (++jumpcount == 10000000 && prvm_runawaycheck)
-					{
-						prog->xstatement = st - cached_statements;
-						PRVM_Profile(prog, 1<<30, 0.01, 0);
-						prog->error_cmd("%s runaway loop counter hit limit of %d jumps\ntip: read above for list of most-executed functions", prog->name, jumpcount);
-					}
+					PRVM_EXEC_JUMP(0.01);
 				}
 				DISPATCH_OPCODE();
 
 			HANDLE_OPCODE(OP_GOTO):
-				ADVANCE_PROFILE_BEFORE_JUMP();
-				st = cached_statements + st->jumpabsolute - 1;	// offset the st++
-				startst = st;
-				// no bounds check needed, it is done when loading progs
-				if (++jumpcount == 10000000 && prvm_runawaycheck)
-				{
-					prog->xstatement = st - cached_statements;
-					PRVM_Profile(prog, 1<<30, 0.01, 0);
-					prog->error_cmd("%s runaway loop counter hit limit of %d jumps\ntip: read above for list of most-executed functions", prog->name, jumpcount);
-				}
+				PRVM_EXEC_JUMP(0.01);
 				DISPATCH_OPCODE();
 
 			HANDLE_OPCODE(OP_CALL0):
@@ -500,26 +533,21 @@
 						prog->xfunction->tbprofile += (tm - starttm >= 0 && tm - starttm < 1800) ? (tm - starttm) : 0;
 						starttm = tm;
 #endif
-						// builtins may cause ED_Alloc() to be called, update cached variables
-						cached_edictsfields = prog->edictsfields;
-						cached_entityfields = prog->entityfields;
-						cached_entityfields_3 = prog->entityfields - 3;
-						cached_entityfieldsarea = prog->entityfieldsarea;
-						cached_entityfieldsarea_entityfields = prog->entityfieldsarea - prog->entityfields;
-						cached_entityfieldsarea_3 = prog->entityfieldsarea - 3;
-						cached_entityfieldsarea_entityfields_3 = prog->entityfieldsarea - prog->entityfields - 3;
-						cached_max_edicts = prog->max_edicts;
-						// these do not change
-						//cached_statements = prog->statements;
-						//cached_allowworldwrites = prog->allowworldwrites;
-						//cached_flag = prog->flag;
-						// if prog->trace changed we need to change interpreter path
-						if (prog->trace != cachedpr_trace)
-							goto chooseexecprogram;
+						PRVM_EXEC_REFRESH_CACHED();
 					}
 					else
 						prog->error_cmd("No such builtin #%i in %s; most likely cause: outdated engine build. Try updating!", builtinnumber, prog->name);
 				}
+#if !PRVMSLOWINTERPRETER && !PRVMTIMEPROFILING
+				else if (PRVM_AOT_USABLE(newf))
+				{
+					// compiled by prvm_aot_compile
+					PRVM_EnterFunction(prog, newf);
+					PRVM_AOT_Run(prog, newf);
+					PRVM_LeaveFunction(prog);
+					PRVM_EXEC_REFRESH_CACHED();
+				}
+#endif
 				else
 					st = cached_statements + PRVM_EnterFunction(prog, newf);
 				startst = st;
@@ -549,6 +577,7 @@
 				if(cached_flag & PRVM_OP_STATE)
 				{
 					ed = PRVM_PROG_TO_EDICT(PRVM_gameglobaledict(self));
+					PRVM_ED_WRITENOTIFY(prog, PRVM_gameglobaledict(self), prog->fieldoffsets.nextthink);
 					PRVM_gameedictfloat(ed,nextthink) = PRVM_gameglobalfloat(time) + 0.1;
 					PRVM_gameedictfloat(ed,frame) = OPA->_float;
 					PRVM_gameedictfunction(ed,think) = OPB->function;
@@ -561,6 +590,125 @@
 				}
 				DISPATCH_OPCODE();
 
+		//==================
+		// superinstructions, each runs the statement it is on and the one
+		// after it, stepping st so profiling, coverage and error messages
+		// still see every statement (see PRVM_Init_Exec)
+
+			HANDLE_OPCODE(PRVM_SOP_ADDRESS_STOREP):
+				PRVM_EXEC_ADDRESS();
+				st++;
+				PRVM_EXEC_STOREP();
+				DISPATCH_OPCODE();
+			HANDLE_OPCODE(PRVM_SOP_ADDRESS_STOREP_V):
+				PRVM_EXEC_ADDRESS();
+				st++;
+				PRVM_EXEC_STOREP_V();
+				DISPATCH_OPCODE();
+			HANDLE_OPCODE(PRVM_SOP_LOAD_IF):
+				PRVM_EXEC_LOAD();
+				st++;
+				if(FLOAT_IS_TRUE_FOR_INT(OPA->_int))
+				{
+					PRVM_EXEC_JUMP(0.01);
+				}
+				DISPATCH_OPCODE();
+			HANDLE_OPCODE(PRVM_SOP_LOAD_IFNOT):
+				PRVM_EXEC_LOAD();
+				st++;
+				if(!FLOAT_IS_TRUE_FOR_INT(OPA->_int))
+				{
+					PRVM_EXEC_JUMP(1000000);
+				}
+				DISPATCH_OPCODE();
+			HANDLE_OPCODE(PRVM_SOP_NOT_F_IFNOT):
+				OPC->_float = !FLOAT_IS_TRUE_FOR_INT(OPA->_int);
+				st++;
+				if(!FLOAT_IS_TRUE_FOR_INT(OPA->_int))
+				{
+					PRVM_EXEC_JUMP(1000000);
+				}
+				DISPATCH_OPCODE();
+			HANDLE_OPCODE(PRVM_SOP_LT_IFNOT):
+				OPC->_float = OPA->_float < OPB->_float;
+				st++;
+				if(!FLOAT_IS_TRUE_FOR_INT(OPA->_int))
+				{
+					PRVM_EXEC_JUMP(1000000);
+				}
+				DISPATCH_OPCODE();
+			HANDLE_OPCODE(PRVM_SOP_LE_IFNOT):
+				OPC->_float = OPA->_float <= OPB->_float;
+				st++;
+				if(!FLOAT_IS_TRUE_FOR_INT(OPA->_int))
+				{
+					PRVM_EXEC_JUMP(1000000);
+				}
+				DISPATCH_OPCODE();
+			HANDLE_OPCODE(PRVM_SOP_GT_IFNOT):
+				OPC->_float = OPA->_float > OPB->_float;
+				st++;
+				if(!FLOAT_IS_TRUE_FOR_INT(OPA->_int))
+				{
+					PRVM_EXEC_JUMP(1000000);
+				}
+				DISPATCH_OPCODE();
+			HANDLE_OPCODE(PRVM_SOP_GE_IFNOT):
+				OPC->_float = OPA->_float >= OPB->_float;
+				st++;
+				if(!FLOAT_IS_TRUE_FOR_INT(OPA->_int))
+				{
+					PRVM_EXEC_JUMP(1000000);
+				}
+				DISPATCH_OPCODE();
+			HANDLE_OPCODE(PRVM_SOP_EQ_F_IFNOT):
+				OPC->_float = OPA->_float == OPB->_float;
+				st++;
+				if(!FLOAT_IS_TRUE_FOR_INT(OPA->_int))
+				{
+					PRVM_EXEC_JUMP(1000000);
+				}
+				DISPATCH_OPCODE();
+			HANDLE_OPCODE(PRVM_SOP_NE_F_IFNOT):
+				OPC->_float = OPA->_float != OPB->_float;
+				st++;
+				if(!FLOAT_IS_TRUE_FOR_INT(OPA->_int))
+				{
+					PRVM_EXEC_JUMP(1000000);
+				}
+				DISPATCH_OPCODE();
+			HANDLE_OPCODE(PRVM_SOP_EQ_E_IFNOT):
+				OPC->_float = OPA->_int == OPB->_int;
+				st++;
+				if(!FLOAT_IS_TRUE_FOR_INT(OPA->_int))
+				{
+					PRVM_EXEC_JUMP(1000000);
+				}
+				DISPATCH_OPCODE();
+			HANDLE_OPCODE(PRVM_SOP_NE_E_IFNOT):
+				OPC->_float = OPA->_int != OPB->_int;
+				st++;
+				if(!FLOAT_IS_TRUE_FOR_INT(OPA->_int))
+				{
+					PRVM_EXEC_JUMP(1000000);
+				}
+				DISPATCH_OPCODE();
+			HANDLE_OPCODE(PRVM_SOP_ADD_F_STORE_F):
+				OPC->_float = OPA->_float + OPB->_float;
+				st++;
+				OPB->_int = OPA->_int;
+				DISPATCH_OPCODE();
+			HANDLE_OPCODE(PRVM_SOP_SUB_F_STORE_F):
+				OPC->_float = OPA->_float - OPB->_float;
+				st++;
+				OPB->_int = OPA->_int;
+				DISPATCH_OPCODE();
+			HANDLE_OPCODE(PRVM_SOP_MUL_F_STORE_F):
+				OPC->_float = OPA->_float * OPB->_float;
+				st++;
+				OPB->_int = OPA->_int;
+				DISPATCH_OPCODE();
+
 // LordHavoc: to be enabled when Progs version 7 (or whatever it will be numbered) is finalized
 /*
 			HANDLE_OPCODE(OP_ADD_I):
@@ -857,6 +1005,12 @@
 
 #undef DISPATCH_OPCODE
 #undef HANDLE_OPCODE
+#undef PRVM_EXEC_ADDRESS
+#undef PRVM_EXEC_LOAD
+#undef PRVM_EXEC_STOREP
+#undef PRVM_EXEC_STOREP_V
+#undef PRVM_EXEC_JUMP
+#undef PRVM_EXEC_REFRESH_CACHED
 #undef USE_COMPUTED_GOTOS
 #undef PRE_ERROR
 #undef ADVANCE_PROFILE_BEFORE_JUMP
@@ -466,6 +466,7 @@ PRVM_DECLARE_global(gettaginfo_up)
 PRVM_DECLARE_global(getlight_ambient)
 PRVM_DECLARE_global(getlight_diffuse)
 PRVM_DECLARE_global(getlight_dir)
+PRVM_DECLARE_global(independentthinks)
 PRVM_DECLARE_global(input_angles)
 PRVM_DECLARE_global(input_buttons)
 PRVM_DECLARE_global(input_movevalues)
@@ -843,6 +844,7 @@ PRVM_DECLARE_serverglobalfloat(trace_plane_dist)
 PRVM_DECLARE_serverglobalfloat(trace_startsolid)
 PRVM_DECLARE_serverglobalstring(SV_InitCmd)
 PRVM_DECLARE_serverglobalstring(gettaginfo_name)
+PRVM_DECLARE_serverglobalstring(independentthinks)
 PRVM_DECLARE_serverglobalstring(mapname)
 PRVM_DECLARE_serverglobalstring(trace_dphittexturename)
 PRVM_DECLARE_serverglobalstring(worldstatus)
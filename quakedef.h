@@ -513,6 +513,36 @@ qboolean Sys_HaveSSE2(void);
 #define Sys_HaveSSE2() false
 #endif
 
+// compilers that can build the AVX2 and AVX-512 code paths (which are only
+// used when the cpu and os support them)
+#if defined(SSE_POSSIBLE) && (defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))) || (defined(_MSC_VER) && _MSC_VER >= 1800))
+# define AVX2_POSSIBLE
+#endif
+#if defined(AVX2_POSSIBLE) && (!defined(_MSC_VER) || _MSC_VER >= 1911)
+# define AVX512_POSSIBLE
+#endif
+#ifdef AVX2_POSSIBLE
+# define AESNI_POSSIBLE
+#endif
+
+#ifdef AVX2_POSSIBLE
+// runtime detection of AVX2 (with FMA) and AVX-512F capabilities for x86
+qboolean Sys_HaveAVX2(void);
+#else
+#define Sys_HaveAVX2() false
+#endif
+#ifdef AVX512_POSSIBLE
+qboolean Sys_HaveAVX512(void);
+#else
+#define Sys_HaveAVX512() false
+#endif
+#ifdef AESNI_POSSIBLE
+// runtime detection of the AES instructions (with SSE2) for x86
+qboolean Sys_HaveAESNI(void);
+#else
+#define Sys_HaveAESNI() false
+#endif
+
 #include "glquake.h"
 
 #include "palette.h"
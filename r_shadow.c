@@ -248,6 +248,26 @@ skinframe_t *r_shadow_lightcorona;
 rtexture_t *r_shadow_shadowmap2ddepthbuffer;
 rtexture_t *r_shadow_shadowmap2ddepthtexture;
 rtexture_t *r_shadow_shadowmapvsdcttexture;
+
+// shadowmaps kept between frames for static lights, see r_shadow_shadowmapping_cache
+typedef struct r_shadow_shadowmapcache_s
+{
+	rtlight_t *rtlight;
+	int size;
+	int lastused;
+	// sides whose contents were rendered from the casters hashed in sidehash
+	int validsides;
+	unsigned int sidehash[6];
+	rtexture_t *depthtexture;
+	rtexture_t *depthbuffer;
+	GLuint fbo;
+}
+r_shadow_shadowmapcache_t;
+
+#define R_SHADOW_SHADOWMAPCACHE_MAXSLOTS 256
+static r_shadow_shadowmapcache_t r_shadow_shadowmapcache[R_SHADOW_SHADOWMAPCACHE_MAXSLOTS];
+static int r_shadow_shadowmapcache_numslots;
+static int r_shadow_shadowmapcache_frame;
 int r_shadow_shadowmapsize; // changes for each light based on distance
 int r_shadow_shadowmaplod; // changes for each light based on distance
 
@@ -321,6 +341,7 @@ cvar_t r_shadow_shadowmapping_nearclip = {CVAR_SAVE, "r_shadow_shadowmapping_nea
 cvar_t r_shadow_shadowmapping_bias = {CVAR_SAVE, "r_shadow_shadowmapping_bias", "0.03", "shadowmap bias parameter (this is multiplied by nearclip * 1024 / lodsize)"};
 cvar_t r_shadow_shadowmapping_polygonfactor = {CVAR_SAVE, "r_shadow_shadowmapping_polygonfactor", "2", "slope-dependent shadowmapping bias"};
 cvar_t r_shadow_shadowmapping_polygonoffset = {CVAR_SAVE, "r_shadow_shadowmapping_polygonoffset", "0", "constant shadowmapping bias"};
+cvar_t r_shadow_shadowmapping_cache = {CVAR_SAVE, "r_shadow_shadowmapping_cache", "0", "keeps the shadowmaps of this many compiled static lights between frames and only re-renders the cube sides whose shadow casting entities changed (each light uses its own texture)"};
 cvar_t r_shadow_sortsurfaces = {0, "r_shadow_sortsurfaces", "1", "improve performance by sorting illuminated surfaces by texture"};
 cvar_t r_shadow_polygonfactor = {0, "r_shadow_polygonfactor", "0", "how much to enlarge shadow volume polygons when rendering (should be 0!)"};
 cvar_t r_shadow_polygonoffset = {0, "r_shadow_polygonoffset", "1", "how much to push shadow volumes into the distance when rendering, to reduce chances of zfighting artifacts (should not be less than 0)"};
@@ -532,10 +553,98 @@ qboolean R_Shadow_ShadowMappingEnabled(void)
 	}
 }
 
+static void R_Shadow_ShadowMapCache_FreeSlot(r_shadow_shadowmapcache_t *slot)
+{
+	R_Mesh_DestroyFramebufferObject(slot->fbo);
+	slot->fbo = 0;
+	if (slot->depthtexture)
+		R_FreeTexture(slot->depthtexture);
+	slot->depthtexture = NULL;
+	if (slot->depthbuffer)
+		R_FreeTexture(slot->depthbuffer);
+	slot->depthbuffer = NULL;
+	slot->validsides = 0;
+}
+
+static void R_Shadow_ShadowMapCache_Free(void)
+{
+	int i;
+	for (i = 0;i < r_shadow_shadowmapcache_numslots;i++)
+		R_Shadow_ShadowMapCache_FreeSlot(r_shadow_shadowmapcache + i);
+	memset(r_shadow_shadowmapcache, 0, r_shadow_shadowmapcache_numslots * sizeof(*r_shadow_shadowmapcache));
+	r_shadow_shadowmapcache_numslots = 0;
+}
+
+// called when a light changes or goes away, the slot keeps its textures for the next light
+static void R_Shadow_ShadowMapCache_Forget(rtlight_t *rtlight)
+{
+	int i;
+	for (i = 0;i < r_shadow_shadowmapcache_numslots;i++)
+	{
+		if (r_shadow_shadowmapcache[i].rtlight == rtlight)
+		{
+			r_shadow_shadowmapcache[i].rtlight = NULL;
+			r_shadow_shadowmapcache[i].validsides = 0;
+		}
+	}
+}
+
+// returns the slot holding this light's shadowmap, taking over the least
+// recently used slot if needed, NULL if every slot is in use this frame
+static r_shadow_shadowmapcache_t *R_Shadow_ShadowMapCache_Find(rtlight_t *rtlight, int size)
+{
+	int i;
+	int maxslots = bound(0, r_shadow_shadowmapping_cache.integer, R_SHADOW_SHADOWMAPCACHE_MAXSLOTS);
+	r_shadow_shadowmapcache_t *slot, *best = NULL;
+	if (r_shadow_shadowmapcache_numslots > maxslots)
+		R_Shadow_ShadowMapCache_Free();
+	for (i = 0, slot = r_shadow_shadowmapcache;i < r_shadow_shadowmapcache_numslots;i++, slot++)
+	{
+		if (slot->rtlight == rtlight)
+			break;
+		if (!best || (best->rtlight && (!slot->rtlight || slot->lastused < best->lastused)))
+			best = slot;
+	}
+	if (i == r_shadow_shadowmapcache_numslots)
+	{
+		if ((!best || best->rtlight) && r_shadow_shadowmapcache_numslots < maxslots)
+			best = r_shadow_shadowmapcache + r_shadow_shadowmapcache_numslots++;
+		if (!best || (best->rtlight && best->lastused == r_shadow_shadowmapcache_frame))
+			return NULL;
+		slot = best;
+		slot->rtlight = rtlight;
+		slot->validsides = 0;
+	}
+	// lod changes need a different texture size
+	if (slot->size != size)
+	{
+		R_Shadow_ShadowMapCache_FreeSlot(slot);
+		slot->size = size;
+	}
+	slot->lastused = r_shadow_shadowmapcache_frame;
+	return slot;
+}
+
+// exchanges the shared shadowmap with the slot's one
+static void R_Shadow_ShadowMapCache_Swap(r_shadow_shadowmapcache_t *slot)
+{
+	rtexture_t *depthtexture = r_shadow_shadowmap2ddepthtexture;
+	rtexture_t *depthbuffer = r_shadow_shadowmap2ddepthbuffer;
+	GLuint fbo = r_shadow_fbo2d;
+	r_shadow_shadowmap2ddepthtexture = slot->depthtexture;
+	r_shadow_shadowmap2ddepthbuffer = slot->depthbuffer;
+	r_shadow_fbo2d = slot->fbo;
+	slot->depthtexture = depthtexture;
+	slot->depthbuffer = depthbuffer;
+	slot->fbo = fbo;
+}
+
 static void R_Shadow_FreeShadowMaps(void)
 {
 	R_Shadow_SetShadowMode();
 
+	R_Shadow_ShadowMapCache_Free();
+
 	R_Mesh_DestroyFramebufferObject(r_shadow_fbo2d);
 
 	r_shadow_fbo2d = 0;
@@ -764,6 +873,7 @@ void R_Shadow_Init(void)
 	Cvar_RegisterVariable(&r_shadow_shadowmapping_bias);
 	Cvar_RegisterVariable(&r_shadow_shadowmapping_polygonfactor);
 	Cvar_RegisterVariable(&r_shadow_shadowmapping_polygonoffset);
+	Cvar_RegisterVariable(&r_shadow_shadowmapping_cache);
 	Cvar_RegisterVariable(&r_shadow_sortsurfaces);
 	Cvar_RegisterVariable(&r_shadow_polygonfactor);
 	Cvar_RegisterVariable(&r_shadow_polygonoffset);
@@ -2142,23 +2252,39 @@ static void R_Shadow_MakeShadowMap(int side, int size)
 	}
 }
 
-static void R_Shadow_RenderMode_ShadowMap(int side, int clear, int size)
+// sets up sampling of the current shadowmap for the active light
+static void R_Shadow_SetShadowMapParameters(int size)
 {
 	float nearclip, farclip, bias;
-	r_viewport_t viewport;
-	int flipped;
-	GLuint fbo2d = 0;
-	float clearcolor[4];
 	nearclip = r_shadow_shadowmapping_nearclip.value / rsurface.rtlight->radius;
 	farclip = 1.0f;
 	bias = r_shadow_shadowmapping_bias.value * nearclip * (1024.0f / size);// * rsurface.rtlight->radius;
 	r_shadow_shadowmap_parameters[1] = -nearclip * farclip / (farclip - nearclip) - 0.5f * bias;
 	r_shadow_shadowmap_parameters[3] = 0.5f + 0.5f * (farclip + nearclip) / (farclip - nearclip);
-	r_shadow_shadowmapside = side;
 	r_shadow_shadowmapsize = size;
 
 	r_shadow_shadowmap_parameters[0] = 0.5f * (size - r_shadow_shadowmapborder);
 	r_shadow_shadowmap_parameters[2] = r_shadow_shadowmapvsdct ? 2.5f*size : size;
+	if (r_shadow_shadowmap2ddepthbuffer)
+	{
+		// completely different meaning than in depthtexture approach
+		r_shadow_shadowmap_parameters[1] = 0;
+		r_shadow_shadowmap_parameters[3] = -bias;
+	}
+	r_shadow_shadowmap_texturescale[0] = 1.0f / R_TextureWidth(r_shadow_shadowmap2ddepthtexture);
+	r_shadow_shadowmap_texturescale[1] = 1.0f / R_TextureHeight(r_shadow_shadowmap2ddepthtexture);
+}
+
+static void R_Shadow_RenderMode_ShadowMap(int side, int clear, int size)
+{
+	float nearclip, farclip;
+	r_viewport_t viewport;
+	int flipped;
+	GLuint fbo2d = 0;
+	float clearcolor[4];
+	nearclip = r_shadow_shadowmapping_nearclip.value / rsurface.rtlight->radius;
+	farclip = 1.0f;
+	r_shadow_shadowmapside = side;
 	R_Viewport_InitRectSideView(&viewport, &rsurface.rtlight->matrix_lighttoworld, side, size, r_shadow_shadowmapborder, nearclip, farclip, NULL);
 	if (r_shadow_rendermode == R_SHADOW_RENDERMODE_SHADOWMAP2D) goto init_done;
 
@@ -2168,8 +2294,6 @@ static void R_Shadow_RenderMode_ShadowMap(int side, int clear, int size)
 	if (!r_shadow_shadowmap2ddepthtexture)
 		R_Shadow_MakeShadowMap(side, r_shadow_shadowmapmaxsize);
 	fbo2d = r_shadow_fbo2d;
-	r_shadow_shadowmap_texturescale[0] = 1.0f / R_TextureWidth(r_shadow_shadowmap2ddepthtexture);
-	r_shadow_shadowmap_texturescale[1] = 1.0f / R_TextureHeight(r_shadow_shadowmap2ddepthtexture);
 	r_shadow_rendermode = R_SHADOW_RENDERMODE_SHADOWMAP2D;
 
 	R_Mesh_ResetTextureState();
@@ -2184,16 +2308,11 @@ static void R_Shadow_RenderMode_ShadowMap(int side, int clear, int size)
 	GL_DepthTest(true);
 
 init_done:
+	R_Shadow_SetShadowMapParameters(size);
 	R_SetViewport(&viewport);
 	flipped = (side & 1) ^ (side >> 2);
 	r_refdef.view.cullface_front = flipped ? r_shadow_cullface_back : r_shadow_cullface_front;
 	r_refdef.view.cullface_back = flipped ? r_shadow_cullface_front : r_shadow_cullface_back;
-	if (r_shadow_shadowmap2ddepthbuffer)
-	{
-		// completely different meaning than in depthtexture approach
-		r_shadow_shadowmap_parameters[1] = 0;
-		r_shadow_shadowmap_parameters[3] = -bias;
-	}
 	Vector4Set(clearcolor, 1,1,1,1);
 	if (r_shadow_shadowmap2ddepthbuffer)
 		GL_ColorMask(1,1,1,1);
@@ -2356,6 +2475,11 @@ void R_Shadow_UpdateBounceGridTexture(void)
 	unsigned int range1;
 	unsigned int range2;
 	unsigned int seed = (unsigned int)(realtime * 1000.0f);
+	int batchindex, batchsize;
+	unsigned int batchseeds[MAX_TRACELINESBATCH];
+	vec3_t batchstarts[MAX_TRACELINESBATCH];
+	vec3_t batchends[MAX_TRACELINESBATCH];
+	trace_t batchtraces[MAX_TRACELINESBATCH];
 	vec3_t shotcolor;
 	vec3_t baseshotcolor;
 	vec3_t surfcolor;
@@ -2703,21 +2827,51 @@ void R_Shadow_UpdateBounceGridTexture(void)
 		r_refdef.stats[r_stat_bouncegrid_particles] += shootparticles;
 		for (shotparticles = 0;shotparticles < shootparticles;shotparticles++)
 		{
-			if (settings.stablerandom > 0)
-				seed = lightindex * 11937 + shotparticles;
+			if (settings.staticmode && !(shotparticles % MAX_TRACELINESBATCH))
+			{
+				// all photons start at the light, so static mode traces the
+				// first line of a batch of them together
+				batchsize = min(shootparticles - shotparticles, MAX_TRACELINESBATCH);
+				for (batchindex = 0;batchindex < batchsize;batchindex++)
+				{
+					if (settings.stablerandom > 0)
+						seed = lightindex * 11937 + shotparticles + batchindex;
+					VectorCopy(rtlight->shadoworigin, batchstarts[batchindex]);
+					if (settings.stablerandom < 0)
+						VectorRandom(batchends[batchindex]);
+					else
+						VectorCheeseRandom(batchends[batchindex]);
+					VectorMA(batchstarts[batchindex], radius, batchends[batchindex], batchends[batchindex]);
+					batchseeds[batchindex] = seed;
+				}
+				Collision_ClipLinesToWorld(batchsize, batchtraces, cl.worldmodel, batchstarts[0], batchends[0], hitsupercontentsmask, collision_extendmovelength.value, true);
+			}
 			VectorCopy(baseshotcolor, shotcolor);
 			VectorCopy(rtlight->shadoworigin, clipstart);
-			if (settings.stablerandom < 0)
-				VectorRandom(clipend);
+			if (settings.staticmode)
+			{
+				// continue the random sequence after this photon's direction
+				seed = batchseeds[shotparticles % MAX_TRACELINESBATCH];
+				VectorCopy(batchends[shotparticles % MAX_TRACELINESBATCH], clipend);
+			}
 			else
-				VectorCheeseRandom(clipend);
-			VectorMA(clipstart, radius, clipend, clipend);
+			{
+				if (settings.stablerandom > 0)
+					seed = lightindex * 11937 + shotparticles;
+				if (settings.stablerandom < 0)
+					VectorRandom(clipend);
+				else
+					VectorCheeseRandom(clipend);
+				VectorMA(clipstart, radius, clipend, clipend);
+			}
 			for (bouncecount = 0;;bouncecount++)
 			{
 				r_refdef.stats[r_stat_bouncegrid_traces]++;
 				//r_refdef.scene.worldmodel->TraceLineAgainstSurfaces(r_refdef.scene.worldmodel, NULL, NULL, &cliptrace, clipstart, clipend, hitsupercontentsmask);
 				//r_refdef.scene.worldmodel->TraceLine(r_refdef.scene.worldmodel, NULL, NULL, &cliptrace2, clipstart, clipend, hitsupercontentsmask);
-				if (settings.staticmode)
+				if (settings.staticmode && bouncecount == 0)
+					cliptrace = batchtraces[shotparticles % MAX_TRACELINESBATCH];
+				else if (settings.staticmode)
 				{
 					// static mode fires a LOT of rays but none of them are identical, so they are not cached
 					cliptrace = CL_TraceLine(clipstart, clipend, settings.staticmode ? MOVE_WORLDONLY : (settings.hitmodels ? MOVE_HITMODEL : MOVE_NOMONSTERS), NULL, hitsupercontentsmask, collision_extendmovelength.value, true, false, NULL, true, true);
@@ -3434,6 +3588,19 @@ void R_RTLight_Update(rtlight_t *rtlight, int isstatic, matrix4x4_t *matrix, vec
 
 // compiles rtlight geometry
 // (undone by R_FreeCompiledRTLight, which R_UpdateLight calls)
+// whether the shadow cast by surfaces with this texture can change between
+// frames (q3 deformvertexes, animated or scrolling alpha tested textures)
+static qboolean R_Shadow_TextureShadowAnimated(const texture_t *t)
+{
+	if (t->basematerialflags & MATERIALFLAG_NOSHADOW)
+		return false;
+	if (t->deforms[0].deform != Q3DEFORM_NONE)
+		return true;
+	if (t->basematerialflags & MATERIALFLAG_ALPHATEST)
+		return t->animated || t->numskinframes > 1 || t->tcmods[0].tcmod != Q3TCMOD_NONE;
+	return false;
+}
+
 void R_RTLight_Compile(rtlight_t *rtlight)
 {
 	int i;
@@ -3455,6 +3622,7 @@ void R_RTLight_Compile(rtlight_t *rtlight)
 	rtlight->static_surfacelist = NULL;
 	rtlight->static_shadowmap_receivers = 0x3F;
 	rtlight->static_shadowmap_casters = 0x3F;
+	rtlight->static_shadowmap_animated = false;
 	rtlight->cullmins[0] = rtlight->shadoworigin[0] - rtlight->radius;
 	rtlight->cullmins[1] = rtlight->shadoworigin[1] - rtlight->radius;
 	rtlight->cullmins[2] = rtlight->shadoworigin[2] - rtlight->radius;
@@ -3485,6 +3653,8 @@ void R_RTLight_Compile(rtlight_t *rtlight)
 		rtlight->static_lighttrispvs = (unsigned char *)data;data += numlighttrispvsbytes;
 		if (rtlight->static_numsurfaces)
 			memcpy(rtlight->static_surfacelist, r_shadow_buffer_surfacelist, rtlight->static_numsurfaces * sizeof(*rtlight->static_surfacelist));
+		for (i = 0;i < rtlight->static_numsurfaces && !rtlight->static_shadowmap_animated;i++)
+			rtlight->static_shadowmap_animated = R_Shadow_TextureShadowAnimated(model->data_surfaces[rtlight->static_surfacelist[i]].texture);
 		if (rtlight->static_numleafs)
 			memcpy(rtlight->static_leaflist, r_shadow_buffer_leaflist, rtlight->static_numleafs * sizeof(*rtlight->static_leaflist));
 		if (rtlight->static_numleafpvsbytes)
@@ -3543,6 +3713,7 @@ void R_RTLight_Compile(rtlight_t *rtlight)
 
 void R_RTLight_Uncompile(rtlight_t *rtlight)
 {
+	R_Shadow_ShadowMapCache_Forget(rtlight);
 	if (rtlight->compiled)
 	{
 		if (rtlight->static_meshchain_shadow_zpass)
@@ -4173,6 +4344,63 @@ static void R_Shadow_PrepareLight(rtlight_t *rtlight)
 	}
 }
 
+static unsigned int R_Shadow_ShadowMapCache_Hash(unsigned int hash, const void *data, size_t size)
+{
+	const unsigned char *bytes = (const unsigned char *)data;
+	size_t i;
+	// FNV-1a
+	for (i = 0;i < size;i++)
+		hash = (hash ^ bytes[i]) * 16777619u;
+	return hash;
+}
+
+// hashes what each cube side of a cached shadowmap was rendered from, returns
+// the sides that can not be cached at all
+static int R_Shadow_ShadowMapCache_HashSides(int numentities, entity_render_t **entities, const unsigned char *entitysides, unsigned int *sidehash)
+{
+	int i, side, uncacheable = 0;
+	unsigned int hash;
+	struct
+	{
+		const void *worldmodel;
+		float nearclip, polygonfactor, polygonoffset;
+	}
+	global;
+	struct
+	{
+		const void *ent, *model;
+		matrix4x4_t matrix;
+		frameblend_t frameblend[MAX_FRAMEBLENDS];
+		int skinnum;
+	}
+	state;
+	memset(&global, 0, sizeof(global));
+	global.worldmodel = r_refdef.scene.worldmodel;
+	global.nearclip = r_shadow_shadowmapping_nearclip.value;
+	global.polygonfactor = r_shadow_shadowmapping_polygonfactor.value;
+	global.polygonoffset = r_shadow_shadowmapping_polygonoffset.value;
+	hash = R_Shadow_ShadowMapCache_Hash(2166136261u, &global, sizeof(global));
+	for (side = 0;side < 6;side++)
+		sidehash[side] = hash;
+	for (i = 0;i < numentities;i++)
+	{
+		entity_render_t *ent = entities[i];
+		// skeletons can change without anything else changing
+		if (ent->skeleton && ent->skeleton->relativetransforms)
+			uncacheable |= entitysides[i];
+		memset(&state, 0, sizeof(state));
+		state.ent = ent;
+		state.model = ent->model;
+		state.matrix = ent->matrix;
+		memcpy(state.frameblend, ent->frameblend, sizeof(state.frameblend));
+		state.skinnum = ent->skinnum;
+		for (side = 0;side < 6;side++)
+			if (entitysides[i] & (1 << side))
+				sidehash[side] = R_Shadow_ShadowMapCache_Hash(sidehash[side], &state, sizeof(state));
+	}
+	return uncacheable;
+}
+
 static void R_Shadow_DrawLight(rtlight_t *rtlight)
 {
 	int i;
@@ -4193,6 +4421,7 @@ static void R_Shadow_DrawLight(rtlight_t *rtlight)
 	vec_t distance;
 	qboolean castshadows;
 	int lodlinear;
+	r_shadow_shadowmapcache_t *shadowmapcache = NULL;
 
 	// check if we cached this light this frame (meaning it is worth drawing)
 	if (!rtlight->draw)
@@ -4267,6 +4496,8 @@ static void R_Shadow_DrawLight(rtlight_t *rtlight)
 		int size;
 		int castermask = 0;
 		int receivermask = 0;
+		int rendermask;
+		qboolean cacheshadowmap;
 		matrix4x4_t radiustolight = rtlight->matrix_worldtolight;
 		Matrix4x4_Abs(&radiustolight);
 
@@ -4275,8 +4506,20 @@ static void R_Shadow_DrawLight(rtlight_t *rtlight)
 			if ((r_shadow_shadowmapmaxsize >> i) > lodlinear)
 				r_shadow_shadowmaplod = i;
 
-		size = bound(r_shadow_shadowmapborder, lodlinear, r_shadow_shadowmapmaxsize);
-			
+		// compiled lights have the same world shadows every frame (unless
+		// they deform or are alpha tested with an animated texture), so their
+		// shadowmap sides only change when the entities in them do (the
+		// noselfshadow entities are drawn into the shadowmap afterwards, which
+		// leaves it unusable for the next frame)
+		cacheshadowmap = rtlight->isstatic && rtlight->compiled && r_shadow_realtime_world_compile.integer && r_shadow_realtime_world_compileshadow.integer && !rtlight->static_shadowmap_animated && !numshadowentities_noselfshadow && r_shadow_shadowmapping_cache.integer > 0;
+
+		// cached shadowmaps use the size of the lod, so that moving around
+		// does not change their size every frame
+		if (cacheshadowmap)
+			size = bound(r_shadow_shadowmapborder, r_shadow_shadowmapmaxsize >> r_shadow_shadowmaplod, r_shadow_shadowmapmaxsize);
+		else
+			size = bound(r_shadow_shadowmapborder, lodlinear, r_shadow_shadowmapmaxsize);
+
 		borderbias = r_shadow_shadowmapborder / (float)(size - r_shadow_shadowmapborder);
 
 		surfacesides = NULL;
@@ -4320,10 +4563,36 @@ static void R_Shadow_DrawLight(rtlight_t *rtlight)
 
 		//Con_Printf("distance %f lodlinear %i (lod %i) size %i\n", distance, lodlinear, r_shadow_shadowmaplod, size);
 
+		if (receivermask && cacheshadowmap)
+			shadowmapcache = R_Shadow_ShadowMapCache_Find(rtlight, size);
+		rendermask = receivermask;
+		if (shadowmapcache)
+		{
+			unsigned int sidehash[6];
+			int uncacheable = R_Shadow_ShadowMapCache_HashSides(numshadowentities, shadowentities, entitysides, sidehash);
+			R_Shadow_ShadowMapCache_Swap(shadowmapcache);
+			if (!r_shadow_shadowmap2ddepthtexture)
+				R_Shadow_MakeShadowMap(0, size);
+			for (side = 0;side < 6;side++)
+			{
+				if (!(receivermask & (1 << side)))
+					continue;
+				if ((shadowmapcache->validsides & (1 << side)) && shadowmapcache->sidehash[side] == sidehash[side])
+					rendermask &= ~(1 << side);
+				else
+					shadowmapcache->sidehash[side] = sidehash[side];
+			}
+			// the sides rendered below are valid from now on
+			shadowmapcache->validsides = (shadowmapcache->validsides | rendermask) & ~uncacheable;
+			// in case every side is cached
+			R_Shadow_SetShadowMapParameters(size);
+		}
+
 		// render shadow casters into 6 sided depth texture
-		for (side = 0;side < 6;side++) if (receivermask & (1 << side))
+		for (side = 0;side < 6;side++) if (rendermask & (1 << side))
 		{
-			R_Shadow_RenderMode_ShadowMap(side, receivermask, size);
+			// cached shadowmaps clear each side on its own to keep the others
+			R_Shadow_RenderMode_ShadowMap(side, shadowmapcache ? (1 << side) : receivermask, size);
 			if (! (castermask & (1 << side))) continue;
 			if (numsurfaces)
 				R_Shadow_DrawWorldShadow_ShadowMap(numsurfaces, surfacelist, shadowtrispvs, surfacesides);
@@ -4409,6 +4678,10 @@ static void R_Shadow_DrawLight(rtlight_t *rtlight)
 		else
 			R_Shadow_RenderMode_DrawDeferredLight(false, false);
 	}
+
+	// put the shared shadowmap back
+	if (shadowmapcache)
+		R_Shadow_ShadowMapCache_Swap(shadowmapcache);
 }
 
 static void R_Shadow_FreeDeferred(void)
@@ -4540,6 +4813,8 @@ void R_Shadow_PrepareLights(int fbo, rtexture_t *depthtexture, rtexture_t *color
 		r_shadow_shadowmapdepthtexture != r_fb.usedepthtextures)
 		R_Shadow_FreeShadowMaps();
 
+	r_shadow_shadowmapcache_frame++;
+
 	r_shadow_fb_fbo = fbo;
 	r_shadow_fb_depthtexture = depthtexture;
 	r_shadow_fb_colortexture = colortexture;
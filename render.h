@@ -55,6 +55,7 @@ extern cvar_t gl_flashblend;
 extern cvar_t r_novis;
 
 extern cvar_t r_trippy;
+extern cvar_t r_threads;
 extern cvar_t r_fxaa;
 
 extern cvar_t r_lerpsprites;
@@ -162,6 +163,10 @@ void R_DrawExplosions(void);
 
 int R_CullBox(const vec3_t mins, const vec3_t maxs);
 int R_CullBoxCustomPlanes(const vec3_t mins, const vec3_t maxs, int numplanes, const mplane_t *planes);
+// how many tasks to split count items of culling work into (see r_threads),
+// 1 means do it on the calling thread
+#define R_MAXTASKS 64
+int R_NumTasks(int count, int minpertask);
 
 #include "r_modules.h"
 
@@ -59,6 +59,12 @@ typedef struct server_static_s
 	qboolean volatile threadstop;
 	void *threadmutex;
 	void *thread;
+
+	// parallel entity culling (sv_threads)
+	void *cullmutex; // protects SV_EntitiesInBox while culling tasks run
+
+	// parallel thinks (sv_parallelthinks)
+	void *thinkmutex; // serializes the builtins that trace while think tasks run
 } server_static_t;
 
 //=============================================================================
@@ -74,6 +80,14 @@ typedef struct server_floodaddress_s
 }
 server_floodaddress_t;
 
+/// sleeping edict waiting for its nextthink, see SV_Physics
+typedef struct server_physicstimer_s
+{
+	double time;
+	int entnum;
+}
+server_physicstimer_t;
+
 typedef struct server_s
 {
 	/// false if only a net client
@@ -144,32 +158,72 @@ typedef struct server_s
 	qboolean particleeffectnamesloaded;
 	char particleeffectname[MAX_PARTICLEEFFECTNAME][MAX_QPATH];
 
-	int writeentitiestoclient_stats_culled_pvs;
-	int writeentitiestoclient_stats_culled_trace;
-	int writeentitiestoclient_stats_visibleentities;
-	int writeentitiestoclient_stats_totalentities;
 	int writeentitiestoclient_cliententitynumber;
 	int writeentitiestoclient_clientnumber;
 	sizebuf_t *writeentitiestoclient_msg;
-	vec3_t writeentitiestoclient_eyes[MAX_CLIENTNETWORKEYES];
-	int writeentitiestoclient_numeyes;
-	int writeentitiestoclient_pvsbytes;
-	unsigned char writeentitiestoclient_pvs[MAX_MAP_LEAFS/8];
 	const entity_state_t *writeentitiestoclient_sendstates[MAX_EDICTS];
 	unsigned short writeentitiestoclient_csqcsendstates[MAX_EDICTS];
 
 	int numsendentities;
 	entity_state_t sendentities[MAX_EDICTS];
 	entity_state_t *sendentitiesindex[MAX_EDICTS];
-
-	int sententitiesmark;
-	int sententities[MAX_EDICTS];
-	int sententitiesconsideration[MAX_EDICTS];
+	/// entity updates copied from another client's encoding this frame
+	/// (sv_entitysendcache) and ones that had to be encoded
+	int entitysendcache_hits;
+	int entitysendcache_misses;
 
 	/// legacy support for self.Version based csqc entity networking
 	unsigned char csqcentityversion[MAX_EDICTS]; // legacy
+
+	/// sv_activeedicts: SV_Physics skips the non-client edicts with a bit set
+	/// here (free or idle MOVETYPE_NONE ones), SV_WakeEdict clears it
+	qboolean physics_sleeping;
+	unsigned int physics_asleep[MAX_EDICTS / 32];
+	/// min-heap of sleeping edicts by nextthink, at most one timer per edict
+	int physics_numtimers;
+	server_physicstimer_t physics_timers[MAX_EDICTS];
+	/// position in physics_timers + 1, 0 if the edict has no timer
+	int physics_timerindex[MAX_EDICTS];
+
+	/// sv_parallelthinks: edicts whose think runs on the task queue this frame
+	int parallelthinks_numedicts;
+	int parallelthinks_edicts[MAX_EDICTS];
 } server_t;
 
+/// most clusters within 8 units of a client's eyes for the fat pvs to be cached
+#define MAX_CLIENTPVSCLUSTERS 32
+
+/// entity culling state for one client, filled in by SV_WriteEntitiesToClient
+/// (or ahead of time on worker threads if sv_threads is enabled)
+typedef struct server_clientvisibility_s
+{
+	int clientnumber;
+	int cliententitynumber;
+	vec3_t eyes[MAX_CLIENTNETWORKEYES];
+	int numeyes;
+	int pvsbytes;
+	/// fat pvs of the eyes as 32bit words so entity cluster masks can be
+	/// tested a word at a time (see pvs_clusterwordmask)
+	unsigned int pvs[MAX_MAP_LEAFS/32];
+	/// world model and clusters within 8 units of the eyes that pvs was
+	/// built from, it is only rebuilt when they change (NULL if not cached)
+	dp_model_t *pvsmodel;
+	int pvsnumclusters;
+	int pvsclusters[MAX_CLIENTPVSCLUSTERS];
+	/// eyes and pvs are set up and the threaded culling pass has been done
+	qboolean prepared;
+	/// one bit per entity number
+	unsigned char considered[MAX_EDICTS/8];
+	unsigned char visible[MAX_EDICTS/8];
+	int stats_culled_pvs;
+	int stats_culled_trace;
+	/// sv_cullentities_trace checks answered by the visibility grid
+	int stats_gridanswers;
+	int stats_visibleentities;
+	int stats_totalentities;
+}
+server_clientvisibility_t;
+
 #define NUM_CSQCENTITIES_PER_FRAME 256
 typedef struct csqcentityframedb_s
 {
@@ -253,6 +307,7 @@ typedef struct client_s
 
 	/// visibility state
 	float visibletime[MAX_EDICTS];
+	server_clientvisibility_t visibility;
 
 	// scope is whether an entity is currently being networked to this client
 	// sendflags is what properties have changed on the entity since the last
@@ -422,6 +477,8 @@ extern cvar_t sv_allowdownloads_config;
 extern cvar_t sv_allowdownloads_dlcache;
 extern cvar_t sv_allowdownloads_inarchive;
 extern cvar_t sv_areagrid_mingridsize;
+extern cvar_t sv_areatree;
+extern cvar_t sv_areatree_margin;
 extern cvar_t sv_checkforpacketsduringsleep;
 extern cvar_t sv_clmovement_enable;
 extern cvar_t sv_clmovement_minping;
@@ -434,12 +491,16 @@ extern cvar_t sv_cullentities_stats;
 extern cvar_t sv_cullentities_trace;
 extern cvar_t sv_cullentities_trace_delay;
 extern cvar_t sv_cullentities_trace_enlarge;
+extern cvar_t sv_cullentities_trace_entityocclusion;
+extern cvar_t sv_cullentities_trace_grid;
 extern cvar_t sv_cullentities_trace_prediction;
 extern cvar_t sv_cullentities_trace_samples;
 extern cvar_t sv_cullentities_trace_samples_extra;
 extern cvar_t sv_debugmove;
 extern cvar_t sv_echobprint;
 extern cvar_t sv_edgefriction;
+extern cvar_t sv_entityframe8_benchmark;
+extern cvar_t sv_entitysendcache;
 extern cvar_t sv_entpatch;
 extern cvar_t sv_fixedframeratesingleplayer;
 extern cvar_t sv_freezenonclients;
@@ -447,6 +508,8 @@ extern cvar_t sv_friction;
 extern cvar_t sv_gameplayfix_blowupfallenzombies;
 extern cvar_t sv_gameplayfix_consistentplayerprethink;
 extern cvar_t sv_gameplayfix_delayprojectiles;
+extern cvar_t sv_activeedicts;
+extern cvar_t sv_parallelthinks;
 extern cvar_t sv_gameplayfix_droptofloorstartsolid;
 extern cvar_t sv_gameplayfix_droptofloorstartsolid_nudgetocorrect;
 extern cvar_t sv_gameplayfix_easierwaterjump;
@@ -490,6 +553,7 @@ extern cvar_t sv_sound_land;
 extern cvar_t sv_sound_watersplash;
 extern cvar_t sv_stepheight;
 extern cvar_t sv_stopspeed;
+extern cvar_t sv_threads;
 extern cvar_t sv_wallfriction;
 extern cvar_t sv_wateraccelerate;
 extern cvar_t sv_waterfriction;
@@ -548,6 +612,13 @@ void SV_BroadcastPrint(const char *msg);
 void SV_BroadcastPrintf(const char *fmt, ...) DP_FUNC_PRINTF(1);
 
 void SV_Physics (void);
+/// makes SV_Physics look at the edict again, call this when its nextthink or movetype change
+void SV_WakeEdict (int entnum);
+/// used by the builtins that a think running on a worker thread (sv_parallelthinks) may call
+void SV_ParallelThinks_Lock (void);
+void SV_ParallelThinks_Unlock (void);
+void SV_ParallelThinks_LinkEdict (prvm_edict_t *ent);
+void SV_ParallelThinks_SetOrigin (prvm_edict_t *ent, const vec3_t origin);
 void SV_Physics_ClientMove (void);
 //void SV_Physics_ClientEntity (prvm_edict_t *ent);
 
@@ -582,6 +653,12 @@ int SV_EntitiesInBox(const vec3_t mins, const vec3_t maxs, int maxedicts, prvm_e
 
 qboolean SV_CanSeeBox(int numsamples, vec_t enlarge, vec3_t eye, vec3_t entboxmins, vec3_t entboxmaxs);
 
+void SV_VisGrid_Init(void);
+void SV_VisGrid_Start(void);
+void SV_VisGrid_End(void);
+void SV_VisGrid_Update(void);
+int SV_VisGrid_CanSeeBox(int numeyes, const vec3_t *eyes, const vec3_t mins, const vec3_t maxs);
+
 int SV_PointSuperContents(const vec3_t point);
 
 void SV_FlushBroadcastMessages(void);
@@ -24,6 +24,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "libcurl.h"
 #include "csprogs.h"
 #include "thread.h"
+#include "taskqueue.h"
 
 static void SV_SaveEntFile_f(void);
 static void SV_StartDownload_f(void);
@@ -69,6 +70,8 @@ cvar_t sv_allowdownloads_config = {0, "sv_allowdownloads_config", "0", "whether
 cvar_t sv_allowdownloads_dlcache = {0, "sv_allowdownloads_dlcache", "0", "whether to allow downloads of dlcache files (dlcache/)"};
 cvar_t sv_allowdownloads_inarchive = {0, "sv_allowdownloads_inarchive", "0", "whether to allow downloads from archives (pak/pk3)"};
 cvar_t sv_areagrid_mingridsize = {CVAR_NOTIFY, "sv_areagrid_mingridsize", "128", "minimum areagrid cell size, smaller values work better for lots of small objects, higher values for large objects"};
+cvar_t sv_areatree = {CVAR_NOTIFY, "sv_areatree", "0", "use a dynamic bounding box tree instead of the areagrid to find entities near a trace (for both server and client), usually faster on large maps or with many entities, takes effect on next map load"};
+cvar_t sv_areatree_margin = {0, "sv_areatree_margin", "8", "how far an entity may move before it has to be relinked into the sv_areatree tree, takes effect on next map load"};
 cvar_t sv_checkforpacketsduringsleep = {0, "sv_checkforpacketsduringsleep", "0", "uses select() function to wait between frames which can be interrupted by packets being received, instead of Sleep()/usleep()/SDL_Sleep() functions which do not check for packets"};
 cvar_t sv_clmovement_enable = {0, "sv_clmovement_enable", "1", "whether to allow clients to use cl_movement prediction, which can cause choppy movement on the server which may annoy other players"};
 cvar_t sv_clmovement_minping = {0, "sv_clmovement_minping", "0", "if client ping is below this time in milliseconds, then their ability to use cl_movement prediction is disabled for a while (as they don't need it)"};
@@ -90,9 +93,13 @@ cvar_t sv_cullentities_trace_samples_players = {0, "sv_cullentities_trace_sample
 cvar_t sv_debugmove = {CVAR_NOTIFY, "sv_debugmove", "0", "disables collision detection optimizations for debugging purposes"};
 cvar_t sv_echobprint = {CVAR_SAVE, "sv_echobprint", "1", "prints gamecode bprint() calls to server console"};
 cvar_t sv_edgefriction = {0, "edgefriction", "1", "how much you slow down when nearing a ledge you might fall off, multiplier of sv_friction (Quake used 2, QuakeWorld used 1 due to a bug in physics code)"};
+cvar_t sv_entityframe8_benchmark = {0, "sv_entityframe8_benchmark", "0", "when the server runs protocol DP5 to DP7, transcodes every entity frame and stat update sent to a client to DP8 and back (continuing from the frames the client acknowledged) and prints the bytes and time per frame when the client disconnects or the level changes"};
+cvar_t sv_entitysendcache = {0, "sv_entitysendcache", "1", "encodes each entity update once per frame and copies it to every client that needs the same update (protocol DP5 and later), sv_cullentities_stats shows how often this happens"};
 cvar_t sv_entpatch = {0, "sv_entpatch", "1", "enables loading of .ent files to override entities in the bsp (for example Threewave CTF server pack contains .ent patch files enabling play of CTF on id1 maps)"};
 cvar_t sv_fixedframeratesingleplayer = {0, "sv_fixedframeratesingleplayer", "1", "allows you to use server-style timing system in singleplayer (don't run faster than sys_ticrate)"};
 cvar_t sv_freezenonclients = {CVAR_NOTIFY, "sv_freezenonclients", "0", "freezes time, except for players, allowing you to walk around and take screenshots of explosions"};
+cvar_t sv_activeedicts = {0, "sv_activeedicts", "1", "physics skips idle MOVETYPE_NONE entities until their nextthink comes up or QuakeC changes their nextthink or movetype (0 checks every entity every frame)"};
+cvar_t sv_parallelthinks = {0, "sv_parallelthinks", "0", "number of parallel tasks to split the thinks of entities into (run on taskqueue_maxthreads worker threads), only think functions the progs list in the independentthinks global run this way, 0 runs every think on the server thread"};
 cvar_t sv_friction = {CVAR_NOTIFY, "sv_friction","4", "how fast you slow down"};
 cvar_t sv_gameplayfix_blowupfallenzombies = {0, "sv_gameplayfix_blowupfallenzombies", "1", "causes findradius to detect SOLID_NOT entities such as zombies and corpses on the floor, allowing splash damage to apply to them"};
 cvar_t sv_gameplayfix_consistentplayerprethink = {0, "sv_gameplayfix_consistentplayerprethink", "0", "improves fairness in multiplayer by running all PlayerPreThink functions (which fire weapons) before performing physics, then running all PlayerPostThink functions"};
@@ -155,6 +162,8 @@ cvar_t sys_ticrate = {CVAR_SAVE, "sys_ticrate","0.0138889", "how long a server f
 cvar_t teamplay = {CVAR_NOTIFY, "teamplay","0", "teamplay mode, values depend on mod but typically 0 = no teams, 1 = no team damage no self damage, 2 = team damage and self damage, some mods support 3 = no team damage but can damage self"};
 cvar_t timelimit = {CVAR_NOTIFY, "timelimit","0", "ends level at this time (in minutes)"};
 cvar_t sv_threaded = {0, "sv_threaded", "0", "enables a separate thread for server code, improving performance, especially when hosting a game while playing, EXPERIMENTAL, may be crashy"};
+cvar_t sv_threads = {0, "sv_threads", "0", "number of parallel tasks to split per-client entity culling into (run on taskqueue_maxthreads worker threads), 0 culls each client on the server thread while writing its packet"};
+cvar_t sv_threads_stats = {0, "sv_threads_stats", "0", "prints how much time each phase of sending client messages took (prepare, parallel culling, packet writing)"};
 
 cvar_t saved1 = {CVAR_SAVE, "saved1", "0", "unused cvar in quake that is saved to config.cfg on exit, can be used by mods"};
 cvar_t saved2 = {CVAR_SAVE, "saved2", "0", "unused cvar in quake that is saved to config.cfg on exit, can be used by mods"};
@@ -420,6 +429,11 @@ static void SV_AreaStats_f(void)
 	World_PrintAreaStats(&sv.world, "server");
 }
 
+static void SV_AreaBenchmark_f(void)
+{
+	World_BenchmarkAreas(&sv.world, "server", Cmd_Argc() > 1 ? max(1, atoi(Cmd_Argv(1))) : 100000);
+}
+
 /*
 ===============
 SV_Init
@@ -446,6 +460,7 @@ void SV_Init (void)
 
 	Cmd_AddCommand("sv_saveentfile", SV_SaveEntFile_f, "save map entities to .ent file (to allow external editing)");
 	Cmd_AddCommand("sv_areastats", SV_AreaStats_f, "prints statistics on entity culling during collision traces");
+	Cmd_AddCommand("sv_areabenchmark", SV_AreaBenchmark_f, "times entity box queries (default 100000) around the linked entities with the areagrid and with sv_areatree");
 	Cmd_AddCommand_WithClientCommand("sv_startdownload", NULL, SV_StartDownload_f, "begins sending a file to the client (network protocol use only)");
 	Cmd_AddCommand_WithClientCommand("download", NULL, SV_Download_f, "downloads a specified file from the server");
 
@@ -481,6 +496,8 @@ void SV_Init (void)
 	Cvar_RegisterVariable (&sv_allowdownloads_dlcache);
 	Cvar_RegisterVariable (&sv_allowdownloads_inarchive);
 	Cvar_RegisterVariable (&sv_areagrid_mingridsize);
+	Cvar_RegisterVariable (&sv_areatree);
+	Cvar_RegisterVariable (&sv_areatree_margin);
 	Cvar_RegisterVariable (&sv_checkforpacketsduringsleep);
 	Cvar_RegisterVariable (&sv_clmovement_enable);
 	Cvar_RegisterVariable (&sv_clmovement_minping);
@@ -499,12 +516,17 @@ void SV_Init (void)
 	Cvar_RegisterVariable (&sv_cullentities_trace_samples);
 	Cvar_RegisterVariable (&sv_cullentities_trace_samples_extra);
 	Cvar_RegisterVariable (&sv_cullentities_trace_samples_players);
+	SV_VisGrid_Init();
 	Cvar_RegisterVariable (&sv_debugmove);
 	Cvar_RegisterVariable (&sv_echobprint);
 	Cvar_RegisterVariable (&sv_edgefriction);
+	Cvar_RegisterVariable (&sv_entityframe8_benchmark);
+	Cvar_RegisterVariable (&sv_entitysendcache);
 	Cvar_RegisterVariable (&sv_entpatch);
 	Cvar_RegisterVariable (&sv_fixedframeratesingleplayer);
 	Cvar_RegisterVariable (&sv_freezenonclients);
+	Cvar_RegisterVariable (&sv_activeedicts);
+	Cvar_RegisterVariable (&sv_parallelthinks);
 	Cvar_RegisterVariable (&sv_friction);
 	Cvar_RegisterVariable (&sv_gameplayfix_blowupfallenzombies);
 	Cvar_RegisterVariable (&sv_gameplayfix_consistentplayerprethink);
@@ -567,6 +589,8 @@ void SV_Init (void)
 	Cvar_RegisterVariable (&teamplay);
 	Cvar_RegisterVariable (&timelimit);
 	Cvar_RegisterVariable (&sv_threaded);
+	Cvar_RegisterVariable (&sv_threads);
+	Cvar_RegisterVariable (&sv_threads_stats);
 
 	Cvar_RegisterVariable (&saved1);
 	Cvar_RegisterVariable (&saved2);
@@ -611,6 +635,12 @@ void SV_Init (void)
 	Cvar_RegisterVariable (&sv_mapformat_is_quake3);
 
 	sv_mempool = Mem_AllocPool("server", 0, NULL);
+
+	if (Thread_HasThreads())
+	{
+		svs.cullmutex = Thread_CreateMutex();
+		svs.thinkmutex = Thread_CreateMutex();
+	}
 }
 
 static void SV_SaveEntFile_f(void)
@@ -1156,6 +1186,37 @@ crosses a waterline.
 =============================================================================
 */
 
+// groups a cluster list by the 32bit pvs words the clusters are in, returns
+// the number of words or -1 if there are more than MAX_ENTITYCLUSTERS
+static int SV_BuildClusterWords(const int *clusterlist, int numclusters, int *wordindex, unsigned int *wordmask)
+{
+	int i, j, cluster, numwords = 0;
+	unsigned char bytes[4];
+	unsigned int mask;
+	for (i = 0;i < numclusters;i++)
+	{
+		// clusters of solid leafs are never visible
+		cluster = clusterlist[i];
+		if (cluster < 0)
+			continue;
+		// build the mask in memory order so it matches the pvs bytes
+		memset(bytes, 0, sizeof(bytes));
+		bytes[(cluster >> 3) & 3] = 1 << (cluster & 7);
+		memcpy(&mask, bytes, sizeof(mask));
+		for (j = 0;j < numwords && wordindex[j] != cluster >> 5;j++)
+			;
+		if (j == numwords)
+		{
+			if (numwords == MAX_ENTITYCLUSTERS)
+				return -1;
+			wordindex[numwords] = cluster >> 5;
+			wordmask[numwords++] = 0;
+		}
+		wordmask[j] |= mask;
+	}
+	return numwords;
+}
+
 static qboolean SV_PrepareEntityForSending (prvm_edict_t *ent, entity_state_t *cs, int enumber)
 {
 	prvm_prog_t *prog = SVVM_prog;
@@ -1426,16 +1487,17 @@ static qboolean SV_PrepareEntityForSending (prvm_edict_t *ent, entity_state_t *c
 	{
 		VectorCopy(cullmins, ent->priv.server->cullmins);
 		VectorCopy(cullmaxs, ent->priv.server->cullmaxs);
-		// a value of -1 for pvs_numclusters indicates that the links are not
-		// cached, and should be re-tested each time, this is the case if the
-		// culling box touches too many pvs clusters to store, or if the world
-		// model does not support FindBoxClusters
-		ent->priv.server->pvs_numclusters = -1;
+		// a value of -1 for pvs_numclusterwords indicates that the links are
+		// not cached, and should be re-tested each time, this is the case if
+		// the culling box touches too many pvs clusters to store, or if the
+		// world model does not support FindBoxClusters
+		ent->priv.server->pvs_numclusterwords = -1;
 		if (sv.worldmodel && sv.worldmodel->brush.FindBoxClusters)
 		{
-			i = sv.worldmodel->brush.FindBoxClusters(sv.worldmodel, cullmins, cullmaxs, MAX_ENTITYCLUSTERS, ent->priv.server->pvs_clusterlist);
-			if (i <= MAX_ENTITYCLUSTERS)
-				ent->priv.server->pvs_numclusters = i;
+			int clusterlist[MAX_ENTITYCLUSTERS * 4];
+			i = sv.worldmodel->brush.FindBoxClusters(sv.worldmodel, cullmins, cullmaxs, MAX_ENTITYCLUSTERS * 4, clusterlist);
+			if (i >= 0 && i <= MAX_ENTITYCLUSTERS * 4)
+				ent->priv.server->pvs_numclusterwords = SV_BuildClusterWords(clusterlist, i, ent->priv.server->pvs_clusterwordindex, ent->priv.server->pvs_clusterwordmask);
 		}
 	}
 
@@ -1470,6 +1532,7 @@ static void SV_PrepareEntitiesForSending(void)
 	int e;
 	prvm_edict_t *ent;
 	// send all entities that touch the pvs
+	EntityFrame5_ClearSendCache();
 	sv.numsendentities = 0;
 	sv.sendentitiesindex[0] = NULL;
 	memset(sv.sendentitiesindex, 0, prog->num_edicts * sizeof(*sv.sendentitiesindex));
@@ -1484,8 +1547,11 @@ static void SV_PrepareEntitiesForSending(void)
 }
 
 #define MAX_LINEOFSIGHTTRACES 64
+// world line of sight traces done together (the packet size of the batch tracers)
+#define LINEOFSIGHTBATCH 4
 
-qboolean SV_CanSeeBox(int numtraces, vec_t enlarge, vec3_t eye, vec3_t entboxmins, vec3_t entboxmaxs)
+// touchedicts must have room for MAX_EDICTS entries, each thread needs its own
+static qboolean SV_CanSeeBox_TouchList(int numtraces, vec_t enlarge, vec3_t eye, vec3_t entboxmins, vec3_t entboxmaxs, prvm_edict_t **touchedicts)
 {
 	prvm_prog_t *prog = SVVM_prog;
 	float pitchsign;
@@ -1499,10 +1565,12 @@ qboolean SV_CanSeeBox(int numtraces, vec_t enlarge, vec3_t eye, vec3_t entboxmin
 	matrix4x4_t matrix, imatrix;
 	dp_model_t *model;
 	prvm_edict_t *touch;
-	static prvm_edict_t *touchedicts[MAX_EDICTS];
 	vec3_t boxmins, boxmaxs;
 	vec3_t clipboxmins, clipboxmaxs;
 	vec3_t endpoints[MAX_LINEOFSIGHTTRACES];
+	int batchindex, batchsize;
+	vec3_t batchstarts[LINEOFSIGHTBATCH];
+	qboolean batchvisible[LINEOFSIGHTBATCH];
 
 	numtraces = min(numtraces, MAX_LINEOFSIGHTTRACES);
 
@@ -1532,8 +1600,16 @@ qboolean SV_CanSeeBox(int numtraces, vec_t enlarge, vec3_t eye, vec3_t entboxmin
 	}
 
 	// get the list of entities in the sweep box
+	// (the area grid marks entities while walking it, so only one culling
+	// task may do this at a time)
 	if (sv_cullentities_trace_entityocclusion.integer)
+	{
+		if (svs.cullmutex)
+			Thread_LockMutex(svs.cullmutex);
 		numtouchedicts = SV_EntitiesInBox(clipboxmins, clipboxmaxs, MAX_EDICTS, touchedicts);
+		if (svs.cullmutex)
+			Thread_UnlockMutex(svs.cullmutex);
+	}
 	if (numtouchedicts > MAX_EDICTS)
 	{
 		// this never happens
@@ -1566,8 +1642,21 @@ qboolean SV_CanSeeBox(int numtraces, vec_t enlarge, vec3_t eye, vec3_t entboxmin
 
 	for (traceindex = 0;traceindex < numtraces;traceindex++)
 	{
-		// check world occlusion
-		if (sv.worldmodel && sv.worldmodel->brush.TraceLineOfSight)
+		// check world occlusion, a few rays at a time when the world model
+		// can trace them together (this still stops early when one is visible)
+		if (sv.worldmodel && sv.worldmodel->brush.TraceLinesOfSight)
+		{
+			if (!(traceindex % LINEOFSIGHTBATCH))
+			{
+				batchsize = min(numtraces - traceindex, LINEOFSIGHTBATCH);
+				for (batchindex = 0;batchindex < batchsize;batchindex++)
+					VectorCopy(eye, batchstarts[batchindex]);
+				sv.worldmodel->brush.TraceLinesOfSight(sv.worldmodel, batchsize, batchstarts[0], endpoints[traceindex], batchvisible);
+			}
+			if (!batchvisible[traceindex % LINEOFSIGHTBATCH])
+				continue;
+		}
+		else if (sv.worldmodel && sv.worldmodel->brush.TraceLineOfSight)
 			if (!sv.worldmodel->brush.TraceLineOfSight(sv.worldmodel, eye, endpoints[traceindex]))
 				continue;
 		for (touchindex = 0;touchindex < numtouchedicts;touchindex++)
@@ -1601,34 +1690,46 @@ qboolean SV_CanSeeBox(int numtraces, vec_t enlarge, vec3_t eye, vec3_t entboxmin
 	return false;
 }
 
-static void SV_MarkWriteEntityStateToClient(entity_state_t *s)
+qboolean SV_CanSeeBox(int numtraces, vec_t enlarge, vec3_t eye, vec3_t entboxmins, vec3_t entboxmaxs)
+{
+	static prvm_edict_t *touchedicts[MAX_EDICTS];
+	return SV_CanSeeBox_TouchList(numtraces, enlarge, eye, entboxmins, entboxmaxs, touchedicts);
+}
+
+// when threaded is true this may run on a worker thread, and entities that
+// need QC (customizeentityforclient) are left unconsidered for the final
+// pass on the server thread
+static void SV_MarkWriteEntityStateToClient(entity_state_t *s, client_t *client, prvm_edict_t **touchedicts, qboolean threaded)
 {
 	prvm_prog_t *prog = SVVM_prog;
+	server_clientvisibility_t *vis = &client->visibility;
 	int isbmodel;
 	dp_model_t *model;
 	prvm_edict_t *ed;
-	if (sv.sententitiesconsideration[s->number] == sv.sententitiesmark)
+	if (CHECKPVSBIT(vis->considered, s->number))
 		return;
-	sv.sententitiesconsideration[s->number] = sv.sententitiesmark;
-	sv.writeentitiestoclient_stats_totalentities++;
+	if (s->customizeentityforclient && threaded)
+		return;
+	SETPVSBIT(vis->considered, s->number);
+	vis->stats_totalentities++;
 
 	if (s->customizeentityforclient)
 	{
 		PRVM_serverglobalfloat(time) = sv.time;
 		PRVM_serverglobaledict(self) = s->number;
-		PRVM_serverglobaledict(other) = sv.writeentitiestoclient_cliententitynumber;
+		PRVM_serverglobaledict(other) = vis->cliententitynumber;
 		prog->ExecuteProgram(prog, s->customizeentityforclient, "customizeentityforclient: NULL function");
 		if(!PRVM_G_FLOAT(OFS_RETURN) || !SV_PrepareEntityForSending(PRVM_EDICT_NUM(s->number), s, s->number))
 			return;
 	}
 
 	// never reject player
-	if (s->number != sv.writeentitiestoclient_cliententitynumber)
+	if (s->number != vis->cliententitynumber)
 	{
 		// check various rejection conditions
-		if (s->nodrawtoclient == sv.writeentitiestoclient_cliententitynumber)
+		if (s->nodrawtoclient == vis->cliententitynumber)
 			return;
-		if (s->drawonlytoclient && s->drawonlytoclient != sv.writeentitiestoclient_cliententitynumber)
+		if (s->drawonlytoclient && s->drawonlytoclient != vis->cliententitynumber)
 			return;
 		if (s->effects & EF_NODRAW)
 			return;
@@ -1640,7 +1741,7 @@ static void SV_MarkWriteEntityStateToClient(entity_state_t *s)
 		// viewmodels don't have visibility checking
 		if (s->viewmodelforclient)
 		{
-			if (s->viewmodelforclient != sv.writeentitiestoclient_cliententitynumber)
+			if (s->viewmodelforclient != vis->cliententitynumber)
 				return;
 		}
 		else if (s->tagentity)
@@ -1648,8 +1749,15 @@ static void SV_MarkWriteEntityStateToClient(entity_state_t *s)
 			// tag attached entities simply check their parent
 			if (!sv.sendentitiesindex[s->tagentity])
 				return;
-			SV_MarkWriteEntityStateToClient(sv.sendentitiesindex[s->tagentity]);
-			if (sv.sententities[s->tagentity] != sv.sententitiesmark)
+			SV_MarkWriteEntityStateToClient(sv.sendentitiesindex[s->tagentity], client, touchedicts, threaded);
+			if (!CHECKPVSBIT(vis->considered, s->tagentity))
+			{
+				// parent was left for the server thread, so this one is too
+				CLEARPVSBIT(vis->considered, s->number);
+				vis->stats_totalentities--;
+				return;
+			}
+			if (!CHECKPVSBIT(vis->visible, s->tagentity))
 				return;
 		}
 		// always send world submodels in newer protocols because they don't
@@ -1661,27 +1769,27 @@ static void SV_MarkWriteEntityStateToClient(entity_state_t *s)
 			ed = PRVM_EDICT_NUM(s->number);
 
 			// if not touching a visible leaf
-			if (sv_cullentities_pvs.integer && !r_novis.integer && !r_trippy.integer && sv.writeentitiestoclient_pvsbytes)
+			if (sv_cullentities_pvs.integer && !r_novis.integer && !r_trippy.integer && vis->pvsbytes)
 			{
-				if (ed->priv.server->pvs_numclusters < 0)
+				if (ed->priv.server->pvs_numclusterwords < 0)
 				{
 					// entity too big for clusters list
-					if (sv.worldmodel && sv.worldmodel->brush.BoxTouchingPVS && !sv.worldmodel->brush.BoxTouchingPVS(sv.worldmodel, sv.writeentitiestoclient_pvs, ed->priv.server->cullmins, ed->priv.server->cullmaxs))
+					if (sv.worldmodel && sv.worldmodel->brush.BoxTouchingPVS && !sv.worldmodel->brush.BoxTouchingPVS(sv.worldmodel, (unsigned char *)vis->pvs, ed->priv.server->cullmins, ed->priv.server->cullmaxs))
 					{
-						sv.writeentitiestoclient_stats_culled_pvs++;
+						vis->stats_culled_pvs++;
 						return;
 					}
 				}
 				else
 				{
 					int i;
-					// check cached clusters list
-					for (i = 0;i < ed->priv.server->pvs_numclusters;i++)
-						if (CHECKPVSBIT(sv.writeentitiestoclient_pvs, ed->priv.server->pvs_clusterlist[i]))
+					// check cached cluster words
+					for (i = 0;i < ed->priv.server->pvs_numclusterwords;i++)
+						if (vis->pvs[ed->priv.server->pvs_clusterwordindex[i]] & ed->priv.server->pvs_clusterwordmask[i])
 							break;
-					if (i == ed->priv.server->pvs_numclusters)
+					if (i == ed->priv.server->pvs_numclusterwords)
 					{
-						sv.writeentitiestoclient_stats_culled_pvs++;
+						vis->stats_culled_pvs++;
 						return;
 					}
 				}
@@ -1702,19 +1810,27 @@ static void SV_MarkWriteEntityStateToClient(entity_state_t *s)
 				if(samples > 0)
 				{
 					int eyeindex;
-					for (eyeindex = 0;eyeindex < sv.writeentitiestoclient_numeyes;eyeindex++)
-						if(SV_CanSeeBox(samples, enlarge, sv.writeentitiestoclient_eyes[eyeindex], ed->priv.server->cullmins, ed->priv.server->cullmaxs))
-							break;
-					if(eyeindex < sv.writeentitiestoclient_numeyes)
-						svs.clients[sv.writeentitiestoclient_clientnumber].visibletime[s->number] =
+					// the visibility grid answers the ones likely in plain view with one trace
+					int visible = SV_VisGrid_CanSeeBox(vis->numeyes, (const vec3_t *)vis->eyes, ed->priv.server->cullmins, ed->priv.server->cullmaxs);
+					if (visible < 0)
+					{
+						for (eyeindex = 0;eyeindex < vis->numeyes;eyeindex++)
+							if(SV_CanSeeBox_TouchList(samples, enlarge, vis->eyes[eyeindex], ed->priv.server->cullmins, ed->priv.server->cullmaxs, touchedicts))
+								break;
+						visible = eyeindex < vis->numeyes;
+					}
+					else
+						vis->stats_gridanswers++;
+					if(visible)
+						client->visibletime[s->number] =
 							realtime + (
 								s->number <= svs.maxclients
 									? sv_cullentities_trace_delay_players.value
 									: sv_cullentities_trace_delay.value
 							);
-					else if (realtime > svs.clients[sv.writeentitiestoclient_clientnumber].visibletime[s->number])
+					else if (realtime > client->visibletime[s->number])
 					{
-						sv.writeentitiestoclient_stats_culled_trace++;
+						vis->stats_culled_trace++;
 						return;
 					}
 				}
@@ -1725,13 +1841,13 @@ static void SV_MarkWriteEntityStateToClient(entity_state_t *s)
 	// this just marks it for sending
 	// FIXME: it would be more efficient to send here, but the entity
 	// compressor isn't that flexible
-	sv.writeentitiestoclient_stats_visibleentities++;
-	sv.sententities[s->number] = sv.sententitiesmark;
+	vis->stats_visibleentities++;
+	SETPVSBIT(vis->visible, s->number);
 }
 
 #if MAX_LEVELNETWORKEYES > 0
 #define MAX_EYE_RECURSION 1 // increase if recursion gets supported by portals
-static void SV_AddCameraEyes(void)
+static void SV_AddCameraEyes(server_clientvisibility_t *vis)
 {
 	prvm_prog_t *prog = SVVM_prog;
 	int e, i, j, k;
@@ -1742,7 +1858,7 @@ static void SV_AddCameraEyes(void)
 	int n_cameras = 0;
 	vec3_t mi, ma;
 
-	for(i = 0; i < sv.writeentitiestoclient_numeyes; ++i)
+	for(i = 0; i < vis->numeyes; ++i)
 		eye_levels[i] = 0;
 
 	// check line of sight to portal entities and add them to PVS
@@ -1754,12 +1870,12 @@ static void SV_AddCameraEyes(void)
 			{
 				PRVM_serverglobalfloat(time) = sv.time;
 				PRVM_serverglobaledict(self) = e;
-				PRVM_serverglobaledict(other) = sv.writeentitiestoclient_cliententitynumber;
-				VectorCopy(sv.writeentitiestoclient_eyes[0], PRVM_serverglobalvector(trace_endpos));
-				VectorCopy(sv.writeentitiestoclient_eyes[0], PRVM_G_VECTOR(OFS_PARM0));
+				PRVM_serverglobaledict(other) = vis->cliententitynumber;
+				VectorCopy(vis->eyes[0], PRVM_serverglobalvector(trace_endpos));
+				VectorCopy(vis->eyes[0], PRVM_G_VECTOR(OFS_PARM0));
 				VectorClear(PRVM_G_VECTOR(OFS_PARM1));
 				prog->ExecuteProgram(prog, PRVM_serveredictfunction(ed, camera_transform), "QC function e.camera_transform is missing");
-				if(!VectorCompare(PRVM_serverglobalvector(trace_endpos), sv.writeentitiestoclient_eyes[0]))
+				if(!VectorCompare(PRVM_serverglobalvector(trace_endpos), vis->eyes[0]))
 				{
 					VectorCopy(PRVM_serverglobalvector(trace_endpos), camera_origins[n_cameras]);
 					cameras[n_cameras] = e;
@@ -1776,22 +1892,22 @@ static void SV_AddCameraEyes(void)
 
 	// i is loop counter, is reset to 0 when an eye got added
 	// j is camera index to check
-	for(i = 0, j = 0; sv.writeentitiestoclient_numeyes < MAX_CLIENTNETWORKEYES && i < n_cameras; ++i, ++j, j %= n_cameras)
+	for(i = 0, j = 0; vis->numeyes < MAX_CLIENTNETWORKEYES && i < n_cameras; ++i, ++j, j %= n_cameras)
 	{
 		if(!cameras[j])
 			continue;
 		ed = PRVM_EDICT_NUM(cameras[j]);
 		VectorAdd(PRVM_serveredictvector(ed, origin), PRVM_serveredictvector(ed, mins), mi);
 		VectorAdd(PRVM_serveredictvector(ed, origin), PRVM_serveredictvector(ed, maxs), ma);
-		for(k = 0; k < sv.writeentitiestoclient_numeyes; ++k)
+		for(k = 0; k < vis->numeyes; ++k)
 		if(eye_levels[k] <= MAX_EYE_RECURSION)
 		{
-			if(SV_CanSeeBox(sv_cullentities_trace_samples.integer, sv_cullentities_trace_enlarge.value, sv.writeentitiestoclient_eyes[k], mi, ma))
+			if(SV_CanSeeBox(sv_cullentities_trace_samples.integer, sv_cullentities_trace_enlarge.value, vis->eyes[k], mi, ma))
 			{
-				eye_levels[sv.writeentitiestoclient_numeyes] = eye_levels[k] + 1;
-				VectorCopy(camera_origins[j], sv.writeentitiestoclient_eyes[sv.writeentitiestoclient_numeyes]);
-				// Con_Printf("added eye %d: %f %f %f because we can see %f %f %f .. %f %f %f from eye %d\n", j, sv.writeentitiestoclient_eyes[sv.writeentitiestoclient_numeyes][0], sv.writeentitiestoclient_eyes[sv.writeentitiestoclient_numeyes][1], sv.writeentitiestoclient_eyes[sv.writeentitiestoclient_numeyes][2], mi[0], mi[1], mi[2], ma[0], ma[1], ma[2], k);
-				sv.writeentitiestoclient_numeyes++;
+				eye_levels[vis->numeyes] = eye_levels[k] + 1;
+				VectorCopy(camera_origins[j], vis->eyes[vis->numeyes]);
+				// Con_Printf("added eye %d: %f %f %f because we can see %f %f %f .. %f %f %f from eye %d\n", j, vis->eyes[vis->numeyes][0], vis->eyes[vis->numeyes][1], vis->eyes[vis->numeyes][2], mi[0], mi[1], mi[2], ma[0], ma[1], ma[2], k);
+				vis->numeyes++;
 				cameras[j] = 0;
 				i = 0;
 				break;
@@ -1800,80 +1916,212 @@ static void SV_AddCameraEyes(void)
 	}
 }
 #else
-void SV_AddCameraEyes(void)
+static void SV_AddCameraEyes(server_clientvisibility_t *vis)
 {
 }
 #endif
 
-static void SV_WriteEntitiesToClient(client_t *client, prvm_edict_t *clent, sizebuf_t *msg, int maxsize)
+// builds the fat pvs of all eyes, the fat pvs only depends on the clusters
+// within 8 units of the eyes so it is kept until those change (which is most
+// frames for a client that is standing or walking around a room)
+static void SV_BuildClientPVS(server_clientvisibility_t *vis)
 {
-	prvm_prog_t *prog = SVVM_prog;
-	qboolean need_empty = false;
-	int i, numsendstates, numcsqcsendstates;
-	entity_state_t *s;
-	prvm_edict_t *camera;
-	qboolean success;
-	vec3_t eye;
-
-	// if there isn't enough space to accomplish anything, skip it
-	if (msg->cursize + 25 > maxsize)
+	dp_model_t *model = sv.worldmodel;
+	int clusters[MAX_CLIENTPVSCLUSTERS];
+	int i, j, k, n, numclusters = 0, numbytes;
+	const unsigned char *row;
+	unsigned char *pvs = (unsigned char *)vis->pvs;
+	mleaf_t *leaf;
+	vec3_t mins, maxs;
+
+	vis->pvsbytes = 0;
+	if (!model || !model->brush.FatPVS)
+	{
+		vis->pvsmodel = NULL;
 		return;
+	}
 
-	sv.writeentitiestoclient_msg = msg;
-	sv.writeentitiestoclient_clientnumber = client - svs.clients;
+	if (model->brush.FindBoxClusters && model->brush.PointInLeaf && model->brush.num_pvsclusters && model->brush.data_pvsclusters && !r_novis.integer && !r_trippy.integer)
+	{
+		for (i = 0;i < vis->numeyes;i++)
+		{
+			// FatPVS makes everything visible from an eye in a solid leaf,
+			// leave that to it
+			leaf = model->brush.PointInLeaf(model, vis->eyes[i]);
+			if (!leaf || leaf->clusterindex < 0)
+				break;
+			VectorSet(mins, vis->eyes[i][0] - 8, vis->eyes[i][1] - 8, vis->eyes[i][2] - 8);
+			VectorSet(maxs, vis->eyes[i][0] + 8, vis->eyes[i][1] + 8, vis->eyes[i][2] + 8);
+			n = model->brush.FindBoxClusters(model, mins, maxs, MAX_CLIENTPVSCLUSTERS - numclusters, clusters + numclusters);
+			if (n < 0 || numclusters + n > MAX_CLIENTPVSCLUSTERS)
+				break;
+			// solid leafs near the eye add nothing, as in FatPVS
+			for (j = 0, k = numclusters;j < n;j++)
+				if (clusters[numclusters + j] >= 0)
+					clusters[k++] = clusters[numclusters + j];
+			numclusters = k;
+		}
+		if (i == vis->numeyes)
+		{
+			numbytes = min(model->brush.num_pvsclusterbytes, (int)sizeof(vis->pvs));
+			if (vis->pvsmodel != model || vis->pvsnumclusters != numclusters || memcmp(vis->pvsclusters, clusters, numclusters * sizeof(int)))
+			{
+				memset(pvs, 0, numbytes);
+				for (i = 0;i < numclusters;i++)
+				{
+					row = model->brush.data_pvsclusters + clusters[i] * model->brush.num_pvsclusterbytes;
+					for (j = 0;j < numbytes;j++)
+						pvs[j] |= row[j];
+				}
+				vis->pvsmodel = model;
+				vis->pvsnumclusters = numclusters;
+				memcpy(vis->pvsclusters, clusters, numclusters * sizeof(int));
+			}
+			vis->pvsbytes = numbytes;
+			return;
+		}
+	}
+
+	// get the PVS values for the eye locations, later FatPVS calls will merge
+	vis->pvsmodel = NULL;
+	for (i = 0;i < vis->numeyes;i++)
+		vis->pvsbytes = model->brush.FatPVS(model, vis->eyes[i], 8, pvs, sizeof(vis->pvs), vis->pvsbytes != 0);
+}
 
-	sv.writeentitiestoclient_stats_culled_pvs = 0;
-	sv.writeentitiestoclient_stats_culled_trace = 0;
-	sv.writeentitiestoclient_stats_visibleentities = 0;
-	sv.writeentitiestoclient_stats_totalentities = 0;
-	sv.writeentitiestoclient_numeyes = 0;
+// sets up the eyes and pvs for culling, may run QC so it must be called on
+// the server thread
+static void SV_PrepareClientVisibility(client_t *client, prvm_edict_t *clent)
+{
+	prvm_prog_t *prog = SVVM_prog;
+	server_clientvisibility_t *vis = &client->visibility;
+	prvm_edict_t *camera;
+	vec3_t eye;
+	int numbytes;
+
+	vis->clientnumber = client - svs.clients;
+	vis->stats_culled_pvs = 0;
+	vis->stats_culled_trace = 0;
+	vis->stats_gridanswers = 0;
+	vis->stats_visibleentities = 0;
+	vis->stats_totalentities = 0;
+	vis->numeyes = 0;
+	numbytes = (prog->num_edicts + 7) >> 3;
+	memset(vis->considered, 0, numbytes);
+	memset(vis->visible, 0, numbytes);
 
 	// get eye location
-	sv.writeentitiestoclient_cliententitynumber = PRVM_EDICT_TO_PROG(clent); // LordHavoc: for comparison purposes
+	vis->cliententitynumber = PRVM_EDICT_TO_PROG(clent); // LordHavoc: for comparison purposes
 	camera = PRVM_EDICT_NUM( client->clientcamera );
 	VectorAdd(PRVM_serveredictvector(camera, origin), PRVM_serveredictvector(clent, view_ofs), eye);
-	sv.writeentitiestoclient_pvsbytes = 0;
-	// get the PVS values for the eye location, later FatPVS calls will merge
-	if (sv.worldmodel && sv.worldmodel->brush.FatPVS)
-		sv.writeentitiestoclient_pvsbytes = sv.worldmodel->brush.FatPVS(sv.worldmodel, eye, 8, sv.writeentitiestoclient_pvs, sizeof(sv.writeentitiestoclient_pvs), sv.writeentitiestoclient_pvsbytes != 0);
-
 	// add the eye to a list for SV_CanSeeBox tests
-	VectorCopy(eye, sv.writeentitiestoclient_eyes[sv.writeentitiestoclient_numeyes]);
-	sv.writeentitiestoclient_numeyes++;
+	VectorCopy(eye, vis->eyes[vis->numeyes]);
+	vis->numeyes++;
 
 	// calculate predicted eye origin for SV_CanSeeBox tests
 	if (sv_cullentities_trace_prediction.integer)
 	{
-		vec_t predtime = bound(0, host_client->ping, sv_cullentities_trace_prediction_time.value);
+		vec_t predtime = bound(0, client->ping, sv_cullentities_trace_prediction_time.value);
 		vec3_t predeye;
 		VectorMA(eye, predtime, PRVM_serveredictvector(camera, velocity), predeye);
 		if (SV_CanSeeBox(1, 0, eye, predeye, predeye))
 		{
-			VectorCopy(predeye, sv.writeentitiestoclient_eyes[sv.writeentitiestoclient_numeyes]);
-			sv.writeentitiestoclient_numeyes++;
+			VectorCopy(predeye, vis->eyes[vis->numeyes]);
+			vis->numeyes++;
 		}
 		//if (!sv.writeentitiestoclient_useprediction)
 		//	Con_DPrintf("Trying to walk into solid in a pingtime... not predicting for culling\n");
 	}
 
-	SV_AddCameraEyes();
+	SV_AddCameraEyes(vis);
 
-	// build PVS from the new eyes
-	if (sv.worldmodel && sv.worldmodel->brush.FatPVS)
-		for(i = 1; i < sv.writeentitiestoclient_numeyes; ++i)
-			sv.writeentitiestoclient_pvsbytes = sv.worldmodel->brush.FatPVS(sv.worldmodel, sv.writeentitiestoclient_eyes[i], 8, sv.writeentitiestoclient_pvs, sizeof(sv.writeentitiestoclient_pvs), sv.writeentitiestoclient_pvsbytes != 0);
+	SV_BuildClientPVS(vis);
 
-	sv.sententitiesmark++;
+	vis->prepared = true;
+}
 
+static void SV_MarkClientVisibility(client_t *client, prvm_edict_t **touchedicts, qboolean threaded)
+{
+	int i;
 	for (i = 0;i < sv.numsendentities;i++)
-		SV_MarkWriteEntityStateToClient(sv.sendentities + i);
+		SV_MarkWriteEntityStateToClient(sv.sendentities + i, client, touchedicts, threaded);
+}
+
+// culling task for sv_threads, i[0] is the first entry in the client number
+// list at p[0], i[1] is the stride, p[1] is this task's touchedicts scratch
+static void SV_MarkClientVisibility_Task(taskqueue_task_t *t)
+{
+	int *clientnumbers = (int *)t->p[0];
+	size_t i;
+	for (i = t->i[0];clientnumbers[i] >= 0;i += t->i[1])
+		SV_MarkClientVisibility(svs.clients + clientnumbers[i], (prvm_edict_t **)t->p[1], true);
+}
+
+// does the entity culling for every client that will be sent a datagram this
+// frame, in parallel on the task queue, leaving only the entities that need
+// QC to be checked by SV_WriteEntitiesToClient
+static void SV_MarkClientVisibility_Threaded(int firstclient)
+{
+	int i, numclients = 0, numtasks;
+	int clientnumbers[MAX_SCOREBOARD + MAX_SCOREBOARD + 1];
+	taskqueue_task_t tasks[MAX_SCOREBOARD];
+	client_t *client;
+	prvm_edict_t **touchedicts;
+
+	// eyes are set up first because camera eyes can run QC
+	for (i = firstclient, client = svs.clients + i;i < svs.maxclients;i++, client++)
+	{
+		if (!client->active || !client->begun || !client->netconnection || client->netconnection->message.overflowed || !NetConn_CanSend(client->netconnection))
+			continue;
+		SV_PrepareClientVisibility(client, client->edict);
+		clientnumbers[numclients++] = i;
+	}
+	if (!numclients)
+		return;
+
+	numtasks = bound(1, sv_threads.integer, numclients);
+	// MAX_EDICTS scratch entries per task
+	touchedicts = (prvm_edict_t **)Mem_FrameAlloc(&mem_framearena_server, numtasks * MAX_EDICTS * sizeof(prvm_edict_t *));
+
+	// each task takes every numtasks'th client, the list is terminated by
+	// enough -1 entries that every task finds one
+	for (i = numclients;i < numclients + numtasks;i++)
+		clientnumbers[i] = -1;
+	for (i = 0;i < numtasks;i++)
+		TaskQueue_Setup(tasks + i, SV_MarkClientVisibility_Task, i, numtasks, clientnumbers, touchedicts + i * MAX_EDICTS);
+	TaskQueue_Enqueue(numtasks, tasks);
+	TaskQueue_WaitForTaskDone(numtasks, tasks);
+}
+
+static void SV_WriteEntitiesToClient(client_t *client, prvm_edict_t *clent, sizebuf_t *msg, int maxsize)
+{
+	prvm_prog_t *prog = SVVM_prog;
+	static prvm_edict_t *touchedicts[MAX_EDICTS];
+	server_clientvisibility_t *vis = &client->visibility;
+	qboolean need_empty = false;
+	int i, numsendstates, numcsqcsendstates;
+	entity_state_t *s;
+	qboolean success;
+
+	// if there isn't enough space to accomplish anything, skip it
+	if (msg->cursize + 25 > maxsize)
+		return;
+
+	sv.writeentitiestoclient_msg = msg;
+	sv.writeentitiestoclient_clientnumber = client - svs.clients;
+	sv.writeentitiestoclient_cliententitynumber = PRVM_EDICT_TO_PROG(clent); // LordHavoc: for comparison purposes
+
+	// the threaded pass already did everything but the QC customized entities
+	if (!vis->prepared)
+		SV_PrepareClientVisibility(client, clent);
+	SV_MarkClientVisibility(client, touchedicts, false);
+	vis->prepared = false;
 
 	numsendstates = 0;
 	numcsqcsendstates = 0;
 	for (i = 0;i < sv.numsendentities;i++)
 	{
 		s = &sv.sendentities[i];
-		if (sv.sententities[s->number] == sv.sententitiesmark)
+		if (CHECKPVSBIT(vis->visible, s->number))
 		{
 			if(s->active == ACTIVE_NETWORK)
 			{
@@ -1894,7 +2142,7 @@ static void SV_WriteEntitiesToClient(client_t *client, prvm_edict_t *clent, size
 	}
 
 	if (sv_cullentities_stats.integer)
-		Con_Printf("client \"%s\" entities: %d total, %d visible, %d culled by: %d pvs %d trace\n", client->name, sv.writeentitiestoclient_stats_totalentities, sv.writeentitiestoclient_stats_visibleentities, sv.writeentitiestoclient_stats_culled_pvs + sv.writeentitiestoclient_stats_culled_trace, sv.writeentitiestoclient_stats_culled_pvs, sv.writeentitiestoclient_stats_culled_trace);
+		Con_Printf("client \"%s\" entities: %d total, %d visible, %d culled by: %d pvs %d trace (%d checks answered by the visibility grid)\n", client->name, vis->stats_totalentities, vis->stats_visibleentities, vis->stats_culled_pvs + vis->stats_culled_trace, vis->stats_culled_pvs, vis->stats_culled_trace, vis->stats_gridanswers);
 
 	if(client->entitydatabase5)
 		need_empty = EntityFrameCSQC_WriteFrame(msg, maxsize, numcsqcsendstates, sv.writeentitiestoclient_csqcsendstates, client->entitydatabase5->latestframenum + 1);
@@ -2575,15 +2823,25 @@ SV_SendClientMessages
 void SV_SendClientMessages(void)
 {
 	int i, prepared = false;
+	double time0 = 0, time1 = 0, time2 = 0, time3 = 0;
 
 	if (sv.protocol == PROTOCOL_QUAKEWORLD)
 		Sys_Error("SV_SendClientMessages: no quakeworld support\n");
 
+	if (sv_threads_stats.integer)
+		time0 = time1 = time2 = Sys_DirtyTime();
+
 	SV_FlushBroadcastMessages();
 
 // update frags, names, etc
 	SV_UpdateToReliableMessages();
 
+	// classify the visibility grid cells the last frame's culling asked about
+	SV_VisGrid_Update();
+
+	// the datagrams for all clients go out together at the end
+	NetConn_BeginWriteBatch();
+
 // build individual updates
 	for (i = 0, host_client = svs.clients;i < svs.maxclients;i++, host_client++)
 	{
@@ -2603,12 +2861,35 @@ void SV_SendClientMessages(void)
 			prepared = true;
 			// only prepare entities once per frame
 			SV_PrepareEntitiesForSending();
+			if (sv_threads_stats.integer)
+				time1 = Sys_DirtyTime();
+			// sv.sendentities is only read from here on, so the culling
+			// for all clients can be done at once
+			if (sv_threads.integer > 0)
+				SV_MarkClientVisibility_Threaded(i);
+			if (sv_threads_stats.integer)
+				time2 = Sys_DirtyTime();
 		}
 		SV_SendClientDatagram(host_client);
 	}
 
+	NetConn_EndWriteBatch();
+
+	// forget culling done for clients that did not get a datagram after all
+	for (i = 0, host_client = svs.clients;i < svs.maxclients;i++, host_client++)
+		host_client->visibility.prepared = false;
+
+	if (sv_cullentities_stats.integer && sv.entitysendcache_hits + sv.entitysendcache_misses)
+		Con_Printf("entity updates: %d total, %d shared between clients (%d%%), %d encoded\n", sv.entitysendcache_hits + sv.entitysendcache_misses, sv.entitysendcache_hits, sv.entitysendcache_hits * 100 / (sv.entitysendcache_hits + sv.entitysendcache_misses), sv.entitysendcache_misses);
+
 // clear muzzle flashes
 	SV_CleanupEnts();
+
+	if (sv_threads_stats.integer)
+	{
+		time3 = Sys_DirtyTime();
+		Con_Printf("%6ius prepare %6ius cull (%i tasks on %i threads) %6ius write\n", (int)((time1 - time0)*1000000), (int)((time2 - time1)*1000000), sv_threads.integer > 0 ? sv_threads.integer : 0, TaskQueue_NumThreads(), (int)((time3 - time2)*1000000));
+	}
 }
 
 static void SV_StartDownload_f(void)
@@ -3250,8 +3531,10 @@ void SV_SpawnServer (const char *server)
 	dp_model_t *worldmodel;
 	char modelname[sizeof(sv.worldname)];
 	char vabuf[1024];
+	double spawnstart, spawnmark;
 
 	Con_DPrintf("SpawnServer: %s\n", server);
+	spawnstart = spawnmark = Sys_DirtyTime();
 
 	dpsnprintf (modelname, sizeof(modelname), "maps/%s.bsp", server);
 
@@ -3279,6 +3562,7 @@ void SV_SpawnServer (const char *server)
 	if(sv.active)
 	{
 		World_End(&sv.world);
+		SV_VisGrid_End();
 		if(PRVM_serverfunction(SV_Shutdown))
 		{
 			func_t s = PRVM_serverfunction(SV_Shutdown);
@@ -3291,7 +3575,9 @@ void SV_SpawnServer (const char *server)
 	// free q3 shaders so that any newly downloaded shaders will be active
 	Mod_FreeQ3Shaders();
 
+	Mod_LoadTimings_Stage("SpawnServer", "shutdown", &spawnmark);
 	worldmodel = Mod_ForName(modelname, false, developer.integer > 0, NULL);
+	Mod_LoadTimings_Stage("SpawnServer", "world model", &spawnmark);
 	if (!worldmodel || !worldmodel->TraceBox)
 	{
 		Con_Printf("Couldn't load map %s\n", modelname);
@@ -3367,6 +3653,7 @@ void SV_SpawnServer (const char *server)
 	}
 
 	SV_VM_Setup();
+	Mod_LoadTimings_Stage("SpawnServer", "progs", &spawnmark);
 
 	sv.active = true;
 
@@ -3424,6 +3711,7 @@ void SV_SpawnServer (const char *server)
 //
 	World_SetSize(&sv.world, sv.worldname, sv.worldmodel->normalmins, sv.worldmodel->normalmaxs, prog);
 	World_Start(&sv.world);
+	SV_VisGrid_Start();
 
 	strlcpy(sv.sound_precache[0], "", sizeof(sv.sound_precache[0]));
 
@@ -3436,6 +3724,7 @@ void SV_SpawnServer (const char *server)
 	}
 	if(i < sv.worldmodel->brush.numsubmodels)
 		Con_Printf("Too many submodels (MAX_MODELS is %i)\n", MAX_MODELS);
+	Mod_LoadTimings_Stage("SpawnServer", "world setup", &spawnmark);
 
 //
 // load the rest of the entities
@@ -3470,6 +3759,7 @@ void SV_SpawnServer (const char *server)
 	for (i = 0, host_client = svs.clients;i < svs.maxclients;i++, host_client++)
 	{
 		host_client->begun = false;
+		host_client->visibility.pvsmodel = NULL;
 		host_client->edict = PRVM_EDICT_NUM(i + 1);
 		PRVM_ED_ClearEdict(prog, host_client->edict);
 	}
@@ -3483,6 +3773,7 @@ void SV_SpawnServer (const char *server)
 	}
 	else
 		PRVM_ED_LoadFromFile(prog, sv.worldmodel->brush.entities);
+	Mod_LoadTimings_Stage("SpawnServer", "entities", &spawnmark);
 
 
 	// LordHavoc: clear world angles (to fix e3m3.bsp)
@@ -3499,6 +3790,7 @@ void SV_SpawnServer (const char *server)
 		sv.frametime = 0.1;
 		SV_Physics ();
 	}
+	Mod_LoadTimings_Stage("SpawnServer", "init frames", &spawnmark);
 
 	// Once all init frames have been run, we consider svqc code fully initialized.
 	prog->inittime = realtime;
@@ -3545,6 +3837,8 @@ void SV_SpawnServer (const char *server)
 	Cvar_SetQuick(&sv_worldmessage, sv.worldmessage);
 
 	Con_DPrint("Server spawned.\n");
+	spawnmark = spawnstart;
+	Mod_LoadTimings_Stage("SpawnServer", "total", &spawnmark);
 	NetConn_Heartbeat (2);
 
 	if(cls.state == ca_dedicated)
@@ -3573,12 +3867,18 @@ static void SVVM_end_increase_edicts(prvm_prog_t *prog)
 			SV_LinkEdict(ent);
 }
 
+static void SVVM_writenotify_edict(prvm_prog_t *prog, prvm_int_t edictnum)
+{
+	SV_WakeEdict((int)edictnum);
+}
+
 static void SVVM_init_edict(prvm_prog_t *prog, prvm_edict_t *e)
 {
 	// LordHavoc: for consistency set these here
 	int num = PRVM_NUM_FOR_EDICT(e) - 1;
 
 	e->priv.server->move = false; // don't move on first frame
+	SV_WakeEdict(num + 1);
 
 	if (num >= 0 && num < svs.maxclients)
 	{
@@ -3631,7 +3931,7 @@ static void SVVM_free_edict(prvm_prog_t *prog, prvm_edict_t *ed)
 	int i;
 	int e;
 
-	World_UnlinkEdict(ed);		// unlink from world bsp
+	World_UnlinkEdict(&sv.world, ed);		// unlink from world bsp
 
 	PRVM_serveredictstring(ed, model) = 0;
 	PRVM_serveredictfloat(ed, takedamage) = 0;
@@ -3890,6 +4190,11 @@ static void SV_VM_Setup(void)
 	// OP_STATE is always supported on server because we add fields/globals for it
 	prog->flag |= PRVM_OP_STATE;
 
+	// SV_Physics lets idle entities sleep until QC changes one of these
+	prog->writenotify_fields[0] = prog->fieldoffsets.nextthink;
+	prog->writenotify_fields[1] = prog->fieldoffsets.movetype;
+	prog->writenotify_edict = SVVM_writenotify_edict;
+
 	VM_CustomStats_Clear();//[515]: csqc
 
 	SV_Prepare_CSQC();
@@ -3925,6 +4230,8 @@ static int SV_ThreadFunc(void *voiddata)
 		// at this point we start doing real server work, and must block on any client activity pertaining to the server (such as executing SV_SpawnServer)
 		SV_LockThreadMutex();
 
+		Mem_FrameReset(&mem_framearena_server);
+
 		// Look for clients who have spawned
 		playing = false;
 		if (sv.active)
@@ -21,6 +21,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "quakedef.h"
 #include "prvm_cmds.h"
+#include "thread.h"
+#include "taskqueue.h"
 
 /*
 
@@ -137,7 +139,7 @@ trace_t SV_TracePoint(const vec3_t start, int type, prvm_edict_t *passedict, int
 #endif
 
 	// clip to world
-	Collision_ClipPointToWorld(&cliptrace, sv.worldmodel, clipstart, hitsupercontentsmask);
+	Collision_TraceCache_ClipPointToWorld(&sv.world.tracecache, &cliptrace, sv.worldmodel, clipstart, hitsupercontentsmask);
 	cliptrace.worldstartsolid = cliptrace.bmodelstartsolid = cliptrace.startsolid;
 	if (cliptrace.startsolid || cliptrace.fraction < 1)
 		cliptrace.ent = prog->edicts;
@@ -286,7 +288,7 @@ trace_t SV_TraceLine(const vec3_t start, const vec3_t end, int type, prvm_edict_
 #endif
 
 	// clip to world
-	Collision_ClipLineToWorld(&cliptrace, sv.worldmodel, clipstart, clipend, hitsupercontentsmask, extend, false);
+	Collision_TraceCache_ClipLineToWorld(&sv.world.tracecache, &cliptrace, sv.worldmodel, clipstart, clipend, hitsupercontentsmask, extend, false);
 	cliptrace.worldstartsolid = cliptrace.bmodelstartsolid = cliptrace.startsolid;
 	if (cliptrace.startsolid || cliptrace.fraction < 1)
 		cliptrace.ent = prog->edicts;
@@ -380,9 +382,9 @@ trace_t SV_TraceLine(const vec3_t start, const vec3_t end, int type, prvm_edict_
 		VectorCopy(PRVM_serveredictvector(touch, mins), touchmins);
 		VectorCopy(PRVM_serveredictvector(touch, maxs), touchmaxs);
 		if (type == MOVE_MISSILE && (int)PRVM_serveredictfloat(touch, flags) & FL_MONSTER)
-			Collision_ClipToGenericEntity(&trace, model, touch->priv.server->frameblend, &touch->priv.server->skeleton, touchmins, touchmaxs, bodysupercontents, &matrix, &imatrix, clipstart, clipmins2, clipmaxs2, clipend, hitsupercontentsmask, extend);
+			Collision_TraceCache_ClipToGenericEntity(&sv.world.tracecache, &trace, model, touch->priv.server->frameblend, &touch->priv.server->skeleton, touchmins, touchmaxs, bodysupercontents, &matrix, &imatrix, clipstart, clipmins2, clipmaxs2, clipend, hitsupercontentsmask, extend);
 		else
-			Collision_ClipLineToGenericEntity(&trace, model, touch->priv.server->frameblend, &touch->priv.server->skeleton, touchmins, touchmaxs, bodysupercontents, &matrix, &imatrix, clipstart, clipend, hitsupercontentsmask, extend, false);
+			Collision_TraceCache_ClipLineToGenericEntity(&sv.world.tracecache, &trace, model, touch->priv.server->frameblend, &touch->priv.server->skeleton, touchmins, touchmaxs, bodysupercontents, &matrix, &imatrix, clipstart, clipend, hitsupercontentsmask, extend, false);
 
 		Collision_CombineTraces(&cliptrace, &trace, (void *)touch, PRVM_serveredictfloat(touch, solid) == SOLID_BSP);
 	}
@@ -453,7 +455,7 @@ trace_t SV_TraceBox(const vec3_t start, const vec3_t mins, const vec3_t maxs, co
 #endif
 
 	// clip to world
-	Collision_ClipToWorld(&cliptrace, sv.worldmodel, clipstart, clipmins, clipmaxs, clipend, hitsupercontentsmask, extend);
+	Collision_TraceCache_ClipToWorld(&sv.world.tracecache, &cliptrace, sv.worldmodel, clipstart, clipmins, clipmaxs, clipend, hitsupercontentsmask, extend);
 	cliptrace.worldstartsolid = cliptrace.bmodelstartsolid = cliptrace.startsolid;
 	if (cliptrace.startsolid || cliptrace.fraction < 1)
 		cliptrace.ent = prog->edicts;
@@ -558,9 +560,9 @@ trace_t SV_TraceBox(const vec3_t start, const vec3_t mins, const vec3_t maxs, co
 		VectorCopy(PRVM_serveredictvector(touch, mins), touchmins);
 		VectorCopy(PRVM_serveredictvector(touch, maxs), touchmaxs);
 		if (type == MOVE_MISSILE && (int)PRVM_serveredictfloat(touch, flags) & FL_MONSTER)
-			Collision_ClipToGenericEntity(&trace, model, touch->priv.server->frameblend, &touch->priv.server->skeleton, touchmins, touchmaxs, bodysupercontents, &matrix, &imatrix, clipstart, clipmins2, clipmaxs2, clipend, hitsupercontentsmask, extend);
+			Collision_TraceCache_ClipToGenericEntity(&sv.world.tracecache, &trace, model, touch->priv.server->frameblend, &touch->priv.server->skeleton, touchmins, touchmaxs, bodysupercontents, &matrix, &imatrix, clipstart, clipmins2, clipmaxs2, clipend, hitsupercontentsmask, extend);
 		else
-			Collision_ClipToGenericEntity(&trace, model, touch->priv.server->frameblend, &touch->priv.server->skeleton, touchmins, touchmaxs, bodysupercontents, &matrix, &imatrix, clipstart, clipmins, clipmaxs, clipend, hitsupercontentsmask, extend);
+			Collision_TraceCache_ClipToGenericEntity(&sv.world.tracecache, &trace, model, touch->priv.server->frameblend, &touch->priv.server->skeleton, touchmins, touchmaxs, bodysupercontents, &matrix, &imatrix, clipstart, clipmins, clipmaxs, clipend, hitsupercontentsmask, extend);
 
 		Collision_CombineTraces(&cliptrace, &trace, (void *)touch, PRVM_serveredictfloat(touch, solid) == SOLID_BSP);
 	}
@@ -607,8 +609,7 @@ int SV_PointSuperContents(const vec3_t point)
 	static prvm_edict_t *touchedicts[MAX_EDICTS];
 
 	// get world supercontents at this point
-	if (sv.worldmodel && sv.worldmodel->PointSuperContents)
-		supercontents = sv.worldmodel->PointSuperContents(sv.worldmodel, 0, point);
+	supercontents = Collision_TraceCache_PointSuperContents(&sv.world.tracecache, sv.worldmodel, point);
 
 	// if sv_gameplayfix_swiminbmodels is off we're done
 	if (!sv_gameplayfix_swiminbmodels.integer)
@@ -1070,6 +1071,10 @@ static qboolean SV_RunThink (prvm_edict_t *ent)
 	if (PRVM_serveredictfloat(ent, nextthink) <= 0 || PRVM_serveredictfloat(ent, nextthink) > sv.time + sv.frametime)
 		return true;
 
+	// sv_parallelthinks got to it first
+	if (ent->priv.server->thinkdone)
+		return !ent->priv.server->free;
+
 	for (iterations = 0;iterations < 128  && !ent->priv.server->free;iterations++)
 	{
 		PRVM_serverglobalfloat(time) = max(sv.time, PRVM_serveredictfloat(ent, nextthink));
@@ -3071,6 +3076,667 @@ static void SV_Physics_ClientEntity(prvm_edict_t *ent)
 	SV_CheckVelocity (ent);
 }
 
+/*
+=============================================================================
+
+ACTIVE EDICTS
+
+With sv_activeedicts SV_Physics only looks at the non-client entities that
+can do something this frame. An idle MOVETYPE_NONE entity (nothing to do
+until its nextthink) is put to sleep after its physics ran and gets a timer
+for its nextthink. It wakes when the timer comes up, when it is spawned, or
+when QuakeC writes its nextthink or movetype (prog->writenotify_fields).
+Awake entities still run in edict number order, so QC sees the same order.
+
+=============================================================================
+*/
+
+void SV_WakeEdict (int entnum)
+{
+	if (entnum > 0 && entnum < MAX_EDICTS)
+		sv.physics_asleep[entnum >> 5] &= ~(1u << (entnum & 31));
+}
+
+static void SV_Physics_TimerSwap (int a, int b)
+{
+	server_physicstimer_t temp = sv.physics_timers[a];
+	sv.physics_timers[a] = sv.physics_timers[b];
+	sv.physics_timers[b] = temp;
+	sv.physics_timerindex[sv.physics_timers[a].entnum] = a + 1;
+	sv.physics_timerindex[sv.physics_timers[b].entnum] = b + 1;
+}
+
+static void SV_Physics_TimerSiftUp (int i)
+{
+	while (i > 0 && sv.physics_timers[i].time < sv.physics_timers[(i - 1) / 2].time)
+	{
+		SV_Physics_TimerSwap (i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+static void SV_Physics_TimerSiftDown (int i)
+{
+	int child;
+	for (;;)
+	{
+		child = i * 2 + 1;
+		if (child >= sv.physics_numtimers)
+			break;
+		if (child + 1 < sv.physics_numtimers && sv.physics_timers[child + 1].time < sv.physics_timers[child].time)
+			child++;
+		if (sv.physics_timers[i].time <= sv.physics_timers[child].time)
+			break;
+		SV_Physics_TimerSwap (i, child);
+		i = child;
+	}
+}
+
+static void SV_Physics_SetTimer (int entnum, double time)
+{
+	int i = sv.physics_timerindex[entnum] - 1;
+	if (i < 0)
+	{
+		i = sv.physics_numtimers++;
+		sv.physics_timers[i].entnum = entnum;
+		sv.physics_timers[i].time = time;
+		sv.physics_timerindex[entnum] = i + 1;
+		SV_Physics_TimerSiftUp (i);
+	}
+	else if (time < sv.physics_timers[i].time)
+	{
+		sv.physics_timers[i].time = time;
+		SV_Physics_TimerSiftUp (i);
+	}
+	else
+	{
+		sv.physics_timers[i].time = time;
+		SV_Physics_TimerSiftDown (i);
+	}
+}
+
+// wakes the sleeping entities whose nextthink is due this frame
+static void SV_Physics_RunTimers (double time)
+{
+	int entnum;
+	while (sv.physics_numtimers > 0 && sv.physics_timers[0].time <= time)
+	{
+		entnum = sv.physics_timers[0].entnum;
+		SV_WakeEdict (entnum);
+		sv.physics_timerindex[entnum] = 0;
+		if (--sv.physics_numtimers > 0)
+		{
+			sv.physics_timers[0] = sv.physics_timers[sv.physics_numtimers];
+			sv.physics_timerindex[sv.physics_timers[0].entnum] = 1;
+			SV_Physics_TimerSiftDown (0);
+		}
+	}
+}
+
+// puts the entity to sleep if it would not do anything next frame
+static void SV_Physics_SleepEdict (prvm_edict_t *ent, int entnum)
+{
+	prvm_prog_t *prog = SVVM_prog;
+	double nextthink;
+
+	if (!ent->priv.server->free)
+	{
+		// skipping SV_Physics_Entity is only the same as running it for
+		// MOVETYPE_NONE entities with no think coming up
+		if ((int) PRVM_serveredictfloat(ent, movetype) != MOVETYPE_NONE || !ent->priv.server->move)
+			return;
+		nextthink = PRVM_serveredictfloat(ent, nextthink);
+		if (nextthink > 0)
+		{
+			if (nextthink <= sv.time + sv.frametime)
+				return;
+			SV_Physics_SetTimer (entnum, nextthink);
+		}
+	}
+	sv.physics_asleep[entnum >> 5] |= 1u << (entnum & 31);
+}
+
+// returns the first edict from entnum on that SV_Physics has to look at
+static int SV_Physics_NextAwakeEdict (int entnum, int numedicts)
+{
+	unsigned int bits;
+
+	if (!sv.physics_sleeping)
+		return entnum;
+	while (entnum < numedicts)
+	{
+		bits = ~sv.physics_asleep[entnum >> 5] >> (entnum & 31);
+		if (!bits)
+		{
+			entnum = (entnum | 31) + 1;
+			continue;
+		}
+		while (!(bits & 1))
+		{
+			bits >>= 1;
+			entnum++;
+		}
+		break;
+	}
+	return entnum;
+}
+
+/*
+===============================================================================
+
+PARALLEL THINKS
+
+The progs can list think functions that only change the entity running them in
+the independentthinks global (DP_SV_INDEPENDENTTHINKS).  With sv_parallelthinks
+those thinks run before the rest of the physics, on the task queue, each task
+with its own copy of the VM (globals, stacks and tempstrings) and a builtin
+table that only allows builtins that are safe to use there.  setorigin links
+and nextthink/movetype notifications are queued and done after the tasks, as
+is setorigin on any entity but self (another task may be thinking for it).
+The tasks share the function profile counters, so prvm_profile may be a bit off.
+
+===============================================================================
+*/
+
+#define SV_PARALLELTHINKS_MAXTASKS 64
+#define SV_PARALLELTHINKS_MAXSETORIGINS 1024
+
+typedef struct sv_thinktask_s
+{
+	// copy of SVVM_prog for this task, refreshed every frame
+	prvm_prog_t prog;
+	// these survive the refresh, they belong to the progs with id progid
+	unsigned int progid;
+	prvm_vec_t *globals;
+	sizebuf_t tempstringsbuf;
+	// queued for the server thread
+	int numrelinks;
+	int relinks[MAX_EDICTS];
+	int numwakes;
+	int wakes[MAX_EDICTS];
+	int numsetorigins;
+	int setorigins[SV_PARALLELTHINKS_MAXSETORIGINS];
+	vec3_t setoriginvalues[SV_PARALLELTHINKS_MAXSETORIGINS];
+	// set if the task stopped on a QC error
+	qboolean error;
+	char errormessage[MAX_INPUTLINE];
+	qboolean locked;
+	jmp_buf abort;
+}
+sv_thinktask_t;
+
+typedef struct sv_parallelthinks_s
+{
+	sv_thinktask_t *tasks[SV_PARALLELTHINKS_MAXTASKS];
+	// parsed copy of the independentthinks global of the progs with id progid
+	unsigned int progid;
+	char list[MAX_INPUTLINE];
+	// per function: 0 = not checked, 1 = listed and runs in parallel, 2 = can
+	// not run in parallel, 3 = being checked, 4 = only called by listed ones
+	unsigned char *functions;
+	int numfunctions;
+}
+sv_parallelthinks_t;
+
+static sv_parallelthinks_t sv_parallelthinks_state;
+static THREAD_LOCAL sv_thinktask_t *sv_thinktask_current;
+
+// error_cmd of the task VMs, there is no Host_Error on worker threads, the
+// server VM uses it too while the tasks run because the engine code the
+// builtins call reports errors through SVVM_prog
+static void SV_ParallelThinks_Error(const char *format, ...)
+{
+	va_list argptr;
+	char message[MAX_INPUTLINE];
+	sv_thinktask_t *task = sv_thinktask_current;
+
+	va_start(argptr, format);
+	dpvsnprintf(message, sizeof(message), format, argptr);
+	va_end(argptr);
+	if (!task)
+		Host_Error("%s", message);
+	strlcpy(task->errormessage, message, sizeof(task->errormessage));
+	task->error = true;
+	if (task->locked)
+		SV_ParallelThinks_Unlock();
+	longjmp(task->abort, 1);
+}
+
+static void SV_ParallelThinks_WriteNotify(prvm_prog_t *prog, prvm_int_t edictnum)
+{
+	sv_thinktask_t *task = sv_thinktask_current;
+	if (task->numwakes && task->wakes[task->numwakes - 1] == edictnum)
+		return;
+	if (task->numwakes >= MAX_EDICTS)
+		prog->error_cmd("%s: too many nextthink or movetype changes in parallel thinks", prog->name);
+	task->wakes[task->numwakes++] = (int)edictnum;
+}
+
+void SV_ParallelThinks_Lock(void)
+{
+	if (svs.thinkmutex)
+		Thread_LockMutex(svs.thinkmutex);
+	if (sv_thinktask_current)
+		sv_thinktask_current->locked = true;
+}
+
+void SV_ParallelThinks_Unlock(void)
+{
+	if (sv_thinktask_current)
+		sv_thinktask_current->locked = false;
+	if (svs.thinkmutex)
+		Thread_UnlockMutex(svs.thinkmutex);
+}
+
+void SV_ParallelThinks_LinkEdict(prvm_edict_t *ent)
+{
+	sv_thinktask_t *task = sv_thinktask_current;
+	prvm_prog_t *prog = &task->prog;
+	int entnum = PRVM_NUM_FOR_EDICT(ent);
+	if (task->numrelinks && task->relinks[task->numrelinks - 1] == entnum)
+		return;
+	if (task->numrelinks >= MAX_EDICTS)
+		prog->error_cmd("%s: too many setorigin calls in parallel thinks", prog->name);
+	task->relinks[task->numrelinks++] = entnum;
+}
+
+void SV_ParallelThinks_SetOrigin(prvm_edict_t *ent, const vec3_t origin)
+{
+	sv_thinktask_t *task = sv_thinktask_current;
+	prvm_prog_t *prog = &task->prog;
+	if (task->numsetorigins >= SV_PARALLELTHINKS_MAXSETORIGINS)
+		prog->error_cmd("%s: too many setorigin calls on other entities in parallel thinks", prog->name);
+	task->setorigins[task->numsetorigins] = PRVM_NUM_FOR_EDICT(ent);
+	VectorCopy(origin, task->setoriginvalues[task->numsetorigins]);
+	task->numsetorigins++;
+}
+
+// scratch space for SV_ParallelThinks_CheckFunction
+typedef struct sv_thinkcheck_s
+{
+	// globals holding a function constant that nothing assigns to
+	unsigned char *functionglobals;
+	// function number + 1 of the last walk that reached the statement
+	int *reached;
+	int *stack;
+}
+sv_thinkcheck_t;
+
+// returns false if the function or a function it calls uses a builtin that
+// can not run in parallel, or calls anything but a function constant (a call
+// through a field, variable or temporary could reach any function)
+static qboolean SV_ParallelThinks_CheckFunction(prvm_prog_t *prog, int fnum, sv_thinkcheck_t *check)
+{
+	sv_parallelthinks_t *state = &sv_parallelthinks_state;
+	mfunction_t *f = prog->functions + fnum;
+	mstatement_t *st;
+	int i, k, numstack = 0, numcallees = 0, next[2], numnext;
+	int *callees;
+	qboolean ok = true;
+
+	if (f->first_statement < 0)
+		return SVVM_parallelsafe_builtin(-f->first_statement);
+	if (state->functions[fnum])
+		return state->functions[fnum] != 2;
+	state->functions[fnum] = 3;
+
+	// walk the statements the function can reach, the calls are collected
+	// at the start of the stack, which they never catch up with
+	check->reached[f->first_statement] = fnum + 1;
+	check->stack[prog->numstatements - ++numstack] = f->first_statement;
+	while (numstack)
+	{
+		i = check->stack[prog->numstatements - numstack--];
+		st = prog->statements + i;
+		numnext = 0;
+		switch (st->op)
+		{
+		case OP_DONE:
+		case OP_RETURN:
+			break;
+		case OP_GOTO:
+			next[numnext++] = st->jumpabsolute;
+			break;
+		case OP_IF:
+		case OP_IFNOT:
+			next[numnext++] = st->jumpabsolute;
+			next[numnext++] = i + 1;
+			break;
+		case OP_CALL0:
+		case OP_CALL1:
+		case OP_CALL2:
+		case OP_CALL3:
+		case OP_CALL4:
+		case OP_CALL5:
+		case OP_CALL6:
+		case OP_CALL7:
+		case OP_CALL8:
+			if ((unsigned int)st->operand[0] < (unsigned int)prog->numglobals && check->functionglobals[st->operand[0]])
+				check->stack[numcallees++] = prog->globals.ip[st->operand[0]];
+			else if (ok)
+			{
+				Con_DPrintf("%s: %s calls a function through a field or variable, which can not be used by independentthinks\n", prog->name, PRVM_GetString(prog, f->s_name));
+				ok = false;
+			}
+			// fall through
+		default:
+			next[numnext++] = i + 1;
+			break;
+		}
+		for (k = 0;k < numnext;k++)
+		{
+			if (next[k] >= 0 && next[k] < prog->numstatements && check->reached[next[k]] != fnum + 1)
+			{
+				check->reached[next[k]] = fnum + 1;
+				check->stack[prog->numstatements - ++numstack] = next[k];
+			}
+		}
+	}
+
+	// the walks of the callees reuse the scratch space
+	callees = (int *)Mem_Alloc(tempmempool, max(numcallees, 1) * sizeof(int));
+	memcpy(callees, check->stack, numcallees * sizeof(int));
+	for (k = 0;k < numcallees && ok;k++)
+	{
+		if (callees[k] <= 0 || callees[k] >= prog->numfunctions)
+			continue;
+		if (!SV_ParallelThinks_CheckFunction(prog, callees[k], check))
+		{
+			if (prog->functions[callees[k]].first_statement < 0)
+				Con_Printf("%s: %s calls %s, which can not be used by independentthinks\n", prog->name, PRVM_GetString(prog, f->s_name), PRVM_GetString(prog, prog->functions[callees[k]].s_name));
+			ok = false;
+		}
+	}
+	Mem_Free(callees);
+	state->functions[fnum] = ok ? 4 : 2;
+	return ok;
+}
+
+// parses the independentthinks global when it has changed, returns false if
+// no function is listed
+static qboolean SV_ParallelThinks_ParseList(prvm_prog_t *prog)
+{
+	sv_parallelthinks_t *state = &sv_parallelthinks_state;
+	const char *list = PRVM_GetString(prog, PRVM_serverglobalstring(independentthinks));
+	const char *data;
+	sv_thinkcheck_t check;
+	mstatement_t *st;
+	ddef_t *d;
+	int i, j, fnum, numlisted;
+
+	if (!list)
+		list = "";
+	if (state->functions && state->progid == prog->id && !strcmp(state->list, list))
+		return state->list[0] != 0;
+
+	state->progid = prog->id;
+	strlcpy(state->list, list, sizeof(state->list));
+	if (state->functions)
+		Mem_Free(state->functions);
+	state->numfunctions = prog->numfunctions;
+	state->functions = (unsigned char *)Mem_Alloc(sv_mempool, state->numfunctions);
+	if (!list[0])
+		return false;
+
+	// only calls through function constants can be followed, those are the
+	// globals named after the function they hold
+	check.functionglobals = (unsigned char *)Mem_Alloc(tempmempool, prog->numglobals);
+	check.reached = (int *)Mem_Alloc(tempmempool, prog->numstatements * sizeof(int));
+	check.stack = (int *)Mem_Alloc(tempmempool, prog->numstatements * sizeof(int));
+	for (i = 0, d = prog->globaldefs;i < prog->numglobaldefs;i++, d++)
+	{
+		if ((d->type & ~DEF_SAVEGLOBAL) != ev_function || d->ofs >= prog->numglobals)
+			continue;
+		fnum = prog->globals.ip[d->ofs];
+		if (fnum > 0 && fnum < prog->numfunctions && !strcmp(PRVM_GetString(prog, d->s_name), PRVM_GetString(prog, prog->functions[fnum].s_name)))
+			check.functionglobals[d->ofs] = true;
+	}
+	// and that no statement writes to
+	for (i = 0, st = prog->statements;i < prog->numstatements;i++, st++)
+	{
+		j = (st->op >= OP_STORE_F && st->op <= OP_STORE_FNC) ? st->operand[1] : st->operand[2];
+		if (j < 0 || j >= prog->numglobals)
+			continue;
+		switch (st->op)
+		{
+		case OP_MUL_FV:
+		case OP_MUL_VF:
+		case OP_ADD_V:
+		case OP_SUB_V:
+		case OP_LOAD_V:
+		case OP_STORE_V:
+			memset(check.functionglobals + j, 0, min(prog->numglobals - j, 3));
+			break;
+		default:
+			check.functionglobals[j] = 0;
+			break;
+		}
+	}
+
+	numlisted = 0;
+	data = list;
+	while (COM_ParseToken_Simple(&data, false, false, true))
+	{
+		fnum = PRVM_ED_FindFunctionOffset(prog, com_token);
+		if (fnum <= 0 || prog->functions[fnum].first_statement < 0)
+		{
+			Con_Printf("%s: independentthinks lists %s which is not a QuakeC function\n", prog->name, com_token);
+			continue;
+		}
+		if (SV_ParallelThinks_CheckFunction(prog, fnum, &check))
+		{
+			state->functions[fnum] = 1;
+			numlisted++;
+		}
+		else
+			Con_Printf("%s: %s from independentthinks will run on the server thread\n", prog->name, com_token);
+	}
+	Mem_Free(check.stack);
+	Mem_Free(check.reached);
+	Mem_Free(check.functionglobals);
+	Con_DPrintf("%s: %i functions in independentthinks can run in parallel\n", prog->name, numlisted);
+	return numlisted > 0;
+}
+
+static qboolean SV_ParallelThinks_Independent(prvm_prog_t *prog, func_t think)
+{
+	sv_parallelthinks_t *state = &sv_parallelthinks_state;
+	return think > 0 && think < (func_t)state->numfunctions && state->functions[think] == 1;
+}
+
+// true if SV_Physics_Entity runs the think of this entity before it does
+// anything else to it
+static qboolean SV_ParallelThinks_ThinksFirst(prvm_prog_t *prog, prvm_edict_t *ent)
+{
+	int flags;
+
+	if (ent->priv.server->free || !ent->priv.server->move)
+		return false;
+	if (PRVM_serveredictfloat(ent, nextthink) <= 0 || PRVM_serveredictfloat(ent, nextthink) > sv.time + sv.frametime)
+		return false;
+	switch ((int) PRVM_serveredictfloat(ent, movetype))
+	{
+	case MOVETYPE_NONE:
+	case MOVETYPE_NOCLIP:
+	case MOVETYPE_WALK:
+	case MOVETYPE_TOSS:
+	case MOVETYPE_BOUNCE:
+	case MOVETYPE_BOUNCEMISSILE:
+	case MOVETYPE_FLYMISSILE:
+	case MOVETYPE_FLY:
+	case MOVETYPE_FLY_WORLDONLY:
+	case MOVETYPE_PHYSICS:
+		return true;
+	case MOVETYPE_STEP:
+		// SV_Physics_Step only moves falling monsters before their think
+		flags = (int)PRVM_serveredictfloat(ent, flags);
+		if (flags & (FL_FLY | FL_SWIM))
+			return true;
+		return (flags & FL_ONGROUND) && !(PRVM_serveredictvector(ent, velocity)[2] >= (1.0 / 32.0) && sv_gameplayfix_upwardvelocityclearsongroundflag.integer);
+	default:
+		return false;
+	}
+}
+
+// thinks for a slice of sv.parallelthinks_edicts, i[0] is the first entry,
+// i[1] is one past the last, p[0] is the sv_thinktask_t
+static void SV_ParallelThinks_Task(taskqueue_task_t *t)
+{
+	sv_thinktask_t *task = (sv_thinktask_t *)t->p[0];
+	prvm_prog_t *prog = &task->prog;
+	prvm_edict_t *ent;
+	size_t i;
+	int iterations;
+
+	sv_thinktask_current = task;
+	if (setjmp(task->abort))
+	{
+		sv_thinktask_current = NULL;
+		return;
+	}
+	for (i = t->i[0];i < t->i[1];i++)
+	{
+		ent = PRVM_EDICT_NUM(sv.parallelthinks_edicts[i]);
+		ent->priv.server->thinkdone = true;
+		// the same as SV_RunThink, except that a think that is not
+		// independent is left to it
+		for (iterations = 0;iterations < 128;iterations++)
+		{
+			if (!SV_ParallelThinks_Independent(prog, PRVM_serveredictfunction(ent, think)))
+			{
+				ent->priv.server->thinkdone = false;
+				break;
+			}
+			PRVM_serverglobalfloat(time) = max(sv.time, PRVM_serveredictfloat(ent, nextthink));
+			PRVM_serveredictfloat(ent, nextthink) = 0;
+			PRVM_serverglobaledict(self) = PRVM_EDICT_TO_PROG(ent);
+			PRVM_serverglobaledict(other) = PRVM_EDICT_TO_PROG(prog->edicts);
+			prog->ExecuteProgram(prog, PRVM_serveredictfunction(ent, think), "QC function self.think is missing");
+			if (PRVM_serveredictfloat(ent, nextthink) <= PRVM_serverglobalfloat(time) || PRVM_serveredictfloat(ent, nextthink) > sv.time + sv.frametime || !sv_gameplayfix_multiplethinksperframe.integer)
+				break;
+		}
+	}
+	sv_thinktask_current = NULL;
+}
+
+// gets the task ready to run QC for this frame
+static sv_thinktask_t *SV_ParallelThinks_SetupTask(prvm_prog_t *prog, int tasknum)
+{
+	sv_thinktask_t *task = sv_parallelthinks_state.tasks[tasknum];
+
+	if (!task)
+		task = sv_parallelthinks_state.tasks[tasknum] = (sv_thinktask_t *)Mem_Alloc(sv_mempool, sizeof(*task));
+	if (!task->globals || task->progid != prog->id)
+	{
+		// the old globals and tempstrings went away with the old progs
+		task->progid = prog->id;
+		task->globals = (prvm_vec_t *)Mem_Alloc(prog->progs_mempool, prog->numglobals * sizeof(prvm_vec_t));
+		memset(&task->tempstringsbuf, 0, sizeof(task->tempstringsbuf));
+	}
+	memcpy(task->globals, prog->globals.fp, prog->numglobals * sizeof(prvm_vec_t));
+
+	task->prog = *prog;
+	task->prog.globals.fp = task->globals;
+	task->prog.depth = 0;
+	task->prog.localstack_used = 0;
+	task->prog.tempstringsbuf = task->tempstringsbuf;
+	task->prog.tempstringsbuf.cursize = 0;
+	task->prog.builtins = vm_sv_parallelbuiltins;
+	task->prog.error_cmd = SV_ParallelThinks_Error;
+	task->prog.writenotify_edict = SV_ParallelThinks_WriteNotify;
+	task->prog.aot.prog = &task->prog;
+	// the debugger only follows the server thread
+	task->prog.break_statement = -1;
+	task->prog.watch_global_type = ev_void;
+	task->prog.watch_field_type = ev_void;
+
+	task->numrelinks = 0;
+	task->numwakes = 0;
+	task->numsetorigins = 0;
+	task->error = false;
+	task->locked = false;
+	return task;
+}
+
+/*
+=============
+SV_Physics_ParallelThinks
+
+Runs the independent thinks that are due before anything else is done to the
+non-client entities, SV_RunThink skips them afterwards
+=============
+*/
+static void SV_Physics_ParallelThinks(void)
+{
+	prvm_prog_t *prog = SVVM_prog;
+	int i, j, numtasks, numedicts;
+	sv_thinktask_t *thinktasks[SV_PARALLELTHINKS_MAXTASKS];
+	taskqueue_task_t tasks[SV_PARALLELTHINKS_MAXTASKS];
+	prvm_edict_t *ent;
+	void (*error_cmd)(const char *format, ...);
+
+	sv.parallelthinks_numedicts = 0;
+	if (sv_parallelthinks.integer < 1 || !SV_ParallelThinks_ParseList(prog))
+		return;
+
+	for (i = SV_Physics_NextAwakeEdict(svs.maxclients + 1, prog->num_edicts);i < prog->num_edicts;i = SV_Physics_NextAwakeEdict(i + 1, prog->num_edicts))
+	{
+		ent = PRVM_EDICT_NUM(i);
+		if (SV_ParallelThinks_ThinksFirst(prog, ent) && SV_ParallelThinks_Independent(prog, PRVM_serveredictfunction(ent, think)))
+			sv.parallelthinks_edicts[sv.parallelthinks_numedicts++] = i;
+	}
+	numedicts = sv.parallelthinks_numedicts;
+	if (!numedicts)
+		return;
+
+	// contiguous slices keep neighbouring entities on one thread
+	numtasks = bound(1, sv_parallelthinks.integer, min(numedicts, SV_PARALLELTHINKS_MAXTASKS));
+	for (i = 0;i < numtasks;i++)
+	{
+		thinktasks[i] = SV_ParallelThinks_SetupTask(prog, i);
+		TaskQueue_Setup(tasks + i, SV_ParallelThinks_Task, (size_t)numedicts * i / numtasks, (size_t)numedicts * (i + 1) / numtasks, thinktasks[i], NULL);
+	}
+	error_cmd = prog->error_cmd;
+	prog->error_cmd = SV_ParallelThinks_Error;
+	TaskQueue_Enqueue(numtasks, tasks);
+	TaskQueue_WaitForTaskDone(numtasks, tasks);
+	prog->error_cmd = error_cmd;
+
+	for (i = 0;i < numtasks;i++)
+	{
+		// keep a tempstrings buffer that had to grow
+		thinktasks[i]->tempstringsbuf = thinktasks[i]->prog.tempstringsbuf;
+		if (thinktasks[i]->error)
+		{
+			for (j = 0;j < numedicts;j++)
+				PRVM_EDICT_NUM(sv.parallelthinks_edicts[j])->priv.server->thinkdone = false;
+			sv.parallelthinks_numedicts = 0;
+			prog->error_cmd("SV_Physics: %s", thinktasks[i]->errormessage);
+		}
+	}
+	for (i = 0;i < numtasks;i++)
+	{
+		for (j = 0;j < thinktasks[i]->numsetorigins;j++)
+		{
+			ent = PRVM_EDICT_NUM(thinktasks[i]->setorigins[j]);
+			if (ent->priv.server->free)
+				continue;
+			VectorCopy(thinktasks[i]->setoriginvalues[j], PRVM_serveredictvector(ent, origin));
+			if (ent->priv.required->mark == PRVM_EDICT_MARK_WAIT_FOR_SETORIGIN)
+				ent->priv.required->mark = PRVM_EDICT_MARK_SETORIGIN_CAUGHT;
+			SV_LinkEdict(ent);
+		}
+		for (j = 0;j < thinktasks[i]->numrelinks;j++)
+		{
+			ent = PRVM_EDICT_NUM(thinktasks[i]->relinks[j]);
+			if (!ent->priv.server->free)
+				SV_LinkEdict(ent);
+		}
+		for (j = 0;j < thinktasks[i]->numwakes;j++)
+			SV_WakeEdict(thinktasks[i]->wakes[j]);
+	}
+}
+
 /*
 ================
 SV_Physics
@@ -3135,15 +3801,44 @@ void SV_Physics (void)
 	// run physics on all the non-client entities
 	if (!sv_freezenonclients.integer)
 	{
-		for (;i < prog->num_edicts;i++, ent = PRVM_NEXT_EDICT(ent))
+		// wake everything when sv_activeedicts gets turned on
+		if (sv_activeedicts.integer && !sv.physics_sleeping)
+			memset(sv.physics_asleep, 0, sizeof(sv.physics_asleep));
+		sv.physics_sleeping = sv_activeedicts.integer != 0;
+		if (sv.physics_sleeping)
+			SV_Physics_RunTimers(sv.time + sv.frametime);
+
+		SV_Physics_ParallelThinks();
+
+		// (the edict number is looked up again each time because physics can
+		//  spawn or wake entities further on, which still run this frame)
+		for (i = SV_Physics_NextAwakeEdict(svs.maxclients + 1, prog->num_edicts);i < prog->num_edicts;i = SV_Physics_NextAwakeEdict(i + 1, prog->num_edicts))
+		{
+			ent = PRVM_EDICT_NUM(i);
 			if (!ent->priv.server->free)
 				SV_Physics_Entity(ent);
+			if (sv.physics_sleeping)
+				SV_Physics_SleepEdict(ent, i);
+		}
 		// make a second pass to see if any ents spawned this frame and make
 		// sure they run their move/think
 		if (sv_gameplayfix_delayprojectiles.integer < 0)
-			for (i = svs.maxclients + 1, ent = PRVM_EDICT_NUM(i);i < prog->num_edicts;i++, ent = PRVM_NEXT_EDICT(ent))
+		{
+			for (i = SV_Physics_NextAwakeEdict(svs.maxclients + 1, prog->num_edicts);i < prog->num_edicts;i = SV_Physics_NextAwakeEdict(i + 1, prog->num_edicts))
+			{
+				ent = PRVM_EDICT_NUM(i);
 				if (!ent->priv.server->move && !ent->priv.server->free)
+				{
 					SV_Physics_Entity(ent);
+					if (sv.physics_sleeping)
+						SV_Physics_SleepEdict(ent, i);
+				}
+			}
+		}
+
+		for (i = 0;i < sv.parallelthinks_numedicts;i++)
+			PRVM_EDICT_NUM(sv.parallelthinks_edicts[i])->priv.server->thinkdone = false;
+		sv.parallelthinks_numedicts = 0;
 	}
 
 	if (PRVM_serverglobalfloat(force_retouch) > 0)
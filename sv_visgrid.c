@@ -0,0 +1,463 @@
+// sv_visgrid.c -- coarse cell to cell visibility of the world for
+// sv_cullentities_trace
+
+// the world bounds are split into at most SV_VISGRID_MAXCELLS cubic cells and
+// every pair of cells is classified by tracing lines between points in them:
+// visible if every line is clear, otherwise ambiguous.
+// a client eye whose cell sees one of the cells of an entity box only traces
+// one line to the box center, and sees the entity if that is clear (sample
+// points can't show a whole cell sees another, so the grid only picks the
+// trace, it never decides that something is visible or hidden by itself).
+// everything else still traces the usual samples.
+// pairs are classified when first needed (up to
+// sv_cullentities_trace_grid_budget traces per frame, on the task queue) or
+// all at once by sv_cullentities_trace_grid_build, and saved to
+// cache/<mapname>.visgrid in the game directory when the map ends.
+
+#include "quakedef.h"
+#include "thread.h"
+#include "taskqueue.h"
+
+cvar_t sv_cullentities_trace_grid = {0, "sv_cullentities_trace_grid", "1", "answers sv_cullentities_trace checks with a single trace to the entity center when a coarse cell to cell visibility grid of the world shows the entity is likely in view (not with sv_cullentities_trace_entityocclusion), the grid is filled in as needed and saved to cache/ in the game directory"};
+cvar_t sv_cullentities_trace_grid_cellsize = {0, "sv_cullentities_trace_grid_cellsize", "256", "size of the visibility grid cells, larger maps use larger cells (takes effect on the next map)"};
+cvar_t sv_cullentities_trace_grid_budget = {0, "sv_cullentities_trace_grid_budget", "648", "maximum number of traces per server frame spent classifying visibility grid cell pairs (a pair takes up to 81)"};
+
+// bump this whenever the file layout or the way pairs are classified changes
+#define SV_VISGRID_VERSION 2
+#define SV_VISGRID_MAXCELLS 4096
+// entity boxes spanning more cells than this are always traced
+#define SV_VISGRID_MAXBOXCELLS 8
+#define SV_VISGRID_MAXPENDING 4096
+// sample points per cell, and so the most traces classifying a pair takes
+#define SV_VISGRID_CELLPOINTS 9
+#define SV_VISGRID_PAIRTRACES (SV_VISGRID_CELLPOINTS * SV_VISGRID_CELLPOINTS)
+
+// pair states, 2 bits each
+#define VISGRID_UNKNOWN 0
+#define VISGRID_AMBIGUOUS 1
+#define VISGRID_VISIBLE 2
+
+typedef struct sv_visgrid_header_s
+{
+	char magic[8];
+	int version;
+	// identity of the world model
+	int crc;
+	int geometrychecksum;
+	// grid layout
+	float mins[3];
+	float cellsize;
+	int size[3];
+}
+sv_visgrid_header_t;
+
+typedef struct sv_visgrid_s
+{
+	dp_model_t *model;
+	sv_visgrid_header_t header;
+	int numcells;
+	int numpairs;
+	// 2 bits per unordered pair of cells, see SV_VisGrid_PairIndex
+	unsigned char *pairs;
+	// 1 bit per pair that is in the pending list
+	unsigned char *pendingbits;
+	int numpending;
+	int pending[SV_VISGRID_MAXPENDING][2];
+	// pairs were classified since the cache was loaded
+	qboolean dirty;
+}
+sv_visgrid_t;
+
+static sv_visgrid_t sv_visgrid;
+
+static int SV_VisGrid_PairIndex(int a, int b)
+{
+	if (a > b)
+	{
+		int t = a;a = b;b = t;
+	}
+	return b * (b + 1) / 2 + a;
+}
+
+static int SV_VisGrid_GetPair(int index)
+{
+	return (sv_visgrid.pairs[index >> 2] >> ((index & 3) * 2)) & 3;
+}
+
+static void SV_VisGrid_SetPair(int index, int state)
+{
+	sv_visgrid.pairs[index >> 2] = (sv_visgrid.pairs[index >> 2] & ~(3 << ((index & 3) * 2))) | (state << ((index & 3) * 2));
+}
+
+static void SV_VisGrid_Path(dp_model_t *model, char *path, size_t pathsize)
+{
+	dpsnprintf(path, pathsize, "cache/%s.visgrid", model->name);
+}
+
+static int SV_VisGrid_CellForPoint(const vec3_t p)
+{
+	int i, c[3];
+	for (i = 0;i < 3;i++)
+	{
+		c[i] = (int)floor((p[i] - sv_visgrid.header.mins[i]) / sv_visgrid.header.cellsize);
+		if (c[i] < 0 || c[i] >= sv_visgrid.header.size[i])
+			return -1;
+	}
+	return (c[2] * sv_visgrid.header.size[1] + c[1]) * sv_visgrid.header.size[0] + c[0];
+}
+
+// sample points of a cell that are not in solid, the cell center and 8 points
+// halfway to the corners
+static int SV_VisGrid_CellPoints(int cell, vec3_t *points)
+{
+	dp_model_t *model = sv_visgrid.model;
+	int i, numpoints = 0;
+	float s = sv_visgrid.header.cellsize;
+	vec3_t center, p;
+	center[0] = sv_visgrid.header.mins[0] + (cell % sv_visgrid.header.size[0] + 0.5f) * s;
+	center[1] = sv_visgrid.header.mins[1] + ((cell / sv_visgrid.header.size[0]) % sv_visgrid.header.size[1] + 0.5f) * s;
+	center[2] = sv_visgrid.header.mins[2] + (cell / (sv_visgrid.header.size[0] * sv_visgrid.header.size[1]) + 0.5f) * s;
+	if (!(model->PointSuperContents(model, 0, center) & SUPERCONTENTS_SOLID))
+	{
+		VectorCopy(center, points[numpoints]);
+		numpoints++;
+	}
+	s *= 0.25f;
+	for (i = 0;i < 8;i++)
+	{
+		VectorSet(p, center[0] + (i & 1 ? s : -s), center[1] + (i & 2 ? s : -s), center[2] + (i & 4 ? s : -s));
+		if (!(model->PointSuperContents(model, 0, p) & SUPERCONTENTS_SOLID))
+		{
+			VectorCopy(p, points[numpoints]);
+			numpoints++;
+		}
+	}
+	return numpoints;
+}
+
+// traces lines from every point in a to every point in b, returns false as
+// soon as one of them is blocked
+static qboolean SV_VisGrid_TraceCells(const vec3_t *a, int na, const vec3_t *b, int nb)
+{
+	dp_model_t *model = sv_visgrid.model;
+	int i, j;
+	vec3_t starts[SV_VISGRID_CELLPOINTS];
+	qboolean visible[SV_VISGRID_CELLPOINTS];
+	for (i = 0;i < na;i++)
+	{
+		if (model->brush.TraceLinesOfSight)
+		{
+			for (j = 0;j < nb;j++)
+				VectorCopy(a[i], starts[j]);
+			model->brush.TraceLinesOfSight(model, nb, starts[0], b[0], visible);
+			for (j = 0;j < nb;j++)
+				if (!visible[j])
+					return false;
+		}
+		else
+			for (j = 0;j < nb;j++)
+				if (!model->brush.TraceLineOfSight(model, a[i], b[j]))
+					return false;
+	}
+	return true;
+}
+
+static int SV_VisGrid_Classify(int a, int b)
+{
+	vec3_t pointsa[SV_VISGRID_CELLPOINTS], pointsb[SV_VISGRID_CELLPOINTS];
+	int na, nb;
+	// a cell with all of its samples in solid can't be judged
+	na = SV_VisGrid_CellPoints(a, pointsa);
+	nb = SV_VisGrid_CellPoints(b, pointsb);
+	if (!na || !nb || !SV_VisGrid_TraceCells(pointsa, na, pointsb, nb))
+		return VISGRID_AMBIGUOUS;
+	return VISGRID_VISIBLE;
+}
+
+// classifies pairs [i[0], i[1]) of the list at p[0] into the states at p[1]
+static void SV_VisGrid_ClassifyTask(taskqueue_task_t *t)
+{
+	int (*pairs)[2] = (int (*)[2])t->p[0];
+	unsigned char *states = (unsigned char *)t->p[1];
+	size_t i;
+	for (i = t->i[0];i < t->i[1];i++)
+		states[i] = SV_VisGrid_Classify(pairs[i][0], pairs[i][1]);
+}
+
+static void SV_VisGrid_ClassifyPairs(int numpairs, int (*pairs)[2])
+{
+	int i, numtasks;
+	taskqueue_task_t tasks[64];
+	unsigned char *states;
+	if (!numpairs)
+		return;
+	states = (unsigned char *)Mem_Alloc(tempmempool, numpairs);
+	numtasks = bound(1, max(sv_threads.integer, TaskQueue_NumThreads()), min(numpairs, (int)(sizeof(tasks) / sizeof(tasks[0]))));
+	for (i = 0;i < numtasks;i++)
+		TaskQueue_Setup(tasks + i, SV_VisGrid_ClassifyTask, (size_t)numpairs * i / numtasks, (size_t)numpairs * (i + 1) / numtasks, pairs, states);
+	TaskQueue_Enqueue(numtasks, tasks);
+	TaskQueue_WaitForTaskDone(numtasks, tasks);
+	// the states share bytes, so they are stored here rather than in the tasks
+	for (i = 0;i < numpairs;i++)
+		SV_VisGrid_SetPair(SV_VisGrid_PairIndex(pairs[i][0], pairs[i][1]), states[i]);
+	Mem_Free(states);
+	sv_visgrid.dirty = true;
+}
+
+static void SV_VisGrid_MakeHeader(dp_model_t *model, sv_visgrid_header_t *header)
+{
+	int i;
+	vec3_t extent;
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, "DPVISGRD", 8);
+	header->version = SV_VISGRID_VERSION;
+	header->crc = model->crc;
+	// the file crc is only 16 bits, so also check the geometry
+	header->geometrychecksum = (int)(Com_BlockChecksum(model->surfmesh.data_vertex3f, model->surfmesh.num_vertices * sizeof(float[3])) ^ Com_BlockChecksum(model->surfmesh.data_element3i, model->surfmesh.num_triangles * sizeof(int[3])));
+	VectorCopy(model->normalmins, header->mins);
+	VectorSubtract(model->normalmaxs, model->normalmins, extent);
+	// larger maps use larger cells so the pair array stays small
+	header->cellsize = max(sv_cullentities_trace_grid_cellsize.value, 16);
+	for (;;)
+	{
+		for (i = 0;i < 3;i++)
+			header->size[i] = max(1, (int)ceil(extent[i] / header->cellsize));
+		if (header->size[0] * header->size[1] * header->size[2] <= SV_VISGRID_MAXCELLS)
+			break;
+		header->cellsize *= 2;
+	}
+}
+
+/*
+===============
+SV_VisGrid_Start
+
+sets up the grid for the world model of a new map, loading the pairs
+classified on earlier runs if there is a matching cache file
+===============
+*/
+void SV_VisGrid_Start(void)
+{
+	dp_model_t *model = sv.worldmodel;
+	char path[MAX_QPATH + 16];
+	unsigned char *filedata;
+	fs_offset_t filesize;
+	size_t pairbytes;
+
+	memset(&sv_visgrid, 0, sizeof(sv_visgrid));
+	if (!sv_cullentities_trace_grid.integer || !model || !model->brush.TraceLineOfSight || !model->PointSuperContents || !model->surfmesh.num_vertices)
+		return;
+
+	sv_visgrid.model = model;
+	SV_VisGrid_MakeHeader(model, &sv_visgrid.header);
+	sv_visgrid.numcells = sv_visgrid.header.size[0] * sv_visgrid.header.size[1] * sv_visgrid.header.size[2];
+	sv_visgrid.numpairs = sv_visgrid.numcells * (sv_visgrid.numcells + 1) / 2;
+	pairbytes = (sv_visgrid.numpairs + 3) / 4;
+	sv_visgrid.pairs = (unsigned char *)Mem_Alloc(sv_mempool, pairbytes);
+	sv_visgrid.pendingbits = (unsigned char *)Mem_Alloc(sv_mempool, (sv_visgrid.numpairs + 7) / 8);
+
+	SV_VisGrid_Path(model, path, sizeof(path));
+	filedata = FS_LoadFile(path, tempmempool, true, &filesize);
+	if (filedata)
+	{
+		if (filesize == (fs_offset_t)(sizeof(sv_visgrid_header_t) + pairbytes) && !memcmp(filedata, &sv_visgrid.header, sizeof(sv_visgrid_header_t)))
+		{
+			memcpy(sv_visgrid.pairs, filedata + sizeof(sv_visgrid_header_t), pairbytes);
+			Con_DPrintf("Loaded visibility grid %s\n", path);
+		}
+		Mem_Free(filedata);
+	}
+}
+
+/*
+===============
+SV_VisGrid_End
+
+saves the grid if anything was classified and frees it
+===============
+*/
+void SV_VisGrid_End(void)
+{
+	char path[MAX_QPATH + 16];
+	qfile_t *file;
+	if (!sv_visgrid.model)
+		return;
+	if (sv_visgrid.dirty)
+	{
+		SV_VisGrid_Path(sv_visgrid.model, path, sizeof(path));
+		file = FS_OpenRealFile(path, "wb", false);
+		if (file)
+		{
+			FS_Write(file, &sv_visgrid.header, sizeof(sv_visgrid.header));
+			FS_Write(file, sv_visgrid.pairs, (sv_visgrid.numpairs + 3) / 4);
+			FS_Close(file);
+		}
+	}
+	Mem_Free(sv_visgrid.pairs);
+	Mem_Free(sv_visgrid.pendingbits);
+	memset(&sv_visgrid, 0, sizeof(sv_visgrid));
+}
+
+/*
+===============
+SV_VisGrid_Update
+
+classifies some of the pairs that visibility checks asked about, as many as
+the trace budget allows even if every line has to be traced, must not run
+while culling tasks do
+===============
+*/
+void SV_VisGrid_Update(void)
+{
+	int i, n;
+	if (!sv_visgrid.numpending)
+		return;
+	n = min(sv_visgrid.numpending, max(sv_cullentities_trace_grid_budget.integer, 0) / SV_VISGRID_PAIRTRACES);
+	if (!n)
+		return;
+	SV_VisGrid_ClassifyPairs(n, sv_visgrid.pending);
+	for (i = 0;i < n;i++)
+	{
+		int index = SV_VisGrid_PairIndex(sv_visgrid.pending[i][0], sv_visgrid.pending[i][1]);
+		sv_visgrid.pendingbits[index >> 3] &= ~(1 << (index & 7));
+	}
+	sv_visgrid.numpending -= n;
+	memmove(sv_visgrid.pending, sv_visgrid.pending + n, sv_visgrid.numpending * sizeof(sv_visgrid.pending[0]));
+}
+
+static void SV_VisGrid_Queue(int a, int b, int index)
+{
+	// culling tasks may call this at the same time
+	if (svs.cullmutex)
+		Thread_LockMutex(svs.cullmutex);
+	if (!(sv_visgrid.pendingbits[index >> 3] & (1 << (index & 7))) && sv_visgrid.numpending < SV_VISGRID_MAXPENDING)
+	{
+		sv_visgrid.pendingbits[index >> 3] |= 1 << (index & 7);
+		sv_visgrid.pending[sv_visgrid.numpending][0] = a;
+		sv_visgrid.pending[sv_visgrid.numpending][1] = b;
+		sv_visgrid.numpending++;
+	}
+	if (svs.cullmutex)
+		Thread_UnlockMutex(svs.cullmutex);
+}
+
+/*
+===============
+SV_VisGrid_CanSeeBox
+
+returns 1 if the box is visible from one of the eyes, and -1 if that has to
+be found out by tracing (the world is all the grid knows about, so that is
+always the case with sv_cullentities_trace_entityocclusion)
+===============
+*/
+int SV_VisGrid_CanSeeBox(int numeyes, const vec3_t *eyes, const vec3_t mins, const vec3_t maxs)
+{
+	int i, x, y, z, eyecell, index, state, boxmin[3], boxmax[3];
+	qboolean traced;
+	vec3_t center;
+	if (!sv_visgrid.model || !sv_cullentities_trace_grid.integer || sv_visgrid.model != sv.worldmodel || sv_cullentities_trace_entityocclusion.integer)
+		return -1;
+	// the parts of the box outside the world can't be seen
+	for (i = 0;i < 3;i++)
+	{
+		boxmin[i] = max((int)floor((mins[i] - sv_visgrid.header.mins[i]) / sv_visgrid.header.cellsize), 0);
+		boxmax[i] = min((int)floor((maxs[i] - sv_visgrid.header.mins[i]) / sv_visgrid.header.cellsize), sv_visgrid.header.size[i] - 1);
+		if (boxmin[i] > boxmax[i])
+			return -1;
+	}
+	if ((boxmax[0] - boxmin[0] + 1) * (boxmax[1] - boxmin[1] + 1) * (boxmax[2] - boxmin[2] + 1) > SV_VISGRID_MAXBOXCELLS)
+		return -1;
+	VectorMAM(0.5f, mins, 0.5f, maxs, center);
+	for (i = 0;i < numeyes;i++)
+	{
+		eyecell = SV_VisGrid_CellForPoint(eyes[i]);
+		if (eyecell < 0)
+			return -1;
+		traced = false;
+		for (z = boxmin[2];z <= boxmax[2];z++)
+		{
+			for (y = boxmin[1];y <= boxmax[1];y++)
+			{
+				for (x = boxmin[0];x <= boxmax[0];x++)
+				{
+					int cell = (z * sv_visgrid.header.size[1] + y) * sv_visgrid.header.size[0] + x;
+					index = SV_VisGrid_PairIndex(eyecell, cell);
+					state = SV_VisGrid_GetPair(index);
+					// the cells are likely in view of each other, but this eye
+					// or this box may still be behind a wall, so make sure
+					if (state == VISGRID_VISIBLE && !traced)
+					{
+						if (sv.worldmodel->brush.TraceLineOfSight(sv.worldmodel, eyes[i], center))
+							return 1;
+						traced = true;
+					}
+					if (state == VISGRID_UNKNOWN)
+						SV_VisGrid_Queue(eyecell, cell, index);
+				}
+			}
+		}
+	}
+	return -1;
+}
+
+static void SV_VisGrid_Build_f(void)
+{
+	int a, b, i, n, numpairs, counts[4];
+	int (*pairs)[2];
+	unsigned char *open;
+	vec3_t points[SV_VISGRID_CELLPOINTS];
+	double starttime;
+
+	if (!sv.active || !sv_visgrid.model)
+	{
+		Con_Print("sv_cullentities_trace_grid_build: no visibility grid (is sv_cullentities_trace_grid on and a map running?)\n");
+		return;
+	}
+	starttime = Sys_DirtyTime();
+	// cells with all samples in solid are always ambiguous
+	open = (unsigned char *)Mem_Alloc(tempmempool, sv_visgrid.numcells);
+	for (a = 0;a < sv_visgrid.numcells;a++)
+		open[a] = SV_VisGrid_CellPoints(a, points) > 0;
+	pairs = (int (*)[2])Mem_Alloc(tempmempool, SV_VISGRID_MAXPENDING * sizeof(pairs[0]));
+	n = 0;
+	numpairs = 0;
+	for (b = 0;b < sv_visgrid.numcells;b++)
+	{
+		for (a = 0;a <= b;a++)
+		{
+			i = SV_VisGrid_PairIndex(a, b);
+			if (SV_VisGrid_GetPair(i) != VISGRID_UNKNOWN)
+				continue;
+			if (!open[a] || !open[b])
+			{
+				SV_VisGrid_SetPair(i, VISGRID_AMBIGUOUS);
+				continue;
+			}
+			pairs[n][0] = a;
+			pairs[n][1] = b;
+			if (++n == SV_VISGRID_MAXPENDING)
+			{
+				SV_VisGrid_ClassifyPairs(n, pairs);
+				numpairs += n;
+				n = 0;
+			}
+		}
+	}
+	SV_VisGrid_ClassifyPairs(n, pairs);
+	numpairs += n;
+	sv_visgrid.dirty = true;
+	Mem_Free(pairs);
+	Mem_Free(open);
+	memset(counts, 0, sizeof(counts));
+	for (i = 0;i < sv_visgrid.numpairs;i++)
+		counts[SV_VisGrid_GetPair(i)]++;
+	Con_Printf("visibility grid: %ix%ix%i cells of %g units, classified %i pairs in %.1f seconds, %i visible, %i ambiguous\n", sv_visgrid.header.size[0], sv_visgrid.header.size[1], sv_visgrid.header.size[2], sv_visgrid.header.cellsize, numpairs, Sys_DirtyTime() - starttime, counts[VISGRID_VISIBLE], counts[VISGRID_AMBIGUOUS]);
+}
+
+void SV_VisGrid_Init(void)
+{
+	Cvar_RegisterVariable(&sv_cullentities_trace_grid);
+	Cvar_RegisterVariable(&sv_cullentities_trace_grid_cellsize);
+	Cvar_RegisterVariable(&sv_cullentities_trace_grid_budget);
+	Cmd_AddCommand("sv_cullentities_trace_grid_build", SV_VisGrid_Build_f, "classifies every pair of cells of the visibility grid now (instead of as needed) and saves it when the map ends");
+}
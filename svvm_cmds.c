@@ -173,6 +173,7 @@ const char *vm_sv_extensions =
 "DP_SV_DROPCLIENT "
 "DP_SV_EFFECT "
 "DP_SV_ENTITYCONTENTSTRANSITION "
+"DP_SV_INDEPENDENTTHINKS "
 "DP_SV_MODELFLAGS_AS_EFFECTS "
 "DP_SV_MOVETYPESTEP_LANDEVENT "
 "DP_SV_NETADDRESS "
@@ -1764,6 +1765,7 @@ static void VM_SV_copyentity(prvm_prog_t *prog)
 		return;
 	}
 	memcpy(out->fields.fp, in->fields.fp, prog->entityfields * sizeof(prvm_vec_t));
+	SV_WakeEdict(PRVM_NUM_FOR_EDICT(out));
 	SV_LinkEdict(out);
 }
 
@@ -3178,6 +3180,68 @@ static void VM_SV_frameduration(prvm_prog_t *prog)
 }
 
 
+//============================================================================
+// sv_parallelthinks
+
+// the area grid and the trace cache are not thread safe, so only one think
+// task traces at a time
+static void VM_SV_traceline_parallel(prvm_prog_t *prog)
+{
+	SV_ParallelThinks_Lock();
+	VM_SV_traceline(prog);
+	SV_ParallelThinks_Unlock();
+}
+
+static void VM_SV_tracebox_parallel(prvm_prog_t *prog)
+{
+	SV_ParallelThinks_Lock();
+	VM_SV_tracebox(prog);
+	SV_ParallelThinks_Unlock();
+}
+
+static void VM_SV_pointcontents_parallel(prvm_prog_t *prog)
+{
+	SV_ParallelThinks_Lock();
+	VM_SV_pointcontents(prog);
+	SV_ParallelThinks_Unlock();
+}
+
+// setorigin that leaves linking the entity to the server thread, and the
+// whole thing for any entity but self, which another task may be thinking for
+static void VM_SV_setorigin_parallel(prvm_prog_t *prog)
+{
+	prvm_edict_t	*e;
+
+	VM_SAFEPARMCOUNT(2, VM_setorigin);
+
+	e = PRVM_G_EDICT(OFS_PARM0);
+	if (e == prog->edicts)
+	{
+		VM_Warning(prog, "setorigin: can not modify world entity\n");
+		return;
+	}
+	if (e->priv.server->free)
+	{
+		VM_Warning(prog, "setorigin: can not modify free entity\n");
+		return;
+	}
+	if (e != PRVM_PROG_TO_EDICT(PRVM_serverglobaledict(self)))
+	{
+		SV_ParallelThinks_SetOrigin(e, PRVM_G_VECTOR(OFS_PARM1));
+		return;
+	}
+	VectorCopy(PRVM_G_VECTOR(OFS_PARM1), PRVM_serveredictvector(e, origin));
+	if(e->priv.required->mark == PRVM_EDICT_MARK_WAIT_FOR_SETORIGIN)
+		e->priv.required->mark = PRVM_EDICT_MARK_SETORIGIN_CAUGHT;
+	SV_ParallelThinks_LinkEdict(e);
+}
+
+// SV_ParallelThinks_CheckFunction keeps the thinks from getting here
+static void VM_SV_parallel_forbidden(prvm_prog_t *prog)
+{
+	prog->error_cmd("%s: %s called a builtin that can not be used by the functions in independentthinks", prog->name, PRVM_GetString(prog, prog->xfunction->s_name));
+}
+
 prvm_builtin_t vm_sv_builtins[] = {
 NULL,							// #0 NULL function (not callable) (QUAKE)
 VM_makevectors,					// #1 void(vector ang) makevectors (QUAKE)
@@ -3831,9 +3895,81 @@ NULL,							// #643
 
 const int vm_sv_numbuiltins = sizeof(vm_sv_builtins) / sizeof(prvm_builtin_t);
 
+// the builtins a think running on a worker thread may call, and what it calls
+// instead, these only touch the VM they are called from and the calling
+// entity (any other builtin is an error)
+static const struct {prvm_builtin_t builtin, parallel;} vm_sv_parallelsafebuiltins[] =
+{
+	{VM_SV_setorigin, VM_SV_setorigin_parallel},
+	{VM_SV_traceline, VM_SV_traceline_parallel},
+	{VM_SV_tracebox, VM_SV_tracebox_parallel},
+	{VM_SV_pointcontents, VM_SV_pointcontents_parallel},
+	{VM_makevectors, VM_makevectors},
+	{VM_random, VM_random},
+	{VM_randomvec, VM_randomvec},
+	{VM_normalize, VM_normalize},
+	{VM_vlen, VM_vlen},
+	{VM_vectoyaw, VM_vectoyaw},
+	{VM_vectoangles, VM_vectoangles},
+	{VM_vectorvectors, VM_vectorvectors},
+	{VM_changeyaw, VM_changeyaw},
+	{VM_changepitch, VM_changepitch},
+	{VM_rint, VM_rint},
+	{VM_floor, VM_floor},
+	{VM_ceil, VM_ceil},
+	{VM_fabs, VM_fabs},
+	{VM_sin, VM_sin},
+	{VM_cos, VM_cos},
+	{VM_tan, VM_tan},
+	{VM_asin, VM_asin},
+	{VM_acos, VM_acos},
+	{VM_atan2, VM_atan2},
+	{VM_sqrt, VM_sqrt},
+	{VM_pow, VM_pow},
+	{VM_log, VM_log},
+	{VM_min, VM_min},
+	{VM_max, VM_max},
+	{VM_bound, VM_bound},
+	{VM_bitshift, VM_bitshift},
+	{VM_ftos, VM_ftos},
+	{VM_vtos, VM_vtos},
+	{VM_etos, VM_etos},
+	{VM_stof, VM_stof},
+	{VM_stov, VM_stov},
+	{VM_ftoe, VM_ftoe},
+	{VM_etof, VM_etof},
+	{VM_strlen, VM_strlen},
+	{VM_strcat, VM_strcat},
+	{VM_substring, VM_substring},
+	{VM_nextent, VM_nextent},
+	{VM_find, VM_find},
+	{VM_findfloat, VM_findfloat},
+	{VM_dprint, VM_dprint},
+};
+
+prvm_builtin_t vm_sv_parallelbuiltins[sizeof(vm_sv_builtins) / sizeof(prvm_builtin_t)];
+
+static void SVVM_init_parallelbuiltins(void)
+{
+	int i, j;
+	for (i = 0;i < vm_sv_numbuiltins;i++)
+	{
+		vm_sv_parallelbuiltins[i] = vm_sv_builtins[i] ? VM_SV_parallel_forbidden : NULL;
+		for (j = 0;j < (int)(sizeof(vm_sv_parallelsafebuiltins) / sizeof(vm_sv_parallelsafebuiltins[0]));j++)
+			if (vm_sv_builtins[i] == vm_sv_parallelsafebuiltins[j].builtin)
+				vm_sv_parallelbuiltins[i] = vm_sv_parallelsafebuiltins[j].parallel;
+	}
+}
+
+qboolean SVVM_parallelsafe_builtin(int builtinnumber)
+{
+	return builtinnumber > 0 && builtinnumber < vm_sv_numbuiltins && vm_sv_parallelbuiltins[builtinnumber] && vm_sv_parallelbuiltins[builtinnumber] != VM_SV_parallel_forbidden;
+}
+
 void SVVM_init_cmd(prvm_prog_t *prog)
 {
 	VM_Cmd_Init(prog);
+	SVVM_init_parallelbuiltins();
 }
 
 void SVVM_reset_cmd(prvm_prog_t *prog)
@@ -584,6 +584,86 @@ qboolean Sys_HaveSSE2(void)
 }
 #endif
 
+#ifdef AVX2_POSSIBLE
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+// the same cpuid check but for the leaf 7 extensions, which also need the os
+// to save the wider registers (checked through xgetbv)
+// returns 1 for AVX2 with FMA, 2 when AVX-512F is also usable
+static int CPUID_AVXLevel(void)
+{
+	unsigned int regs[4], xcr0;
+#ifdef _MSC_VER
+	__cpuidex((int *)regs, 0, 0);
+	if (regs[0] < 7)
+		return 0;
+	__cpuidex((int *)regs, 1, 0);
+#else
+	if (__get_cpuid_max(0, NULL) < 7)
+		return 0;
+	__cpuid_count(1, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+	// OSXSAVE is 1<<27, AVX is 1<<28, FMA is 1<<12
+	if ((regs[2] & ((1 << 27) | (1 << 28) | (1 << 12))) != ((1 << 27) | (1 << 28) | (1 << 12)))
+		return 0;
+#ifdef _MSC_VER
+	xcr0 = (unsigned int)_xgetbv(0);
+	__cpuidex((int *)regs, 7, 0);
+#else
+	__asm__ __volatile__ ("xgetbv" : "=a" (xcr0), "=d" (regs[3]) : "c" (0));
+	__cpuid_count(7, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+	// xmm and ymm state, then AVX2 is 1<<5
+	if ((xcr0 & 0x06) != 0x06 || !(regs[1] & (1 << 5)))
+		return 0;
+	// opmask and zmm state, then AVX-512F is 1<<16
+	if ((xcr0 & 0xe6) != 0xe6 || !(regs[1] & (1 << 16)))
+		return 1;
+	return 2;
+}
+
+qboolean Sys_HaveAVX2(void)
+{
+	// COMMANDLINEOPTION: AVX2: -noavx2 disables AVX2 (and AVX-512) support and detection
+	if(COM_CheckParm("-nosse") || COM_CheckParm("-noavx2"))
+		return false;
+	return CPUID_AVXLevel() >= 1;
+}
+
+#ifdef AVX512_POSSIBLE
+qboolean Sys_HaveAVX512(void)
+{
+	// COMMANDLINEOPTION: AVX512: -noavx512 disables AVX-512 support and detection
+	if(COM_CheckParm("-nosse") || COM_CheckParm("-noavx2") || COM_CheckParm("-noavx512"))
+		return false;
+	return CPUID_AVXLevel() >= 2;
+}
+#endif
+
+#ifdef AESNI_POSSIBLE
+qboolean Sys_HaveAESNI(void)
+{
+	unsigned int regs[4];
+	// COMMANDLINEOPTION: AESNI: -noaesni disables the AES instructions for packet encryption
+	if(COM_CheckParm("-nosse") || COM_CheckParm("-nosse2") || COM_CheckParm("-noaesni"))
+		return false;
+#ifdef _MSC_VER
+	__cpuidex((int *)regs, 1, 0);
+#else
+	if (__get_cpuid_max(0, NULL) < 1)
+		return false;
+	__cpuid_count(1, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+	// AES is 1<<25 in ecx, SSE2 is 1<<26 in edx
+	return (regs[2] & (1 << 25)) && (regs[3] & (1 << 26));
+}
+#endif
+#endif
+
 /// called to set process priority for dedicated servers
 #if defined(__linux__)
 #include <sys/resource.h>
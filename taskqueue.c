@@ -0,0 +1,226 @@
+#include "quakedef.h"
+#include "thread.h"
+#include "taskqueue.h"
+
+cvar_t taskqueue_maxthreads = {CVAR_SAVE, "taskqueue_maxthreads", "4", "how many worker threads to start for parallel jobs (such as sv_threads), 0 runs all jobs on the thread waiting for them"};
+
+typedef struct taskqueue_state_thread_s
+{
+	void *handle;
+	int index;
+}
+taskqueue_state_thread_t;
+
+typedef struct taskqueue_state_s
+{
+	// protects everything below, NULL if the platform has no threads
+	void *mutex;
+	// signaled when tasks are queued or threads need to exit
+	void *workcond;
+	// broadcast whenever a task is done
+	void *donecond;
+
+	taskqueue_task_t *first;
+	taskqueue_task_t *last;
+
+	// threads with an index >= threadlimit exit when they see it
+	int threadlimit;
+	int numthreads;
+	taskqueue_state_thread_t threads[TASKQUEUE_MAXTHREADS];
+}
+taskqueue_state_t;
+
+static taskqueue_state_t taskqueue_state;
+
+// index + 1 on the worker threads, 0 on any other thread
+static THREAD_LOCAL int taskqueue_isworkerthread;
+
+// caller must hold the mutex
+static taskqueue_task_t *TaskQueue_Dequeue(void)
+{
+	taskqueue_task_t *t = taskqueue_state.first;
+	if (t)
+	{
+		taskqueue_state.first = t->next;
+		if (!taskqueue_state.first)
+			taskqueue_state.last = NULL;
+		t->next = NULL;
+	}
+	return t;
+}
+
+// caller must hold the mutex, it is released while the task runs
+static void TaskQueue_Run(taskqueue_task_t *t)
+{
+	if (taskqueue_state.mutex)
+		Thread_UnlockMutex(taskqueue_state.mutex);
+	t->func(t);
+	if (taskqueue_state.mutex)
+	{
+		Thread_LockMutex(taskqueue_state.mutex);
+		t->done = 1;
+		Thread_CondBroadcast(taskqueue_state.donecond);
+	}
+	else
+		t->done = 1;
+}
+
+static int TaskQueue_ThreadFunc(void *d)
+{
+	taskqueue_state_thread_t *s = (taskqueue_state_thread_t *)d;
+	taskqueue_task_t *t;
+	taskqueue_isworkerthread = s->index + 1;
+	Thread_LockMutex(taskqueue_state.mutex);
+	while (s->index < taskqueue_state.threadlimit)
+	{
+		t = TaskQueue_Dequeue();
+		if (t)
+			TaskQueue_Run(t);
+		else
+			Thread_CondWait(taskqueue_state.workcond, taskqueue_state.mutex);
+	}
+	Thread_UnlockMutex(taskqueue_state.mutex);
+	return 0;
+}
+
+void TaskQueue_Setup(taskqueue_task_t *t, void (*func)(taskqueue_task_t *), size_t i0, size_t i1, void *p0, void *p1)
+{
+	memset(t, 0, sizeof(*t));
+	t->func = func;
+	t->i[0] = i0;
+	t->i[1] = i1;
+	t->p[0] = p0;
+	t->p[1] = p1;
+}
+
+void TaskQueue_Enqueue(int numtasks, taskqueue_task_t *tasks)
+{
+	int i;
+	if (numtasks < 1)
+		return;
+	if (taskqueue_state.mutex)
+		Thread_LockMutex(taskqueue_state.mutex);
+	for (i = 0;i < numtasks;i++)
+	{
+		tasks[i].done = 0;
+		tasks[i].next = NULL;
+		if (taskqueue_state.last)
+			taskqueue_state.last->next = tasks + i;
+		else
+			taskqueue_state.first = tasks + i;
+		taskqueue_state.last = tasks + i;
+	}
+	if (taskqueue_state.mutex)
+	{
+		Thread_CondBroadcast(taskqueue_state.workcond);
+		Thread_UnlockMutex(taskqueue_state.mutex);
+	}
+}
+
+void TaskQueue_WaitForTaskDone(int numtasks, taskqueue_task_t *tasks)
+{
+	int i;
+	taskqueue_task_t *t;
+	if (taskqueue_state.mutex)
+		Thread_LockMutex(taskqueue_state.mutex);
+	for (;;)
+	{
+		for (i = 0;i < numtasks;i++)
+			if (!tasks[i].done)
+				break;
+		if (i == numtasks)
+			break;
+		// help out rather than sleep, this also makes it work without threads
+		t = TaskQueue_Dequeue();
+		if (t)
+			TaskQueue_Run(t);
+		else if (taskqueue_state.mutex)
+			Thread_CondWait(taskqueue_state.donecond, taskqueue_state.mutex);
+		else
+		{
+			Con_Printf("TaskQueue_WaitForTaskDone: waiting on a task that was never queued\n");
+			break;
+		}
+	}
+	if (taskqueue_state.mutex)
+		Thread_UnlockMutex(taskqueue_state.mutex);
+}
+
+int TaskQueue_NumThreads(void)
+{
+	return taskqueue_state.numthreads;
+}
+
+qboolean TaskQueue_IsWorkerThread(void)
+{
+	return taskqueue_isworkerthread != 0;
+}
+
+int TaskQueue_ThreadNumber(void)
+{
+	return taskqueue_isworkerthread;
+}
+
+void TaskQueue_Init(void)
+{
+	Cvar_RegisterVariable(&taskqueue_maxthreads);
+	memset(&taskqueue_state, 0, sizeof(taskqueue_state));
+	if (Thread_HasThreads())
+	{
+		taskqueue_state.mutex = Thread_CreateMutex();
+		taskqueue_state.workcond = Thread_CreateCond();
+		taskqueue_state.donecond = Thread_CreateCond();
+	}
+}
+
+void TaskQueue_Shutdown(void)
+{
+	TaskQueue_Frame(true);
+	if (taskqueue_state.mutex)
+	{
+		Thread_DestroyCond(taskqueue_state.donecond);
+		Thread_DestroyCond(taskqueue_state.workcond);
+		Thread_DestroyMutex(taskqueue_state.mutex);
+	}
+	memset(&taskqueue_state, 0, sizeof(taskqueue_state));
+}
+
+void TaskQueue_Frame(qboolean shutdown)
+{
+	int i, numthreads;
+	if (!taskqueue_state.mutex)
+		return;
+	numthreads = shutdown ? 0 : bound(0, taskqueue_maxthreads.integer, TASKQUEUE_MAXTHREADS);
+	if (numthreads == taskqueue_state.numthreads)
+		return;
+
+	// tell any surplus threads to exit, and wait for them
+	Thread_LockMutex(taskqueue_state.mutex);
+	taskqueue_state.threadlimit = numthreads;
+	Thread_CondBroadcast(taskqueue_state.workcond);
+	Thread_UnlockMutex(taskqueue_state.mutex);
+	for (i = taskqueue_state.numthreads - 1;i >= numthreads;i--)
+	{
+		if (taskqueue_state.threads[i].handle)
+			Thread_WaitThread(taskqueue_state.threads[i].handle, 0);
+		taskqueue_state.threads[i].handle = NULL;
+	}
+	taskqueue_state.numthreads = min(taskqueue_state.numthreads, numthreads);
+
+	// start new threads
+	for (i = taskqueue_state.numthreads;i < numthreads;i++)
+	{
+		taskqueue_state.threads[i].index = i;
+		taskqueue_state.threads[i].handle = Thread_CreateThread(TaskQueue_ThreadFunc, &taskqueue_state.threads[i]);
+		if (!taskqueue_state.threads[i].handle)
+		{
+			Con_Printf("TaskQueue_Frame: failed to create worker thread %i\n", i);
+			Cvar_SetValueQuick(&taskqueue_maxthreads, i);
+			break;
+		}
+	}
+	taskqueue_state.numthreads = i;
+	Thread_LockMutex(taskqueue_state.mutex);
+	taskqueue_state.threadlimit = i;
+	Thread_UnlockMutex(taskqueue_state.mutex);
+}
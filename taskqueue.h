@@ -0,0 +1,41 @@
+#ifndef TASKQUEUE_H
+#define TASKQUEUE_H
+
+#include "qtypes.h"
+
+#define TASKQUEUE_MAXTHREADS 32
+
+typedef struct taskqueue_task_s
+{
+	// function to call, and parameters for it to use
+	void (*func)(struct taskqueue_task_s *task);
+	void *p[2];
+	size_t i[2];
+	// set by the thread that ran the task, only read this through TaskQueue_WaitForTaskDone
+	volatile int done;
+	// next task in the queue (used internally)
+	struct taskqueue_task_s *next;
+}
+taskqueue_task_t;
+
+// fills in a task structure, does not enqueue it
+void TaskQueue_Setup(taskqueue_task_t *t, void (*func)(taskqueue_task_t *), size_t i0, size_t i1, void *p0, void *p1);
+// queues tasks to be run by the worker threads (or by a thread that waits on them)
+void TaskQueue_Enqueue(int numtasks, taskqueue_task_t *tasks);
+// runs queued tasks on the calling thread until all of the given tasks are done
+void TaskQueue_WaitForTaskDone(int numtasks, taskqueue_task_t *tasks);
+// how many worker threads are running, 0 means tasks run on the thread waiting for them
+int TaskQueue_NumThreads(void);
+// true when called from a task running on a worker thread (which must not
+// touch client, renderer or network state)
+qboolean TaskQueue_IsWorkerThread(void);
+// 1 + the index of the worker thread (at most TASKQUEUE_MAXTHREADS), 0 when
+// not called from a worker
+int TaskQueue_ThreadNumber(void);
+
+void TaskQueue_Init(void);
+void TaskQueue_Shutdown(void);
+// starts or stops worker threads to match taskqueue_maxthreads
+void TaskQueue_Frame(qboolean shutdown);
+
+#endif
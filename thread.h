@@ -21,6 +21,19 @@
 #define Thread_DestroyBarrier(barrier)    (_Thread_DestroyBarrier(barrier, __FILE__, __LINE__))
 #define Thread_WaitBarrier(barrier)       (_Thread_WaitBarrier(barrier, __FILE__, __LINE__))
 
+// loads and stores of an int shared between threads without a mutex, both
+// act as full memory barriers so a value published with Thread_AtomicSet is
+// seen together with everything written before it
+int Thread_AtomicGet(volatile int *a);
+void Thread_AtomicSet(volatile int *a, int v);
+
+// storage class for a variable that has a separate copy in each thread
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
 int Thread_Init(void);
 void Thread_Shutdown(void);
 qboolean Thread_HasThreads(void);
@@ -80,3 +80,13 @@ void _Thread_DestroyBarrier(void *barrier, const char *filename, int fileline)
 void _Thread_WaitBarrier(void *barrier, const char *filename, int fileline)
 {
 }
+
+int Thread_AtomicGet(volatile int *a)
+{
+	return *a;
+}
+
+void Thread_AtomicSet(volatile int *a, int v)
+{
+	*a = v;
+}
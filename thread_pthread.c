@@ -224,3 +224,19 @@ void _Thread_WaitBarrier(void *barrier, const char *filename, int fileline)
 	Thread_UnlockMutex(b->mutex);
 }
 #endif
+
+int Thread_AtomicGet(volatile int *a)
+{
+	int v;
+	__sync_synchronize();
+	v = *a;
+	__sync_synchronize();
+	return v;
+}
+
+void Thread_AtomicSet(volatile int *a, int v)
+{
+	__sync_synchronize();
+	*a = v;
+	__sync_synchronize();
+}
@@ -171,3 +171,39 @@ void _Thread_WaitBarrier(void *barrier, const char *filename, int fileline)
 	}
 	Thread_UnlockMutex(b->mutex);
 }
+
+#if SDL_MAJOR_VERSION == 1
+// SDL 1.2 has no atomics, fall back to a lock
+static SDL_mutex *thread_atomicmutex;
+
+int Thread_AtomicGet(volatile int *a)
+{
+	int v;
+	if (!thread_atomicmutex)
+		thread_atomicmutex = SDL_CreateMutex();
+	SDL_LockMutex(thread_atomicmutex);
+	v = *a;
+	SDL_UnlockMutex(thread_atomicmutex);
+	return v;
+}
+
+void Thread_AtomicSet(volatile int *a, int v)
+{
+	if (!thread_atomicmutex)
+		thread_atomicmutex = SDL_CreateMutex();
+	SDL_LockMutex(thread_atomicmutex);
+	*a = v;
+	SDL_UnlockMutex(thread_atomicmutex);
+}
+#else
+int Thread_AtomicGet(volatile int *a)
+{
+	// SDL_atomic_t is a struct holding a single int
+	return SDL_AtomicGet((SDL_atomic_t *)a);
+}
+
+void Thread_AtomicSet(volatile int *a, int v)
+{
+	SDL_AtomicSet((SDL_atomic_t *)a, v);
+}
+#endif
@@ -301,3 +301,13 @@ void _Thread_WaitBarrier(void *barrier, const char *filename, int fileline)
 	}
 	Thread_UnlockMutex(b->mutex);
 }
+
+int Thread_AtomicGet(volatile int *a)
+{
+	return (int)InterlockedCompareExchange((volatile LONG *)a, 0, 0);
+}
+
+void Thread_AtomicSet(volatile int *a, int v)
+{
+	InterlockedExchange((volatile LONG *)a, v);
+}
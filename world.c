@@ -31,11 +31,14 @@ line of sight checks trace->inopen and trace->inwater, but bullets don't
 
 */
 
+static mempool_t *world_mempool;
+
 static void World_Physics_Init(void);
 void World_Init(void)
 {
 	Collision_Init();
 	World_Physics_Init();
+	world_mempool = Mem_AllocPool("world", 0, NULL);
 }
 
 static void World_Physics_Shutdown(void);
@@ -50,10 +53,13 @@ void World_Start(world_t *world)
 	World_Physics_Start(world);
 }
 
+static void World_AreaTree_Clear(world_t *world);
 static void World_Physics_End(world_t *world);
 void World_End(world_t *world)
 {
 	World_Physics_End(world);
+	World_AreaTree_Clear(world);
+	Collision_TraceCache_Reset(&world->tracecache);
 }
 
 //============================================================================
@@ -90,12 +96,372 @@ ENTITY AREA CHECKING
 
 void World_PrintAreaStats(world_t *world, const char *worldname)
 {
-	Con_Printf("%s areagrid check stats: %d calls %d nodes (%f per call) %d entities (%f per call)\n", worldname, world->areagrid_stats_calls, world->areagrid_stats_nodechecks, (double) world->areagrid_stats_nodechecks / (double) world->areagrid_stats_calls, world->areagrid_stats_entitychecks, (double) world->areagrid_stats_entitychecks / (double) world->areagrid_stats_calls);
+	Con_Printf("%s %s check stats: %d calls %d nodes (%f per call) %d entities (%f per call)\n", worldname, world->broadphase == WORLD_BROADPHASE_AREATREE ? "areatree" : "areagrid", world->areagrid_stats_calls, world->areagrid_stats_nodechecks, (double) world->areagrid_stats_nodechecks / (double) world->areagrid_stats_calls, world->areagrid_stats_entitychecks, (double) world->areagrid_stats_entitychecks / (double) world->areagrid_stats_calls);
 	world->areagrid_stats_calls = 0;
 	world->areagrid_stats_nodechecks = 0;
 	world->areagrid_stats_entitychecks = 0;
 }
 
+/*
+===============
+Dynamic bounding box tree
+
+Alternative to the area grid (sv_areatree), each linked entity is a leaf
+holding its box enlarged by a margin so small moves do not need to touch the
+tree, and inserts pick the sibling that grows the total surface area least,
+then rotate nodes on the way back up to keep the tree balanced.
+===============
+*/
+
+#define AREATREE_MAXSTACK 1024
+
+static vec_t World_AreaTree_BoxArea(const vec3_t mins, const vec3_t maxs)
+{
+	vec3_t size;
+	VectorSubtract(maxs, mins, size);
+	return size[0] * size[1] + size[1] * size[2] + size[2] * size[0];
+}
+
+static vec_t World_AreaTree_UnionArea(const areatree_node_t *a, const areatree_node_t *b)
+{
+	vec3_t mins, maxs;
+	mins[0] = min(a->mins[0], b->mins[0]);
+	mins[1] = min(a->mins[1], b->mins[1]);
+	mins[2] = min(a->mins[2], b->mins[2]);
+	maxs[0] = max(a->maxs[0], b->maxs[0]);
+	maxs[1] = max(a->maxs[1], b->maxs[1]);
+	maxs[2] = max(a->maxs[2], b->maxs[2]);
+	return World_AreaTree_BoxArea(mins, maxs);
+}
+
+// recalculates box and height of a node from its children
+static void World_AreaTree_UpdateNode(world_t *world, int index)
+{
+	areatree_node_t *n = world->areatree_nodes + index;
+	areatree_node_t *c1 = world->areatree_nodes + n->children[0];
+	areatree_node_t *c2 = world->areatree_nodes + n->children[1];
+	n->mins[0] = min(c1->mins[0], c2->mins[0]);
+	n->mins[1] = min(c1->mins[1], c2->mins[1]);
+	n->mins[2] = min(c1->mins[2], c2->mins[2]);
+	n->maxs[0] = max(c1->maxs[0], c2->maxs[0]);
+	n->maxs[1] = max(c1->maxs[1], c2->maxs[1]);
+	n->maxs[2] = max(c1->maxs[2], c2->maxs[2]);
+	n->height = 1 + max(c1->height, c2->height);
+}
+
+static void World_AreaTree_Clear(world_t *world)
+{
+	world->areatree_root = 0;
+	world->areatree_freenode = 0;
+	world->areatree_numleafs = 0;
+	if (world->areatree_nodes)
+		Mem_Free(world->areatree_nodes);
+	world->areatree_nodes = NULL;
+	world->areatree_maxnodes = 0;
+}
+
+static int World_AreaTree_AllocNode(world_t *world)
+{
+	int i;
+	areatree_node_t *n;
+	if (!world->areatree_freenode)
+	{
+		// node 0 is reserved to mean none
+		int oldmaxnodes = world->areatree_maxnodes;
+		world->areatree_maxnodes = max(oldmaxnodes * 2, 256);
+		world->areatree_nodes = (areatree_node_t *)Mem_Realloc(world_mempool, world->areatree_nodes, world->areatree_maxnodes * sizeof(areatree_node_t));
+		for (i = world->areatree_maxnodes - 1;i >= max(oldmaxnodes, 1);i--)
+		{
+			world->areatree_nodes[i].height = -1;
+			world->areatree_nodes[i].parent = world->areatree_freenode;
+			world->areatree_freenode = i;
+		}
+	}
+	i = world->areatree_freenode;
+	n = world->areatree_nodes + i;
+	world->areatree_freenode = n->parent;
+	memset(n, 0, sizeof(*n));
+	return i;
+}
+
+static void World_AreaTree_FreeNode(world_t *world, int index)
+{
+	areatree_node_t *n = world->areatree_nodes + index;
+	n->height = -1;
+	n->entitynumber = 0;
+	n->parent = world->areatree_freenode;
+	world->areatree_freenode = index;
+}
+
+// if node a is imbalanced, rotate its taller child up into its place,
+// returns the node now in the position of a
+static int World_AreaTree_Balance(world_t *world, int ia)
+{
+	areatree_node_t *nodes = world->areatree_nodes;
+	areatree_node_t *a = nodes + ia, *b, *c, *f, *g;
+	int ib, ic, ifg, igf, balance;
+
+	if (!a->children[0] || a->height < 2)
+		return ia;
+
+	ib = a->children[0];
+	ic = a->children[1];
+	b = nodes + ib;
+	c = nodes + ic;
+	balance = c->height - b->height;
+	if (balance > 1)
+	{
+		// rotate c up
+		f = nodes + c->children[0];
+		g = nodes + c->children[1];
+		c->children[0] = ia;
+		c->parent = a->parent;
+		a->parent = ic;
+		if (c->parent)
+		{
+			if (nodes[c->parent].children[0] == ia)
+				nodes[c->parent].children[0] = ic;
+			else
+				nodes[c->parent].children[1] = ic;
+		}
+		else
+			world->areatree_root = ic;
+		// a keeps the shorter grandchild
+		if (f->height > g->height)
+		{
+			ifg = f - nodes;igf = g - nodes;
+		}
+		else
+		{
+			ifg = g - nodes;igf = f - nodes;
+		}
+		c->children[1] = ifg;
+		a->children[1] = igf;
+		nodes[igf].parent = ia;
+		World_AreaTree_UpdateNode(world, ia);
+		World_AreaTree_UpdateNode(world, ic);
+		return ic;
+	}
+	if (balance < -1)
+	{
+		// rotate b up
+		f = nodes + b->children[0];
+		g = nodes + b->children[1];
+		b->children[0] = ia;
+		b->parent = a->parent;
+		a->parent = ib;
+		if (b->parent)
+		{
+			if (nodes[b->parent].children[0] == ia)
+				nodes[b->parent].children[0] = ib;
+			else
+				nodes[b->parent].children[1] = ib;
+		}
+		else
+			world->areatree_root = ib;
+		if (f->height > g->height)
+		{
+			ifg = f - nodes;igf = g - nodes;
+		}
+		else
+		{
+			ifg = g - nodes;igf = f - nodes;
+		}
+		b->children[1] = ifg;
+		a->children[0] = igf;
+		nodes[igf].parent = ia;
+		World_AreaTree_UpdateNode(world, ia);
+		World_AreaTree_UpdateNode(world, ib);
+		return ib;
+	}
+	return ia;
+}
+
+// walks from a node to the root fixing up boxes and balance
+static void World_AreaTree_Refit(world_t *world, int index)
+{
+	while (index)
+	{
+		index = World_AreaTree_Balance(world, index);
+		World_AreaTree_UpdateNode(world, index);
+		index = world->areatree_nodes[index].parent;
+	}
+}
+
+static void World_AreaTree_InsertLeaf(world_t *world, int leaf)
+{
+	areatree_node_t *nodes;
+	int index, sibling, oldparent, newparent, c1, c2;
+	vec_t area, combinedarea, cost, inheritancecost, cost1, cost2;
+
+	world->areatree_numleafs++;
+	if (!world->areatree_root)
+	{
+		world->areatree_root = leaf;
+		world->areatree_nodes[leaf].parent = 0;
+		return;
+	}
+
+	// find the best sibling
+	nodes = world->areatree_nodes;
+	index = world->areatree_root;
+	while (nodes[index].children[0])
+	{
+		c1 = nodes[index].children[0];
+		c2 = nodes[index].children[1];
+		area = World_AreaTree_BoxArea(nodes[index].mins, nodes[index].maxs);
+		combinedarea = World_AreaTree_UnionArea(nodes + index, nodes + leaf);
+		// cost of making a new parent for this node and the new leaf
+		cost = 2 * combinedarea;
+		// minimum cost of pushing the leaf further down the tree
+		inheritancecost = 2 * (combinedarea - area);
+		cost1 = World_AreaTree_UnionArea(nodes + leaf, nodes + c1) + inheritancecost;
+		if (nodes[c1].children[0])
+			cost1 -= World_AreaTree_BoxArea(nodes[c1].mins, nodes[c1].maxs);
+		cost2 = World_AreaTree_UnionArea(nodes + leaf, nodes + c2) + inheritancecost;
+		if (nodes[c2].children[0])
+			cost2 -= World_AreaTree_BoxArea(nodes[c2].mins, nodes[c2].maxs);
+		if (cost < cost1 && cost < cost2)
+			break;
+		index = cost1 < cost2 ? c1 : c2;
+	}
+	sibling = index;
+
+	// create a new parent for the sibling and the leaf
+	newparent = World_AreaTree_AllocNode(world);
+	nodes = world->areatree_nodes;
+	oldparent = nodes[sibling].parent;
+	nodes[newparent].parent = oldparent;
+	nodes[newparent].children[0] = sibling;
+	nodes[newparent].children[1] = leaf;
+	nodes[sibling].parent = newparent;
+	nodes[leaf].parent = newparent;
+	if (oldparent)
+	{
+		if (nodes[oldparent].children[0] == sibling)
+			nodes[oldparent].children[0] = newparent;
+		else
+			nodes[oldparent].children[1] = newparent;
+	}
+	else
+		world->areatree_root = newparent;
+
+	World_AreaTree_Refit(world, newparent);
+}
+
+static void World_AreaTree_RemoveLeaf(world_t *world, int leaf)
+{
+	areatree_node_t *nodes = world->areatree_nodes;
+	int parent, grandparent, sibling;
+
+	world->areatree_numleafs--;
+	if (leaf == world->areatree_root)
+	{
+		world->areatree_root = 0;
+		return;
+	}
+
+	// the sibling takes the place of the parent
+	parent = nodes[leaf].parent;
+	grandparent = nodes[parent].parent;
+	sibling = nodes[parent].children[0] == leaf ? nodes[parent].children[1] : nodes[parent].children[0];
+	nodes[sibling].parent = grandparent;
+	World_AreaTree_FreeNode(world, parent);
+	if (grandparent)
+	{
+		if (nodes[grandparent].children[0] == parent)
+			nodes[grandparent].children[0] = sibling;
+		else
+			nodes[grandparent].children[1] = sibling;
+		World_AreaTree_Refit(world, grandparent);
+	}
+	else
+		world->areatree_root = sibling;
+}
+
+// the tree may have been cleared by World_End while entities still
+// remember their leafs
+static qboolean World_AreaTree_IsLeafOf(world_t *world, int leaf, prvm_edict_t *ent)
+{
+	prvm_prog_t *prog = world->prog;
+	return leaf > 0 && leaf < world->areatree_maxnodes && world->areatree_nodes[leaf].height == 0 && world->areatree_nodes[leaf].entitynumber == PRVM_NUM_FOR_EDICT(ent);
+}
+
+static void World_LinkEdict_AreaTree(world_t *world, prvm_edict_t *ent)
+{
+	prvm_prog_t *prog = world->prog;
+	areatree_node_t *n;
+	int leaf = ent->priv.server->areatreeleaf;
+	vec_t margin = world->areatree_margin;
+
+	if (leaf && !World_AreaTree_IsLeafOf(world, leaf, ent))
+		leaf = ent->priv.server->areatreeleaf = 0;
+	if (leaf)
+	{
+		// still inside the enlarged box, nothing to do
+		n = world->areatree_nodes + leaf;
+		if (n->mins[0] <= ent->priv.server->areamins[0] && n->mins[1] <= ent->priv.server->areamins[1] && n->mins[2] <= ent->priv.server->areamins[2]
+		 && n->maxs[0] >= ent->priv.server->areamaxs[0] && n->maxs[1] >= ent->priv.server->areamaxs[1] && n->maxs[2] >= ent->priv.server->areamaxs[2])
+			return;
+		World_AreaTree_RemoveLeaf(world, leaf);
+	}
+	else
+	{
+		leaf = World_AreaTree_AllocNode(world);
+		ent->priv.server->areatreeleaf = leaf;
+		world->areatree_nodes[leaf].entitynumber = PRVM_NUM_FOR_EDICT(ent);
+	}
+	n = world->areatree_nodes + leaf;
+	VectorSet(n->mins, ent->priv.server->areamins[0] - margin, ent->priv.server->areamins[1] - margin, ent->priv.server->areamins[2] - margin);
+	VectorSet(n->maxs, ent->priv.server->areamaxs[0] + margin, ent->priv.server->areamaxs[1] + margin, ent->priv.server->areamaxs[2] + margin);
+	World_AreaTree_InsertLeaf(world, leaf);
+}
+
+static int World_EntitiesInBox_AreaTree(world_t *world, const vec3_t mins, const vec3_t maxs, int maxlist, prvm_edict_t **list)
+{
+	prvm_prog_t *prog = world->prog;
+	areatree_node_t *nodes = world->areatree_nodes;
+	areatree_node_t *n;
+	prvm_edict_t *ent;
+	int stack[AREATREE_MAXSTACK];
+	int stackpos, numlist = 0;
+
+	world->areagrid_stats_calls++;
+	if (!world->areatree_root)
+		return 0;
+	stackpos = 0;
+	stack[stackpos++] = world->areatree_root;
+	while (stackpos)
+	{
+		n = nodes + stack[--stackpos];
+		if (!BoxesOverlap(mins, maxs, n->mins, n->maxs))
+			continue;
+		if (n->children[0])
+		{
+			world->areagrid_stats_nodechecks++;
+			// the tree is balanced so this can only happen if it is corrupt
+			if (stackpos + 2 > AREATREE_MAXSTACK)
+			{
+				Con_Printf("World_EntitiesInBox_AreaTree: stack overflow\n");
+				break;
+			}
+			stack[stackpos++] = n->children[1];
+			stack[stackpos++] = n->children[0];
+			continue;
+		}
+		// the leaf box is enlarged, so check the real one
+		ent = PRVM_EDICT_NUM(n->entitynumber);
+		if (!ent->priv.server->free && BoxesOverlap(mins, maxs, ent->priv.server->areamins, ent->priv.server->areamaxs))
+		{
+			if (numlist < maxlist)
+				list[numlist] = ent;
+			numlist++;
+		}
+		world->areagrid_stats_entitychecks++;
+	}
+	return numlist;
+}
+
 /*
 ===============
 World_SetSize
@@ -111,6 +477,12 @@ void World_SetSize(world_t *world, const char *filename, const vec3_t mins, cons
 	VectorCopy(maxs, world->maxs);
 	world->prog = prog;
 
+	world->broadphase = sv_areatree.integer ? WORLD_BROADPHASE_AREATREE : WORLD_BROADPHASE_AREAGRID;
+	world->areatree_margin = max(sv_areatree_margin.value, 0);
+	World_AreaTree_Clear(world);
+	// models may have been freed and reloaded since the last map
+	Collision_TraceCache_Reset(&world->tracecache);
+
 	// the areagrid_marknumber is not allowed to be 0
 	if (world->areagrid_marknumber < 1)
 		world->areagrid_marknumber = 1;
@@ -149,12 +521,90 @@ void World_UnlinkAll(world_t *world)
 	int i;
 	link_t *grid;
 	// unlink all entities one by one
+	while (world->areatree_root)
+	{
+		i = world->areatree_root;
+		while (world->areatree_nodes[i].children[0])
+			i = world->areatree_nodes[i].children[0];
+		World_UnlinkEdict(world, PRVM_EDICT_NUM(world->areatree_nodes[i].entitynumber));
+	}
 	grid = &world->areagrid_outside;
 	while (grid->next != grid)
-		World_UnlinkEdict(PRVM_EDICT_NUM(grid->next->entitynumber));
+		World_UnlinkEdict(world, PRVM_EDICT_NUM(grid->next->entitynumber));
 	for (i = 0, grid = world->areagrid;i < AREA_GRIDNODES;i++, grid++)
 		while (grid->next != grid)
-			World_UnlinkEdict(PRVM_EDICT_NUM(grid->next->entitynumber));
+			World_UnlinkEdict(world, PRVM_EDICT_NUM(grid->next->entitynumber));
+}
+
+static void World_LinkEdict_AreaGrid(world_t *world, prvm_edict_t *ent);
+
+void World_BenchmarkAreas(world_t *world, const char *worldname, int numqueries)
+{
+	prvm_prog_t *prog = world->prog;
+	prvm_edict_t *ent;
+	prvm_edict_t **entities, **list;
+	int i, j, broadphase, oldbroadphase, numentities, found;
+	double t;
+	vec3_t mins, maxs;
+
+	if (!prog || !world->prog->loaded)
+	{
+		Con_Printf("%s world is not active\n", worldname);
+		return;
+	}
+	entities = (prvm_edict_t **)Mem_Alloc(tempmempool, prog->num_edicts * sizeof(*entities));
+	list = (prvm_edict_t **)Mem_Alloc(tempmempool, MAX_EDICTS * sizeof(*list));
+	numentities = 0;
+	for (i = 1;i < prog->num_edicts;i++)
+	{
+		ent = PRVM_EDICT_NUM(i);
+		if (!ent->priv.server->free && (ent->priv.server->areagrid[0].prev || ent->priv.server->areatreeleaf))
+			entities[numentities++] = ent;
+	}
+	if (!numentities)
+	{
+		Con_Printf("%s world has no linked entities\n", worldname);
+		Mem_Free(list);
+		Mem_Free(entities);
+		return;
+	}
+
+	oldbroadphase = world->broadphase;
+	for (broadphase = WORLD_BROADPHASE_AREAGRID;broadphase <= WORLD_BROADPHASE_AREATREE + 1;broadphase++)
+	{
+		// relink everything into the broadphase being tested, and finally
+		// into the one that was in use
+		World_UnlinkAll(world);
+		world->broadphase = broadphase <= WORLD_BROADPHASE_AREATREE ? broadphase : oldbroadphase;
+		for (i = 0;i < numentities;i++)
+			World_LinkEdict(world, entities[i], entities[i]->priv.server->areamins, entities[i]->priv.server->areamaxs);
+		if (broadphase > WORLD_BROADPHASE_AREATREE)
+			break;
+
+		// query boxes around each entity, like a move would
+		world->areagrid_stats_calls = 0;
+		world->areagrid_stats_nodechecks = 0;
+		world->areagrid_stats_entitychecks = 0;
+		found = 0;
+		t = Sys_DirtyTime();
+		for (i = 0;i < numqueries;i++)
+		{
+			ent = entities[i % numentities];
+			for (j = 0;j < 3;j++)
+			{
+				mins[j] = ent->priv.server->areamins[j] - (i & 63);
+				maxs[j] = ent->priv.server->areamaxs[j] + (i & 63);
+			}
+			found += World_EntitiesInBox(world, mins, maxs, MAX_EDICTS, list);
+		}
+		t = Sys_DirtyTime() - t;
+		Con_Printf("%s %s: %d entities, %d queries in %.3fms (%.3fus per query), %d found, %d nodes %d entities checked\n", worldname, broadphase == WORLD_BROADPHASE_AREATREE ? "areatree" : "areagrid", numentities, numqueries, t * 1000.0, t * 1000000.0 / numqueries, found, world->areagrid_stats_nodechecks, world->areagrid_stats_entitychecks);
+	}
+	world->areagrid_stats_calls = 0;
+	world->areagrid_stats_nodechecks = 0;
+	world->areagrid_stats_entitychecks = 0;
+	Mem_Free(list);
+	Mem_Free(entities);
 }
 
 /*
@@ -162,9 +612,18 @@ void World_UnlinkAll(world_t *world)
 
 ===============
 */
-void World_UnlinkEdict(prvm_edict_t *ent)
+void World_UnlinkEdict(world_t *world, prvm_edict_t *ent)
 {
-	int i;
+	int i, leaf = ent->priv.server->areatreeleaf;
+	if (leaf)
+	{
+		if (World_AreaTree_IsLeafOf(world, leaf, ent))
+		{
+			World_AreaTree_RemoveLeaf(world, leaf);
+			World_AreaTree_FreeNode(world, leaf);
+		}
+		ent->priv.server->areatreeleaf = 0;
+	}
 	for (i = 0;i < ENTITYGRIDAREAS;i++)
 	{
 		if (ent->priv.server->areagrid[i].prev)
@@ -185,6 +644,9 @@ int World_EntitiesInBox(world_t *world, const vec3_t requestmins, const vec3_t r
 	vec3_t paddedmins, paddedmaxs;
 	int igrid[3], igridmins[3], igridmaxs[3];
 
+	if (world->broadphase == WORLD_BROADPHASE_AREATREE)
+		return World_EntitiesInBox_AreaTree(world, requestmins, requestmaxs, maxlist, list);
+
 	// LordHavoc: discovered this actually causes its own bugs (dm6 teleporters being too close to info_teleport_destination)
 	//VectorSet(paddedmins, requestmins[0] - 1.0f, requestmins[1] - 1.0f, requestmins[2] - 1.0f);
 	//VectorSet(paddedmaxs, requestmaxs[0] + 1.0f, requestmaxs[1] + 1.0f, requestmaxs[2] + 1.0f);
@@ -307,8 +769,9 @@ void World_LinkEdict(world_t *world, prvm_edict_t *ent, const vec3_t mins, const
 {
 	prvm_prog_t *prog = world->prog;
 	// unlink from old position first
+	// (the tree can often keep the entity where it is, so it does that itself)
 	if (ent->priv.server->areagrid[0].prev)
-		World_UnlinkEdict(ent);
+		World_UnlinkEdict(world, ent);
 
 	// don't add the world
 	if (ent == prog->edicts)
@@ -316,11 +779,22 @@ void World_LinkEdict(world_t *world, prvm_edict_t *ent, const vec3_t mins, const
 
 	// don't add free entities
 	if (ent->priv.server->free)
+	{
+		if (ent->priv.server->areatreeleaf)
+			World_UnlinkEdict(world, ent);
 		return;
+	}
 
 	VectorCopy(mins, ent->priv.server->areamins);
 	VectorCopy(maxs, ent->priv.server->areamaxs);
-	World_LinkEdict_AreaGrid(world, ent);
+	if (world->broadphase == WORLD_BROADPHASE_AREATREE)
+		World_LinkEdict_AreaTree(world, ent);
+	else
+	{
+		if (ent->priv.server->areatreeleaf)
+			World_UnlinkEdict(world, ent);
+		World_LinkEdict_AreaGrid(world, ent);
+	}
 }
 
 
@@ -39,6 +39,25 @@ typedef struct link_s
 	struct link_s	*prev, *next;
 } link_t;
 
+#define WORLD_BROADPHASE_AREAGRID 0
+#define WORLD_BROADPHASE_AREATREE 1
+
+/// node in the dynamic bounding box tree (sv_areatree), index 0 means none
+typedef struct areatree_node_s
+{
+	/// for leafs this is the entity box enlarged by sv_areatree_margin
+	vec3_t mins, maxs;
+	/// also used as the free list link
+	int parent;
+	/// both 0 for a leaf
+	int children[2];
+	/// leafs only
+	int entitynumber;
+	/// 0 for leafs, -1 for free nodes
+	int height;
+}
+areatree_node_t;
+
 typedef struct world_physics_s
 {
 	// for ODE physics engine
@@ -84,6 +103,18 @@ typedef struct world_s
 	vec3_t areagrid_size;
 	int areagrid_marknumber;
 
+	/// which of the structures below entities are linked into, set by World_SetSize
+	int broadphase;
+	areatree_node_t *areatree_nodes;
+	int areatree_maxnodes;
+	int areatree_root;
+	int areatree_freenode;
+	int areatree_numleafs;
+	vec_t areatree_margin;
+
+	/// traces against the world model and brush entities remembered across frames
+	collision_tracecache_t tracecache;
+
 	// if the QC uses a physics engine, the data for it is here
 	world_physics_t physics;
 }
@@ -105,10 +136,12 @@ void World_SetSize(world_t *world, const char *filename, const vec3_t mins, cons
 void World_UnlinkAll(world_t *world);
 
 void World_PrintAreaStats(world_t *world, const char *worldname);
+/// times box queries around every linked entity with each broadphase
+void World_BenchmarkAreas(world_t *world, const char *worldname, int numqueries);
 
 /// call before removing an entity, and before trying to move one,
 /// so it doesn't clip against itself
-void World_UnlinkEdict(struct prvm_edict_s *ent);
+void World_UnlinkEdict(world_t *world, struct prvm_edict_s *ent);
 
 /// Needs to be called any time an entity changes origin, mins, maxs
 void World_LinkEdict(world_t *world, struct prvm_edict_s *ent, const vec3_t mins, const vec3_t maxs);
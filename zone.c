@@ -92,6 +92,45 @@ static memclump_t masterclump;
 static memclump_t *clumpchain = NULL;
 #endif
 
+// small allocations are slots in per-pool slabs instead of blocks of their own
+#ifndef MEMSLABS
+# define MEMSLABS 1
+#endif
+
+#if MEMSLABS
+// slabs start small so pools with few allocations do not waste much, and
+// grow with the pool up to the largest size
+#define MEMSLABMINSIZE 8192
+#define MEMSLABMAXSIZE 65536
+// slot sizes, a slot holds the memheader_t, alignment padding, data and sentinel
+static const size_t mem_slabclasssizes[MEMSLABCLASSES] = {96, 128, 160, 192, 256, 320, 384, 512, 640, 768, 1024, 1280};
+
+typedef struct memslab_s
+{
+	// should always be MEMHEADER_SENTINEL_FOR_ADDRESS(&slab->sentinel)
+	unsigned int sentinel;
+	int sizeclass;
+	// size of the block holding the slab
+	size_t size;
+	size_t slotsize;
+	int numslots;
+	int usedslots;
+	// pool this slab belongs to
+	struct mempool_s *pool;
+	// next and previous slabs in pool->slabs[sizeclass], only linked while there are free slots
+	struct memslab_s *next;
+	struct memslab_s *prev;
+	// freed slots, each holds a pointer to the next
+	void *freeslots;
+	// slots from here to end have never been used
+	unsigned char *unused;
+	unsigned char *end;
+}
+memslab_t;
+
+#define MEMSLABHEADERSIZE ((sizeof(memslab_t) + 15) & ~15)
+#endif
+
 
 cvar_t developer_memory = {0, "developer_memory", "0", "prints debugging information about memory allocations"};
 cvar_t developer_memorydebug = {0, "developer_memorydebug", "0", "enables memory corruption checks (very slow)"};
@@ -364,6 +403,124 @@ static void Clump_FreeBlock(void *base, size_t size)
 #endif
 }
 
+#if MEMSLABS
+static void Mem_Slab_Unlink(memslab_t *slab)
+{
+	if (slab->prev)
+		slab->prev->next = slab->next;
+	else
+		slab->pool->slabs[slab->sizeclass] = slab->next;
+	if (slab->next)
+		slab->next->prev = slab->prev;
+	slab->next = slab->prev = NULL;
+}
+
+static void Mem_Slab_Link(memslab_t *slab)
+{
+	slab->prev = NULL;
+	slab->next = slab->pool->slabs[slab->sizeclass];
+	if (slab->next)
+		slab->next->prev = slab;
+	slab->pool->slabs[slab->sizeclass] = slab;
+}
+
+// returns a slot of at least realsize bytes, or NULL if it is too big for a slab
+// caller must hold mem_mutex
+static void *Mem_Slab_Alloc(mempool_t *pool, size_t realsize, memslab_t **slabpointer)
+{
+	int sizeclass;
+	size_t slabsize;
+	unsigned char *slot;
+	memslab_t *slab;
+	for (sizeclass = 0;sizeclass < MEMSLABCLASSES && mem_slabclasssizes[sizeclass] < realsize;sizeclass++)
+		;
+	if (sizeclass == MEMSLABCLASSES)
+		return NULL;
+	slab = pool->slabs[sizeclass];
+	if (!slab)
+	{
+		for (slabsize = MEMSLABMINSIZE;slabsize < MEMSLABMAXSIZE && slabsize * 4 <= pool->slabsize;slabsize *= 2)
+			;
+		slab = (memslab_t *)Clump_AllocBlock(slabsize);
+		if (!slab)
+			return NULL;
+		memset(slab, 0, sizeof(*slab));
+		slab->sentinel = MEMHEADER_SENTINEL_FOR_ADDRESS(&slab->sentinel);
+		slab->sizeclass = sizeclass;
+		slab->size = slabsize;
+		slab->slotsize = mem_slabclasssizes[sizeclass];
+		slab->numslots = (int)((slabsize - MEMSLABHEADERSIZE) / slab->slotsize);
+		slab->pool = pool;
+		slab->unused = (unsigned char *)slab + MEMSLABHEADERSIZE;
+		slab->end = slab->unused + slab->numslots * slab->slotsize;
+		Mem_Slab_Link(slab);
+		pool->slabsize += slabsize;
+	}
+	if (slab->freeslots)
+	{
+		slot = (unsigned char *)slab->freeslots;
+		slab->freeslots = *(void **)slot;
+	}
+	else
+	{
+		slot = slab->unused;
+		slab->unused += slab->slotsize;
+	}
+	slab->usedslots++;
+	pool->slabusedsize += slab->slotsize;
+	// full slabs are only found again through their allocations
+	if (slab->usedslots == slab->numslots)
+		Mem_Slab_Unlink(slab);
+	if (developer_memorydebug.integer)
+		memset(slot, 0xBF, slab->slotsize);
+	*slabpointer = slab;
+	return slot;
+}
+
+// caller must hold mem_mutex
+static void Mem_Slab_Free(memslab_t *slab, void *slot)
+{
+	mempool_t *pool = slab->pool;
+	if (slab->sentinel != MEMHEADER_SENTINEL_FOR_ADDRESS(&slab->sentinel))
+		Sys_Error("Mem_Slab_Free: trashed slab sentinel\n");
+	if ((unsigned char *)slot < (unsigned char *)slab + MEMSLABHEADERSIZE || (unsigned char *)slot >= slab->unused || ((unsigned char *)slot - ((unsigned char *)slab + MEMSLABHEADERSIZE)) % slab->slotsize)
+		Sys_Error("Mem_Slab_Free: slot is not part of this slab\n");
+	if (slab->usedslots == slab->numslots)
+		Mem_Slab_Link(slab);
+	memset(slot, 0xFF, slab->slotsize);
+	*(void **)slot = slab->freeslots;
+	slab->freeslots = slot;
+	slab->usedslots--;
+	pool->slabusedsize -= slab->slotsize;
+	// keep one empty slab for each size class so alloc/free cycles do not thrash
+	if (!slab->usedslots && (slab->prev || slab->next))
+	{
+		Mem_Slab_Unlink(slab);
+		pool->slabsize -= slab->size;
+		Clump_FreeBlock(slab, slab->size);
+	}
+}
+
+// frees the empty slabs kept around by Mem_Slab_Free, caller must hold mem_mutex
+static void Mem_Slab_FreeEmpty(mempool_t *pool)
+{
+	int sizeclass;
+	memslab_t *slab, *next;
+	for (sizeclass = 0;sizeclass < MEMSLABCLASSES;sizeclass++)
+	{
+		for (slab = pool->slabs[sizeclass];slab;slab = next)
+		{
+			next = slab->next;
+			if (slab->usedslots)
+				continue;
+			Mem_Slab_Unlink(slab);
+			pool->slabsize -= slab->size;
+			Clump_FreeBlock(slab, slab->size);
+		}
+	}
+}
+#endif
+
 void *_Mem_Alloc(mempool_t *pool, void *olddata, size_t size, size_t alignment, const char *filename, int fileline)
 {
 	unsigned int sentinel1;
@@ -374,6 +531,7 @@ void *_Mem_Alloc(mempool_t *pool, void *olddata, size_t size, size_t alignment,
 	memheader_t *mem;
 	memheader_t *oldmem;
 	unsigned char *base;
+	struct memslab_s *slab = NULL;
 
 	if (size <= 0)
 	{
@@ -397,7 +555,11 @@ void *_Mem_Alloc(mempool_t *pool, void *olddata, size_t size, size_t alignment,
 	pool->totalsize += size;
 	realsize = alignment + sizeof(memheader_t) + size + sizeof(sentinel2);
 	pool->realsize += realsize;
-	base = (unsigned char *)Clump_AllocBlock(realsize);
+#if MEMSLABS
+	base = (unsigned char *)Mem_Slab_Alloc(pool, realsize, &slab);
+	if (base == NULL)
+#endif
+		base = (unsigned char *)Clump_AllocBlock(realsize);
 	if (base== NULL)
 	{
 		Mem_PrintList(0);
@@ -413,6 +575,7 @@ void *_Mem_Alloc(mempool_t *pool, void *olddata, size_t size, size_t alignment,
 	mem->fileline = fileline;
 	mem->size = size;
 	mem->pool = pool;
+	mem->slab = slab;
 
 	// calculate sentinels (detects buffer overruns, in a way that is hard to exploit)
 	sentinel1 = MEMHEADER_SENTINEL_FOR_ADDRESS(&mem->sentinel);
@@ -481,7 +644,12 @@ static void _Mem_FreeBlock(memheader_t *mem, const char *filename, int fileline)
 	realsize = sizeof(memheader_t) + size + sizeof(sentinel2);
 	pool->totalsize -= size;
 	pool->realsize -= realsize;
-	Clump_FreeBlock(mem->baseaddress, realsize);
+#if MEMSLABS
+	if (mem->slab)
+		Mem_Slab_Free(mem->slab, mem->baseaddress);
+	else
+#endif
+		Clump_FreeBlock(mem->baseaddress, realsize);
 	if (mem_mutex)
 		Thread_UnlockMutex(mem_mutex);
 }
@@ -564,6 +732,14 @@ void _Mem_FreePool(mempool_t **poolpointer, const char *filename, int fileline)
 				_Mem_FreePool(&temp, filename, fileline);
 		}
 
+#if MEMSLABS
+		if (mem_mutex)
+			Thread_LockMutex(mem_mutex);
+		Mem_Slab_FreeEmpty(pool);
+		if (mem_mutex)
+			Thread_UnlockMutex(mem_mutex);
+#endif
+
 		// free the pool itself
 		Clump_FreeBlock(pool, sizeof(*pool));
 
@@ -795,6 +971,126 @@ void *Mem_ExpandableArray_RecordAtIndex(const memexpandablearray_t *l, size_t in
 }
 
 
+memframearena_t mem_framearena_client;
+memframearena_t mem_framearena_server;
+
+#define MEMFRAMEBLOCK_HEADERSIZE ((sizeof(memframeblock_t) + 15) & ~15)
+#define MEMFRAMEBLOCK_DATA(b) ((unsigned char *)(b) + MEMFRAMEBLOCK_HEADERSIZE)
+
+static void Mem_FrameInit(memframearena_t *arena, const char *name, size_t minsize)
+{
+	memset(arena, 0, sizeof(*arena));
+	arena->name = name;
+	arena->pool = Mem_AllocPool(name, 0, NULL);
+	arena->minsize = minsize;
+}
+
+static memframeblock_t *Mem_FrameNewBlock(memframearena_t *arena, size_t size)
+{
+	memframeblock_t *b;
+	size = (size + 65535) & ~65535;
+	b = (memframeblock_t *)Mem_Alloc(arena->pool, MEMFRAMEBLOCK_HEADERSIZE + size);
+	b->next = NULL;
+	b->size = size;
+	b->used = 0;
+	return b;
+}
+
+void *Mem_FrameAlloc(memframearena_t *arena, size_t size)
+{
+	memframeblock_t *b;
+	unsigned char *data;
+	size = (size + 15) & ~15;
+	for (;;)
+	{
+		b = arena->current;
+		if (b && b->used + size <= b->size)
+			break;
+		if (b && b->next)
+		{
+			// reuse a block left over from before Mem_FrameReturnToMark
+			arena->current = b->next;
+			arena->current->used = 0;
+			continue;
+		}
+		// out of space, chain another block (twice as big) and keep going
+		b = Mem_FrameNewBlock(arena, max(size, b ? b->size * 2 : arena->minsize));
+		if (arena->current)
+			arena->current->next = b;
+		else
+			arena->first = b;
+		arena->current = b;
+	}
+	data = MEMFRAMEBLOCK_DATA(b) + b->used;
+	b->used += size;
+	arena->used += size;
+	if (arena->highwater < arena->used)
+		arena->highwater = arena->used;
+	return data;
+}
+
+void Mem_FrameReset(memframearena_t *arena)
+{
+	memframeblock_t *b, *next;
+	size_t size;
+	if (arena->first && (arena->first->next || arena->first->size < arena->minsize))
+	{
+		// a frame needed more than one block, replace them with one block
+		// that would have held it all
+		size = max(arena->minsize, arena->highwater);
+		for (b = arena->first;b;b = next)
+		{
+			next = b->next;
+			Mem_Free(b);
+		}
+		arena->first = Mem_FrameNewBlock(arena, size);
+	}
+	arena->current = arena->first;
+	if (arena->current)
+		arena->current->used = 0;
+	arena->used = 0;
+	arena->markblock = arena->current;
+	arena->markblockused = 0;
+	arena->markused = 0;
+}
+
+void Mem_FrameFree(memframearena_t *arena)
+{
+	memframeblock_t *b, *next;
+	for (b = arena->first;b;b = next)
+	{
+		next = b->next;
+		Mem_Free(b);
+	}
+	arena->first = arena->current = arena->markblock = NULL;
+	arena->used = arena->markblockused = arena->markused = 0;
+}
+
+void Mem_FrameSetMark(memframearena_t *arena)
+{
+	arena->markblock = arena->current;
+	arena->markblockused = arena->current ? arena->current->used : 0;
+	arena->markused = arena->used;
+}
+
+void Mem_FrameReturnToMark(memframearena_t *arena)
+{
+	arena->current = arena->markblock ? arena->markblock : arena->first;
+	if (arena->current)
+		arena->current->used = arena->markblock ? arena->markblockused : 0;
+	arena->used = arena->markused;
+}
+
+static void Mem_FramePrintStats(memframearena_t *arena)
+{
+	size_t size = 0;
+	int blocks = 0;
+	memframeblock_t *b;
+	for (b = arena->first;b;b = b->next, blocks++)
+		size += b->size;
+	Con_Printf("%s: %lu bytes in %i blocks, %lu used this frame, high-water mark %lu bytes (%.3fMB)\n", arena->name, (unsigned long)size, blocks, (unsigned long)arena->used, (unsigned long)arena->highwater, arena->highwater / 1048576.0);
+}
+
 // used for temporary memory allocations around the engine, not for longterm
 // storage, if anything in this pool stays allocated during gameplay, it is
 // considered a leak
@@ -804,7 +1100,7 @@ mempool_t *zonemempool;
 
 void Mem_PrintStats(void)
 {
-	size_t count = 0, size = 0, realsize = 0;
+	size_t count = 0, size = 0, realsize = 0, slabsize = 0, slabusedsize = 0;
 	mempool_t *pool;
 	memheader_t *mem;
 	Mem_CheckSentinelsGlobal();
@@ -813,9 +1109,15 @@ void Mem_PrintStats(void)
 		count++;
 		size += pool->totalsize;
 		realsize += pool->realsize;
+		slabsize += pool->slabsize;
+		slabusedsize += pool->slabusedsize;
 	}
 	Con_Printf("%lu memory pools, totalling %lu bytes (%.3fMB)\n", (unsigned long)count, (unsigned long)size, size / 1048576.0);
 	Con_Printf("total allocated size: %lu bytes (%.3fMB)\n", (unsigned long)realsize, realsize / 1048576.0);
+	Mem_FramePrintStats(&mem_framearena_client);
+	Mem_FramePrintStats(&mem_framearena_server);
+	if (slabsize)
+		Con_Printf("small allocation slabs: %lu bytes (%.3fMB), %.1f%% in use\n", (unsigned long)slabsize, slabsize / 1048576.0, slabusedsize * 100.0 / slabsize);
 	for (pool = poolchain;pool;pool = pool->next)
 	{
 		if ((pool->flags & POOLFLAG_TEMP) && pool->chain)
@@ -836,7 +1138,10 @@ void Mem_PrintList(size_t minallocationsize)
 	           "size    name\n");
 	for (pool = poolchain;pool;pool = pool->next)
 	{
-		Con_Printf("%10luk (%10luk actual) %s (%+li byte change) %s\n", (unsigned long) ((pool->totalsize + 1023) / 1024), (unsigned long)((pool->realsize + 1023) / 1024), pool->name, (long)(pool->totalsize - pool->lastchecksize), (pool->flags & POOLFLAG_TEMP) ? "TEMP" : "");
+		Con_Printf("%10luk (%10luk actual) %s (%+li byte change) %s", (unsigned long) ((pool->totalsize + 1023) / 1024), (unsigned long)((pool->realsize + 1023) / 1024), pool->name, (long)(pool->totalsize - pool->lastchecksize), (pool->flags & POOLFLAG_TEMP) ? "TEMP" : "");
+		if (pool->slabsize)
+			Con_Printf(" (%luk in slabs, %.0f%% used)", (unsigned long)((pool->slabsize + 1023) / 1024), pool->slabusedsize * 100.0 / pool->slabsize);
+		Con_Print("\n");
 		pool->lastchecksize = pool->totalsize;
 		for (mem = pool->chain;mem;mem = mem->next)
 			if (mem->size >= minallocationsize)
@@ -898,6 +1203,8 @@ void Memory_Init (void)
 	poolchain = NULL;
 	tempmempool = Mem_AllocPool("Temporary Memory", POOLFLAG_TEMP, NULL);
 	zonemempool = Mem_AllocPool("Zone", 0, NULL);
+	Mem_FrameInit(&mem_framearena_client, "client frame arena", 512<<10);
+	Mem_FrameInit(&mem_framearena_server, "server frame arena", 512<<10);
 
 	if (Thread_HasThreads())
 		mem_mutex = Thread_CreateMutex();
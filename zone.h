@@ -27,6 +27,8 @@ extern qboolean mem_bigendian;
 #define MEMPARANOIA 0
 
 #define POOLNAMESIZE 128
+// number of slab size classes for small allocations (see MEMSLABS in zone.c)
+#define MEMSLABCLASSES 12
 // if set this pool will be printed in memlist reports
 #define POOLFLAG_TEMP 1
 
@@ -44,6 +46,8 @@ typedef struct memheader_s
 	// file name and line where Mem_Alloc was called
 	const char *filename;
 	int fileline;
+	// slab this allocation is a slot of, NULL if it has a block of its own
+	struct memslab_s *slab;
 	// should always be equal to MEMHEADER_SENTINEL_FOR_ADDRESS()
 	unsigned int sentinel;
 	// immediately followed by data, which is followed by another copy of mem_sentinel[]
@@ -64,6 +68,11 @@ typedef struct mempool_s
 	size_t realsize;
 	// updated each time the pool is displayed by memlist, shows change from previous time (unless pool was freed)
 	size_t lastchecksize;
+	// slabs with free slots, for each size class
+	struct memslab_s *slabs[MEMSLABCLASSES];
+	// memory held in slabs, and how much of it is in slots that are in use
+	size_t slabsize;
+	size_t slabusedsize;
 	// linked into global mempool list
 	struct mempool_s *next;
 	// parent object (used for nested memory pools)
@@ -126,6 +135,52 @@ void Mem_ExpandableArray_FreeRecord(memexpandablearray_t *l, void *record);
 size_t Mem_ExpandableArray_IndexRange(const memexpandablearray_t *l) DP_FUNC_PURE;
 void *Mem_ExpandableArray_RecordAtIndex(const memexpandablearray_t *l, size_t index) DP_FUNC_PURE;
 
+// bump allocator for memory that only lives until the arena is reset (once
+// per frame), allocations can not be freed individually and are not cleared
+typedef struct memframeblock_s
+{
+	struct memframeblock_s *next;
+	// usable bytes after the header, and how many are in use
+	size_t size;
+	size_t used;
+}
+memframeblock_t;
+
+typedef struct memframearena_s
+{
+	const char *name;
+	mempool_t *pool;
+	// blocks are only added during a frame, so pointers stay valid until the
+	// reset, which merges them into one block if the frame overflowed
+	memframeblock_t *first;
+	memframeblock_t *current;
+	// smallest size of the first block
+	size_t minsize;
+	// bytes allocated this frame, and the most allocated in one frame
+	size_t used;
+	size_t highwater;
+	// position saved by Mem_FrameSetMark
+	memframeblock_t *markblock;
+	size_t markblockused;
+	size_t markused;
+}
+memframearena_t;
+
+// the client arena is reset by R_FrameData_NewFrame, the server arena at the
+// start of each server frame (by the server thread when it is threaded)
+extern memframearena_t mem_framearena_client;
+extern memframearena_t mem_framearena_server;
+
+// returns 16 byte aligned memory that stays valid until the next Mem_FrameReset
+void *Mem_FrameAlloc(memframearena_t *arena, size_t size);
+// starts a new frame, all memory from the last one is invalid after this
+void Mem_FrameReset(memframearena_t *arena);
+// releases all of the arena's memory
+void Mem_FrameFree(memframearena_t *arena);
+// temporary allocations made after setting the mark can be undone by returning to it
+void Mem_FrameSetMark(memframearena_t *arena);
+void Mem_FrameReturnToMark(memframearena_t *arena);
+
 // used for temporary allocations
 extern mempool_t *tempmempool;
 